@@ -0,0 +1,759 @@
+/* un7z_bench: times SzArEx_Open, name lookup, single-file and full extraction.
+
+   un7z_bench [-n runs] [-k samples] [-t seconds] [archive.7z ...]
+
+   Without archives it builds a suite of archives in memory: many small
+   files, one large solid block, x86 code through BCJ2 and incompressible
+   media. They use Copy (and BCJ2) coders, which can be written here without
+   an encoder, so they measure the archive handling, BCJ2 and CRC rather
+   than LZMA; pass archives made by 7-Zip for the compressed workloads. */
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "un7z.h"
+
+static unsigned num_runs = 10;     /* of open and full extraction */
+static unsigned num_samples = 200; /* of lookup and single-file extraction */
+static double time_limit = 2.0;    /* seconds per measurement, after 3 runs */
+
+static double Now(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER f, c;
+  QueryPerformanceFrequency(&f);
+  QueryPerformanceCounter(&c);
+  return (double)c.QuadPart / (double)f.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* True while a measurement should take one more sample. */
+static int KeepGoing(unsigned i, unsigned n, double start)
+{
+  return i < n && (i < 3 || Now() - start < time_limit);
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Sorts the n samples and prints their percentiles, scaled by unit. */
+static void PrintPercentiles(const char *name, double *t, unsigned n, double unit, const char *unitName)
+{
+  qsort(t, n, sizeof(t[0]), CompareDouble);
+  printf("  %-8s p50 %10.1f %s  p90 %10.1f %s  p99 %10.1f %s  (%u runs)",
+    name, t[(n - 1) / 2] * unit, unitName, t[(n - 1) * 9 / 10] * unit, unitName,
+    t[(n - 1) * 99 / 100] * unit, unitName, n);
+}
+
+/* ---------- Archives in memory ---------- */
+
+typedef struct
+{
+  Byte *data;
+  size_t size;
+  size_t capacity;
+} Buf;
+
+static void Buf_Reserve(Buf *b, size_t size)
+{
+  if (b->size + size > b->capacity)
+  {
+    size_t capacity = b->capacity ? b->capacity : 1024;
+    while (capacity < b->size + size)
+      capacity <<= 1;
+    if ((b->data = (Byte *)realloc(b->data, capacity)) == NULL)
+    {
+      fprintf(stderr, "can not allocate memory\n");
+      exit(1);
+    }
+    b->capacity = capacity;
+  }
+}
+
+static void Buf_Write(Buf *b, const void *data, size_t size)
+{
+  Buf_Reserve(b, size);
+  memcpy(b->data + b->size, data, size);
+  b->size += size;
+}
+
+static void Buf_Byte(Buf *b, unsigned v)
+{
+  Byte c = (Byte)v;
+  Buf_Write(b, &c, 1);
+}
+
+static void Buf_UInt32(Buf *b, UInt32 v)
+{
+  unsigned i;
+  for (i = 0; i < 4; i++)
+    Buf_Byte(b, (v >> (8 * i)) & 0xFF);
+}
+
+static void Buf_UInt64(Buf *b, UInt64 v)
+{
+  Buf_UInt32(b, (UInt32)v);
+  Buf_UInt32(b, (UInt32)(v >> 32));
+}
+
+/* The variable length number of 7z headers. */
+static void Buf_Number(Buf *b, UInt64 v)
+{
+  unsigned n;
+  Byte mask = 0x80, first = 0;
+  for (n = 0; n < 8; n++)
+  {
+    if (v < ((UInt64)1 << (7 * (n + 1))))
+    {
+      first |= (Byte)(v >> (8 * n));
+      break;
+    }
+    first |= mask;
+    mask >>= 1;
+  }
+  Buf_Byte(b, first);
+  for (; n > 0; n--, v >>= 8)
+    Buf_Byte(b, v & 0xFF);
+}
+
+/* A folder is Copy, or BCJ2 with its four inputs stored as pack streams. */
+typedef struct
+{
+  int bcj2;
+  UInt32 numFiles;
+  UInt64 unpackSize;
+} BenchFolder;
+
+typedef struct
+{
+  Buf packs;
+  Buf packSizes;   /* UInt64 */
+  Buf folders;     /* BenchFolder */
+  Buf fileSizes;   /* UInt64 */
+  Buf fileCrcs;    /* UInt32 */
+  Buf names;       /* UTF-16LE, each with its 0 */
+  UInt32 numFiles;
+} Builder;
+
+static void Builder_AddPack(Builder *p, const Byte *data, size_t size)
+{
+  UInt64 size64 = size;
+  Buf_Write(&p->packs, data, size);
+  Buf_Write(&p->packSizes, &size64, sizeof(size64));
+}
+
+/* Adds a file to the last folder; its data is in the folder's pack streams. */
+static void Builder_AddFile(Builder *p, const char *name, const Byte *data, size_t size)
+{
+  BenchFolder *f = (BenchFolder *)(p->folders.data + p->folders.size) - 1;
+  UInt64 size64 = size;
+  UInt32 crc = CrcCalc(data, size);
+  f->numFiles++;
+  f->unpackSize += size;
+  Buf_Write(&p->fileSizes, &size64, sizeof(size64));
+  Buf_Write(&p->fileCrcs, &crc, sizeof(crc));
+  for (; *name; name++)
+  {
+    Buf_Byte(&p->names, (Byte)*name);
+    Buf_Byte(&p->names, 0);
+  }
+  Buf_Byte(&p->names, 0);
+  Buf_Byte(&p->names, 0);
+  p->numFiles++;
+}
+
+static void Builder_AddFolder(Builder *p, int bcj2)
+{
+  BenchFolder f;
+  f.bcj2 = bcj2;
+  f.numFiles = 0;
+  f.unpackSize = 0;
+  Buf_Write(&p->folders, &f, sizeof(f));
+}
+
+/* Writes the archive: signature header, pack streams, then the header. */
+static Buf Builder_Finish(Builder *p)
+{
+  const BenchFolder *folders = (const BenchFolder *)p->folders.data;
+  UInt32 numFolders = (UInt32)(p->folders.size / sizeof(BenchFolder));
+  UInt32 numPacks = (UInt32)(p->packSizes.size / sizeof(UInt64));
+  Buf h = { NULL, 0, 0 }, arc = { NULL, 0, 0 }, start = { NULL, 0, 0 };
+  UInt32 i, j, file = 0;
+
+  Buf_Byte(&h, 0x01);  /* kHeader */
+  Buf_Byte(&h, 0x04);  /* kMainStreamsInfo */
+  Buf_Byte(&h, 0x06);  /* kPackInfo */
+  Buf_Number(&h, 0);
+  Buf_Number(&h, numPacks);
+  Buf_Byte(&h, 0x09);  /* kSize */
+  for (i = 0; i < numPacks; i++)
+    Buf_Number(&h, ((const UInt64 *)p->packSizes.data)[i]);
+  Buf_Byte(&h, 0x00);
+  Buf_Byte(&h, 0x07);  /* kUnpackInfo */
+  Buf_Byte(&h, 0x0B);  /* kFolder */
+  Buf_Number(&h, numFolders);
+  Buf_Byte(&h, 0);
+  for (i = 0; i < numFolders; i++)
+  {
+    Buf_Number(&h, 1);
+    if (folders[i].bcj2)
+    {
+      static const Byte kBcj2[4] = { 0x03, 0x03, 0x01, 0x1B };
+      Buf_Byte(&h, 0x10 | 4);
+      Buf_Write(&h, kBcj2, 4);
+      Buf_Number(&h, 4);
+      Buf_Number(&h, 1);
+      for (j = 0; j < 4; j++)
+        Buf_Number(&h, j);
+    }
+    else
+    {
+      Buf_Byte(&h, 1);
+      Buf_Byte(&h, 0);
+    }
+  }
+  Buf_Byte(&h, 0x0C);  /* kCodersUnpackSize */
+  for (i = 0; i < numFolders; i++)
+    Buf_Number(&h, folders[i].unpackSize);
+  Buf_Byte(&h, 0x00);
+  Buf_Byte(&h, 0x08);  /* kSubStreamsInfo */
+  Buf_Byte(&h, 0x0D);  /* kNumUnpackStream */
+  for (i = 0; i < numFolders; i++)
+    Buf_Number(&h, folders[i].numFiles);
+  Buf_Byte(&h, 0x09);
+  for (i = 0; i < numFolders; i++)
+  {
+    for (j = 0; j + 1 < folders[i].numFiles; j++)
+      Buf_Number(&h, ((const UInt64 *)p->fileSizes.data)[file + j]);
+    file += folders[i].numFiles;
+  }
+  Buf_Byte(&h, 0x0A);  /* kCRC */
+  Buf_Byte(&h, 1);
+  Buf_Write(&h, p->fileCrcs.data, p->fileCrcs.size);
+  Buf_Byte(&h, 0x00);
+  Buf_Byte(&h, 0x00);
+  Buf_Byte(&h, 0x05);  /* kFilesInfo */
+  Buf_Number(&h, p->numFiles);
+  Buf_Byte(&h, 0x11);  /* kName */
+  Buf_Number(&h, p->names.size + 1);
+  Buf_Byte(&h, 0);
+  Buf_Write(&h, p->names.data, p->names.size);
+  Buf_Byte(&h, 0x00);
+  Buf_Byte(&h, 0x00);
+
+  Buf_UInt64(&start, p->packs.size);
+  Buf_UInt64(&start, h.size);
+  Buf_UInt32(&start, CrcCalc(h.data, h.size));
+  Buf_Write(&arc, "7z\xBC\xAF\x27\x1C\x00\x04", 8);
+  Buf_UInt32(&arc, CrcCalc(start.data, start.size));
+  Buf_Write(&arc, start.data, start.size);
+  Buf_Write(&arc, p->packs.data, p->packs.size);
+  Buf_Write(&arc, h.data, h.size);
+
+  free(h.data);
+  free(start.data);
+  free(p->packs.data);
+  free(p->packSizes.data);
+  free(p->folders.data);
+  free(p->fileSizes.data);
+  free(p->fileCrcs.data);
+  free(p->names.data);
+  return arc;
+}
+
+/* ---------- Generated data ---------- */
+
+static UInt32 rng_state = 1;
+
+static UInt32 Random(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+/* Words from a small vocabulary, like source code or logs. */
+static void GenText(Byte *data, size_t size)
+{
+  static const char *kWords[16] = {
+    "the ", "static ", "return ", "size ", "if (", ") {\n", "data", "->",
+    "for ", "i++", "0;\n", "buf", "}\n", "\t", "archive ", "= " };
+  size_t pos = 0;
+  while (pos < size)
+  {
+    const char *w = kWords[Random() & 15];
+    size_t n = strlen(w);
+    if (n > size - pos)
+      n = size - pos;
+    memcpy(data + pos, w, n);
+    pos += n;
+  }
+}
+
+/* x86-like code: calls and jumps with near targets between other bytes. */
+static void GenCode(Byte *data, size_t size)
+{
+  size_t pos = 0;
+  while (pos < size)
+  {
+    UInt32 r = Random();
+    if ((r & 15) < 3 && size - pos >= 5)
+    {
+      UInt32 rel = (UInt32)((Int32)(Random() % 20000) - 10000);
+      data[pos] = (Byte)((r & 15) == 0 ? 0xE9 : 0xE8);
+      data[pos + 1] = (Byte)rel;
+      data[pos + 2] = (Byte)(rel >> 8);
+      data[pos + 3] = (Byte)(rel >> 16);
+      data[pos + 4] = (Byte)(rel >> 24);
+      pos += 5;
+    }
+    else
+      data[pos++] = (Byte)(r >> 8);
+  }
+}
+
+static void GenRandom(Byte *data, size_t size)
+{
+  size_t i;
+  for (i = 0; i < size; i++)
+    data[i] = (Byte)(Random() >> 24);
+}
+
+/* ---------- BCJ2 encoder ---------- */
+
+typedef struct
+{
+  UInt64 low;
+  UInt32 range;
+  Byte cache;
+  UInt64 cacheSize;
+  Buf *out;
+} RangeEnc;
+
+static void RangeEnc_ShiftLow(RangeEnc *p)
+{
+  if ((UInt32)p->low < 0xFF000000 || (p->low >> 32) != 0)
+  {
+    Byte temp = p->cache;
+    do
+    {
+      Buf_Byte(p->out, (Byte)(temp + (Byte)(p->low >> 32)));
+      temp = 0xFF;
+    }
+    while (--p->cacheSize != 0);
+    p->cache = (Byte)((UInt32)p->low >> 24);
+  }
+  p->cacheSize++;
+  p->low = (UInt32)p->low << 8;
+}
+
+static void RangeEnc_EncodeBit(RangeEnc *p, UInt16 *prob, unsigned bit)
+{
+  UInt32 bound = (p->range >> 11) * *prob;
+  if (bit == 0)
+  {
+    p->range = bound;
+    *prob = (UInt16)(*prob + ((2048 - *prob) >> 5));
+  }
+  else
+  {
+    p->low += bound;
+    p->range -= bound;
+    *prob = (UInt16)(*prob - (*prob >> 5));
+  }
+  while (p->range < (1 << 24))
+  {
+    p->range <<= 8;
+    RangeEnc_ShiftLow(p);
+  }
+}
+
+/* Splits x86 code into the main, call, jump and range coder streams. */
+static void Bcj2Enc(const Byte *data, size_t size, Buf out[4])
+{
+  UInt16 probs[2 + 256];
+  RangeEnc rc;
+  size_t i = 0;
+  Byte prev = 0;
+
+  for (i = 0; i < 258; i++)
+    probs[i] = 1024;
+  rc.low = 0;
+  rc.range = 0xFFFFFFFF;
+  rc.cache = 0;
+  rc.cacheSize = 1;
+  rc.out = &out[3];
+  i = 0;
+  while (i < size)
+  {
+    Byte b = data[i];
+    UInt16 *prob;
+    Buf_Byte(&out[0], b);
+    if ((b & 0xFE) != 0xE8 && !(prev == 0x0F && (b & 0xF0) == 0x80))
+    {
+      prev = b;
+      i++;
+      continue;
+    }
+    if (i + 1 == size)
+      break;
+    prob = probs + (b == 0xE8 ? prev : (b == 0xE9 ? 256 : 257));
+    if (size - i >= 5)
+    {
+      UInt32 dest = (UInt32)data[i + 1] | ((UInt32)data[i + 2] << 8) |
+        ((UInt32)data[i + 3] << 16) | ((UInt32)data[i + 4] << 24);
+      UInt32 src = dest + (UInt32)i + 5;
+      Buf *s = &out[b == 0xE8 ? 1 : 2];
+      RangeEnc_EncodeBit(&rc, prob, 1);
+      Buf_Byte(s, src >> 24);
+      Buf_Byte(s, (src >> 16) & 0xFF);
+      Buf_Byte(s, (src >> 8) & 0xFF);
+      Buf_Byte(s, src & 0xFF);
+      prev = data[i + 4];
+      i += 5;
+    }
+    else
+    {
+      RangeEnc_EncodeBit(&rc, prob, 0);
+      prev = b;
+      i++;
+    }
+  }
+  for (i = 0; i < 5; i++)
+    RangeEnc_ShiftLow(&rc);
+}
+
+/* ---------- The generated suite ---------- */
+
+static Buf MakeSmallFiles(void)
+{
+  Builder b;
+  Byte data[16384];
+  char name[64];
+  UInt32 i;
+  memset(&b, 0, sizeof(b));
+  for (i = 0; i < 5000; i++)
+  {
+    size_t size = 256 + Random() % (sizeof(data) - 256);
+    GenText(data, size);
+    sprintf(name, "src/module%u/file%u.c", (unsigned)(i / 100), (unsigned)i);
+    Builder_AddFolder(&b, 0);
+    Builder_AddPack(&b, data, size);
+    Builder_AddFile(&b, name, data, size);
+  }
+  return Builder_Finish(&b);
+}
+
+static Buf MakeSolid(void)
+{
+  Builder b;
+  size_t size = (size_t)48 << 20, fileSize = size / 192, pos;
+  Byte *data = (Byte *)malloc(size);
+  char name[64];
+  memset(&b, 0, sizeof(b));
+  GenText(data, size);
+  Builder_AddFolder(&b, 0);
+  Builder_AddPack(&b, data, size);
+  for (pos = 0; pos < size; pos += fileSize)
+  {
+    sprintf(name, "logs/day%u.log", (unsigned)(pos / fileSize));
+    Builder_AddFile(&b, name, data + pos, fileSize < size - pos ? fileSize : size - pos);
+  }
+  free(data);
+  return Builder_Finish(&b);
+}
+
+static Buf MakeBcj2(void)
+{
+  Builder b;
+  size_t size = (size_t)16 << 20, fileSize = size / 4, pos;
+  Byte *data = (Byte *)malloc(size);
+  Buf streams[4];
+  char name[64];
+  unsigned i;
+  memset(&b, 0, sizeof(b));
+  memset(streams, 0, sizeof(streams));
+  GenCode(data, size);
+  Bcj2Enc(data, size, streams);
+  Builder_AddFolder(&b, 1);
+  for (i = 0; i < 4; i++)
+  {
+    Builder_AddPack(&b, streams[i].data, streams[i].size);
+    free(streams[i].data);
+  }
+  for (pos = 0; pos < size; pos += fileSize)
+  {
+    sprintf(name, "bin/program%u.exe", (unsigned)(pos / fileSize));
+    Builder_AddFile(&b, name, data + pos, fileSize);
+  }
+  free(data);
+  return Builder_Finish(&b);
+}
+
+static Buf MakeMedia(void)
+{
+  Builder b;
+  size_t size = (size_t)16 << 20;
+  Byte *data = (Byte *)malloc(size);
+  char name[64];
+  unsigned i;
+  memset(&b, 0, sizeof(b));
+  for (i = 0; i < 4; i++)
+  {
+    GenRandom(data, size);
+    sprintf(name, "media/video%u.mp4", i);
+    Builder_AddFolder(&b, 0);
+    Builder_AddPack(&b, data, size);
+    Builder_AddFile(&b, name, data, size);
+  }
+  free(data);
+  return Builder_Finish(&b);
+}
+
+/* ---------- Measurements ---------- */
+
+static SRes Open(CSzArEx *db, CLookToRead *stream, const Byte *data, size_t size)
+{
+  LOOKTOREAD_INIT(stream);
+  stream->data = data;
+  stream->data_len = size;
+  return SzArEx_Open(db, stream);
+}
+
+/* Returns the index of the file with the name (UTF-16LE with its 0), or -1. */
+static UInt32 FindFile(const CSzArEx *db, const Byte *name, size_t len)
+{
+  UInt32 i;
+  for (i = 0; i < db->db.NumFiles; i++)
+  {
+    size_t offset = db->FileNameOffsets[i];
+    if (db->FileNameOffsets[i + 1] - offset == len &&
+        memcmp(db->FileNamesInHeaderBufPtr + offset * 2, name, len * 2) == 0)
+    {
+      return i;
+    }
+  }
+  return (UInt32)-1;
+}
+
+static SRes Bench(const char *label, const Byte *data, size_t size)
+{
+  CSzArEx db;
+  CLookToRead stream;
+  unsigned maxRuns = num_runs > num_samples ? num_runs : num_samples;
+  double *t = (double *)malloc(maxRuns * sizeof(double));
+  double start, total, bytes;
+  UInt64 unpacked = 0;
+  unsigned n;
+  UInt32 numFiles, f;
+  SRes res;
+
+  /* Open */
+  start = Now();
+  for (n = 0; KeepGoing(n, num_runs, start); n++)
+  {
+    double t0 = Now();
+    res = Open(&db, &stream, data, size);
+    t[n] = Now() - t0;
+    LookToRead_Free(&stream);
+    SzArEx_Free(&db);
+    if (res != SZ_OK)
+    {
+      free(t);
+      return res;
+    }
+  }
+
+  if ((res = Open(&db, &stream, data, size)) != SZ_OK)
+  {
+    free(t);
+    return res;
+  }
+  numFiles = db.db.NumFiles;
+  for (f = 0; f < numFiles; f++)
+    unpacked += db.db.Files[f].Size;
+  printf("%s: %u files, %u folders, %.1f MB in %.1f MB\n", label, (unsigned)numFiles,
+    (unsigned)db.db.NumFolders, (double)unpacked / 1e6, (double)size / 1e6);
+  PrintPercentiles("open", t, n, 1e6, "us");
+  printf("\n");
+
+  if (numFiles != 0)
+  {
+    UInt32 blockIndex = (UInt32)-1;
+    Byte *outBuffer = NULL;
+    size_t outBufferSize = 0;
+
+    /* Lookup of random names */
+    start = Now();
+    for (n = 0; KeepGoing(n, num_samples, start); n++)
+    {
+      UInt32 want = Random() % numFiles;
+      size_t offset = db.FileNameOffsets[want];
+      double t0 = Now();
+      f = FindFile(&db, db.FileNamesInHeaderBufPtr + offset * 2, db.FileNameOffsets[want + 1] - offset);
+      t[n] = Now() - t0;
+      if (f != want)
+        res = SZ_ERROR_FAIL;
+    }
+    PrintPercentiles("lookup", t, n, 1e6, "us");
+    printf("\n");
+
+    /* Single random files, without the cache of the last folder */
+    bytes = 0;
+    total = 0;
+    start = Now();
+    for (n = 0; res == SZ_OK && KeepGoing(n, num_samples, start); n++)
+    {
+      size_t offset, processed;
+      double t0;
+      f = Random() % numFiles;
+      t0 = Now();
+      res = SzArEx_Extract(&db, &stream, f, &blockIndex, &outBuffer, &outBufferSize, &offset, &processed);
+      t[n] = Now() - t0;
+      total += t[n];
+      bytes += (double)processed;
+      SzFree(outBuffer);
+      outBuffer = NULL;
+      blockIndex = (UInt32)-1;
+    }
+    if (res == SZ_OK)
+    {
+      PrintPercentiles("single", t, n, 1e3, "ms");
+      printf("  %8.1f MB/s\n", bytes / total / 1e6);
+    }
+
+    /* All files in order, reusing the folder cache */
+    start = Now();
+    for (n = 0; res == SZ_OK && KeepGoing(n, num_runs, start); n++)
+    {
+      double t0 = Now();
+      for (f = 0; res == SZ_OK && f < numFiles; f++)
+      {
+        size_t offset, processed;
+        res = SzArEx_Extract(&db, &stream, f, &blockIndex, &outBuffer, &outBufferSize, &offset, &processed);
+      }
+      t[n] = Now() - t0;
+      SzFree(outBuffer);
+      outBuffer = NULL;
+      blockIndex = (UInt32)-1;
+    }
+    if (res == SZ_OK)
+    {
+      PrintPercentiles("full", t, n, 1e3, "ms");
+      printf("  %8.1f MB/s\n", (double)unpacked / t[(n - 1) / 2] / 1e6);
+    }
+  }
+
+  LookToRead_Free(&stream);
+  SzArEx_Free(&db);
+  free(t);
+  return res;
+}
+
+static int ReadWholeFile(const char *path, Buf *b)
+{
+  FILE *f = fopen(path, "rb");
+  size_t n;
+  if (f == NULL)
+    return 0;
+  memset(b, 0, sizeof(*b));
+  do
+  {
+    Buf_Reserve(b, 1 << 20);
+    n = fread(b->data + b->size, 1, 1 << 20, f);
+    b->size += n;
+  }
+  while (n != 0);
+  fclose(f);
+  return 1;
+}
+
+static int Usage(void)
+{
+  fprintf(stderr, "usage: un7z_bench [-n runs] [-k samples] [-t seconds] [archive.7z ...]\n");
+  return 1;
+}
+
+int main(int argc, const char **argv)
+{
+  int i, numArchives = 0, failed = 0;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+      num_runs = (unsigned)atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+      num_samples = (unsigned)atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+      time_limit = atof(argv[++i]);
+    else if (argv[i][0] == '-')
+      return Usage();
+    else
+      numArchives++;
+  }
+  if (num_runs == 0 || num_samples == 0)
+  {
+    fprintf(stderr, "un7z_bench: -n and -k must be at least 1\n");
+    return Usage();
+  }
+
+  if (numArchives == 0)
+  {
+    static Buf (*const kMake[4])(void) = { MakeSmallFiles, MakeSolid, MakeBcj2, MakeMedia };
+    static const char *const kNames[4] = { "small files", "solid block", "bcj2", "media" };
+    unsigned k;
+    for (k = 0; k < 4; k++)
+    {
+      Buf arc = kMake[k]();
+      SRes res = Bench(kNames[k], arc.data, arc.size);
+      if (res != SZ_OK)
+      {
+        fprintf(stderr, "%s: ERROR # %i\n", kNames[k], res);
+        failed = 1;
+      }
+      free(arc.data);
+    }
+  }
+  for (i = 1; i < argc; i++)
+  {
+    Buf arc;
+    SRes res;
+    if (argv[i][0] == '-')
+    {
+      i++;
+      continue;
+    }
+    if (!ReadWholeFile(argv[i], &arc))
+    {
+      fprintf(stderr, "%s: can not open\n", argv[i]);
+      failed = 1;
+      continue;
+    }
+    if ((res = Bench(argv[i], arc.data, arc.size)) != SZ_OK)
+    {
+      fprintf(stderr, "%s: ERROR # %i\n", argv[i], res);
+      failed = 1;
+    }
+    free(arc.data);
+  }
+  return failed;
+}
@@ -0,0 +1,888 @@
+#!/usr/bin/env python3
+"""Writes the .7z fixtures of the tests to this directory.
+
+The coders' streams are made by liblzma (Python's lzma module, or xz for
+the filters the module doesn't have), zlib, bsdtar (for PPMd) and zstd,
+and put in archives written here, so that each fixture has exactly the
+folders and coders it tests. The data is generated from fixed seeds, so
+running it again gives the same archives.
+
+Each archive ends with a copy of a file of tests/testdata, which the tests
+print (see new_fixture_test in tests/CMakeLists.txt); every other file is
+checked by its CRC.
+"""
+
+import lzma
+import os
+import random
+import struct
+import subprocess
+import tempfile
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TESTDATA = os.path.join(HERE, '..', 'testdata')
+
+K_COPY = 0
+K_LZMA2 = 0x21
+K_LZMA = 0x30101
+K_DELTA = 3
+K_DEFLATE = 0x040108
+K_PPMD = 0x030401
+K_ZSTD = 0x04F71101
+K_DEFLATE64 = 0x040109
+K_BCJ = 0x03030103
+K_BCJ2 = 0x0303011B
+K_ARM = 0x03030501
+K_ARMT = 0x03030701
+K_ARM64 = 0xA
+K_RISCV = 0xB
+K_PPC = 0x03030205
+K_SPARC = 0x03030805
+K_IA64 = 0x03030401
+
+
+# ---------- Archive writer ----------
+
+def number(v):
+    """A 7z variable-length UInt64."""
+    n = 0
+    while n < 8 and v >= 1 << (7 * (n + 1)):
+        n += 1
+    if n == 8:
+        return b'\xff' + struct.pack('<Q', v)
+    high = v >> (8 * n)
+    return bytes([((0xff << (8 - n)) & 0xff) | high]) + (v & ((1 << (8 * n)) - 1)).to_bytes(n, 'little')
+
+
+def coder(method, props=None, num_in=1):
+    return dict(method=method, props=props, num_in=num_in)
+
+
+def folder(coders, packs, unpack_sizes, files, binds=(), pack_indexes=(0,)):
+    """A folder of coders. binds are (in stream, out stream) pairs, packs
+    are the pack streams in the order of pack_indexes, and unpack_sizes has
+    the size of the output of each coder. files are (name, data) pairs.
+    Setting crc gives the folder an UnpackCRC."""
+    return dict(coders=coders, packs=packs, unpack_sizes=unpack_sizes, files=files,
+                binds=binds, pack_indexes=pack_indexes, crc=None)
+
+
+def single(c, packed, files):
+    """A folder with one coder c, which decodes packed to the files."""
+    return folder([c], [packed], [sum(len(d) for n, d in files)], files)
+
+
+def write_folder(f):
+    out = bytearray(number(len(f['coders'])))
+    for c in f['coders']:
+        method = c['method'].to_bytes(max(1, (c['method'].bit_length() + 7) // 8), 'big')
+        flags = len(method)
+        if c['num_in'] != 1:
+            flags |= 0x10
+        if c['props'] is not None:
+            flags |= 0x20
+        out += bytes([flags]) + method
+        if c['num_in'] != 1:
+            out += number(c['num_in']) + number(1)
+        if c['props'] is not None:
+            out += number(len(c['props'])) + c['props']
+    for in_index, out_index in f['binds']:
+        out += number(in_index) + number(out_index)
+    if len(f['pack_indexes']) > 1:
+        for i in f['pack_indexes']:
+            out += number(i)
+    return bytes(out)
+
+
+def bits(defined):
+    """A 7z vector of defined flags: all defined, or a bit per item."""
+    if all(defined):
+        return b'\x01'
+    out = bytearray(b'\x00') + bytes((len(defined) + 7) // 8)
+    for i, d in enumerate(defined):
+        if d:
+            out[1 + i // 8] |= 0x80 >> (i % 8)
+    return bytes(out)
+
+
+def archive(folders):
+    packs = b''.join(p for f in folders for p in f['packs'])
+    files = [x for f in folders for x in f['files']]
+    h = bytearray(b'\x01\x04')
+    h += b'\x06' + number(0) + number(sum(len(f['packs']) for f in folders)) + b'\x09'
+    for f in folders:
+        for p in f['packs']:
+            h += number(len(p))
+    h += b'\x00'
+    h += b'\x07\x0b' + number(len(folders)) + b'\x00'
+    for f in folders:
+        h += write_folder(f)
+    h += b'\x0c'
+    for f in folders:
+        for s in f['unpack_sizes']:
+            h += number(s)
+    if any(f['crc'] is not None for f in folders):
+        h += b'\x0a' + bits([f['crc'] is not None for f in folders])
+        for f in folders:
+            if f['crc'] is not None:
+                h += struct.pack('<I', f['crc'])
+    h += b'\x00'
+    h += b'\x08\x0d'
+    for f in folders:
+        h += number(len(f['files']))
+    h += b'\x09'
+    for f in folders:
+        for n, d in f['files'][:-1]:
+            h += number(len(d))
+    h += b'\x0a\x01'
+    for n, d in files:
+        h += struct.pack('<I', zlib.crc32(d))
+    h += b'\x00\x00'
+    h += b'\x05' + number(len(files))
+    names = b''.join(n.encode('utf-16-le') + b'\x00\x00' for n, d in files)
+    h += b'\x11' + number(len(names) + 1) + b'\x00' + names
+    h += b'\x00\x00'
+    h = bytes(h)
+    start = struct.pack('<QQI', len(packs), len(h), zlib.crc32(h))
+    return b'7z\xbc\xaf\x27\x1c\x00\x04' + struct.pack('<I', zlib.crc32(start)) + start + packs + h
+
+
+def save(name, folders):
+    with open(os.path.join(HERE, name), 'wb') as f:
+        f.write(archive(folders))
+
+
+def testdata(name):
+    with open(os.path.join(TESTDATA, name), 'rb') as f:
+        return (name, f.read())
+
+
+# ---------- Coders ----------
+
+def lzma_props(lc=3, lp=0, pb=2, dict_size=1 << 20):
+    return bytes([(pb * 5 + lp) * 9 + lc]) + struct.pack('<I', dict_size)
+
+
+def lzma_encode(data, lc=3, lp=0, pb=2, dict_size=1 << 20, pre=()):
+    """A raw LZMA stream (with an end marker) and its coder."""
+    chain = list(pre) + [dict(id=lzma.FILTER_LZMA1, dict_size=dict_size, lc=lc, lp=lp, pb=pb)]
+    return lzma.compress(data, format=lzma.FORMAT_RAW, filters=chain), coder(K_LZMA, lzma_props(lc, lp, pb, dict_size))
+
+
+def lzma2_props(dict_size):
+    p = 0
+    while (2 | (p & 1)) << (p // 2 + 11) < dict_size:
+        p += 1
+    return bytes([p])
+
+
+def lzma2_encode(data, lc=3, lp=0, pb=2, dict_size=1 << 20, pre=()):
+    """A raw LZMA2 stream and its coder."""
+    chain = list(pre) + [dict(id=lzma.FILTER_LZMA2, dict_size=dict_size, lc=lc, lp=lp, pb=pb)]
+    return lzma.compress(data, format=lzma.FORMAT_RAW, filters=chain), coder(K_LZMA2, lzma2_props(dict_size))
+
+
+def xz_filter(files, method, option, start=0):
+    """A folder of a branch filter and LZMA2, made by xz (5.6 or later for
+    RISC-V). start is the start offset, given as props if it's not 0."""
+    data = b''.join(d for n, d in files)
+    if start:
+        option += '=start=%d' % start
+    packed = subprocess.run(['xz', '--format=raw', option, '--lzma2=dict=64KiB', '-c'],
+                            input=data, capture_output=True, check=True).stdout
+    return folder([coder(method, struct.pack('<I', start) if start else None),
+                   coder(K_LZMA2, lzma2_props(1 << 16))],
+                  [packed], [len(data)] * 2, files, binds=[(0, 1)], pack_indexes=[1])
+
+
+def ppmd_encode(data, mem_size=None):
+    """A PPMd stream, by bsdtar, and its coder. bsdtar always takes order 6
+    and 16 MB; a stream that doesn't fill the model decodes the same with
+    less memory, which mem_size sets."""
+    with tempfile.TemporaryDirectory() as tmp:
+        with open(os.path.join(tmp, 'data'), 'wb') as f:
+            f.write(data)
+        subprocess.run(['bsdtar', '--format', '7zip', '--options', '7zip:compression=ppmd',
+                        '-cf', 'data.7z', 'data'], cwd=tmp, check=True)
+        with open(os.path.join(tmp, 'data.7z'), 'rb') as f:
+            a = f.read()
+    # The only pack stream is between the signature header and the header.
+    packed = a[32:32 + struct.unpack_from('<Q', a, 12)[0]]
+    i = a.index(K_PPMD.to_bytes(3, 'big'), 32 + len(packed))
+    order, mem = struct.unpack_from('<BI', a, i + 4)
+    return packed, coder(K_PPMD, struct.pack('<BI', order, mem_size or mem))
+
+
+def zstd_frame(data, *options):
+    """A Zstandard frame, by zstd."""
+    return subprocess.run(['zstd', '-c', '-q'] + list(options), input=data,
+                          capture_output=True, check=True).stdout
+
+
+def zlib_deflate(data, level=6, strategy=zlib.Z_DEFAULT_STRATEGY, final=True):
+    """A raw Deflate stream. Without final, it ends with a full flush, at a
+    byte boundary, so that another one can follow."""
+    c = zlib.compressobj(level, zlib.DEFLATED, -15, 8, strategy)
+    return c.compress(data) + c.flush(zlib.Z_FINISH if final else zlib.Z_FULL_FLUSH)
+
+
+class BitWriter:
+    def __init__(self):
+        self.out, self.bits, self.count = bytearray(), 0, 0
+
+    def write(self, value, count):
+        self.bits |= value << self.count
+        self.count += count
+        while self.count >= 8:
+            self.out.append(self.bits & 0xff)
+            self.bits >>= 8
+            self.count -= 8
+
+    def code(self, code, length):
+        """A Huffman code, which is sent from its top bit."""
+        self.write(int(format(code, '0%db' % length)[::-1], 2), length)
+
+    def align(self):
+        if self.count:
+            self.write(0, 8 - self.count)
+
+
+LEN_BASE = [3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227]
+LEN_BITS = [0] * 8 + [1] * 4 + [2] * 4 + [3] * 4 + [4] * 4 + [5] * 4
+DIST_BASE = [1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+             4097, 6145, 8193, 12289, 16385, 24577, 32769, 49153]
+DIST_BITS = [0, 0, 0, 0] + [n // 2 for n in range(2, 30)]
+
+
+def deflate_symbols(length, dist, deflate64):
+    """The length and distance codes of a match, with their extra bits:
+    Deflate64's code 285 has 16 extra bits, its codes 30 and 31 reach 64 KB."""
+    if deflate64 and length > 258:
+        lc = (285, length - 3, 16)
+    elif length == 258 and not deflate64:
+        lc = (285, 0, 0)
+    else:
+        i = max(i for i in range(28) if LEN_BASE[i] <= length)
+        lc = (257 + i, length - LEN_BASE[i], LEN_BITS[i])
+    i = max(i for i in range(32) if DIST_BASE[i] <= dist)
+    return lc, (i, dist - DIST_BASE[i], DIST_BITS[i])
+
+
+def matches(data, start, end, window, max_len):
+    """Greedy LZ77 tokens of data[start:end], which can refer back to
+    window bytes before it: literals (int) and (length, distance) pairs."""
+    heads = {}
+    for i in range(max(0, start - window), start):
+        heads.setdefault(data[i:i + 3], []).append(i)
+    tokens, i = [], start
+    while i < end:
+        best = (0, 0)
+        for j in reversed(heads.get(data[i:i + 3], [])[-16:]):
+            if i - j > window:
+                break
+            n = 0
+            while n < max_len and i + n < end and data[j + n] == data[i + n]:
+                n += 1
+            if n > best[0]:
+                best = (n, i - j)
+        n = best[0] if best[0] >= 3 else 1
+        tokens.append(best if n > 1 else data[i])
+        for k in range(i, i + n):
+            heads.setdefault(data[k:k + 3], []).append(k)
+        i += n
+    return tokens
+
+
+def huffman_lengths(freqs, limit):
+    """Code lengths of at most limit bits for the symbols of freqs."""
+    import heapq
+    while True:
+        heap = [(f, i, [s]) for i, (s, f) in enumerate(sorted(freqs.items())) if f]
+        lengths = dict.fromkeys(freqs, 0)
+        if len(heap) == 1:
+            lengths[heap[0][2][0]] = 1
+            return lengths
+        heapq.heapify(heap)
+        n = len(heap)
+        while len(heap) > 1:
+            f1, _, s1 = heapq.heappop(heap)
+            f2, _, s2 = heapq.heappop(heap)
+            for s in s1 + s2:
+                lengths[s] += 1
+            heapq.heappush(heap, (f1 + f2, n, s1 + s2))
+            n += 1
+        if max(lengths.values()) <= limit:
+            return lengths
+        freqs = {s: (f + 1) // 2 if f else 0 for s, f in freqs.items()}
+
+
+def canonical(lengths):
+    codes, code = {}, 0
+    for length in range(1, 16):
+        for s in sorted(s for s, n in lengths.items() if n == length):
+            codes[s] = (code, length)
+            code += 1
+        code <<= 1
+    return codes
+
+
+def write_tokens(w, tokens, lit, dist, deflate64):
+    for t in tokens + [None]:
+        if t is None:
+            w.code(*lit[256])
+        elif isinstance(t, int):
+            w.code(*lit[t])
+        else:
+            (lc, lv, lb), (dc, dv, db) = deflate_symbols(t[0], t[1], deflate64)
+            w.code(*lit[lc])
+            w.write(lv, lb)
+            w.code(*dist[dc])
+            w.write(dv, db)
+
+
+def deflate_encode(data, blocks, deflate64=True):
+    """A raw Deflate64 (or Deflate) stream of data, with the blocks given
+    as (type, end): 'stored', 'fixed' or 'dynamic'."""
+    w = BitWriter()
+    window, max_len = (65536, 65538) if deflate64 else (32768, 258)
+    start = 0
+    for n, (kind, end) in enumerate(blocks):
+        w.write(n == len(blocks) - 1, 1)
+        if kind == 'stored':
+            w.write(0, 2)
+            w.align()
+            w.write(end - start, 16)
+            w.write((end - start) ^ 0xffff, 16)
+            for b in data[start:end]:
+                w.write(b, 8)
+            start = end
+            continue
+        tokens = matches(data, start, end, window, max_len)
+        if kind == 'fixed':
+            w.write(1, 2)
+            lit = canonical({s: 8 if s < 144 else 9 if s < 256 else 7 if s < 280 else 8 for s in range(288)})
+            dist = canonical({s: 5 for s in range(32)})
+        else:
+            w.write(2, 2)
+            lit_freqs, dist_freqs = dict.fromkeys(range(286), 0), dict.fromkeys(range(32 if deflate64 else 30), 0)
+            lit_freqs[256] = 1
+            for t in tokens:
+                if isinstance(t, int):
+                    lit_freqs[t] += 1
+                else:
+                    (lc, _, _), (dc, _, _) = deflate_symbols(t[0], t[1], deflate64)
+                    lit_freqs[lc] += 1
+                    dist_freqs[dc] += 1
+            if not any(dist_freqs.values()):
+                dist_freqs[0] = 1
+            lit_lengths, dist_lengths = huffman_lengths(lit_freqs, 15), huffman_lengths(dist_freqs, 15)
+            lit, dist = canonical(lit_lengths), canonical(dist_lengths)
+            num_lit = max(s for s, n in lit_lengths.items() if n) + 1
+            num_dist = max(max(s for s, n in dist_lengths.items() if n) + 1, 1)
+            seq = [lit_lengths[s] for s in range(num_lit)] + [dist_lengths[s] for s in range(num_dist)]
+            # Runs of code lengths: 16 repeats the last one, 17 and 18 are zeros.
+            rle, i = [], 0
+            while i < len(seq):
+                run = 1
+                while i + run < len(seq) and seq[i + run] == seq[i]:
+                    run += 1
+                if seq[i] == 0 and run >= 11:
+                    run = min(run, 138)
+                    rle.append((18, run - 11, 7))
+                elif seq[i] == 0 and run >= 3:
+                    rle.append((17, run - 3, 3))
+                elif run >= 4:
+                    run = min(run, 7)
+                    rle += [(seq[i], 0, 0), (16, run - 4, 2)]
+                else:
+                    run = 1
+                    rle.append((seq[i], 0, 0))
+                i += run
+            cl_freqs = dict.fromkeys(range(19), 0)
+            for sym, _, _ in rle:
+                cl_freqs[sym] += 1
+            cl_lengths = huffman_lengths(cl_freqs, 7)
+            cl = canonical(cl_lengths)
+            order = [16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15]
+            num_cl = max(4, max(i for i, s in enumerate(order) if cl_lengths[s]) + 1)
+            w.write(num_lit - 257, 5)
+            w.write(num_dist - 1, 5)
+            w.write(num_cl - 4, 4)
+            for s in order[:num_cl]:
+                w.write(cl_lengths[s], 3)
+            for sym, value, bits in rle:
+                w.code(*cl[sym])
+                w.write(value, bits)
+        write_tokens(w, tokens, lit, dist, deflate64)
+        start = end
+    w.align()
+    return bytes(w.out)
+
+
+class RangeEncoder:
+    def __init__(self):
+        self.low, self.range, self.cache, self.cache_size = 0, 0xffffffff, 0, 1
+        self.out = bytearray()
+
+    def shift_low(self):
+        if self.low < 0xff000000 or self.low >= 1 << 32:
+            carry, temp = self.low >> 32, self.cache
+            while True:
+                self.out.append((temp + carry) & 0xff)
+                temp = 0xff
+                self.cache_size -= 1
+                if self.cache_size == 0:
+                    break
+            self.cache = (self.low >> 24) & 0xff
+        self.cache_size += 1
+        self.low = (self.low & 0xffffff) << 8
+
+    def bit(self, probs, i, b):
+        bound = (self.range >> 11) * probs[i]
+        if b == 0:
+            self.range = bound
+            probs[i] += (2048 - probs[i]) >> 5
+        else:
+            self.low += bound
+            self.range -= bound
+            probs[i] -= probs[i] >> 5
+        while self.range < 1 << 24:
+            self.range = (self.range << 8) & 0xffffffff
+            self.shift_low()
+
+    def finish(self):
+        for _ in range(5):
+            self.shift_low()
+        return bytes(self.out)
+
+
+def bcj2_split(data):
+    """The main, call, jump and range coder streams of BCJ2."""
+    probs = [1024] * 258
+    rc = RangeEncoder()
+    main, call, jump = bytearray(), bytearray(), bytearray()
+    prev, i = 0, 0
+    while i < len(data):
+        b = data[i]
+        main.append(b)
+        if (b & 0xfe) != 0xe8 and not (prev == 0x0f and (b & 0xf0) == 0x80):
+            prev = b
+            i += 1
+            continue
+        if i + 1 == len(data):
+            break
+        index = prev if b == 0xe8 else (256 if b == 0xe9 else 257)
+        if i + 5 <= len(data) and (data[i + 4] in (0, 0xff) or b != 0xe9):
+            rc.bit(probs, index, 1)
+            dest = (struct.unpack('<I', data[i + 1:i + 5])[0] + i + 5) & 0xffffffff
+            (call if b == 0xe8 else jump).extend(struct.pack('>I', dest))
+            prev = data[i + 4]
+            i += 5
+        else:
+            rc.bit(probs, index, 0)
+            prev = b
+            i += 1
+    return bytes(main), bytes(call), bytes(jump), rc.finish()
+
+
+def bcj2_folder(files, encode):
+    """A BCJ2 folder as 7-Zip writes it: BCJ2 takes the main, call and jump
+    streams from coders, made by encode(stream, index), and the range coder
+    stream from a pack stream."""
+    main, call, jump, rc = bcj2_split(b''.join(d for n, d in files))
+    coded = [encode(x, i) for i, x in enumerate((main, call, jump))]
+    return folder([coder(K_BCJ2, None, 4)] + [c for p, c in coded],
+                  [p for p, c in coded] + [rc],
+                  [sum(len(d) for n, d in files), len(main), len(call), len(jump)], files,
+                  binds=[(0, 1), (1, 2), (2, 3)], pack_indexes=[4, 5, 6, 3])
+
+
+# ---------- Data ----------
+
+def text(rng, size):
+    words = [bytes(rng.choice(b'abcdefghijklmnopqrstuvwxyz') for _ in range(rng.randint(2, 9))) for _ in range(300)]
+    out = bytearray()
+    while len(out) < size:
+        out += rng.choice(words) + (b'\n' if rng.random() < 0.1 else b' ')
+    return bytes(out[:size])
+
+
+def mixed(rng, size):
+    """Text, random bytes, runs and short periods (matches overlapping
+    their source), and long repeats (matches of the maximum length)."""
+    out = bytearray()
+    while len(out) < size:
+        k = rng.random()
+        if k < 0.3:
+            out += text(rng, rng.randint(16, 600))
+        elif k < 0.45:
+            out += bytes(rng.randrange(256) for _ in range(rng.randint(1, 60)))
+        elif k < 0.6:
+            out += bytes([rng.randrange(256)]) * rng.randint(2, 600)
+        elif k < 0.85:
+            period = bytes(rng.randrange(256) for _ in range(rng.randint(2, 40)))
+            out += period * rng.randint(2, 40)
+        elif len(out) > 1000:
+            start = rng.randrange(len(out) - 600)
+            out += out[start:start + rng.randint(273, 600)]
+    return bytes(out[:size])
+
+
+def x86(rng, size, jcc_targets=False):
+    """Code-like bytes: blocks of instructions (some with E8 in their
+    immediates) from a few templates, with calls and jumps to a few targets.
+    Jcc go to the targets with jcc_targets, as BCJ2 converts them, or to a
+    fixed distance. At each 64 KB boundary, a call crosses it, and a Jcc's 0F 8x
+    pair straddles the next one."""
+    targets = [rng.randrange(size) for _ in range(32)]
+    ops = [b'\x55', b'\x48\x89\xe5', b'\x8b\x45\xfc', b'\xc3', b'\x90', b'\x48\x83\xec\x20',
+           b'\x89\x7d\xfc', b'\x31\xc0', b'\xb8\xe8\x03\x00\x00', b'\x0f\xb6\xc0', b'\x74\x08', b'\xeb\xe9']
+    templates = []
+    for _ in range(24):
+        block = []
+        for _ in range(rng.randint(3, 12)):
+            k = rng.random()
+            if k < 0.25:
+                block.append((0xe8, rng.choice(targets)))
+            elif k < 0.35:
+                block.append((0xe9, rng.choice(targets)))
+            elif k < 0.45:
+                block.append((0x80 | rng.randrange(16), rng.choice(targets) if jcc_targets else None))
+            else:
+                block.append(rng.choice(ops))
+        templates.append(block)
+    out = bytearray()
+    while len(out) < size:
+        for op in rng.choice(templates):
+            if isinstance(op, bytes):
+                out += op
+            elif op[0] & 0xfe == 0xe8:
+                out += bytes([op[0]]) + struct.pack('<i', op[1] - len(out) - 5)
+            else:
+                out += bytes([0x0f, op[0]]) + struct.pack('<i', op[1] - len(out) - 6 if op[1] is not None else 100)
+    for n, boundary in enumerate(range(1 << 16, size - 8, 1 << 16)):
+        at = boundary - 1 - n % 4
+        out[at:at + 5] = b'\xe8' + struct.pack('<i', rng.choice(targets) - at - 5)
+        if n % 2:
+            out[boundary - 1:boundary + 5] = b'\x0f\x85' + struct.pack('<i', 100)
+    return bytes(out[:size])
+
+
+def x86_branches(rng, size):
+    """Only calls, jumps and Jcc, in runs from a few templates, so that
+    BCJ2's call and jump streams are about as large as its main one."""
+    targets = [rng.randrange(size) for _ in range(32)]
+    templates = [[(rng.choice((b'\xe8', b'\xe8', b'\xe9', b'\x0f\x85')), rng.choice(targets)) for _ in range(16)]
+                 for _ in range(24)]
+    out = bytearray()
+    while len(out) < size:
+        for op, target in rng.choice(templates):
+            out += op + struct.pack('<i', target - len(out) - len(op) - 4)
+    return bytes(out[:size])
+
+
+def samples(rng, size, width):
+    """Interleaved channels of width bytes of slowly changing values, which
+    Delta with a distance of width turns into small differences."""
+    out = bytearray()
+    values = [rng.randrange(256) for _ in range(width)]
+    while len(out) < size:
+        values = [(v + rng.choice((-1, 0, 0, 0, 1))) & 0xff for v in values]
+        out += bytes(values)
+    return bytes(out[:size])
+
+
+def branches(rng, size, align, branch):
+    """Code of another architecture: words of align bytes from a small set,
+    and every few words a branch to one of a few targets, which
+    branch(pc, target) encodes."""
+    targets = [rng.randrange(size) & -align for _ in range(32)]
+    words = [bytes(rng.randrange(256) for _ in range(align)) for _ in range(16)]
+    out = bytearray()
+    while len(out) < size:
+        if rng.random() < 0.2:
+            out += branch(len(out), rng.choice(targets))
+        else:
+            out += rng.choice(words)
+    return bytes(out)
+
+
+def ia64_bundle(pc, target):
+    """A bundle of template 0x10, with a branch in slot 2."""
+    disp = ((target - pc) >> 4) & 0x1fffff
+    slot2 = 5 << 37 | (disp >> 20) << 36 | (disp & 0xfffff) << 13
+    return (0x10 | 0x12345 << 5 | slot2 << 87).to_bytes(16, 'little')
+
+
+def riscv_branch(pc, target):
+    """JAL, or AUIPC and JALR with the same register."""
+    off = (target - pc) & 0xffffffff
+    if pc & 4:
+        imm = off & 0x1ffffe
+        return struct.pack('<I', (imm >> 20) << 31 | ((imm >> 1) & 0x3ff) << 21 | ((imm >> 11) & 1) << 20 |
+                           ((imm >> 12) & 0xff) << 12 | 1 << 7 | 0x6f)
+    return struct.pack('<II', ((off + 0x800) & 0xfffff000) | 6 << 7 | 0x17,
+                       (off & 0xfff) << 20 | 6 << 15 | 1 << 7 | 0x67)
+
+
+BRANCHES = {
+    'arm': (K_ARM, '--arm', 4, lambda pc, t: struct.pack('<I', 0xeb000000 | (((t - pc - 8) >> 2) & 0xffffff))),
+    'armt': (K_ARMT, '--armthumb', 2, lambda pc, t: struct.pack(
+        '<HH', 0xf000 | (((t - pc - 4) >> 12) & 0x7ff), 0xf800 | (((t - pc - 4) >> 1) & 0x7ff))),
+    'arm64': (K_ARM64, '--arm64', 4, lambda pc, t: struct.pack(
+        '<I', 0x94000000 | (((t - pc) >> 2) & 0x3ffffff) if pc & 4 else
+        0x90000000 | (((t >> 12) - (pc >> 12)) & 3) << 29 | ((((t >> 12) - (pc >> 12)) >> 2) & 0x7ffff) << 5 | 3)),
+    'ppc': (K_PPC, '--powerpc', 4, lambda pc, t: struct.pack('>I', 0x48000001 | ((t - pc) & 0x3fffffc))),
+    'sparc': (K_SPARC, '--sparc', 4, lambda pc, t: struct.pack('>I', 0x40000000 | (((t - pc) >> 2) & 0x3fffffff))),
+    'ia64': (K_IA64, '--ia64', 16, ia64_bundle),
+    'riscv': (K_RISCV, '--riscv', 2, riscv_branch),
+}
+
+
+# ---------- Fixtures ----------
+
+def make_lzma():
+    """LZMA with the default lc3:lp0:pb2 and the smallest dictionary, which
+    the folder is much larger than, so a stream decoder wraps around it."""
+    rng = random.Random(29)
+    files = [('mixed.bin', mixed(rng, 64 << 10)), testdata('file2.txt')]
+    packed, c = lzma_encode(b''.join(d for n, d in files), dict_size=1 << 12)
+    return [single(c, packed, files)]
+
+
+def make_lzma_props():
+    """A folder for each of the lc/lp/pb sets with a decoder loop of their
+    own (lc0:lp2:pb2, besides the default) and others, which take the
+    generic one. The last folder is LZMA2 whose props change between
+    chunks: it's the concatenation of three streams."""
+    rng = random.Random(30)
+    folders = []
+    for i, (lc, lp, pb) in enumerate([(0, 2, 2), (4, 0, 0), (1, 3, 4), (2, 1, 1), (0, 0, 0)]):
+        files = [('props%d%d%d.bin' % (lc, lp, pb), mixed(rng, 8 << 10))]
+        packed, c = lzma_encode(files[0][1], lc, lp, pb, dict_size=1 << 16)
+        folders.append(single(c, packed, files))
+    parts = [mixed(rng, 8 << 10), mixed(rng, 8 << 10), mixed(rng, 8 << 10)]
+    files = [('lzma2.bin', b''.join(parts)), testdata('file2.txt')]
+    parts[-1] += files[-1][1]
+    packed = b''
+    for part, (lc, lp, pb) in zip(parts, [(3, 0, 2), (0, 2, 2), (1, 3, 1)]):
+        # Each stream ends with a 0 byte, only the last one is kept.
+        packed = packed[:-1] + lzma2_encode(part, lc, lp, pb, dict_size=1 << 16)[0]
+    folders.append(single(coder(K_LZMA2, lzma2_props(1 << 16)), packed, files))
+    return folders
+
+
+def make_bcj():
+    """x86 code through BCJ and LZMA with a 64 KB dictionary, which a whole
+    folder decode filters in spans of 256 KB, and through BCJ2. Their E8, E9
+    and 0F 8x bytes are at every offset of the 16 and 32 byte blocks of the
+    SIMD scanners."""
+    rng = random.Random(31)
+    files = [('code.bin', x86(rng, 300 << 10))]
+    packed, c = lzma_encode(files[0][1], dict_size=1 << 16, pre=[dict(id=lzma.FILTER_X86)])
+    bcj = folder([coder(K_BCJ), c], [packed], [sum(len(d) for n, d in files)] * 2, files,
+                 binds=[(0, 1)], pack_indexes=[1])
+    files = [('code2.bin', x86(rng, 96 << 10, True)), testdata('file1.txt')]
+    bcj2 = bcj2_folder(files, lambda x, i: lzma_encode(x, *((3, 0, 2) if i == 0 else (0, 2, 2))))
+    return [bcj, bcj2]
+
+
+def make_delta():
+    """A folder of Delta and LZMA2 for each distance which has its own SIMD
+    loop (1, 2, 4, 8), for ones which share the one of 16 and up, and for
+    ones which are decoded by the scalar loop. The sizes aren't multiples of
+    16, and the last folder is larger than the 64 KB a stream decoder
+    converts at a time."""
+    rng = random.Random(34)
+    folders = []
+    sizes = [(dist, 3001 + dist) for dist in (1, 2, 3, 4, 7, 8, 15, 16, 17, 32, 256)] + [(4, 70000)]
+    for dist, size in sizes:
+        files = [('delta%d_%d.bin' % (dist, size), samples(rng, size, dist))]
+        if len(folders) == len(sizes) - 1:
+            files.append(testdata('file1.txt'))
+        packed, c = lzma2_encode(b''.join(d for n, d in files), dict_size=1 << 16,
+                                 pre=[dict(id=lzma.FILTER_DELTA, dist=dist)])
+        folders.append(folder([coder(K_DELTA, bytes([dist - 1])), c], [packed],
+                              [sum(len(d) for n, d in files)] * 2, files, binds=[(0, 1)], pack_indexes=[1]))
+    return folders
+
+
+def make_graph():
+    """Folders of the shapes a coder graph allows besides the usual ones:
+    stacked filters, coders listed after the ones they take, a filter with
+    no main coder, and BCJ2 with a filter between its main stream and its
+    coder and with a jump stream which is a pack stream."""
+    rng = random.Random(35)
+    folders = []
+
+    files = [('stacked.bin', x86(rng, 20 << 10))]
+    packed, c = lzma2_encode(files[0][1], pre=[dict(id=lzma.FILTER_X86), dict(id=lzma.FILTER_DELTA, dist=4)])
+    folders.append(folder([coder(K_BCJ), coder(K_DELTA, b'\x03'), c], [packed], [len(files[0][1])] * 3, files,
+                          binds=[(0, 1), (1, 2)], pack_indexes=[2]))
+
+    files = [('reversed.bin', x86(rng, 20 << 10))]
+    packed, c = lzma2_encode(files[0][1], pre=[dict(id=lzma.FILTER_X86)])
+    folders.append(folder([c, coder(K_BCJ)], [packed], [len(files[0][1])] * 2, files,
+                          binds=[(1, 0)], pack_indexes=[0]))
+
+    files = [('filter.bin', x86(rng, 4 << 10))]
+    packed = lzma.decompress(lzma2_encode(files[0][1], pre=[dict(id=lzma.FILTER_X86)])[0],
+                             format=lzma.FORMAT_RAW, filters=[dict(id=lzma.FILTER_LZMA2)])
+    folders.append(single(coder(K_BCJ), packed, files))
+
+    files = [('bcj2.bin', x86(rng, 20 << 10, True)), testdata('file1.txt')]
+    main, call, jump, rc = bcj2_split(b''.join(d for n, d in files))
+    packed_main, main_coder = lzma_encode(main, pre=[dict(id=lzma.FILTER_DELTA, dist=1)])
+    packed_call, call_coder = lzma_encode(call, 0, 2, 2)
+    folders.append(folder([coder(K_BCJ2, None, 4), coder(K_DELTA, b'\x00'), main_coder, call_coder],
+                          [packed_main, packed_call, jump, rc],
+                          [sum(len(d) for n, d in files), len(main), len(main), len(call)], files,
+                          binds=[(0, 1), (4, 2), (1, 3)], pack_indexes=[5, 6, 2, 3]))
+    return folders
+
+
+def make_bcj2():
+    """BCJ2 whose call and jump streams, decoded by LZMA, are over the 64 KB
+    from which they are decoded on threads of their own."""
+    rng = random.Random(36)
+    files = [('branches.bin', x86_branches(rng, 192 << 10)), testdata('file1.txt')]
+    return [bcj2_folder(files, lambda x, i: lzma_encode(x, *((3, 0, 2) if i == 0 else (0, 2, 2))))]
+
+
+def make_deflate():
+    """One Deflate stream, by zlib, of stored blocks (one of them empty),
+    fixed Huffman blocks and dynamic ones, which are concatenated at the
+    byte boundaries of full flushes."""
+    rng = random.Random(39)
+    parts = [bytes(rng.randrange(256) for _ in range(3000)), text(rng, 6000), mixed(rng, 40 << 10)]
+    files = [('deflate.bin', b''.join(parts)), testdata('file2.txt')]
+    parts[-1] += files[-1][1]
+    packed = (zlib_deflate(parts[0][:1000], 0, final=False) + zlib_deflate(parts[0][1000:], 0, final=False) +
+              zlib_deflate(parts[1], strategy=zlib.Z_FIXED, final=False) + zlib_deflate(parts[2], 9))
+    return [single(coder(K_DEFLATE), packed, files)]
+
+
+def make_ppmd():
+    """PPMd folders which take a model from the decoder pool in turn: one
+    over the size of a stream buffer, one with less memory, which gets
+    the same model, and one which needs its memory back. The last is BCJ2
+    whose main stream is PPMd, as 7-Zip does for x86 code with PPMd."""
+    rng = random.Random(40)
+    folders = []
+    for i, (size, mem_size) in enumerate([(72 << 10, None), (12 << 10, 1 << 20), (12 << 10, None)]):
+        files = [('text%d.txt' % i, text(rng, size))]
+        packed, c = ppmd_encode(files[0][1], mem_size)
+        folders.append(single(c, packed, files))
+    files = [('x86.bin', x86(rng, 24 << 10)), testdata('file1.txt')]
+    folders.append(bcj2_folder(files, lambda x, i: ppmd_encode(x) if i == 0 else lzma_encode(x, 0, 2, 2)))
+    return folders
+
+
+def make_corrupt():
+    """An LZMA folder of two files with a bit flipped in its middle, which
+    makes it fail to decode, for the tests of the un7z tool."""
+    rng = random.Random(45)
+    files = [('a.bin', mixed(rng, 16 << 10)), testdata('file1.txt')]
+    packed, c = lzma_encode(b''.join(d for n, d in files))
+    packed = bytearray(packed)
+    packed[len(packed) // 2] ^= 0x10
+    return [single(c, bytes(packed), files)]
+
+
+def make_folder_crc():
+    """An LZMA folder whose files are right but whose UnpackCRC is wrong,
+    which only a decode of the whole folder notices."""
+    rng = random.Random(37)
+    files = [('a.bin', mixed(rng, 16 << 10)), testdata('file1.txt')]
+    data = b''.join(d for n, d in files)
+    packed, c = lzma_encode(data)
+    f = single(c, packed, files)
+    f['crc'] = zlib.crc32(data) ^ 1
+    return [f]
+
+
+def make_file_crc():
+    """An LZMA folder without an UnpackCRC whose last file decodes to other
+    bytes than its CRC is of, as if the file was changed before packing."""
+    rng = random.Random(49)
+    files = [('a.bin', mixed(rng, 16 << 10)), testdata('file2.txt')]
+    data = bytearray(b''.join(d for n, d in files))
+    data[-10] ^= 0x20
+    packed, c = lzma_encode(bytes(data))
+    return [single(c, packed, files)]
+
+
+def make_zstd():
+    """Zstd as 7-Zip ZS writes it (props: its version and the level): two
+    frames, with and without a checksum, and a skippable frame between them,
+    which its multithreaded encoder adds. The first is over a stream buffer."""
+    rng = random.Random(38)
+    files = [('mixed.bin', mixed(rng, 72 << 10)), testdata('file2.txt')]
+    data = b''.join(d for n, d in files)
+    skippable = struct.pack('<II', 0x184D2A50, 4) + b'7zZS'
+    packed = (zstd_frame(data[:68 << 10], '-19', '--no-check') + skippable +
+              zstd_frame(data[68 << 10:], '-3', '--check'))
+    return [single(coder(K_ZSTD, bytes([1, 5, 19])), packed, files)]
+
+
+def long_repeats(rng):
+    """Text repeated after runs, at distances over 32 KB and over 48 KB, and
+    runs longer than 258 bytes: Deflate64's distance codes 30 and 31 and its
+    length code 285."""
+    first, second = text(rng, 6000), text(rng, 6000)
+    return first + b'\0' * 34000 + first + second + b'\1' * 48000 + second
+
+
+def make_deflate64():
+    """A Deflate64 stream with a stored block, a fixed Huffman block and
+    dynamic blocks. The encoder is in this file, as no tool at hand writes
+    Deflate64; zlib checks it as a Deflate encoder, which only differs by
+    its tables."""
+    rng = random.Random(39)
+    head = bytes(rng.randrange(256) for _ in range(2000)) + text(rng, 4000)
+    data = head + long_repeats(rng)
+    files = [('deflate64.bin', data), testdata('file2.txt')]
+    data += files[-1][1]
+    blocks = [('stored', 2000), ('fixed', len(head)), ('dynamic', len(head) + 46000), ('dynamic', len(data))]
+    assert zlib.decompress(deflate_encode(data, blocks, False), -15) == data
+    return [single(coder(K_DEFLATE64), deflate_encode(data, blocks), files)]
+
+
+def make_branch(name):
+    """Code of one architecture through its branch filter. ARM64 and RISC-V
+    have a second folder with a start offset in the props."""
+    method, option, align, branch = BRANCHES[name]
+
+    def make():
+        rng = random.Random(33)
+        folders = []
+        for start in (0, 1 << 16) if method in (K_ARM64, K_RISCV) else (0,):
+            files = [('%s%d.bin' % (name, start), branches(rng, 16 << 10, align, branch))]
+            folders.append(xz_filter(files, method, option, start))
+        folders[-1] = xz_filter(folders[-1]['files'] + [testdata('file1.txt')], method, option, start)
+        return folders
+    return make
+
+
+FIXTURES = {
+    'lzma.7z': make_lzma,
+    'lzma_props.7z': make_lzma_props,
+    'bcj.7z': make_bcj,
+    'delta.7z': make_delta,
+    'graph.7z': make_graph,
+    'bcj2.7z': make_bcj2,
+    'deflate.7z': make_deflate,
+    'deflate64.7z': make_deflate64,
+    'ppmd.7z': make_ppmd,
+    'corrupt.7z': make_corrupt,
+    'folder_crc.7z': make_folder_crc,
+    'file_crc.7z': make_file_crc,
+    'zstd.7z': make_zstd,
+}
+for name in BRANCHES:
+    FIXTURES[name + '.7z'] = make_branch(name)
+
+if __name__ == '__main__':
+    for name, make in FIXTURES.items():
+        save(name, make())
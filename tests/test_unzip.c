@@ -10,67 +10,289 @@
 extern const unsigned char pak_data[];
 extern const unsigned int  pak_data_length;
 
-static Byte kUtf8Limits[5] = { 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
+static size_t volume_size = 0;
 
-static Bool Utf16Le_To_Utf8(Byte *dest, size_t *destLen, const Byte *srcUtf16Le, size_t srcUtf16LeLen)
+/* Serves pak_data split into fixed-size volumes, opening them on demand. */
+static SRes OpenVolume(void *p, UInt32 index, CSzVolume *volume)
 {
-  size_t destPos = 0;
-  const Byte *srcUtf16LeEnd = srcUtf16Le + srcUtf16LeLen * 2;
-  for (;;)
-  {
-	unsigned numAdds;
-	UInt32 value;
-	if (srcUtf16Le == srcUtf16LeEnd)
-	{
-	  *destLen = destPos;
-	  return True;
-	}
-	value = GetUi16(srcUtf16Le);
-	srcUtf16Le += 2;
-	if (value < 0x80)
-	{
-	  if (dest)
-		dest[destPos] = (char)value;
-	  destPos++;
-	  continue;
-	}
-	if (value >= 0xD800 && value < 0xE000)
-	{
-	  UInt32 c2;
-	  if (value >= 0xDC00 || srcUtf16Le == srcUtf16LeEnd)
+	(void)p;
+	volume->data = pak_data + (size_t)index * volume_size;
+	return SZ_OK;
+}
+
+/* Prints a file by reading its folder in small chunks, to its end. */
+static SRes ExtractStream(const CSzArEx *db, CLookToRead *lookStream, UInt32 fileIndex)
+{
+	UInt32 folderIndex = db->FileIndexToFolderIndexMap[fileIndex];
+	CSzFolderStream *folderStream;
+	UInt64 skip = 0, size = db->db.Files[fileIndex].Size;
+	UInt32 i;
+	Byte buf[7];
+	SRes res;
+
+	if (folderIndex == (UInt32)-1) {
+		fputc('\n', stdout);
+		return SZ_OK;
+	}
+	for (i = db->FolderStartFileIndex[folderIndex]; i < fileIndex; i++) {
+		skip += db->db.Files[i].Size;
+	}
+	res = SzArEx_OpenFolderStream(db, lookStream, folderIndex, &folderStream);
+	while (res == SZ_OK && skip + size != 0) {
+		size_t n = sizeof(buf);
+		if (n > skip + size) {
+			n = (size_t)(skip + size);
+		}
+		if ((res = SzFolderStream_Read(folderStream, buf, &n)) == SZ_OK && n == 0) {
+			res = SZ_ERROR_DATA;
+		}
+		if (res == SZ_OK) {
+			size_t k = n < skip ? n : (size_t)skip;
+			fwrite(buf + k, 1, n - k, stdout);
+			if (skip > k) {
+				skip -= k;
+			} else {
+				size -= n - k;
+				skip = 0;
+			}
+		}
+	}
+	/* Reads on to the end of the folder, where its CRC is checked. */
+	while (res == SZ_OK) {
+		size_t n = sizeof(buf);
+		if ((res = SzFolderStream_Read(folderStream, buf, &n)) != SZ_OK || n == 0) {
+			break;
+		}
+	}
+	if (res == SZ_OK) {
+		fputc('\n', stdout);
+	}
+	SzFolderStream_Close(folderStream);
+	return res;
+}
+
+/* Prints a file through a file reader in small reads, after a read in its
+   middle, so that the folder is started again. */
+static SRes ExtractReader(const CSzArEx *db, CLookToRead *lookStream, UInt32 fileIndex)
+{
+	CSzFileReader *reader;
+	UInt64 offset = 0;
+	Byte buf[7];
+	size_t n = sizeof(buf);
+	SRes res = SzArEx_OpenFile(db, lookStream, fileIndex, (UInt32)-1, NULL, &reader);
+
+	if (res == SZ_OK) {
+		res = SzFileReader_Read(reader, SzFileReader_GetSize(reader) / 2, buf, &n);
+	}
+	while (res == SZ_OK) {
+		n = sizeof(buf);
+		if ((res = SzFileReader_Read(reader, offset, buf, &n)) != SZ_OK || n == 0) {
+			break;
+		}
+		fwrite(buf, 1, n, stdout);
+		offset += n;
+	}
+	if (res == SZ_OK) {
+		fputc('\n', stdout);
+	}
+	SzFileReader_Close(reader);
+	return res;
+}
+
+/* Cancels a folder decode at its second progress report. */
+typedef struct {
+	ICompressProgress vt;
+	unsigned calls;
+} CCancelProgress;
+
+static SRes CancelProgress(void *pp, UInt64 inSize, UInt64 outSize)
+{
+	CCancelProgress *p = (CCancelProgress *)pp;
+	(void)inSize;
+	(void)outSize;
+	/* Any error cancels: the decode returns SZ_ERROR_PROGRESS. */
+	return ++p->calls < 2 ? SZ_OK : SZ_ERROR_FAIL;
+}
+
+/* Extracts the last file with a progress callback which cancels the decode
+   of its folder partway. Only the calling thread reports progress, so with
+   BCJ2 that is the main input, which must be over two steps. */
+static SRes ExtractCancelled(CSzArEx *db, CLookToRead *lookStream)
+{
+	UInt32 fileIndex = db->db.NumFiles - 1;
+	UInt32 blockIndex = (UInt32)-1;
+	Byte *outBuffer = 0;
+	size_t outBufferSize = 0, offset, outSizeProcessed;
+	CCancelProgress progress;
+	SRes res;
+
+	progress.vt.Progress = CancelProgress;
+	progress.calls = 0;
+	db->Progress = &progress.vt;
+	db->ProgressStep = 4096;
+	res = SzArEx_Extract(db, lookStream, fileIndex, &blockIndex, &outBuffer, &outBufferSize,
+	    &offset, &outSizeProcessed);
+	db->Progress = NULL;
+	SzFree(outBuffer);
+	if (res == SZ_OK) {
+		return SZ_ERROR_FAIL;
+	}
+	return res == SZ_ERROR_PROGRESS && progress.calls == 2 ? SZ_OK : res;
+}
+
+/* Whether the counters of SzArEx_GetStats match the decodes of a folder:
+   decodes times, the last ones timed from timedFrom on. *peak is the
+   MemoryPeak of the decodes before, or 0: decoding the same folder again
+   must not change it. */
+static Bool CheckStats(const CSzArEx *db, UInt32 fileIndex, UInt32 decodes, UInt32 timedFrom, UInt64 *peak)
+{
+	UInt32 folderIndex = db->FileIndexToFolderIndexMap[fileIndex];
+	CSzFolder *folder = db->db.Folders + folderIndex;
+	const UInt64 *packSizes = db->db.PackSizes + db->FolderStartPackStreamIndex[folderIndex];
+	UInt64 unpackSize = SzFolder_GetUnpackSize(folder), packSize = 0, memory = unpackSize, limit;
+	UInt64 bytes = 0, time = 0, crcBytes = 0, models = 0, temps = 0;
+	CSzArExStats stats;
+	UInt32 i, j, inStart = 0;
+
+	SzArEx_GetStats(db, &stats);
+	for (i = 0; i < folder->NumPackStreams; i++) {
+		packSize += packSizes[i];
+	}
+	/* Besides the output, a PPMd model is there while its coder decodes,
+	   and the call, jump and range coder inputs of BCJ2 which are outputs
+	   of coders are there at once, after the main input. At most, the
+	   outputs of the other coders and the dictionaries, which are smaller,
+	   are there too. */
+	for (i = 0; i < folder->NumCoders; inStart += folder->Coders[i++].NumInStreams) {
+		if (folder->Coders[i].MethodID == 0x30401) {
+			models += GetUi32(folder->Coders[i].Props + 1);
+		}
+		if (folder->Coders[i].MethodID == 0x303011B) {
+			for (j = 0; j < folder->NumBindPairs; j++) {
+				UInt32 in = folder->BindPairs[j].InIndex;
+				if (in > inStart && in < inStart + 4) {
+					temps += folder->UnpackSizes[folder->BindPairs[j].OutIndex];
+				}
+			}
+		}
+	}
+	memory += models > temps ? models : temps;
+	limit = memory + models + temps;
+	for (i = 0; i < folder->NumCoders; i++) {
+		limit += folder->UnpackSizes[i] + 16;
+	}
+	for (i = 0; i < SZ_STATS_NUM_CODERS; i++) {
+		bytes += stats.Coders[i].Bytes;
+		time += stats.Coders[i].Time;
+	}
+	if (folder->UnpackCRCDefined) {
+		crcBytes += unpackSize;
+	}
+	if (db->db.Files[fileIndex].CrcDefined) {
+		crcBytes += db->db.Files[fileIndex].Size;
+	}
+	if (*peak != 0 && stats.MemoryPeak != *peak) {
+		return False;
+	}
+	*peak = stats.MemoryPeak;
+	return stats.FolderDecodes == decodes && stats.FolderRedecodes == decodes - 1 &&
+	    stats.InputBytes == packSize * decodes && bytes >= unpackSize * decodes &&
+	    stats.Crc.Bytes == crcBytes * decodes && stats.MemoryPeak >= memory && stats.MemoryPeak <= limit &&
+	    (decodes > timedFrom) == (time != 0);
+}
+
+/* Extracts a file, untimed then again timed, checking the counters of
+   SzArEx_GetStats after each, and prints it. */
+static SRes ExtractStats(CSzArEx *db, CLookToRead *lookStream, UInt32 fileIndex)
+{
+	UInt64 peak = 0;
+	int i;
+	for (i = 1; i <= 2; i++) {
+		UInt32 blockIndex = (UInt32)-1;
+		Byte *outBuffer = 0;
+		size_t outBufferSize = 0, offset, outSizeProcessed;
+		SRes res;
+
+		db->TimeStats = (i == 2);
+		res = SzArEx_Extract(db, lookStream, fileIndex, &blockIndex, &outBuffer, &outBufferSize,
+		    &offset, &outSizeProcessed);
+		if (res == SZ_OK && !CheckStats(db, fileIndex, (UInt32)i, 1, &peak)) {
+			res = SZ_ERROR_FAIL;
+		}
+		if (res == SZ_OK && i == 2) {
+			fwrite(outBuffer + offset, 1, outSizeProcessed, stdout);
+			fputc('\n', stdout);
+		}
+		SzFree(outBuffer);
+		if (res != SZ_OK) {
+			return res;
+		}
+	}
+	db->TimeStats = False;
+	return SZ_OK;
+}
+
+/* Checks the trace events of an open and extract as they come. It isn't
+   synchronized, so it's only set for archives decoded on one thread (no
+   BCJ2 inputs worth a thread of their own). */
+typedef struct {
+	unsigned seeks, headers, coders, coderEnds;
+	long blocks;  /* allocated and not yet freed */
+	ESzTraceHeaderPhase phase;
+	Bool bad;
+} CTraceCheck;
+
+static void TraceCheck(void *ctx, const CSzTraceEvent *e)
+{
+	CTraceCheck *p = (CTraceCheck *)ctx;
+	switch (e->type) {
+	case SZ_TRACE_SEEK:
+		p->seeks++;
 		break;
-	  c2 = GetUi16(srcUtf16Le);
-	  srcUtf16Le += 2;
-	  if (c2 < 0xDC00 || c2 >= 0xE000)
+	case SZ_TRACE_HEADER:
+		/* The phases come in order, starting with the signature. */
+		if (p->headers++ == 0 ? e->phase != SZ_TRACE_HEADER_SIGNATURE : e->phase <= p->phase) {
+			p->bad = True;
+		}
+		p->phase = e->phase;
 		break;
-	  value = (((value - 0xD800) << 10) | (c2 - 0xDC00)) + 0x10000;
-	}
-	for (numAdds = 1; numAdds < 5; numAdds++)
-	  if (value < (((UInt32)1) << (numAdds * 5 + 6)))
+	case SZ_TRACE_CODER_START:
+		p->coders++;
+		break;
+	case SZ_TRACE_CODER_END:
+		if (++p->coderEnds > p->coders || e->res != SZ_OK) {
+			p->bad = True;
+		}
+		break;
+	case SZ_TRACE_ALLOC:
+		if (e->ptr) {
+			p->blocks++;
+		}
 		break;
-	if (dest)
-	  dest[destPos] = (char)(kUtf8Limits[numAdds - 1] + (value >> (6 * numAdds)));
-	destPos++;
-	do
-	{
-	  numAdds--;
-	  if (dest)
-		dest[destPos] = (char)(0x80 + ((value >> (6 * numAdds)) & 0x3F));
-	  destPos++;
-	}
-	while (numAdds != 0);
-  }
-  *destLen = destPos;
-  return False;
+	case SZ_TRACE_FREE:
+		p->blocks--;
+		break;
+	}
+}
+
+/* Whether the trace saw a whole open and a decode, and every block freed. */
+static Bool TraceCheck_Done(const CTraceCheck *p)
+{
+	return !p->bad && p->seeks != 0 && p->headers >= 3 && p->phase == SZ_TRACE_HEADER_PARSE &&
+	    p->coders != 0 && p->coderEnds == p->coders && p->blocks == 0;
 }
 
 int main(int argc, const char **argv)
 {
 	CSzArEx db;
 	CLookToRead lookStream;
+	CSzVolume volumes[64];
+	ISzVolumeOpen volumeOpen = { OpenVolume };
 	SRes res;
 	Byte *filename_utf8 = NULL;
 	size_t filename_utf8_capacity = 0;
+	CTraceCheck trace;
+	int stream, test, reader, progress, stats;
 
 	if (argc < 2) {
 		return 1;
@@ -80,7 +302,40 @@ int main(int argc, const char **argv)
 	lookStream.data = pak_data;
 	lookStream.data_len = pak_data_length;
 
+	/* A volume size of 0 reads the archive from one buffer. */
+	if (argc > 2 && atoi(argv[2]) != 0) {
+		UInt32 numVolumes = 0;
+		size_t pos;
+		volume_size = (size_t)atoi(argv[2]);
+		if (pak_data_length / volume_size >= sizeof(volumes) / sizeof(volumes[0])) {
+			return 1;
+		}
+		for (pos = 0; pos < pak_data_length; pos += volume_size, numVolumes++) {
+			volumes[numVolumes].data = NULL;
+			volumes[numVolumes].size = pak_data_length - pos < volume_size ? pak_data_length - pos : volume_size;
+		}
+		LookToRead_SetVolumes(&lookStream, volumes, numVolumes, &volumeOpen);
+	}
+	if (argc > 3 && atoi(argv[3]) != 0 && LookToRead_StartReadAhead(&lookStream, (UInt32)atoi(argv[3]), 64) != SZ_OK) {
+		return 1;
+	}
+	stream = argc > 4 && !strcmp(argv[4], "stream");
+	test = argc > 4 && !strcmp(argv[4], "test");
+	reader = argc > 4 && !strcmp(argv[4], "reader");
+	progress = argc > 4 && !strcmp(argv[4], "progress");
+	stats = argc > 4 && !strcmp(argv[4], "stats");
+	memset(&trace, 0, sizeof(trace));
+	if (argc > 4 && !strcmp(argv[4], "trace")) {
+		SzTrace_Set(TraceCheck, &trace);
+	}
+
 	res = SzArEx_Open(&db, &lookStream);
+	if (res == SZ_OK && test) {
+		res = SzArEx_Test(&db, &lookStream, 4, NULL);
+	}
+	if (res == SZ_OK && progress) {
+		res = ExtractCancelled(&db, &lookStream);
+	}
 
 	if (res == SZ_OK) {
 		UInt32 fileIndex;
@@ -95,16 +350,14 @@ int main(int argc, const char **argv)
 			size_t offset = 0;
 			size_t outSizeProcessed = 0;
 			const CSzFileItem *f = db.db.Files + fileIndex;
-			const size_t filename_offset = db.FileNameOffsets[fileIndex];
-			/* The length includes the trailing 0. */
-			const size_t filename_utf16le_len =  db.FileNameOffsets[fileIndex + 1] - filename_offset;
-			const Byte *filename_utf16le = db.FileNamesInHeaderBufPtr + filename_offset * 2;
-			/* 2 for UTF-18 + 3 for UTF-8. 1 UTF-16 entry point can create at most 3 UTF-8 bytes (averaging for surrogates). */
-			size_t filename_utf8_len = filename_utf16le_len * 3;
+			/* The length includes the trailing 0. 1 UTF-16 entry point can create at most 3 UTF-8 bytes (averaging for surrogates). */
+			const size_t filename_utf8_len = (db.FileNameOffsets[fileIndex + 1] - db.FileNameOffsets[fileIndex]) * 3;
 			SRes extract_res = SZ_OK;
 
 			if (f->IsDir) {
 				continue;
+			} else if (stream || reader || stats) {
+				/* Decoded below through a folder stream, a file reader or SzArEx_Extract, if it's the file. */
 			} else {
 				if (blockIndex != db.FileIndexToFolderIndexMap[fileIndex]) {
 				  SzFree(filename_utf8);
@@ -115,6 +368,7 @@ int main(int argc, const char **argv)
 				&blockIndex, &outBuffer, &outBufferSize,
 				&offset, &outSizeProcessed);
 				if (extract_res) {
+					res = extract_res;
 					break;
 				}
 			}
@@ -131,12 +385,21 @@ int main(int argc, const char **argv)
 				}
 			}
 
-			if (!Utf16Le_To_Utf8(filename_utf8, &filename_utf8_len, filename_utf16le, filename_utf16le_len)) {
-				res = SZ_ERROR_BAD_FILENAME;
-				break;
-			}
+			SzArEx_GetFileNameUtf8(&db, fileIndex, (char *)filename_utf8);
 			
 			if (!strcmp((char*)filename_utf8, argv[1])) {
+				if (stream) {
+					res = ExtractStream(&db, &lookStream, fileIndex);
+					break;
+				}
+				if (reader) {
+					res = ExtractReader(&db, &lookStream, fileIndex);
+					break;
+				}
+				if (stats) {
+					res = ExtractStats(&db, &lookStream, fileIndex);
+					break;
+				}
 				fwrite(outBuffer + offset, 1, outSizeProcessed, stdout);
 				fputc('\n', stdout);
 				break;
@@ -145,8 +408,15 @@ int main(int argc, const char **argv)
 		SzFree(outBuffer);
 	}
 
+	LookToRead_Free(&lookStream);
 	SzArEx_Free(&db);
 	SzFree(filename_utf8);
+	if (argc > 4 && !strcmp(argv[4], "trace")) {
+		SzTrace_Set(NULL, NULL);
+		if (res == SZ_OK && !TraceCheck_Done(&trace)) {
+			res = SZ_ERROR_FAIL;
+		}
+	}
 
 	if (res == SZ_OK) {
 		return 0;
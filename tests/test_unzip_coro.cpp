@@ -0,0 +1,142 @@
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "un7z.hpp"
+
+extern "C" const unsigned char pak_data[];
+extern "C" const unsigned int pak_data_length;
+
+static const std::size_t kVolumeSize = 1024;
+static bool failOpen = false;
+
+/* Serves pak_data split into volumes, or fails once failOpen is set. */
+static SRes OpenVolume(void *p, UInt32 index, CSzVolume *volume)
+{
+	(void)p;
+	if (failOpen) {
+		return SZ_ERROR_READ;
+	}
+	volume->data = pak_data + (std::size_t)index * kVolumeSize;
+	return SZ_OK;
+}
+
+/* A coroutine which runs at once and is freed when it ends. */
+struct Task {
+	struct promise_type {
+		Task get_return_object() noexcept { return Task(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
+
+struct Result {
+	std::promise<un7z::Data> data;
+	std::thread::id thread; /* where the coroutine went on after co_await */
+};
+
+/* Extracts a file times times in a row. */
+template <class Executor>
+static Task Extract(un7z::Archive &archive, UInt32 fileIndex, Executor executor, Result &result, int times = 1)
+{
+	try {
+		un7z::Data data;
+		for (int i = 0; i < times; i++) {
+			data = co_await archive.extractAsync(fileIndex, executor);
+		}
+		result.thread = std::this_thread::get_id();
+		result.data.set_value(std::move(data));
+	} catch (...) {
+		result.thread = std::this_thread::get_id();
+		result.data.set_exception(std::current_exception());
+	}
+}
+
+static bool Equal(const un7z::Data &a, const un7z::Data &b)
+{
+	return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+/* Prints a file like test_unzip_cpp, extracted by co_await: on a thread,
+   where the coroutine is resumed, then by an executor which runs the task
+   inline, and from volumes which can't be opened, where the coroutine
+   must go on without suspending, on this thread. The threads wait for go,
+   so that the coroutine is suspended before the task ends. The inline
+   extracts are many, which would run out of stack if each one resumed
+   the coroutine from within the last. */
+int main(int argc, const char **argv)
+{
+	std::promise<void> go;
+	std::shared_future<void> started = go.get_future().share();
+	std::vector<std::thread> workers;
+	auto onThread = [&workers, started](auto task) {
+		workers.emplace_back([started, task = std::move(task)]() mutable {
+			started.wait();
+			task();
+		});
+	};
+	auto inlined = [](auto task) { task(); };
+	un7z::Data data;
+
+	if (argc < 2) {
+		return 1;
+	}
+	try {
+		un7z::Archive archive(pak_data, pak_data_length);
+		std::optional<un7z::Entry> found = archive.find(argv[1]);
+		Result async, sync;
+
+		if (!found) {
+			return 3;
+		}
+		Extract(archive, found->index(), onThread, async);
+		go.set_value();
+		data = async.data.get_future().get();
+		for (std::thread &worker : workers) {
+			worker.join();
+		}
+		if (async.thread == std::this_thread::get_id()) {
+			return 4;
+		}
+		Extract(archive, found->index(), inlined, sync, 100000);
+		if (!Equal(sync.data.get_future().get(), data) || sync.thread != std::this_thread::get_id()) {
+			return 4;
+		}
+	} catch (const un7z::Error &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+
+	std::vector<CSzVolume> volumes;
+	for (std::size_t pos = 0; pos < pak_data_length; pos += kVolumeSize) {
+		volumes.push_back(CSzVolume{ NULL, pak_data_length - pos < kVolumeSize ? pak_data_length - pos : kVolumeSize });
+	}
+	ISzVolumeOpen volumeOpen = { OpenVolume };
+	un7z::Archive archive(volumes.data(), (UInt32)volumes.size(), &volumeOpen);
+	Result failed;
+	bool thrown = false;
+	failOpen = true;
+	Extract(archive, archive.find(argv[1])->index(), onThread, failed);
+	try {
+		failed.data.get_future().get();
+	} catch (const un7z::Error &) {
+		thrown = true;
+	}
+	for (std::thread &worker : workers) {
+		if (worker.joinable()) {
+			worker.join();
+		}
+	}
+	if (!thrown || failed.thread != std::this_thread::get_id() || workers.size() != 1) {
+		return 5;
+	}
+
+	fwrite(data.data(), 1, data.size(), stdout);
+	fputc('\n', stdout);
+	return 0;
+}
@@ -0,0 +1,102 @@
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "un7z.hpp"
+
+extern "C" const unsigned char pak_data[];
+extern "C" const unsigned int pak_data_length;
+
+/* Extracts a file on a thread of its own with extractAsync. */
+static un7z::Data ExtractOnThread(un7z::Archive &archive, const un7z::Entry &entry)
+{
+	std::thread worker;
+	std::exception_ptr error;
+	un7z::Data data;
+	archive.extractAsync(entry, [&worker](auto task) {
+		worker = std::thread(std::move(task));
+	}, [&error, &data](std::exception_ptr e, un7z::Data d) {
+		error = e;
+		data = std::move(d);
+	});
+	worker.join();
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	return data;
+}
+
+static bool Equal(const un7z::Data &a, const un7z::Data &b)
+{
+	return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+/* Reads a file with a FileReader, taken by move: its second half, then
+   all of it in 5 byte steps from its start, which must match data. */
+static bool ReadsMatch(un7z::FileReader reader, const un7z::Data &data)
+{
+	std::vector<Byte> buf(data.size() + 1);
+	std::size_t half = data.size() / 2, n;
+
+	if (reader.size() != data.size() || reader.read(half, &buf[half], buf.size()) != data.size() - half) {
+		return false;
+	}
+	for (std::size_t pos = 0; pos < data.size(); pos += n) {
+		if ((n = reader.read(pos, &buf[pos], 5)) == 0) {
+			return false;
+		}
+	}
+	return reader.read(data.size(), buf.data(), 1) == 0 && memcmp(buf.data(), data.data(), data.size()) == 0;
+}
+
+/* Prints a file like test_unzip, through the C++ interface. The data is
+   written after the archive is gone, it holds its decoded folder. It is
+   also extracted on a thread by extractAsync, which must match: before
+   extract, which decodes from a clone of the stream, and after it, which
+   takes the folder extract has cached. openFile reads it the same way,
+   from the folder stream and then from the cached folder. */
+int main(int argc, const char **argv)
+{
+	un7z::Data data, fresh, cached;
+
+	if (argc < 2) {
+		return 1;
+	}
+	try {
+		un7z::Archive archive(pak_data, pak_data_length);
+		un7z::Archive moved = std::move(archive);
+		std::optional<un7z::Entry> found = moved.find(argv[1]);
+
+		moved.test(2);
+		if (!found) {
+			return 3;
+		}
+		fresh = ExtractOnThread(moved, *found);
+		if (!ReadsMatch(moved.openFile(*found), fresh)) {
+			return 5;
+		}
+		for (const un7z::Entry &entry : moved.entries()) {
+			if (!entry.isDir() && entry.name() == argv[1]) {
+				if (found->index() != entry.index()) {
+					return 3;
+				}
+				data = moved.extract(entry);
+				break;
+			}
+		}
+		cached = ExtractOnThread(moved, *found);
+		if (!ReadsMatch(moved.openFile(found->index()), data)) {
+			return 5;
+		}
+		if (!Equal(fresh, data) || !Equal(cached, data)) {
+			return 4;
+		}
+	} catch (const un7z::Error &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+	fwrite(data.data(), 1, data.size(), stdout);
+	fputc('\n', stdout);
+	return 0;
+}
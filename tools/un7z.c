@@ -0,0 +1,1021 @@
+/* un7z: lists, tests, extracts and benchmarks 7z archives.
+
+   un7z l archive.7z                  lists the files and folders
+   un7z t [-j threads] archive.7z     tests the CRCs, folders in parallel
+   un7z x [-o dir] [-y] archive.7z    extracts to dir (. by default)
+   un7z b [-n runs] archive.7z        times the decoding of every folder
+   un7z a [-w access.log] [-c sizes] archive.7z
+                                      prints the cost of reaching every file,
+                                      and of a list of accesses with caches of
+                                      decoded folders of sizes (0,16M,...)
+
+   archive.7z.001 reads archive.7z.001, archive.7z.002, ... as one archive.
+   The archive is read to memory first. */
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "un7z.h"
+
+#define MAX_VOLUMES 999
+
+static double Now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER f, c;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&c);
+	return (double)c.QuadPart / (double)f.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static const char *ResText(SRes res)
+{
+	switch (res) {
+	case SZ_OK: return "OK";
+	case SZ_ERROR_DATA: return "data error";
+	case SZ_ERROR_MEM: return "can not allocate memory";
+	case SZ_ERROR_CRC: return "CRC error";
+	case SZ_ERROR_UNSUPPORTED: return "decoder doesn't support this archive";
+	case SZ_ERROR_INPUT_EOF: return "unexpected end of archive";
+	case SZ_ERROR_READ: return "can not read archive";
+	case SZ_ERROR_ARCHIVE: return "archive header error";
+	case SZ_ERROR_NO_ARCHIVE: return "input file is not a .7z archive";
+	case SZ_ERROR_OVERWRITE: return "already exists, specify -y to overwrite";
+	case SZ_ERROR_WRITE_OPEN: return "can not open output file";
+	case SZ_ERROR_WRITE_CHMOD: return "can not chmod output file";
+	case SZ_ERROR_WRITE: return "can not write output file";
+	case SZ_ERROR_BAD_FILENAME: return "bad filename (UTF-16 encoding)";
+	case SZ_ERROR_UNSAFE_FILENAME: return "unsafe filename";
+	case SZ_ERROR_WRITE_MKDIR: return "can not create output dir";
+	case SZ_ERROR_WRITE_SYMLINK: return "can not create symlink";
+	}
+	return "error";
+}
+
+static unsigned NumCpus(void)
+{
+#if defined(UN7Z_CLI_ST)
+	return 1;
+#elif defined(_WIN32)
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (unsigned)si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1;
+#endif
+}
+
+/* ---------- Archive ---------- */
+
+typedef struct {
+	Byte *data;  /* of a single file */
+	size_t size;
+	CSzVolume volumes[MAX_VOLUMES];
+	UInt32 numVolumes;  /* 0 for a single file */
+	CSzArEx db;
+} Archive;
+
+static Byte *ReadWholeFile(const char *path, size_t *size)
+{
+	FILE *f = fopen(path, "rb");
+	Byte *data = NULL;
+	size_t capacity = 0, n;
+	if (f == NULL) {
+		return NULL;
+	}
+	*size = 0;
+	do {
+		if (*size == capacity) {
+			Byte *p;
+			capacity = capacity ? capacity * 2 : 1 << 20;
+			if ((p = (Byte *)realloc(data, capacity)) == NULL) {
+				free(data);
+				fclose(f);
+				return NULL;
+			}
+			data = p;
+		}
+		n = fread(data + *size, 1, capacity - *size, f);
+		*size += n;
+	} while (n != 0);
+	fclose(f);
+	return data;
+}
+
+/* Sets up a position in the archive: every thread has its own. */
+static void Archive_InitStream(Archive *a, CLookToRead *s)
+{
+	LOOKTOREAD_INIT(s);
+	if (a->numVolumes != 0) {
+		LookToRead_SetVolumes(s, a->volumes, a->numVolumes, NULL);
+	} else {
+		s->data = a->data;
+		s->data_len = a->size;
+	}
+}
+
+static void Archive_Close(Archive *a)
+{
+	UInt32 i;
+	SzArEx_Free(&a->db);
+	for (i = 0; i < a->numVolumes; i++) {
+		free((void *)a->volumes[i].data);
+	}
+	free(a->data);
+}
+
+static SRes Archive_Open(Archive *a, const char *path)
+{
+	size_t len = strlen(path);
+	CLookToRead s;
+	SRes res;
+
+	memset(a, 0, sizeof(*a));
+	if (len > 4 && !strcmp(path + len - 4, ".001")) {
+		char *name = (char *)malloc(len + 1);
+		if (name == NULL) {
+			return SZ_ERROR_MEM;
+		}
+		memcpy(name, path, len + 1);
+		for (; a->numVolumes < MAX_VOLUMES; a->numVolumes++) {
+			CSzVolume *v = &a->volumes[a->numVolumes];
+			sprintf(name + len - 3, "%03u", (unsigned)a->numVolumes + 1);
+			if ((v->data = ReadWholeFile(name, &v->size)) == NULL) {
+				break;
+			}
+		}
+		free(name);
+		if (a->numVolumes == 0) {
+			return SZ_ERROR_READ;
+		}
+	} else if ((a->data = ReadWholeFile(path, &a->size)) == NULL) {
+		return SZ_ERROR_READ;
+	}
+
+	Archive_InitStream(a, &s);
+	res = SzArEx_Open(&a->db, &s);
+	LookToRead_Free(&s);
+	return res;
+}
+
+static UInt64 Archive_GetSize(const Archive *a)
+{
+	UInt64 size = a->size;
+	UInt32 i;
+	for (i = 0; i < a->numVolumes; i++) {
+		size += a->volumes[i].size;
+	}
+	return size;
+}
+
+/* Returns the name of a file in UTF-8, in a buffer that the caller frees. */
+static char *GetName(const CSzArEx *db, UInt32 fileIndex)
+{
+	size_t len = db->FileNameOffsets[fileIndex + 1] - db->FileNameOffsets[fileIndex];
+	char *name = (char *)malloc(len * 3 + 1);
+	if (name != NULL) {
+		SzArEx_GetFileNameUtf8(db, fileIndex, name);
+	}
+	return name;
+}
+
+static UInt64 FolderPackSize(const CSzArEx *db, UInt32 folderIndex)
+{
+	const UInt64 *packSizes = db->db.PackSizes + db->FolderStartPackStreamIndex[folderIndex];
+	UInt64 size = 0;
+	UInt32 i;
+	for (i = 0; i < db->db.Folders[folderIndex].NumPackStreams; i++) {
+		size += packSizes[i];
+	}
+	return size;
+}
+
+static void FormatSize(char *s, UInt64 size)
+{
+	static const char kUnits[] = "BKMGT";
+	unsigned u = 0;
+	while (u < 4 && size >= 1024 && size % 1024 == 0) {
+		size >>= 10;
+		u++;
+	}
+	sprintf(s, "%llu%c", (unsigned long long)size, kUnits[u]);
+}
+
+/* Writes the methods of a folder, like "LZMA2:16M BCJ". */
+static void FormatMethods(char *s, const CSzFolder *f)
+{
+	UInt32 i;
+	*s = 0;
+	for (i = 0; i < f->NumCoders; i++) {
+		const CSzCoderInfo *c = &f->Coders[i];
+		char *d = s + strlen(s);
+		if (i != 0) {
+			*d++ = ' ';
+		}
+		switch (c->MethodID) {
+		case 0: strcpy(d, "Copy"); break;
+		case 3: strcpy(d, "Delta"); break;
+		case 0x21:
+			strcpy(d, "LZMA2");
+			if (c->PropsSize == 1 && c->Props[0] < 40) {
+				UInt32 bits = c->Props[0];
+				strcat(d, ":");
+				FormatSize(d + strlen(d), (UInt64)(2 | (bits & 1)) << (bits / 2 + 11));
+			}
+			break;
+		case 0x30101:
+			strcpy(d, "LZMA");
+			if (c->PropsSize == 5) {
+				strcat(d, ":");
+				FormatSize(d + strlen(d), GetUi32(c->Props + 1));
+			}
+			break;
+		case 0x30401:
+			strcpy(d, "PPMd");
+			if (c->PropsSize == 5) {
+				sprintf(d + 4, ":o%u:", (unsigned)c->Props[0]);
+				FormatSize(d + strlen(d), GetUi32(c->Props + 1));
+			}
+			break;
+		case 0x40108: strcpy(d, "Deflate"); break;
+		case 0x40109: strcpy(d, "Deflate64"); break;
+		case 0x4F71101: strcpy(d, "Zstd"); break;
+		case 0x03030103: strcpy(d, "BCJ"); break;
+		case 0x0303011B: strcpy(d, "BCJ2"); break;
+		case 0x03030205: strcpy(d, "PPC"); break;
+		case 0x03030401: strcpy(d, "IA64"); break;
+		case 0x03030501: strcpy(d, "ARM"); break;
+		case 0x03030701: strcpy(d, "ARMT"); break;
+		case 0x03030805: strcpy(d, "SPARC"); break;
+		case 0xA: strcpy(d, "ARM64"); break;
+		case 0xB: strcpy(d, "RISCV"); break;
+		default: sprintf(d, "%llX", (unsigned long long)c->MethodID); break;
+		}
+	}
+}
+
+/* ---------- l ---------- */
+
+static int List(Archive *a)
+{
+	const CSzArEx *db = &a->db;
+	UInt64 unpacked = 0, packed = 0;
+	UInt32 i, numFiles = 0;
+	char methods[256];
+
+	printf("        Size  Folder  Name\n");
+	for (i = 0; i < db->db.NumFiles; i++) {
+		const CSzFileItem *f = db->db.Files + i;
+		UInt32 folderIndex = db->FileIndexToFolderIndexMap[i];
+		char *name = GetName(db, i);
+		if (f->IsDir) {
+			printf("%12s  %6s  %s\n", "<DIR>", "", name ? name : "?");
+		} else {
+			char folder[16] = "-";
+			if (folderIndex != (UInt32)-1) {
+				sprintf(folder, "%u", (unsigned)folderIndex);
+			}
+			printf("%12llu  %6s  %s\n", (unsigned long long)f->Size, folder, name ? name : "?");
+			numFiles++;
+		}
+		free(name);
+	}
+
+	printf("\nFolder   Files      Unpacked        Packed   Ratio  Methods\n");
+	for (i = 0; i < db->db.NumFolders; i++) {
+		CSzFolder *f = db->db.Folders + i;
+		UInt64 u = SzFolder_GetUnpackSize(f), p = FolderPackSize(db, i);
+		FormatMethods(methods, f);
+		printf("%6u  %6u  %12llu  %12llu  %5.1f%%  %s\n", (unsigned)i, (unsigned)f->NumUnpackStreams,
+			(unsigned long long)u, (unsigned long long)p, u ? 100.0 * (double)p / (double)u : 0.0, methods);
+		unpacked += u;
+		packed += p;
+	}
+
+	printf("\n%u files, %u folders, %llu bytes, %llu packed (%.1f%%), archive %llu bytes\n",
+		(unsigned)numFiles, (unsigned)db->db.NumFolders, (unsigned long long)unpacked,
+		(unsigned long long)packed, unpacked ? 100.0 * (double)packed / (double)unpacked : 0.0,
+		(unsigned long long)Archive_GetSize(a));
+	return 0;
+}
+
+/* ---------- t ---------- */
+
+static int Test(Archive *a, unsigned numThreads)
+{
+	CLookToRead s;
+	UInt32 i, numFiles = 0, errorFileIndex;
+	UInt64 bytes = 0;
+	double start = Now(), t;
+	SRes res;
+
+	Archive_InitStream(a, &s);
+	res = SzArEx_Test(&a->db, &s, numThreads, &errorFileIndex);
+	LookToRead_Free(&s);
+	t = Now() - start;
+
+	if (res != SZ_OK) {
+		char *name = errorFileIndex != (UInt32)-1 ? GetName(&a->db, errorFileIndex) : NULL;
+		fprintf(stderr, "%s: %s\n", name ? name : "archive", ResText(res));
+		free(name);
+		return 2;
+	}
+	for (i = 0; i < a->db.db.NumFiles; i++) {
+		numFiles += !a->db.db.Files[i].IsDir;
+		bytes += a->db.db.Files[i].Size;
+	}
+#ifdef UN7Z_CLI_ST
+	numThreads = 1;
+#endif
+	if (numThreads > a->db.db.NumFolders) {
+		numThreads = a->db.db.NumFolders ? a->db.db.NumFolders : 1;
+	}
+	printf("%u files, %u folders, %llu bytes in %.3f s (%.1f MB/s) on %u threads\n",
+		(unsigned)numFiles, (unsigned)a->db.db.NumFolders, (unsigned long long)bytes,
+		t, t > 0 ? (double)bytes / t / 1e6 : 0.0, numThreads);
+	printf("Everything is Ok\n");
+	return 0;
+}
+
+/* ---------- x ---------- */
+
+/* Rejects names which would be written outside of the output dir. Turns
+   backslashes into slashes. */
+static int IsNameSafe(char *name)
+{
+	char *p, *part = name;
+	if (name[0] == 0 || name[0] == '/' || name[0] == '\\' || (name[0] != 0 && name[1] == ':')) {
+		return 0;
+	}
+	for (p = name; ; p++) {
+		if (*p == '\\') {
+			*p = '/';
+		}
+		if (*p == '/' || *p == 0) {
+			if (p - part == 2 && part[0] == '.' && part[1] == '.') {
+				return 0;
+			}
+			if (*p == 0) {
+				return 1;
+			}
+			part = p + 1;
+		}
+	}
+}
+
+static int MakeDir(const char *path)
+{
+#ifdef _WIN32
+	return _mkdir(path) == 0 || errno == EEXIST;
+#else
+	return mkdir(path, 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+/* Creates the parent dirs of path, and path itself if isDir. */
+static SRes MakeDirs(char *path, int isDir)
+{
+	char *p;
+	for (p = path + 1; *p; p++) {
+		if (*p == '/') {
+			*p = 0;
+			if (!MakeDir(path)) {
+				*p = '/';
+				return SZ_ERROR_WRITE_MKDIR;
+			}
+			*p = '/';
+		}
+	}
+	return (!isDir || MakeDir(path)) ? SZ_OK : SZ_ERROR_WRITE_MKDIR;
+}
+
+#ifndef _WIN32
+/* The Unix mode of a file, or 0 if the archive doesn't have it. */
+static unsigned GetUnixMode(const CSzFileItem *f)
+{
+	if (f->Attrib != (UInt32)-1 && (f->Attrib & FILE_ATTRIBUTE_UNIX_EXTENSION)) {
+		return f->Attrib >> 16;
+	}
+	return 0;
+}
+
+static void SetTimeAndMode(const char *path, const CSzFileItem *f)
+{
+	unsigned mode = GetUnixMode(f);
+	if (f->MTimeDefined) {
+		UInt64 t = ((UInt64)f->MTime.High << 32) | f->MTime.Low;
+		struct utimbuf times;
+		times.actime = times.modtime = (time_t)((Int64)(t / 10000000) - 11644473600);
+		utime(path, &times);
+	}
+	if (mode != 0) {
+		chmod(path, mode & 0777);
+	}
+}
+#endif
+
+typedef struct {
+	char *path;
+	char *target;
+} Symlink;
+
+typedef struct {
+	char *path;
+	UInt32 fileIndex;
+} Dir;
+
+/* Sorts a dir after the ones in it. */
+static int CompareDirs(const void *a, const void *b)
+{
+	return strcmp(((const Dir *)b)->path, ((const Dir *)a)->path);
+}
+
+static int Extract(Archive *a, const char *outDir, int overwrite)
+{
+	const CSzArEx *db = &a->db;
+	CLookToRead s;
+	UInt32 i, blockIndex = (UInt32)-1;
+	Byte *outBuffer = NULL;
+	size_t outBufferSize = 0;
+	Symlink *links = NULL;
+	Dir *dirs = NULL;
+	UInt32 numLinks = 0, numDirs = 0, numErrors = 0;
+	SRes res = SZ_OK;
+
+	Archive_InitStream(a, &s);
+	for (i = 0; i < db->db.NumFiles && res != SZ_ERROR_MEM; i++) {
+		const CSzFileItem *f = db->db.Files + i;
+		char *name = GetName(db, i), *path = NULL;
+		size_t offset = 0, size = 0;
+		FILE *out;
+
+		res = SZ_OK;
+		if (name == NULL || (path = (char *)malloc(strlen(outDir) + strlen(name) + 2)) == NULL) {
+			res = SZ_ERROR_MEM;
+		} else if (!IsNameSafe(name)) {
+			res = SZ_ERROR_UNSAFE_FILENAME;
+		} else {
+			sprintf(path, "%s/%s", outDir, name);
+			res = MakeDirs(path, f->IsDir);
+		}
+		if (res == SZ_OK && !f->IsDir) {
+			if (db->FileIndexToFolderIndexMap[i] != (UInt32)-1) {
+				res = SzArEx_Extract(db, &s, i, &blockIndex, &outBuffer, &outBufferSize, &offset, &size);
+				if (res != SZ_OK) {
+					/* outBuffer may hold part of the folder, which the
+					   next file of it must not be taken from. */
+					blockIndex = (UInt32)-1;
+				}
+			}
+#ifndef _WIN32
+			if (res == SZ_OK && (GetUnixMode(f) & 0170000) == 0120000) {
+				/* Symlinks are made last, so that no file is written
+				   through one. */
+				Symlink *l = (Symlink *)realloc(links, (numLinks + 1) * sizeof(Symlink));
+				if (l == NULL || (l[numLinks].target = (char *)malloc(size + 1)) == NULL) {
+					res = SZ_ERROR_MEM;
+				} else {
+					links = l;
+					memcpy(links[numLinks].target, outBuffer + offset, size);
+					links[numLinks].target[size] = 0;
+					links[numLinks++].path = path;
+					path = NULL;
+				}
+				if (res != SZ_OK) {
+					fprintf(stderr, "%s: %s\n", name, ResText(res));
+					numErrors++;
+				}
+				free(name);
+				free(path);
+				continue;
+			}
+#endif
+			if (res == SZ_OK && !overwrite && (out = fopen(path, "rb")) != NULL) {
+				fclose(out);
+				res = SZ_ERROR_OVERWRITE;
+			}
+			if (res == SZ_OK) {
+				if ((out = fopen(path, "wb")) == NULL) {
+					res = SZ_ERROR_WRITE_OPEN;
+				} else {
+					if (fwrite(outBuffer + offset, 1, size, out) != size) {
+						res = SZ_ERROR_WRITE;
+					}
+					if (fclose(out) != 0) {
+						res = SZ_ERROR_WRITE;
+					}
+				}
+			}
+		}
+#ifndef _WIN32
+		if (res == SZ_OK && f->IsDir) {
+			/* Dirs get their time and mode once nothing more is written
+			   in them, which would change the time or be denied. */
+			Dir *d = (Dir *)realloc(dirs, (numDirs + 1) * sizeof(Dir));
+			if (d == NULL) {
+				res = SZ_ERROR_MEM;
+			} else {
+				dirs = d;
+				dirs[numDirs].path = path;
+				dirs[numDirs++].fileIndex = i;
+				path = NULL;
+			}
+		} else if (res == SZ_OK) {
+			SetTimeAndMode(path, f);
+		}
+#endif
+		if (res != SZ_OK) {
+			fprintf(stderr, "%s: %s\n", name ? name : "?", ResText(res));
+			numErrors++;
+		}
+		free(name);
+		free(path);
+	}
+	SzFree(outBuffer);
+	LookToRead_Free(&s);
+
+	for (i = 0; i < numLinks; i++) {
+#ifndef _WIN32
+		if (symlink(links[i].target, links[i].path) != 0) {
+			fprintf(stderr, "%s: %s\n", links[i].path, ResText(SZ_ERROR_WRITE_SYMLINK));
+			numErrors++;
+		}
+#endif
+		free(links[i].path);
+		free(links[i].target);
+	}
+	free(links);
+
+	if (numDirs != 0) {
+		qsort(dirs, numDirs, sizeof(Dir), CompareDirs);
+	}
+	for (i = 0; i < numDirs; i++) {
+#ifndef _WIN32
+		SetTimeAndMode(dirs[i].path, db->db.Files + dirs[i].fileIndex);
+#endif
+		free(dirs[i].path);
+	}
+	free(dirs);
+
+	if (numErrors != 0) {
+		printf("%u errors\n", (unsigned)numErrors);
+		return 2;
+	}
+	printf("Everything is Ok\n");
+	return 0;
+}
+
+/* ---------- b ---------- */
+
+typedef struct {
+	UInt32 folderIndex;
+	double time;
+} FolderTime;
+
+static int CompareFolderTime(const void *a, const void *b)
+{
+	double x = ((const FolderTime *)a)->time, y = ((const FolderTime *)b)->time;
+	return x > y ? -1 : x < y;
+}
+
+static const char *const kCoderNames[SZ_STATS_NUM_CODERS] = {
+	"Copy", "LZMA", "LZMA2", "Deflate", "PPMd", "Zstd", "BCJ", "BCJ2", "filters"
+};
+
+/* Decodes every folder runs times, then prints the speed of the best run,
+   the counters of the archive and the slowest folders. */
+static int Bench(Archive *a, unsigned runs)
+{
+	const CSzArEx *db = &a->db;
+	UInt32 numFolders = db->db.NumFolders, i;
+	FolderTime *times = (FolderTime *)malloc((numFolders + 1) * sizeof(FolderTime));
+	UInt64 unpacked = 0;
+	double best = 0;
+	unsigned r;
+	CSzArExStats stats;
+	char methods[256];
+
+	if (times == NULL) {
+		return 1;
+	}
+	a->db.TimeStats = True;
+	for (i = 0; i < numFolders; i++) {
+		unpacked += SzFolder_GetUnpackSize(db->db.Folders + i);
+		times[i].folderIndex = i;
+		times[i].time = 0;
+	}
+	for (r = 0; r < runs; r++) {
+		CLookToRead s;
+		double total = 0;
+		Archive_InitStream(a, &s);
+		for (i = 0; i < numFolders; i++) {
+			UInt32 blockIndex = (UInt32)-1;
+			Byte *outBuffer = NULL;
+			size_t outBufferSize = 0, offset, size;
+			double start = Now(), t;
+			SRes res;
+			if (db->db.Folders[i].NumUnpackStreams == 0) {
+				continue;
+			}
+			res = SzArEx_Extract(db, &s, db->FolderStartFileIndex[i], &blockIndex,
+				&outBuffer, &outBufferSize, &offset, &size);
+			t = Now() - start;
+			SzFree(outBuffer);
+			if (res != SZ_OK) {
+				fprintf(stderr, "folder %u: %s\n", (unsigned)i, ResText(res));
+				LookToRead_Free(&s);
+				free(times);
+				return 2;
+			}
+			if (r == 0 || t < times[i].time) {
+				times[i].time = t;
+			}
+			total += t;
+		}
+		LookToRead_Free(&s);
+		printf("run %u: %.3f s, %.1f MB/s\n", r + 1, total, total > 0 ? (double)unpacked / total / 1e6 : 0.0);
+		if (r == 0 || total < best) {
+			best = total;
+		}
+	}
+	printf("best: %.1f MB/s of %llu bytes in %u folders\n", best > 0 ? (double)unpacked / best / 1e6 : 0.0,
+		(unsigned long long)unpacked, (unsigned)numFolders);
+
+	SzArEx_GetStats(db, &stats);
+	printf("\nCoder            Bytes      Time      MB/s  (all runs)\n");
+	for (i = 0; i < SZ_STATS_NUM_CODERS; i++) {
+		const CSzStatsCounter *c = &stats.Coders[i];
+		if (c->Bytes != 0) {
+			printf("%-8s  %12llu  %6.3f s  %8.1f\n", kCoderNames[i], (unsigned long long)c->Bytes,
+				(double)c->Time * 1e-9, c->Time ? (double)c->Bytes / (double)c->Time * 1e3 : 0.0);
+		}
+	}
+	if (stats.Crc.Bytes != 0) {
+		printf("%-8s  %12llu  %6.3f s  %8.1f\n", "CRC", (unsigned long long)stats.Crc.Bytes,
+			(double)stats.Crc.Time * 1e-9, stats.Crc.Time ? (double)stats.Crc.Bytes / (double)stats.Crc.Time * 1e3 : 0.0);
+	}
+	printf("input %llu bytes, %u folder decodes, peak memory %llu bytes\n",
+		(unsigned long long)stats.InputBytes, (unsigned)stats.FolderDecodes,
+		(unsigned long long)stats.MemoryPeak);
+
+	qsort(times, numFolders, sizeof(FolderTime), CompareFolderTime);
+	printf("\nSlowest folders     Time      MB/s  Methods\n");
+	for (i = 0; i < numFolders && i < 10; i++) {
+		CSzFolder *f = db->db.Folders + times[i].folderIndex;
+		FormatMethods(methods, f);
+		printf("%15u  %6.3f s  %8.1f  %s\n", (unsigned)times[i].folderIndex, times[i].time,
+			times[i].time > 0 ? (double)SzFolder_GetUnpackSize(f) / times[i].time / 1e6 : 0.0, methods);
+	}
+	free(times);
+	return 0;
+}
+
+/* ---------- a ---------- */
+
+#define MAX_CACHE_SIZES 16
+
+typedef struct {
+	char *name;
+	UInt32 fileIndex;
+} NameIndex;
+
+static int CompareNameIndex(const void *a, const void *b)
+{
+	return strcmp(((const NameIndex *)a)->name, ((const NameIndex *)b)->name);
+}
+
+static void ToSlashes(char *s)
+{
+	for (; *s; s++) {
+		if (*s == '\\') {
+			*s = '/';
+		}
+	}
+}
+
+/* Parses sizes like "0,16M,1G" to bytes. Returns the count or 0. */
+static unsigned ParseSizes(const char *s, UInt64 *sizes)
+{
+	unsigned n = 0;
+	for (;;) {
+		char *end;
+		UInt64 size = strtoul(s, &end, 10);
+		if (end == s || n == MAX_CACHE_SIZES) {
+			return 0;
+		}
+		switch (*end) {
+		case 'K': case 'k': size <<= 10; end++; break;
+		case 'M': case 'm': size <<= 20; end++; break;
+		case 'G': case 'g': size <<= 30; end++; break;
+		}
+		sizes[n++] = size;
+		if (*end == 0) {
+			return n;
+		}
+		if (*end != ',') {
+			return 0;
+		}
+		s = end + 1;
+	}
+}
+
+/* Replays the accesses with an LRU cache of decoded folders holding up to
+   cacheSize bytes. The last folder is always kept, like the blockIndex
+   cache of SzArEx_Extract, so 0 is SzArEx_Extract alone. Every miss decodes
+   the whole folder. */
+static UInt64 SimulateCache(const CSzArEx *db, const UInt32 *accesses, size_t numAccesses,
+	UInt64 cacheSize, UInt32 *lru, UInt32 *misses)
+{
+	UInt32 numCached = 0, i;
+	UInt64 cached = 0, decoded = 0;
+	size_t k;
+
+	*misses = 0;
+	for (k = 0; k < numAccesses; k++) {
+		UInt32 folderIndex = db->FileIndexToFolderIndexMap[accesses[k]];
+		UInt64 size;
+		if (folderIndex == (UInt32)-1) {
+			continue;
+		}
+		for (i = 0; i < numCached && lru[i] != folderIndex; i++) {
+		}
+		size = SzFolder_GetUnpackSize(db->db.Folders + folderIndex);
+		if (i == numCached) {
+			(*misses)++;
+			decoded += size;
+			cached += size;
+			numCached++;
+		}
+		/* Moves the folder to the front. */
+		memmove(lru + 1, lru, i * sizeof(UInt32));
+		lru[0] = folderIndex;
+		while (numCached > 1 && cached > cacheSize) {
+			numCached--;
+			cached -= SzFolder_GetUnpackSize(db->db.Folders + lru[numCached]);
+		}
+	}
+	return decoded;
+}
+
+/* Reads the names in logPath, one per line, as file indexes. Names which
+   are not in the archive are reported and skipped. */
+static SRes ReadAccessLog(const CSzArEx *db, const char *logPath, UInt32 **accesses, size_t *numAccesses)
+{
+	UInt32 numFiles = db->db.NumFiles, i;
+	NameIndex *names;
+	size_t size, capacity = 0, unknown = 0;
+	char *log = (char *)ReadWholeFile(logPath, &size), *line, *end, *p;
+	SRes res = SZ_OK;
+
+	*accesses = NULL;
+	*numAccesses = 0;
+	if (log == NULL) {
+		return SZ_ERROR_READ;
+	}
+	if ((p = (char *)realloc(log, size + 1)) == NULL
+		|| (names = (NameIndex *)malloc((numFiles + 1) * sizeof(NameIndex))) == NULL) {
+		free(p ? p : log);
+		return SZ_ERROR_MEM;
+	}
+	log = p;
+	log[size] = 0;
+	for (i = 0; i < numFiles; i++) {
+		if ((names[i].name = GetName(db, i)) == NULL) {
+			names[i].name = (char *)calloc(1, 1);
+		}
+		ToSlashes(names[i].name);
+		names[i].fileIndex = i;
+	}
+	qsort(names, numFiles, sizeof(NameIndex), CompareNameIndex);
+
+	for (line = log; line < log + size && res == SZ_OK; line = end + 1) {
+		NameIndex key, *found;
+		for (end = line; *end != '\n' && *end != 0; end++) {
+		}
+		*end = 0;
+		if (end > line && end[-1] == '\r') {
+			end[-1] = 0;
+		}
+		if (line[0] == 0) {
+			continue;
+		}
+		ToSlashes(line);
+		key.name = line;
+		if ((found = (NameIndex *)bsearch(&key, names, numFiles, sizeof(NameIndex), CompareNameIndex)) == NULL) {
+			if (unknown++ < 10) {
+				fprintf(stderr, "%s: not in the archive\n", line);
+			}
+			continue;
+		}
+		if (*numAccesses == capacity) {
+			UInt32 *a;
+			capacity = capacity ? capacity * 2 : 1024;
+			if ((a = (UInt32 *)realloc(*accesses, capacity * sizeof(UInt32))) == NULL) {
+				res = SZ_ERROR_MEM;
+				break;
+			}
+			*accesses = a;
+		}
+		(*accesses)[(*numAccesses)++] = found->fileIndex;
+	}
+	if (unknown > 10) {
+		fprintf(stderr, "%llu more names not in the archive\n", (unsigned long long)(unknown - 10));
+	}
+	for (i = 0; i < numFiles; i++) {
+		free(names[i].name);
+	}
+	free(names);
+	free(log);
+	return res;
+}
+
+/* Prints the layout of the folders and, for every file, the bytes decoded
+   to reach it: its offset in the folder, plus its size. With an access log,
+   it estimates the bytes decoded by the workload with each cache size. */
+static int Analyze(Archive *a, const char *logPath, const UInt64 *cacheSizes, unsigned numCacheSizes)
+{
+	const CSzArEx *db = &a->db;
+	UInt32 numFiles = db->db.NumFiles, numFolders = db->db.NumFolders, i, n = 0;
+	UInt64 *offsets = (UInt64 *)malloc((numFolders + 1) * sizeof(UInt64));
+	UInt64 *reach = (UInt64 *)malloc((numFiles + 1) * sizeof(UInt64));
+	UInt64 reachSum = 0, folderSum = 0;
+	char methods[256];
+	int ret = 0;
+
+	if (offsets == NULL || reach == NULL) {
+		free(offsets);
+		free(reach);
+		return 1;
+	}
+	printf("Folder   Files      Unpacked        Packed   Ratio  Methods\n");
+	for (i = 0; i < numFolders; i++) {
+		CSzFolder *f = db->db.Folders + i;
+		UInt64 u = SzFolder_GetUnpackSize(f), p = FolderPackSize(db, i);
+		FormatMethods(methods, f);
+		printf("%6u  %6u  %12llu  %12llu  %5.1f%%  %s\n", (unsigned)i, (unsigned)f->NumUnpackStreams,
+			(unsigned long long)u, (unsigned long long)p, u ? 100.0 * (double)p / (double)u : 0.0, methods);
+		offsets[i] = 0;
+	}
+
+	printf("\nFolder        Offset          Size         Reach  Name\n");
+	for (i = 0; i < numFiles; i++) {
+		const CSzFileItem *f = db->db.Files + i;
+		UInt32 folderIndex = db->FileIndexToFolderIndexMap[i];
+		char *name;
+		reach[i] = 0;
+		if (folderIndex == (UInt32)-1) {
+			continue;
+		}
+		reach[i] = offsets[folderIndex] + f->Size;
+		name = GetName(db, i);
+		printf("%6u  %12llu  %12llu  %12llu  %s\n", (unsigned)folderIndex,
+			(unsigned long long)offsets[folderIndex], (unsigned long long)f->Size,
+			(unsigned long long)reach[i], name ? name : "?");
+		free(name);
+		offsets[folderIndex] = reach[i];
+		reachSum += reach[i];
+		folderSum += SzFolder_GetUnpackSize(db->db.Folders + folderIndex);
+		n++;
+	}
+	if (n != 0) {
+		printf("\nReaching a file decodes %llu bytes on average with SzArEx_OpenFolderStream, "
+			"%llu bytes with SzArEx_Extract\n", (unsigned long long)(reachSum / n), (unsigned long long)(folderSum / n));
+	}
+
+	if (logPath != NULL) {
+		UInt32 *accesses = NULL, *lru = (UInt32 *)malloc((numFolders + 1) * sizeof(UInt32));
+		size_t numAccesses = 0, k;
+		UInt64 requested = 0, streamed = 0;
+		unsigned c;
+		SRes res = lru ? ReadAccessLog(db, logPath, &accesses, &numAccesses) : SZ_ERROR_MEM;
+		if (res != SZ_OK) {
+			fprintf(stderr, "%s: %s\n", logPath, res == SZ_ERROR_READ ? "can not open" : ResText(res));
+			ret = 2;
+		} else {
+			for (k = 0; k < numAccesses; k++) {
+				requested += db->db.Files[accesses[k]].Size;
+				streamed += reach[accesses[k]];
+			}
+			printf("\n%llu accesses, %llu bytes requested\n", (unsigned long long)numAccesses,
+				(unsigned long long)requested);
+			printf("       Cache     Misses       Decoded  x requested\n");
+			printf("%12s  %9llu  %12llu  %11.2f\n", "stream", (unsigned long long)numAccesses,
+				(unsigned long long)streamed, requested ? (double)streamed / (double)requested : 0.0);
+			for (c = 0; c < numCacheSizes; c++) {
+				UInt32 misses;
+				UInt64 decoded = SimulateCache(db, accesses, numAccesses, cacheSizes[c], lru, &misses);
+				char size[32];
+				FormatSize(size, cacheSizes[c]);
+				printf("%12s  %9u  %12llu  %11.2f\n", size, (unsigned)misses,
+					(unsigned long long)decoded, requested ? (double)decoded / (double)requested : 0.0);
+			}
+		}
+		free(lru);
+		free(accesses);
+	}
+	free(offsets);
+	free(reach);
+	return ret;
+}
+
+static void Usage(void)
+{
+	fprintf(stderr,
+		"usage: un7z l archive.7z\n"
+		"       un7z t [-j threads] archive.7z\n"
+		"       un7z x [-o dir] [-y] archive.7z\n"
+		"       un7z b [-n runs] archive.7z\n"
+		"       un7z a [-w access.log] [-c cache sizes] archive.7z\n");
+}
+
+int main(int argc, const char **argv)
+{
+	static Archive a;
+	const char *path = NULL, *outDir = ".", *logPath = NULL;
+	UInt64 cacheSizes[MAX_CACHE_SIZES];
+	unsigned numThreads = NumCpus(), runs = 3, numCacheSizes = ParseSizes("0,16M,64M,256M,1G", cacheSizes);
+	int overwrite = 0, i, ret;
+	char cmd;
+	double start;
+	SRes res;
+
+	if (argc < 3 || argv[1][0] == 0 || argv[1][1] != 0 || !strchr("ltxba", argv[1][0])) {
+		Usage();
+		return 1;
+	}
+	cmd = argv[1][0];
+	for (i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc && cmd == 't') {
+			numThreads = (unsigned)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc && cmd == 'x') {
+			outDir = argv[++i];
+		} else if (!strcmp(argv[i], "-y") && cmd == 'x') {
+			overwrite = 1;
+		} else if (!strcmp(argv[i], "-n") && i + 1 < argc && cmd == 'b') {
+			runs = (unsigned)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc && cmd == 'a') {
+			logPath = argv[++i];
+		} else if (!strcmp(argv[i], "-c") && i + 1 < argc && cmd == 'a') {
+			numCacheSizes = ParseSizes(argv[++i], cacheSizes);
+		} else if (argv[i][0] == '-' || path != NULL) {
+			Usage();
+			return 1;
+		} else {
+			path = argv[i];
+		}
+	}
+	if (path == NULL || numThreads == 0 || runs == 0 || numCacheSizes == 0) {
+		Usage();
+		return 1;
+	}
+
+	start = Now();
+	if ((res = Archive_Open(&a, path)) != SZ_OK) {
+		fprintf(stderr, "%s: %s\n", path, res == SZ_ERROR_READ ? "can not open" : ResText(res));
+		Archive_Close(&a);
+		return 2;
+	}
+	if (cmd == 'b') {
+		printf("open: %.3f ms\n", (Now() - start) * 1e3);
+	}
+
+	switch (cmd) {
+	case 'l': ret = List(&a); break;
+	case 't': ret = Test(&a, numThreads); break;
+	case 'x':
+		if (MakeDir(outDir)) {
+			ret = Extract(&a, outDir, overwrite);
+		} else {
+			fprintf(stderr, "%s: %s\n", outDir, ResText(SZ_ERROR_WRITE_MKDIR));
+			ret = 2;
+		}
+		break;
+	case 'b': ret = Bench(&a, runs); break;
+	default: ret = Analyze(&a, logPath, cacheSizes, numCacheSizes); break;
+	}
+	Archive_Close(&a);
+	return ret;
+}
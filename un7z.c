@@ -31,14 +31,36 @@
 #include <stdlib.h>
 #include <string.h>
 
-#if defined(_SZ_ALLOC_DEBUG) || defined(_SZ_SEEK_DEBUG) || defined(_SZ_HEADER_DEBUG) || defined(_SZ_READ_DEBUG) || defined(_SZ_CODER_DEBUG) || defined(_SZ_CHMODW_DEBUG)
-#include <stdio.h>
+#ifndef _WIN32
+#include <time.h>  /* clock_gettime() for tracing and statistics */
 #endif
 
 #ifndef UNDER_CE
 #include <errno.h>
 #endif
 
+#if !defined(_7ZIP_ST) && !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#ifdef _7ZIP_ZSTD
+#include <zstd.h>
+#endif
+
+#ifndef _7ZIP_NO_SIMD
+#if defined(MY_CPU_X86_OR_AMD64) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BRA_USE_SSE2
+#include <emmintrin.h>
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#define BRA_USE_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BRA_USE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
 /*
 Conditions:
   outSize <= FullOutputSize,
@@ -83,6 +105,8 @@ in CALL instructions to increase the compression ratio.
   x86    little      1          4
   ARMT   little      2          2
   ARM    little      4          0
+  ARM64  little      4          0
+  RISCV  little      2          6
   PPC     big        4          0
   SPARC   big        4          0
   IA64   little     16          0
@@ -106,6 +130,180 @@ in CALL instructions to increase the compression ratio.
 #define x86_Convert_Init(state) { state = 0; }
 STATIC size_t x86_Convert(Byte *data, size_t size, UInt32 ip, UInt32 *state, int encoding);
 STATIC size_t ARM_Convert(Byte *data, size_t size, UInt32 ip, int encoding);
+STATIC size_t ARMT_Convert(Byte *data, size_t size, UInt32 ip, int encoding);
+STATIC size_t ARM64_Convert(Byte *data, size_t size, UInt32 ip, int encoding);
+STATIC size_t RISCV_Convert(Byte *data, size_t size, UInt32 ip, int encoding);
+STATIC size_t PPC_Convert(Byte *data, size_t size, UInt32 ip, int encoding);
+STATIC size_t SPARC_Convert(Byte *data, size_t size, UInt32 ip, int encoding);
+STATIC size_t IA64_Convert(Byte *data, size_t size, UInt32 ip, int encoding);
+
+/* ---------- Delta converter ---------- */
+
+/* The state keeps the last delta (1..256) bytes of output. Delta_Decode can
+   be called with any size, it converts all the data. */
+
+#define DELTA_STATE_SIZE 256
+
+STATIC void Delta_Init(Byte *state);
+STATIC void Delta_Decode(Byte *state, unsigned delta, Byte *data, size_t size);
+
+/* ---------- Deflate Decoder state ---------- */
+
+/* Deflate, and Deflate64 (a 64 KiB window, distance codes 30 and 31, and
+   16 extra bits for length code 285). The decoder pulls its input through
+   in and writes to dic[dicPos, dicLimit) like LzmaDec: dic is the whole
+   output, or a ring of at least the window size. */
+
+typedef struct
+{
+  SRes (*Look)(void *p, const Byte **buf, size_t *size);
+    /* Sets *size to 0 at the end of the input. */
+  void (*Skip)(void *p, size_t size);
+} ILookIn;
+
+#define DEFLATE_LIT_TABLE_SIZE 2048
+#define DEFLATE_DIST_TABLE_SIZE 1024
+
+typedef struct
+{
+  ILookIn *in;
+  const Byte *start;  /* the buffer returned by in->Look, [start, cur) is read */
+  const Byte *cur;
+  const Byte *lim;
+  UInt64 bitBuf;
+  unsigned bitCount;
+  unsigned overread;  /* zero bytes put in bitBuf after the end of the input */
+  Byte *dic;
+  size_t dicPos;
+  size_t dicBufSize;
+  UInt32 histSize;  /* bytes written so far, up to the window size */
+  UInt32 remLen;  /* of the match stopped at dicLimit */
+  UInt32 rep;  /* its distance */
+  UInt32 storedRem;
+  unsigned state;
+  Bool isFinal;
+  Bool deflate64;
+  Bool fixedTables;  /* litTable and distTable hold the fixed codes */
+  UInt32 litEntries[288];
+  UInt32 distEntries[32];
+  UInt32 litTable[DEFLATE_LIT_TABLE_SIZE];
+  UInt32 distTable[DEFLATE_DIST_TABLE_SIZE];
+} CDeflateDec;
+
+#define DEFLATE_WINDOW_SIZE(deflate64) ((UInt32)1 << ((deflate64) ? 16 : 15))
+
+/* dic and dicBufSize are set by the caller. */
+STATIC void DeflateDec_Init(CDeflateDec *p, ILookIn *in, Bool deflate64);
+
+/* Returns when dicPos reaches dicLimit or the stream ends. With finish, the
+   stream must end exactly at dicLimit, and the input right after it.
+Returns:
+  SZ_OK
+  SZ_ERROR_DATA - Data error
+*/
+STATIC SRes DeflateDec_DecodeToDic(CDeflateDec *p, size_t dicLimit, Bool finish);
+
+/* ---------- PPMd7 (PPMdH) Decoder state ---------- */
+
+/* The model lives in one block of Size bytes (the props of the coder): the
+   text of the context tree grows from the bottom and 12-byte units for the
+   contexts and their stats are carved from the top, with free lists per
+   size. References inside the block are 32-bit offsets from Base. When the
+   block is full the model restarts, exactly where the encoder's does. */
+
+#define PPMD_INT_BITS 7
+#define PPMD_PERIOD_BITS 7
+#define PPMD_BIN_SCALE (1 << (PPMD_INT_BITS + PPMD_PERIOD_BITS))
+
+#define PPMD_GET_MEAN_SPEC(summ, shift, round) (((summ) + (1 << ((shift) - 2))) >> (shift))
+#define PPMD_GET_MEAN(prob) PPMD_GET_MEAN_SPEC((prob), PPMD_PERIOD_BITS, 2)
+#define PPMD_UPDATE_PROB_0(prob) ((prob) + (1 << PPMD_INT_BITS) - PPMD_GET_MEAN(prob))
+#define PPMD_UPDATE_PROB_1(prob) ((prob) - PPMD_GET_MEAN(prob))
+
+#define PPMD_N1 4
+#define PPMD_N2 4
+#define PPMD_N3 4
+#define PPMD_N4 ((128 + 3 - 1 * PPMD_N1 - 2 * PPMD_N2 - 3 * PPMD_N3) / 4)
+#define PPMD_NUM_INDEXES (PPMD_N1 + PPMD_N2 + PPMD_N3 + PPMD_N4)
+
+#define PPMD7_MIN_ORDER 2
+#define PPMD7_MAX_ORDER 64
+#define PPMD7_MIN_MEM_SIZE (1 << 11)
+#define PPMD7_MAX_MEM_SIZE (0xFFFFFFFF - 12 * 3)
+
+typedef struct
+{
+  Byte Symbol;
+  Byte Freq;
+  UInt16 SuccessorLow;
+  UInt16 SuccessorHigh;
+} CPpmd_State;
+
+typedef struct
+{
+  UInt16 Summ;  /* Freq */
+  Byte Shift;  /* Speed of Freq change; low Shift is for fast change */
+  Byte Count;  /* Count to next change of Shift */
+} CPpmd_See;
+
+typedef struct
+{
+  UInt16 NumStats;
+  UInt16 SummFreq;
+  UInt32 Stats;
+  UInt32 Suffix;
+} CPpmd7_Context;
+
+#define Ppmd7Context_OneState(p) ((CPpmd_State *)&(p)->SummFreq)
+
+typedef struct
+{
+  CPpmd7_Context *MinContext, *MaxContext;
+  CPpmd_State *FoundState;
+  unsigned OrderFall, InitEsc, PrevSuccess, MaxOrder, HiBitsFlag;
+  Int32 RunLength, InitRL;
+
+  UInt32 Size;
+  UInt32 GlueCount;
+  Byte *Base, *LoUnit, *HiUnit, *Text, *UnitsStart;
+  UInt32 AlignOffset;
+  size_t BaseSize;  /* allocated, at least PPMD7_ALLOC_SIZE(Size) */
+
+  Byte Indx2Units[PPMD_NUM_INDEXES];
+  Byte Units2Indx[128];
+  UInt32 FreeList[PPMD_NUM_INDEXES];
+  Byte NS2Indx[256], NS2BSIndx[256], HB2Flag[256];
+  CPpmd_See DummySee, See[25][16];
+  UInt16 BinSumm[128][64];
+} CPpmd7;
+
+/* The block, its alignment and one more unit for GlueFreeBlocks. */
+#define PPMD7_ALLOC_SIZE(size) ((size_t)(size) + (4 - ((size) & 3)) + 12)
+
+STATIC void Ppmd7_Construct(CPpmd7 *p);
+/* Keeps the block if it's big enough for size. */
+STATIC Bool Ppmd7_Alloc(CPpmd7 *p, UInt32 size);
+STATIC void Ppmd7_Free(CPpmd7 *p);
+STATIC void Ppmd7_Init(CPpmd7 *p, unsigned maxOrder);
+
+/* The range decoder of the 7z variant. It reads its input through in. */
+typedef struct
+{
+  UInt32 Range;
+  UInt32 Code;
+  ILookIn *in;
+  const Byte *start;  /* the buffer returned by in->Look, [start, cur) is read */
+  const Byte *cur;
+  const Byte *lim;
+  SRes res;  /* of in->Look */
+  Bool extra;  /* a byte was read after the end of the input */
+} CPpmd7z_RangeDec;
+
+STATIC Bool Ppmd7z_RangeDec_Init(CPpmd7z_RangeDec *p, ILookIn *in);
+#define Ppmd7z_RangeDec_IsFinishedOK(p) ((p)->Code == 0)
+
+/* Returns the next byte, -1 at the end marker or -2 for a data error. */
+STATIC int Ppmd7_DecodeSymbol(CPpmd7 *p, CPpmd7z_RangeDec *rc);
 
 /* ---------- LZMA Decoder state ---------- */
 
@@ -120,6 +318,43 @@ STATIC size_t ARM_Convert(Byte *data, size_t size, UInt32 ip, int encoding);
 #endif
 
 
+/* ---------- BCJ2 Decoder state ---------- */
+
+/* Resumable BCJ2 decoder. The caller points bufs/lims at the input that is
+   available in each of the four streams and dest/destLim at the output
+   space, then calls Bcj2Dec_Decode. It returns when the output space is
+   full (need == BCJ2_NEED_OUT) or when stream need has no input left; the
+   caller then moves bufs[need] to more input, or dest to more space, and
+   calls it again. */
+
+#define BCJ2_STREAM_MAIN 0
+#define BCJ2_STREAM_CALL 1
+#define BCJ2_STREAM_JUMP 2
+#define BCJ2_STREAM_RC 3
+#define BCJ2_NEED_OUT 4
+
+typedef struct
+{
+  const Byte *bufs[4];
+  const Byte *lims[4];
+  Byte *dest;
+  const Byte *destLim;
+  unsigned need;
+
+  unsigned state;
+  unsigned tempPos;
+  UInt32 ip;  /* number of bytes written */
+  UInt32 range;
+  UInt32 code;
+  Byte prevByte;
+  Byte opcode;
+  Byte temp[4];
+  CLzmaProb probs[2 + 256];
+} CBcj2Dec;
+
+STATIC void Bcj2Dec_Init(CBcj2Dec *p);
+STATIC void Bcj2Dec_Decode(CBcj2Dec *p);
+
 /* ---------- LZMA Properties ---------- */
 
 #define LZMA_PROPS_SIZE 5
@@ -143,9 +378,10 @@ STATIC SRes LzmaProps_Decode(CLzmaProps *p, const Byte *data, unsigned size);
 
 #define LZMA_REQUIRED_INPUT_MAX 20
 
-typedef struct
+typedef struct _CLzmaDec
 {
   CLzmaProps prop;
+  int (MY_FAST_CALL *decodeReal)(struct _CLzmaDec *p, size_t limit, const Byte *bufLimit);
   CLzmaProb *probs;
   Byte *dic;
   const Byte *buf;
@@ -168,6 +404,10 @@ typedef struct
 
 STATIC void LzmaDec_Init(CLzmaDec *p);
 
+/* Selects the decoder loop for p->prop: a specialised one for the common
+   lc/lp/pb sets, or the generic one. */
+STATIC void LzmaDec_SetDecodeFunc(CLzmaDec *p);
+
 /* There are two types of LZMA streams:
      0) Stream with end mark. That end mark adds about 6 bytes to compressed size.
      1) Stream without end mark. You must know exact uncompressed size to decompress such stream. */
@@ -374,9 +614,168 @@ Returns:
 
 
 
+/* Trace.c */
+
+static SzTraceFunc g_SzTraceFunc;
+static void *g_SzTraceCtx;
+
+/* The only cost of tracing while it's off. */
+#define SZ_TRACE_ON (g_SzTraceFunc != 0)
+
+STATIC void SzTrace_Set(SzTraceFunc func, void *ctx)
+{
+  g_SzTraceCtx = ctx;
+  g_SzTraceFunc = func;
+}
+
+/* Monotonic time in nanoseconds. */
+static UInt64 SzTime_Now(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER t, f;
+  QueryPerformanceCounter(&t);
+  QueryPerformanceFrequency(&f);
+  return (UInt64)(t.QuadPart / f.QuadPart) * 1000000000 +
+      (UInt64)(t.QuadPart % f.QuadPart) * 1000000000 / (UInt64)f.QuadPart;
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (UInt64)t.tv_sec * 1000000000 + (UInt64)t.tv_nsec;
+#endif
+}
+
+static void SzTrace_Init(CSzTraceEvent *e, ESzTraceType type)
+{
+  memset(e, 0, sizeof(*e));
+  e->type = type;
+}
+
+static void SzTrace_Seek(UInt64 offset)
+{
+  CSzTraceEvent e;
+  SzTrace_Init(&e, SZ_TRACE_SEEK);
+  e.offset = offset;
+  g_SzTraceFunc(g_SzTraceCtx, &e);
+}
+
+static void SzTrace_Memory(ESzTraceType type, void *ptr, size_t size)
+{
+  CSzTraceEvent e;
+  SzTrace_Init(&e, type);
+  e.ptr = ptr;
+  e.size = size;
+  g_SzTraceFunc(g_SzTraceCtx, &e);
+}
+
+static void SzTrace_CoderStart(UInt64 method, UInt64 size)
+{
+  CSzTraceEvent e;
+  SzTrace_Init(&e, SZ_TRACE_CODER_START);
+  e.method = method;
+  e.size = size;
+  g_SzTraceFunc(g_SzTraceCtx, &e);
+}
+
+static void SzTrace_CoderEnd(UInt64 method, UInt64 size, SRes res, UInt64 time)
+{
+  CSzTraceEvent e;
+  SzTrace_Init(&e, SZ_TRACE_CODER_END);
+  e.method = method;
+  e.size = size;
+  e.res = res;
+  e.time = time;
+  g_SzTraceFunc(g_SzTraceCtx, &e);
+}
+
+/* Traces the phase that started at *start and starts the next one. */
+static void SzTrace_Header(ESzTraceHeaderPhase phase, UInt64 size, UInt64 *start)
+{
+  CSzTraceEvent e;
+  UInt64 now = SzTime_Now();
+  SzTrace_Init(&e, SZ_TRACE_HEADER);
+  e.phase = phase;
+  e.size = size;
+  e.time = now - *start;
+  g_SzTraceFunc(g_SzTraceCtx, &e);
+  *start = SzTime_Now();
+}
+
+/* Threads.c */
+
+#ifndef _7ZIP_ST
+
+#ifdef _WIN32
+
+typedef HANDLE CThread;
+typedef CRITICAL_SECTION CCriticalSection;
+typedef CONDITION_VARIABLE CCondVar;
+#define THREAD_FUNC_RET_TYPE DWORD
+#define THREAD_FUNC_CALL_TYPE MY_STD_CALL
+
+#else
+
+typedef pthread_t CThread;
+typedef pthread_mutex_t CCriticalSection;
+typedef pthread_cond_t CCondVar;
+#define THREAD_FUNC_RET_TYPE void *
+#define THREAD_FUNC_CALL_TYPE
+
+#endif
+
+typedef THREAD_FUNC_RET_TYPE (THREAD_FUNC_CALL_TYPE * THREAD_FUNC_TYPE)(void *);
+
+#ifdef _WIN32
+
+static WRes Thread_Create(CThread *p, THREAD_FUNC_TYPE func, void *param)
+{
+  *p = CreateThread(NULL, 0, func, param, 0, NULL);
+  return (*p != NULL) ? 0 : GetLastError();
+}
+
+static WRes Thread_Wait(CThread *p)
+{
+  WRes res = (WaitForSingleObject(*p, INFINITE) == WAIT_OBJECT_0) ? 0 : GetLastError();
+  CloseHandle(*p);
+  return res;
+}
+
+#define CriticalSection_Init(p) (InitializeCriticalSection(p), 0)
+#define CriticalSection_Delete(p) DeleteCriticalSection(p)
+#define CriticalSection_Enter(p) EnterCriticalSection(p)
+#define CriticalSection_Leave(p) LeaveCriticalSection(p)
+
+#define CondVar_Init(p) (InitializeConditionVariable(p), 0)
+#define CondVar_Delete(p)
+#define CondVar_Wait(p, cs) SleepConditionVariableCS(p, cs, INFINITE)
+#define CondVar_Signal(p) WakeConditionVariable(p)
+#define CondVar_Broadcast(p) WakeAllConditionVariable(p)
+
+#else
+
+#define Thread_Create(p, func, param) pthread_create(p, NULL, func, param)
+#define Thread_Wait(p) pthread_join(*(p), NULL)
+
+#define CriticalSection_Init(p) pthread_mutex_init(p, NULL)
+#define CriticalSection_Delete(p) pthread_mutex_destroy(p)
+#define CriticalSection_Enter(p) pthread_mutex_lock(p)
+#define CriticalSection_Leave(p) pthread_mutex_unlock(p)
+
+#define CondVar_Init(p) pthread_cond_init(p, NULL)
+#define CondVar_Delete(p) pthread_cond_destroy(p)
+#define CondVar_Wait(p, cs) pthread_cond_wait(p, cs)
+#define CondVar_Signal(p) pthread_cond_signal(p)
+#define CondVar_Broadcast(p) pthread_cond_broadcast(p)
+
+#endif
+
+#endif
+
 /* 7zDec.c */
 
+#define NUM_FOLDER_CODERS_MAX 32
+
 #define k_Copy 0
+#define k_Delta 3
 #define k_LZMA2 0x21
 #define k_LZMA  0x30101
 #define k_BCJ   0x03030103
@@ -385,38 +784,276 @@ Returns:
 #define k_ARMT  0x03030701
 #define k_SPARC 0x03030805
 #define k_BCJ2  0x0303011B
+#define k_IA64  0x03030401
+#define k_ARM64 0xA
+#define k_RISCV 0xB
+#define k_ZSTD  0x4F71101
+#define k_Deflate 0x40108
+#define k_Deflate64 0x40109
+#define k_PPMD  0x30401
+
+/* Filters (branch converters and Delta) are applied by the main coder to
+   each span it has just decoded, while it's still in cache. The output is
+   produced in spans of at most SZ_FILTER_SPAN_SIZE bytes. */
+#define SZ_FILTER_SPAN_SIZE (1 << 18)
+
+typedef struct CSzFilter
+{
+  UInt32 methodID;
+  UInt32 x86State;
+  UInt32 ip;   /* start ip, from the ARM64 or RISCV props */
+  size_t pos;  /* the bytes before pos are converted */
+  UInt64 time;  /* spent converting, in nanoseconds, if timed */
+  Bool timed;
+  unsigned delta;
+  Byte deltaState[DELTA_STATE_SIZE];
+  struct CSzFilter *next;  /* the filter which takes this one's output */
+} CSzFilter;
+
+static SRes SzFilter_Init(CSzFilter *p, const CSzCoderInfo *coder)
+{
+  p->methodID = (UInt32)coder->MethodID;
+  x86_Convert_Init(p->x86State);
+  p->ip = 0;
+  p->pos = 0;
+  p->time = 0;
+  p->timed = False;
+  p->next = NULL;
+  if (p->methodID == k_Delta)
+  {
+    if (coder->PropsSize != 1)
+      return SZ_ERROR_UNSUPPORTED;
+    p->delta = (unsigned)coder->Props[0] + 1;
+    Delta_Init(p->deltaState);
+  }
+  else if (coder->PropsSize == 4 && (p->methodID == k_ARM64 || p->methodID == k_RISCV))
+  {
+    p->ip = GetUi32(coder->Props);
+    if ((p->ip & (p->methodID == k_ARM64 ? 3 : 1)) != 0)
+      return SZ_ERROR_UNSUPPORTED;
+  }
+  else if (coder->PropsSize != 0)
+    return SZ_ERROR_UNSUPPORTED;
+  return SZ_OK;
+}
+
+/* Runs the chain of filters starting at p over data[0, size). A filter may
+   leave a few bytes at the end for the next call, when the span they start
+   an instruction in is complete; the next filter in the chain only gets
+   what's converted. With finish set, size is the end of the stream, and
+   the bytes left there are final. */
+static void SzFilter_Convert(CSzFilter *p, Byte *data, size_t size, Bool finish)
+{
+  for (; p != NULL; p = p->next)
+  {
+    Byte *cur = data + p->pos;
+    size_t rem = size - p->pos;
+    UInt32 ip = p->ip + (UInt32)p->pos;
+    UInt64 start = p->timed ? SzTime_Now() : 0;
+    switch (p->methodID)
+    {
+      case k_BCJ:   p->pos += x86_Convert(cur, rem, ip, &p->x86State, 0); break;
+      case k_ARM:   p->pos += ARM_Convert(cur, rem, ip, 0); break;
+      case k_ARMT:  p->pos += ARMT_Convert(cur, rem, ip, 0); break;
+      case k_ARM64: p->pos += ARM64_Convert(cur, rem, ip, 0); break;
+      case k_RISCV: p->pos += RISCV_Convert(cur, rem, ip, 0); break;
+      case k_PPC:   p->pos += PPC_Convert(cur, rem, ip, 0); break;
+      case k_SPARC: p->pos += SPARC_Convert(cur, rem, ip, 0); break;
+      case k_IA64:  p->pos += IA64_Convert(cur, rem, ip, 0); break;
+      case k_Delta: Delta_Decode(p->deltaState, p->delta, cur, rem); p->pos = size; break;
+    }
+    if (p->timed)
+      p->time += SzTime_Now() - start;
+    if (!finish)
+      size = p->pos;
+  }
+}
+
+/* Returns the time spent in the chain of filters starting at p. */
+static UInt64 SzFilter_GetTime(const CSzFilter *p)
+{
+  UInt64 time = 0;
+  for (; p != NULL; p = p->next)
+    time += p->time;
+  return time;
+}
+
+/* ---------- Progress ----------
+
+The main coders of a whole folder decode report their progress to the
+caller's ICompressProgress every step bytes of output, with the totals of
+all the coders of the folder, and stop with SZ_ERROR_PROGRESS if it
+returns an error. */
+
+typedef struct
+{
+  ICompressProgress *progress;  /* NULL if there's no progress */
+  UInt64 step;
+  UInt64 inPos;
+  UInt64 outPos;
+  UInt64 next;  /* outPos of the next call */
+} CSzProgress;
+
+static void SzProgress_Init(CSzProgress *p, ICompressProgress *progress, UInt64 step)
+{
+  p->progress = progress;
+  p->step = (step != 0) ? step : SZ_PROGRESS_STEP_DEFAULT;
+  p->inPos = 0;
+  p->outPos = 0;
+  p->next = p->step;
+}
+
+/* Returns rem, or less so that the progress is reported in time. p can be
+   NULL. */
+static size_t SzProgress_GetSpan(const CSzProgress *p, size_t rem)
+{
+  if (p && p->progress && rem > p->step)
+    return (size_t)p->step;
+  return rem;
+}
+
+static SRes SzProgress_Add(CSzProgress *p, UInt64 inSize, UInt64 outSize)
+{
+  if (!p || !p->progress)
+    return SZ_OK;
+  p->inPos += inSize;
+  p->outPos += outSize;
+  if (p->outPos < p->next)
+    return SZ_OK;
+  p->next = p->outPos + p->step;
+  return (p->progress->Progress(p->progress, p->inPos, p->outPos) == SZ_OK) ?
+      SZ_OK : SZ_ERROR_PROGRESS;
+}
+
+struct CSzDecoderPool;
+static void SzDecoderPool_AddMemory(struct CSzDecoderPool *pool, size_t size);
+static void SzDecoderPool_SubMemory(struct CSzDecoderPool *pool, size_t size);
+
+/* The LZ decoders read matches from the unconverted output, so a filter
+   can't convert it in place while they run. If the dictionary is smaller
+   than the output, they decode to a ring of dicSize bytes and each span
+   is filtered as it's copied to outBuffer. Otherwise the dictionary is
+   outBuffer itself and the filter runs once decoding is done. */
+static SRes SzDecodeDic_Alloc(Byte **dic, size_t *dicBufSize, UInt32 dicSize,
+    Byte *outBuffer, size_t outSize, const CSzFilter *filter, struct CSzDecoderPool *pool)
+{
+  if (filter && dicSize < outSize)
+  {
+    *dic = (Byte *)SzAlloc(dicSize);
+    if (*dic == 0)
+      return SZ_ERROR_MEM;
+    *dicBufSize = dicSize;
+    SzDecoderPool_AddMemory(pool, dicSize);
+  }
+  else
+  {
+    *dic = outBuffer;
+    *dicBufSize = outSize;
+  }
+  return SZ_OK;
+}
+
+/* Frees a ring allocated by SzDecodeDic_Alloc. */
+static void SzDecodeDic_Free(Byte *dic, size_t dicBufSize, struct CSzDecoderPool *pool)
+{
+  SzDecoderPool_SubMemory(pool, dicBufSize);
+  SzFree(dic);
+}
+
+/* Returns the end of the next span to decode at dicPos. */
+static size_t SzDecodeDic_GetLimit(size_t dicPos, size_t dicBufSize, size_t outRem, Bool isRing,
+    const CSzProgress *progress)
+{
+  size_t limit = dicBufSize - dicPos;
+  if (limit > outRem)
+    limit = outRem;
+  if (isRing && limit > SZ_FILTER_SPAN_SIZE)
+    limit = SZ_FILTER_SPAN_SIZE;
+  return dicPos + SzProgress_GetSpan(progress, limit);
+}
+
+/* Moves dic[from, to) to the output, filtering it on the way. */
+static void SzDecodeDic_Flush(const Byte *dic, size_t from, size_t to,
+    Byte *outBuffer, size_t *outPos, size_t outSize, CSzFilter *filter)
+{
+  if (dic == outBuffer)
+  {
+    *outPos = to;
+    return;
+  }
+  memcpy(outBuffer + *outPos, dic + from, to - from);
+  *outPos += to - from;
+  SzFilter_Convert(filter, outBuffer, *outPos, *outPos == outSize);
+}
+
+static SRes SzDecodeCopy(UInt64 inSize, CLookToRead *inStream,
+    Byte *outBuffer, size_t outSize, CSzFilter *filter, CSzProgress *progress)
+{
+  size_t pos = 0;
+  if (inSize != outSize) /* check it */
+    return SZ_ERROR_DATA;
+  while (pos != outSize)
+  {
+    size_t limit = (filter && outSize - pos > SZ_FILTER_SPAN_SIZE) ?
+        pos + SZ_FILTER_SPAN_SIZE : outSize;
+    limit = pos + SzProgress_GetSpan(progress, limit - pos);
+    RINOK(LookToRead_ReadAll(inStream, outBuffer + pos, limit - pos));
+    RINOK(SzProgress_Add(progress, limit - pos, limit - pos));
+    pos = limit;
+    if (filter)
+      SzFilter_Convert(filter, outBuffer, pos, pos == outSize);
+  }
+  return SZ_OK;
+}
 
 static SRes SzDecodeLzma(CSzCoderInfo *coder, UInt64 inSize, CLookToRead *inStream,
-    Byte *outBuffer, size_t outSize)
+    Byte *outBuffer, size_t outSize, CSzFilter *filter, CSzProgress *progress,
+    struct CSzDecoderPool *pool)
 {
   CLzmaDec state;
   SRes res = SZ_OK;
+  size_t outPos = 0;
 
   LzmaDec_Construct(&state);
   RINOK(LzmaDec_AllocateProbs(&state, coder->Props, (unsigned)coder->PropsSize));
-  state.dic = outBuffer;
-  state.dicBufSize = outSize;
+  res = SzDecodeDic_Alloc(&state.dic, &state.dicBufSize, state.prop.dicSize,
+      outBuffer, outSize, filter, pool);
+  if (res != SZ_OK)
+  {
+    LzmaDec_FreeProbs(&state);
+    return res;
+  }
   LzmaDec_Init(&state);
 
   for (;;)
   {
     Byte *inBuf = NULL;
-    size_t inProcessed = inSize > LookToRead_BUF_SIZE ?
-        LookToRead_BUF_SIZE : inSize;
+    size_t inProcessed = inSize > LookToRead_BUF_SIZE_MAX ?
+        LookToRead_BUF_SIZE_MAX : inSize;
     res = LookToRead_Look(inStream, (const void **)&inBuf, &inProcessed);
     if (res != SZ_OK)
       break;
 
     {
-      size_t dicPos = state.dicPos;
+      size_t dicPos, dicLimit;
       ELzmaStatus status;
-      res = LzmaDec_DecodeToDic(&state, outSize, inBuf, &inProcessed, LZMA_FINISH_END, &status);
+      if (state.dicPos == state.dicBufSize)
+        state.dicPos = 0;
+      dicPos = state.dicPos;
+      dicLimit = SzDecodeDic_GetLimit(dicPos, state.dicBufSize, outSize - outPos,
+          state.dic != outBuffer, progress);
+      res = LzmaDec_DecodeToDic(&state, dicLimit, inBuf, &inProcessed,
+          dicLimit - dicPos == outSize - outPos ? LZMA_FINISH_END : LZMA_FINISH_ANY, &status);
       inSize -= inProcessed;
       if (res != SZ_OK)
         break;
-      if (state.dicPos == state.dicBufSize || (inProcessed == 0 && dicPos == state.dicPos))
+      SzDecodeDic_Flush(state.dic, dicPos, state.dicPos, outBuffer, &outPos, outSize, filter);
+      res = SzProgress_Add(progress, inProcessed, state.dicPos - dicPos);
+      if (res != SZ_OK)
+        break;
+      if (outPos == outSize || (inProcessed == 0 && dicPos == state.dicPos))
       {
-        if (state.dicBufSize != outSize || inSize != 0 ||
+        if (outPos != outSize || inSize != 0 ||
             (status != LZMA_STATUS_FINISHED_WITH_MARK &&
              status != LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK))
           res = SZ_ERROR_DATA;
@@ -426,43 +1063,64 @@ static SRes SzDecodeLzma(CSzCoderInfo *coder, UInt64 inSize, CLookToRead *inStre
     }
   }
 
+  if (state.dic != outBuffer)
+    SzDecodeDic_Free(state.dic, state.dicBufSize, pool);
+  else if (filter && res == SZ_OK)
+    SzFilter_Convert(filter, outBuffer, outSize, True);
   LzmaDec_FreeProbs(&state);
   return res;
 }
 
 static SRes SzDecodeLzma2(CSzCoderInfo *coder, UInt64 inSize, CLookToRead *inStream,
-    Byte *outBuffer, size_t outSize)
+    Byte *outBuffer, size_t outSize, CSzFilter *filter, CSzProgress *progress,
+    struct CSzDecoderPool *pool)
 {
   CLzma2Dec state;
   SRes res = SZ_OK;
+  size_t outPos = 0;
 
   Lzma2Dec_Construct(&state);
   if (coder->PropsSize != 1)
     return SZ_ERROR_DATA;
   RINOK(Lzma2Dec_AllocateProbs(&state, coder->Props[0]));
-  state.decoder.dic = outBuffer;
-  state.decoder.dicBufSize = outSize;
+  res = SzDecodeDic_Alloc(&state.decoder.dic, &state.decoder.dicBufSize,
+      state.decoder.prop.dicSize, outBuffer, outSize, filter, pool);
+  if (res != SZ_OK)
+  {
+    Lzma2Dec_FreeProbs(&state);
+    return res;
+  }
   Lzma2Dec_Init(&state);
 
   for (;;)
   {
     Byte *inBuf = NULL;
-    size_t inProcessed = inSize > LookToRead_BUF_SIZE ?
-        LookToRead_BUF_SIZE : inSize;
+    size_t inProcessed = inSize > LookToRead_BUF_SIZE_MAX ?
+        LookToRead_BUF_SIZE_MAX : inSize;
     res = LookToRead_Look(inStream, (const void **)&inBuf, &inProcessed);
     if (res != SZ_OK)
       break;
 
     {
-      size_t dicPos = state.decoder.dicPos;
+      size_t dicPos, dicLimit;
       ELzmaStatus status;
-      res = Lzma2Dec_DecodeToDic(&state, outSize, inBuf, &inProcessed, LZMA_FINISH_END, &status);
+      if (state.decoder.dicPos == state.decoder.dicBufSize)
+        state.decoder.dicPos = 0;
+      dicPos = state.decoder.dicPos;
+      dicLimit = SzDecodeDic_GetLimit(dicPos, state.decoder.dicBufSize, outSize - outPos,
+          state.decoder.dic != outBuffer, progress);
+      res = Lzma2Dec_DecodeToDic(&state, dicLimit, inBuf, &inProcessed,
+          dicLimit - dicPos == outSize - outPos ? LZMA_FINISH_END : LZMA_FINISH_ANY, &status);
       inSize -= inProcessed;
       if (res != SZ_OK)
         break;
-      if (state.decoder.dicPos == state.decoder.dicBufSize || (inProcessed == 0 && dicPos == state.decoder.dicPos))
+      SzDecodeDic_Flush(state.decoder.dic, dicPos, state.decoder.dicPos, outBuffer, &outPos, outSize, filter);
+      res = SzProgress_Add(progress, inProcessed, state.decoder.dicPos - dicPos);
+      if (res != SZ_OK)
+        break;
+      if (outPos == outSize || (inProcessed == 0 && dicPos == state.decoder.dicPos))
       {
-        if (state.decoder.dicBufSize != outSize || inSize != 0 ||
+        if (outPos != outSize || inSize != 0 ||
             (status != LZMA_STATUS_FINISHED_WITH_MARK))
           res = SZ_ERROR_DATA;
         break;
@@ -471,602 +1129,4513 @@ static SRes SzDecodeLzma2(CSzCoderInfo *coder, UInt64 inSize, CLookToRead *inStr
     }
   }
 
+  if (state.decoder.dic != outBuffer)
+    SzDecodeDic_Free(state.decoder.dic, state.decoder.dicBufSize, pool);
+  else if (filter && res == SZ_OK)
+    SzFilter_Convert(filter, outBuffer, outSize, True);
   Lzma2Dec_FreeProbs(&state);
   return res;
 }
 
-static Bool IS_MAIN_METHOD(UInt32 m)
+/* The input of a pack stream: inStream, up to inSize bytes. */
+typedef struct
 {
-  switch(m)
-  {
-    case k_Copy:
-    case k_LZMA:
-    case k_LZMA2:
-      return True;
-  }
-  return False;
-}
+  ILookIn vt;
+  CLookToRead *stream;
+  UInt64 rem;
+} CSzPackIn;
 
-static Bool IS_SUPPORTED_CODER(const CSzCoderInfo *c)
+static SRes SzPackIn_Look(void *pp, const Byte **buf, size_t *size)
 {
-  return
-      c->NumInStreams == 1 &&
-      c->NumOutStreams == 1 &&
-      c->MethodID <= (UInt32)0xFFFFFFFF &&
-      IS_MAIN_METHOD((UInt32)c->MethodID);
+  CSzPackIn *p = (CSzPackIn *)pp;
+  size_t n = p->rem > LookToRead_BUF_SIZE_MAX ? LookToRead_BUF_SIZE_MAX : (size_t)p->rem;
+  *size = 0;
+  if (n == 0)
+    return SZ_OK;
+  RINOK(LookToRead_Look(p->stream, (const void **)buf, &n));
+  *size = n < p->rem ? n : (size_t)p->rem;
+  return SZ_OK;
 }
 
-#define IS_BCJ2(c) ((c)->MethodID == k_BCJ2 && (c)->NumInStreams == 4 && (c)->NumOutStreams == 1)
+static void SzPackIn_Skip(void *pp, size_t size)
+{
+  CSzPackIn *p = (CSzPackIn *)pp;
+  LOOKTOREAD_SKIP(p->stream, size);
+  p->rem -= size;
+}
 
-static SRes CheckSupportedFolder(const CSzFolder *f)
+static SRes SzDecodeDeflate(CSzCoderInfo *coder, UInt64 inSize, CLookToRead *inStream,
+    Byte *outBuffer, size_t outSize, CSzFilter *filter, CSzProgress *progress,
+    struct CSzDecoderPool *pool)
 {
-  if (f->NumCoders < 1 || f->NumCoders > 4)
-    return SZ_ERROR_UNSUPPORTED;
-  if (!IS_SUPPORTED_CODER(&f->Coders[0]))
-    return SZ_ERROR_UNSUPPORTED;
-  if (f->NumCoders == 1)
+  CDeflateDec *dec;
+  CSzPackIn in;
+  Bool deflate64 = (coder->MethodID == k_Deflate64);
+  SRes res;
+  size_t outPos = 0;
+
+  dec = (CDeflateDec *)SzAlloc(sizeof(CDeflateDec));
+  if (dec == 0)
+    return SZ_ERROR_MEM;
+  in.vt.Look = SzPackIn_Look;
+  in.vt.Skip = SzPackIn_Skip;
+  in.stream = inStream;
+  in.rem = inSize;
+  DeflateDec_Init(dec, &in.vt, deflate64);
+  res = SzDecodeDic_Alloc(&dec->dic, &dec->dicBufSize, DEFLATE_WINDOW_SIZE(deflate64),
+      outBuffer, outSize, filter, pool);
+  if (res != SZ_OK)
   {
-    if (f->NumPackStreams != 1 || f->PackStreams[0] != 0 || f->NumBindPairs != 0)
-      return SZ_ERROR_UNSUPPORTED;
-    return SZ_OK;
+    SzFree(dec);
+    return res;
   }
-  if (f->NumCoders == 2)
-  {
-    CSzCoderInfo *c = &f->Coders[1];
-    if (c->MethodID > (UInt32)0xFFFFFFFF ||
-        c->NumInStreams != 1 ||
-        c->NumOutStreams != 1 ||
-        f->NumPackStreams != 1 ||
-        f->PackStreams[0] != 0 ||
-        f->NumBindPairs != 1 ||
-        f->BindPairs[0].InIndex != 1 ||
-        f->BindPairs[0].OutIndex != 0)
-      return SZ_ERROR_UNSUPPORTED;
-    switch ((UInt32)c->MethodID)
+
+  for (;;)
+  {
+    size_t dicPos, dicLimit;
+    UInt64 inRem = in.rem;
+    if (dec->dicPos == dec->dicBufSize)
+      dec->dicPos = 0;
+    dicPos = dec->dicPos;
+    dicLimit = SzDecodeDic_GetLimit(dicPos, dec->dicBufSize, outSize - outPos,
+        dec->dic != outBuffer, progress);
+    res = DeflateDec_DecodeToDic(dec, dicLimit, dicLimit - dicPos == outSize - outPos);
+    if (res != SZ_OK)
+      break;
+    SzDecodeDic_Flush(dec->dic, dicPos, dec->dicPos, outBuffer, &outPos, outSize, filter);
+    res = SzProgress_Add(progress, inRem - in.rem, dec->dicPos - dicPos);
+    if (res != SZ_OK)
+      break;
+    if (outPos == outSize)
+      break;
+    if (dec->dicPos == dicPos)
     {
-      case k_BCJ:
-      case k_ARM:
-        break;
-      default:
-        return SZ_ERROR_UNSUPPORTED;
+      res = SZ_ERROR_DATA;
+      break;
     }
-    return SZ_OK;
-  }
-  if (f->NumCoders == 4)
-  {
-    if (!IS_SUPPORTED_CODER(&f->Coders[1]) ||
-        !IS_SUPPORTED_CODER(&f->Coders[2]) ||
-        !IS_BCJ2(&f->Coders[3]))
-      return SZ_ERROR_UNSUPPORTED;
-    if (f->NumPackStreams != 4 ||
-        f->PackStreams[0] != 2 ||
-        f->PackStreams[1] != 6 ||
-        f->PackStreams[2] != 1 ||
-        f->PackStreams[3] != 0 ||
-        f->NumBindPairs != 3 ||
-        f->BindPairs[0].InIndex != 5 || f->BindPairs[0].OutIndex != 0 ||
-        f->BindPairs[1].InIndex != 4 || f->BindPairs[1].OutIndex != 1 ||
-        f->BindPairs[2].InIndex != 3 || f->BindPairs[2].OutIndex != 2)
-      return SZ_ERROR_UNSUPPORTED;
-    return SZ_OK;
   }
-  return SZ_ERROR_UNSUPPORTED;
-}
 
-static UInt64 GetSum(const UInt64 *values, UInt32 index)
-{
-  UInt64 sum = 0;
-  UInt32 i;
-  for (i = 0; i < index; i++)
-    sum += values[i];
-  return sum;
+  if (dec->dic != outBuffer)
+    SzDecodeDic_Free(dec->dic, dec->dicBufSize, pool);
+  else if (filter && res == SZ_OK)
+    SzFilter_Convert(filter, outBuffer, outSize, True);
+  SzFree(dec);
+  return res;
+}
+
+#ifdef _7ZIP_ZSTD
+
+/* Zstandard, as written by 7-Zip ZS: the pack stream is a sequence of zstd
+   frames and skippable frames, the props (3 or 5 bytes) hold the version
+   and level of the encoder. The decoder keeps its own window, so the bytes
+   it has written to outBuffer are final and can be filtered at once. */
+static SRes SzDecodeZstd(CSzCoderInfo *coder, UInt64 inSize, CLookToRead *inStream,
+    Byte *outBuffer, size_t outSize, CSzFilter *filter, CSzProgress *progress)
+{
+  ZSTD_DStream *zs;
+  ZSTD_outBuffer out;
+  SRes res = SZ_OK;
+
+  if (coder->PropsSize != 3 && coder->PropsSize != 5)
+    return SZ_ERROR_UNSUPPORTED;
+  if ((zs = ZSTD_createDStream()) == 0)
+    return SZ_ERROR_MEM;
+  ZSTD_initDStream(zs);
+  out.dst = outBuffer;
+  out.size = outSize;
+  out.pos = 0;
+
+  for (;;)
+  {
+    const void *inBuf = NULL;
+    size_t inLen = inSize > LookToRead_BUF_SIZE_MAX ?
+        LookToRead_BUF_SIZE_MAX : (size_t)inSize;
+    size_t outPos = out.pos, ret;
+    ZSTD_inBuffer in;
+    res = LookToRead_Look(inStream, &inBuf, &inLen);
+    if (res != SZ_OK)
+      break;
+    in.src = inBuf;
+    in.size = inLen < inSize ? inLen : (size_t)inSize;
+    in.pos = 0;
+    out.size = outPos + SzProgress_GetSpan(progress, outSize - outPos);
+    ret = ZSTD_decompressStream(zs, &out, &in);
+    LOOKTOREAD_SKIP(inStream, in.pos);
+    inSize -= in.pos;
+    if (ZSTD_isError(ret))
+    {
+      res = SZ_ERROR_DATA;
+      break;
+    }
+    res = SzProgress_Add(progress, in.pos, out.pos - outPos);
+    if (res != SZ_OK)
+      break;
+    if (filter && out.pos != outPos)
+      SzFilter_Convert(filter, outBuffer, out.pos, out.pos == outSize);
+    /* ret is 0 at the end of a frame. */
+    if (out.pos == outSize && inSize == 0 && ret == 0)
+      break;
+    if (in.pos == 0 && out.pos == outPos)
+    {
+      res = SZ_ERROR_DATA;
+      break;
+    }
+  }
+
+  ZSTD_freeDStream(zs);
+  return res;
+}
+
+#endif
+
+/* ---------- Decoder pool ----------
+
+The model memory of PPMd is the bulk of its state, up to the size in the
+props, and is set up again for every folder anyway. The decoders of a
+folder are taken from the pool of the archive and put back when it's done,
+so the next folder with a model that fits reuses the memory instead of
+allocating it again. BCJ2 workers take decoders concurrently.
+The pool also keeps the statistics of the archive, which the decoders add
+to when they're done. */
+
+#define SZ_POOL_PPMD_MAX 2
+
+typedef struct CSzDecoderPool
+{
+#ifndef _7ZIP_ST
+  CCriticalSection cs;
+#endif
+  CPpmd7 *ppmd[SZ_POOL_PPMD_MAX];  /* idle, with their model memory */
+  CSzArExStats stats;
+  UInt64 memory;  /* in the big buffers of the decodes, for stats.MemoryPeak */
+  UInt32 numFolders;
+  Byte *decoded;  /* a bit for each folder decoded once */
+} CSzDecoderPool;
+
+static CSzDecoderPool *SzDecoderPool_Create(UInt32 numFolders)
+{
+  CSzDecoderPool *p = (CSzDecoderPool *)SzAlloc(sizeof(CSzDecoderPool));
+  if (p == 0)
+    return NULL;
+  memset(p, 0, sizeof(*p));
+  p->numFolders = numFolders;
+  if (numFolders != 0)
+  {
+    p->decoded = (Byte *)SzAlloc((numFolders + 7) >> 3);
+    if (p->decoded == 0)
+    {
+      SzFree(p);
+      return NULL;
+    }
+    memset(p->decoded, 0, (numFolders + 7) >> 3);
+  }
+#ifndef _7ZIP_ST
+  if (CriticalSection_Init(&p->cs) != 0)
+  {
+    SzFree(p->decoded);
+    SzFree(p);
+    return NULL;
+  }
+#endif
+  return p;
+}
+
+static void SzDecoderPool_Free(CSzDecoderPool *p)
+{
+  unsigned i;
+  if (!p)
+    return;
+  for (i = 0; i < SZ_POOL_PPMD_MAX; i++)
+    if (p->ppmd[i])
+    {
+      Ppmd7_Free(p->ppmd[i]);
+      SzFree(p->ppmd[i]);
+    }
+#ifndef _7ZIP_ST
+  CriticalSection_Delete(&p->cs);
+#endif
+  SzFree(p->decoded);
+  SzFree(p);
+}
+
+/* Counts size bytes of a big buffer of a decode as in use. pool can be
+   NULL. */
+static void SzDecoderPool_AddMemory(CSzDecoderPool *pool, size_t size)
+{
+  if (!pool || size == 0)
+    return;
+#ifndef _7ZIP_ST
+  CriticalSection_Enter(&pool->cs);
+#endif
+  pool->memory += size;
+  if (pool->stats.MemoryPeak < pool->memory)
+    pool->stats.MemoryPeak = pool->memory;
+#ifndef _7ZIP_ST
+  CriticalSection_Leave(&pool->cs);
+#endif
+}
+
+/* Counts size bytes added by SzDecoderPool_AddMemory as freed. */
+static void SzDecoderPool_SubMemory(CSzDecoderPool *pool, size_t size)
+{
+  if (!pool || size == 0)
+    return;
+#ifndef _7ZIP_ST
+  CriticalSection_Enter(&pool->cs);
+#endif
+  pool->memory -= size;
+#ifndef _7ZIP_ST
+  CriticalSection_Leave(&pool->cs);
+#endif
+}
+
+/* Returns a PPMd decoder for the props of coder, with the model initialized.
+   pool can be NULL. */
+static SRes SzDecoderPool_TakePpmd(CSzDecoderPool *pool, const CSzCoderInfo *coder, CPpmd7 **ppmd)
+{
+  CPpmd7 *p = NULL;
+  unsigned order;
+  UInt32 memSize;
+
+  *ppmd = NULL;
+  if (coder->PropsSize != 5)
+    return SZ_ERROR_UNSUPPORTED;
+  order = coder->Props[0];
+  memSize = GetUi32(coder->Props + 1);
+  if (order < PPMD7_MIN_ORDER || order > PPMD7_MAX_ORDER ||
+      memSize < PPMD7_MIN_MEM_SIZE || memSize > PPMD7_MAX_MEM_SIZE)
+    return SZ_ERROR_UNSUPPORTED;
+
+  if (pool)
+  {
+    unsigned i, best = SZ_POOL_PPMD_MAX;
+#ifndef _7ZIP_ST
+    CriticalSection_Enter(&pool->cs);
+#endif
+    /* The smallest model memory that fits, else the largest one. */
+    for (i = 0; i < SZ_POOL_PPMD_MAX; i++)
+    {
+      CPpmd7 *c = pool->ppmd[i];
+      if (!c)
+        continue;
+      if (best == SZ_POOL_PPMD_MAX)
+        best = i;
+      else
+      {
+        CPpmd7 *b = pool->ppmd[best];
+        Bool fits = (c->BaseSize >= PPMD7_ALLOC_SIZE(memSize));
+        Bool bestFits = (b->BaseSize >= PPMD7_ALLOC_SIZE(memSize));
+        if (fits ? (!bestFits || c->BaseSize < b->BaseSize) : (!bestFits && c->BaseSize > b->BaseSize))
+          best = i;
+      }
+    }
+    if (best != SZ_POOL_PPMD_MAX)
+    {
+      p = pool->ppmd[best];
+      pool->ppmd[best] = NULL;
+    }
+#ifndef _7ZIP_ST
+    CriticalSection_Leave(&pool->cs);
+#endif
+  }
+
+  if (!p)
+  {
+    if ((p = (CPpmd7 *)SzAlloc(sizeof(CPpmd7))) == 0)
+      return SZ_ERROR_MEM;
+    Ppmd7_Construct(p);
+  }
+  if (!Ppmd7_Alloc(p, memSize))
+  {
+    SzFree(p);
+    return SZ_ERROR_MEM;
+  }
+  Ppmd7_Init(p, order);
+  SzDecoderPool_AddMemory(pool, p->BaseSize);
+  *ppmd = p;
+  return SZ_OK;
+}
+
+static void SzDecoderPool_PutPpmd(CSzDecoderPool *pool, CPpmd7 *p)
+{
+  if (!p)
+    return;
+  SzDecoderPool_SubMemory(pool, p->BaseSize);
+  if (pool)
+  {
+    unsigned i;
+#ifndef _7ZIP_ST
+    CriticalSection_Enter(&pool->cs);
+#endif
+    for (i = 0; i < SZ_POOL_PPMD_MAX; i++)
+      if (!pool->ppmd[i])
+      {
+        pool->ppmd[i] = p;
+        p = NULL;
+        break;
+      }
+#ifndef _7ZIP_ST
+    CriticalSection_Leave(&pool->cs);
+#endif
+  }
+  if (p)
+  {
+    Ppmd7_Free(p);
+    SzFree(p);
+  }
+}
+
+#define SZ_STATS_CRC SZ_STATS_NUM_CODERS
+
+static unsigned SzStats_GetCoder(UInt64 methodID)
+{
+  switch (methodID)
+  {
+    case k_Copy: return SZ_STATS_COPY;
+    case k_LZMA: return SZ_STATS_LZMA;
+    case k_LZMA2: return SZ_STATS_LZMA2;
+    case k_Deflate:
+    case k_Deflate64: return SZ_STATS_DEFLATE;
+    case k_PPMD: return SZ_STATS_PPMD;
+    case k_ZSTD: return SZ_STATS_ZSTD;
+    case k_BCJ: return SZ_STATS_BCJ;
+    case k_BCJ2: return SZ_STATS_BCJ2;
+  }
+  return SZ_STATS_FILTER;
+}
+
+/* Adds to the counter of a coder kind or SZ_STATS_CRC. pool can be NULL. */
+static void SzDecoderPool_AddTime(CSzDecoderPool *pool, unsigned kind, UInt64 bytes, UInt64 time)
+{
+  CSzStatsCounter *c;
+  if (!pool)
+    return;
+  c = (kind == SZ_STATS_CRC) ? &pool->stats.Crc : &pool->stats.Coders[kind];
+#ifndef _7ZIP_ST
+  CriticalSection_Enter(&pool->cs);
+#endif
+  c->Bytes += bytes;
+  c->Time += time;
+#ifndef _7ZIP_ST
+  CriticalSection_Leave(&pool->cs);
+#endif
+}
+
+/* Counts a decode of a folder, whole or streamed, and its pack streams. */
+static void SzDecoderPool_AddFolder(CSzDecoderPool *pool, UInt32 folderIndex, UInt64 packSize)
+{
+  if (!pool || folderIndex >= pool->numFolders)
+    return;
+#ifndef _7ZIP_ST
+  CriticalSection_Enter(&pool->cs);
+#endif
+  pool->stats.InputBytes += packSize;
+  pool->stats.FolderDecodes++;
+  if (pool->decoded[folderIndex >> 3] & (1 << (folderIndex & 7)))
+    pool->stats.FolderRedecodes++;
+  pool->decoded[folderIndex >> 3] |= (Byte)(1 << (folderIndex & 7));
+#ifndef _7ZIP_ST
+  CriticalSection_Leave(&pool->cs);
+#endif
+}
+
+/* Decodes size bytes to dest. An error is kept in rc->res: the model
+   can't go on after a symbol that failed. */
+static SRes SzPpmd_Decode(CPpmd7 *ppmd, CPpmd7z_RangeDec *rc, Byte *dest, size_t size)
+{
+  size_t i;
+  if (rc->res != SZ_OK)
+    return rc->res;
+  for (i = 0; i < size; i++)
+  {
+    int sym = Ppmd7_DecodeSymbol(ppmd, rc);
+    if (sym < 0 || rc->extra)
+      break;
+    dest[i] = (Byte)sym;
+  }
+  if (rc->res == SZ_OK && i != size)
+    rc->res = SZ_ERROR_DATA;
+  return rc->res;
+}
+
+/* At the end of the output, the range coder must be flushed and its input
+   fully read. */
+static SRes SzPpmd_Finish(CPpmd7z_RangeDec *rc)
+{
+  const Byte *buf;
+  size_t size;
+  if (!Ppmd7z_RangeDec_IsFinishedOK(rc) || rc->cur != rc->lim)
+    return rc->res = SZ_ERROR_DATA;
+  rc->in->Skip(rc->in, (size_t)(rc->cur - rc->start));
+  rc->start = rc->cur;
+  RINOK(rc->in->Look(rc->in, &buf, &size));
+  if (size != 0)
+    rc->res = SZ_ERROR_DATA;
+  return rc->res;
+}
+
+/* PPMd writes bytes straight to outBuffer, so it's filtered span by span
+   like Copy. */
+static SRes SzDecodePpmd(CSzCoderInfo *coder, UInt64 inSize, CLookToRead *inStream,
+    Byte *outBuffer, size_t outSize, CSzFilter *filter, CSzProgress *progress,
+    CSzDecoderPool *pool)
+{
+  CPpmd7 *ppmd;
+  CPpmd7z_RangeDec rc;
+  CSzPackIn in;
+  size_t pos = 0;
+  SRes res = SZ_OK;
+
+  RINOK(SzDecoderPool_TakePpmd(pool, coder, &ppmd));
+  in.vt.Look = SzPackIn_Look;
+  in.vt.Skip = SzPackIn_Skip;
+  in.stream = inStream;
+  in.rem = inSize;
+  if (!Ppmd7z_RangeDec_Init(&rc, &in.vt))
+    res = rc.res != SZ_OK ? rc.res : SZ_ERROR_DATA;
+  while (res == SZ_OK && pos != outSize)
+  {
+    size_t limit = (filter && outSize - pos > SZ_FILTER_SPAN_SIZE) ?
+        pos + SZ_FILTER_SPAN_SIZE : outSize;
+    /* The range decoder skips its input only when it looks for more. */
+    UInt64 inPos = inSize - in.rem + (size_t)(rc.cur - rc.start);
+    limit = pos + SzProgress_GetSpan(progress, limit - pos);
+    res = SzPpmd_Decode(ppmd, &rc, outBuffer + pos, limit - pos);
+    if (res == SZ_OK)
+      res = SzProgress_Add(progress,
+          inSize - in.rem + (size_t)(rc.cur - rc.start) - inPos, limit - pos);
+    pos = limit;
+    if (res == SZ_OK && filter)
+      SzFilter_Convert(filter, outBuffer, pos, pos == outSize);
+  }
+  if (res == SZ_OK)
+    res = SzPpmd_Finish(&rc);
+  SzDecoderPool_PutPpmd(pool, ppmd);
+  return res;
+}
+
+static Bool IS_MAIN_METHOD(UInt32 m)
+{
+  switch(m)
+  {
+    case k_Copy:
+    case k_LZMA:
+    case k_LZMA2:
+    case k_Deflate:
+    case k_Deflate64:
+    case k_PPMD:
+#ifdef _7ZIP_ZSTD
+    case k_ZSTD:
+#endif
+      return True;
+  }
+  return False;
+}
+
+static Bool IS_FILTER_METHOD(UInt32 m)
+{
+  switch(m)
+  {
+    case k_BCJ:
+    case k_ARM:
+    case k_ARMT:
+    case k_ARM64:
+    case k_RISCV:
+    case k_PPC:
+    case k_SPARC:
+    case k_IA64:
+    case k_Delta:
+      return True;
+  }
+  return False;
+}
+
+static Bool IS_SUPPORTED_CODER(const CSzCoderInfo *c)
+{
+  if (c->MethodID > (UInt32)0xFFFFFFFF || c->NumOutStreams != 1)
+    return False;
+  if (c->MethodID == k_BCJ2)
+    return c->NumInStreams == 4;
+  return
+      c->NumInStreams == 1 &&
+      (IS_MAIN_METHOD((UInt32)c->MethodID) || IS_FILTER_METHOD((UInt32)c->MethodID));
+}
+
+#define IS_FILTER(c) IS_FILTER_METHOD((UInt32)(c)->MethodID)
+
+/* ---------- Coder graph ----------
+
+A folder is a tree of coders. Every supported coder has one output stream,
+so the output stream of coder i has index i. Each input stream is either
+bound to the output of another coder or is a pack stream; the input
+streams of coder i follow the ones of coders 0..i-1. The output that isn't
+bound is the folder's unpacked data.
+
+A coder's output is decoded by taking the chain of filters above it, down
+to a main coder, BCJ2 or a pack stream (the base), and running the chain
+over each span the base produces. Inputs which are outputs of other coders
+are decoded first to temporary buffers. */
+
+typedef struct
+{
+  const CSzFolder *folder;
+  const UInt64 *packSizes;
+  CLookToRead *inStream;
+  UInt64 startPos;
+  CSzDecoderPool *pool;  /* can be NULL */
+  CSzProgress *progress;  /* can be NULL */
+  Bool timed;  /* the coders are timed, for the trace or the stats */
+  UInt32 inStart[NUM_FOLDER_CODERS_MAX + 1];
+} CSzFolderDec;
+
+/* Returns the source of an input stream: a coder index, or
+   (NUM_FOLDER_CODERS_MAX + pack stream index). */
+static UInt32 SzFolderDec_GetSource(const CSzFolderDec *p, UInt32 inIndex)
+{
+  const CSzFolder *f = p->folder;
+  UInt32 i;
+  for (i = 0; i < f->NumBindPairs; i++)
+    if (f->BindPairs[i].InIndex == inIndex)
+      return f->BindPairs[i].OutIndex;
+  for (i = 0; i < f->NumPackStreams; i++)
+    if (f->PackStreams[i] == inIndex)
+      break;
+  return NUM_FOLDER_CODERS_MAX + i;
+}
+
+#define SZ_SOURCE_IS_PACK(src) ((src) >= NUM_FOLDER_CODERS_MAX)
+
+static UInt64 GetSum(const UInt64 *values, UInt32 index)
+{
+  UInt64 sum = 0;
+  UInt32 i;
+  for (i = 0; i < index; i++)
+    sum += values[i];
+  return sum;
+}
+
+/* Checks that the coders are supported, and that the bind pairs and pack
+   streams make a tree with every coder in it. Returns the root coder. */
+static SRes SzFolderDec_Init(CSzFolderDec *p, const CSzFolder *f, UInt32 *root)
+{
+  UInt32 i, numInStreams = 0;
+  Byte used[NUM_FOLDER_CODERS_MAX];
+  Byte boundIn[NUM_FOLDER_CODERS_MAX * 4];
+  UInt32 stack[NUM_FOLDER_CODERS_MAX], numStack = 0, numVisited = 0;
+
+  p->folder = f;
+  if (f->NumCoders < 1 || f->NumCoders > NUM_FOLDER_CODERS_MAX)
+    return SZ_ERROR_UNSUPPORTED;
+  for (i = 0; i < f->NumCoders; i++)
+  {
+    if (!IS_SUPPORTED_CODER(&f->Coders[i]))
+      return SZ_ERROR_UNSUPPORTED;
+    p->inStart[i] = numInStreams;
+    numInStreams += f->Coders[i].NumInStreams;
+    used[i] = 0;
+  }
+  p->inStart[i] = numInStreams;
+  if (f->NumBindPairs != f->NumCoders - 1 ||
+      f->NumBindPairs + f->NumPackStreams != numInStreams)
+    return SZ_ERROR_UNSUPPORTED;
+
+  /* Every input is either bound once or is a pack stream once, and every
+     output but the root is bound once. */
+  memset(boundIn, 0, numInStreams);
+  for (i = 0; i < f->NumBindPairs; i++)
+  {
+    const CSzBindPair *bp = &f->BindPairs[i];
+    if (bp->InIndex >= numInStreams || bp->OutIndex >= f->NumCoders ||
+        boundIn[bp->InIndex] || used[bp->OutIndex])
+      return SZ_ERROR_UNSUPPORTED;
+    boundIn[bp->InIndex] = 1;
+    used[bp->OutIndex] = 1;
+  }
+  for (i = 0; i < f->NumPackStreams; i++)
+  {
+    if (f->PackStreams[i] >= numInStreams || boundIn[f->PackStreams[i]])
+      return SZ_ERROR_UNSUPPORTED;
+    boundIn[f->PackStreams[i]] = 1;
+  }
+  for (i = 0; i < f->NumCoders && used[i]; i++);
+  if (i == f->NumCoders)
+    return SZ_ERROR_UNSUPPORTED;
+  *root = i;
+
+  /* Each coder is reached once from the root: there are no cycles. */
+  memset(used, 0, f->NumCoders);
+  stack[numStack++] = *root;
+  while (numStack != 0)
+  {
+    UInt32 ci = stack[--numStack], j;
+    if (used[ci])
+      return SZ_ERROR_UNSUPPORTED;
+    used[ci] = 1;
+    numVisited++;
+    for (j = p->inStart[ci]; j < p->inStart[ci + 1]; j++)
+    {
+      UInt32 src = SzFolderDec_GetSource(p, j);
+      if (!SZ_SOURCE_IS_PACK(src))
+      {
+        if (numStack == NUM_FOLDER_CODERS_MAX)
+          return SZ_ERROR_UNSUPPORTED;
+        stack[numStack++] = src;
+      }
+    }
+  }
+  return (numVisited == f->NumCoders) ? SZ_OK : SZ_ERROR_UNSUPPORTED;
+}
+
+static SRes SzFolderDec_DecodeOut(CSzFolderDec *p, UInt32 src, Byte *outBuffer, size_t outSize);
+
+/* Frees a buffer of SzFolderDec_DecodeToTemp. */
+static void SzFolderDec_FreeTemp(CSzFolderDec *p, Byte *buf, size_t size)
+{
+  if (!buf)
+    return;
+  SzDecoderPool_SubMemory(p->pool, size);
+  SzFree(buf);
+}
+
+/* Decodes a source to a new buffer of its unpack size. */
+static SRes SzFolderDec_DecodeToTemp(CSzFolderDec *p, UInt32 src, Byte **buf, size_t *size)
+{
+  UInt64 unpackSize = SZ_SOURCE_IS_PACK(src) ?
+      p->packSizes[src - NUM_FOLDER_CODERS_MAX] : p->folder->UnpackSizes[src];
+  SRes res;
+  *size = (size_t)unpackSize;
+  if (*size != unpackSize)
+    return SZ_ERROR_MEM;
+  *buf = (Byte *)SzAlloc(*size);
+  if (*buf == 0 && *size != 0)
+    return SZ_ERROR_MEM;
+  SzDecoderPool_AddMemory(p->pool, *size);
+  res = SzFolderDec_DecodeOut(p, src, *buf, *size);
+  if (res != SZ_OK)
+  {
+    SzFolderDec_FreeTemp(p, *buf, *size);
+    *buf = 0;
+  }
+  return res;
+}
+
+/* Decodes the input of a main coder through the chain of filters. */
+static SRes SzFolderDec_DecodeMain(CSzFolderDec *p, UInt32 ci,
+    Byte *outBuffer, size_t outSize, CSzFilter *filter)
+{
+  CSzCoderInfo *coder = &p->folder->Coders[ci];
+  UInt32 src = SzFolderDec_GetSource(p, p->inStart[ci]);
+  CLookToRead memStream, *inStream = p->inStream;
+  Byte *temp = 0;
+  UInt64 inSize, time;
+  SRes res;
+
+  if (SZ_SOURCE_IS_PACK(src))
+  {
+    UInt32 pi = src - NUM_FOLDER_CODERS_MAX;
+    inSize = p->packSizes[pi];
+    RINOK(LookInStream_SeekTo(inStream, p->startPos + GetSum(p->packSizes, pi)));
+  }
+  else
+  {
+    /* The input is the output of another coder: it's decoded to memory,
+       which this coder then reads like an archive in memory. */
+    size_t size;
+    RINOK(SzFolderDec_DecodeToTemp(p, src, &temp, &size));
+    LOOKTOREAD_INIT(&memStream);
+    memStream.data = temp;
+    memStream.data_len = size;
+    inStream = &memStream;
+    inSize = size;
+  }
+
+  if (SZ_TRACE_ON)
+    SzTrace_CoderStart(coder->MethodID, outSize);
+  time = p->timed ? SzTime_Now() : 0;
+  if (coder->MethodID == k_Copy)
+  {
+    res = SzDecodeCopy(inSize, inStream, outBuffer, outSize, filter, p->progress);
+  }
+  else if (coder->MethodID == k_LZMA)
+  {
+    res = SzDecodeLzma(coder, inSize, inStream, outBuffer, outSize, filter, p->progress, p->pool);
+  }
+  else if (coder->MethodID == k_Deflate || coder->MethodID == k_Deflate64)
+  {
+    res = SzDecodeDeflate(coder, inSize, inStream, outBuffer, outSize, filter, p->progress, p->pool);
+  }
+  else if (coder->MethodID == k_PPMD)
+  {
+    res = SzDecodePpmd(coder, inSize, inStream, outBuffer, outSize, filter, p->progress, p->pool);
+  }
+#ifdef _7ZIP_ZSTD
+  else if (coder->MethodID == k_ZSTD)
+  {
+    res = SzDecodeZstd(coder, inSize, inStream, outBuffer, outSize, filter, p->progress);
+  }
+#endif
+  else
+  {
+    res = SzDecodeLzma2(coder, inSize, inStream, outBuffer, outSize, filter, p->progress, p->pool);
+  }
+  /* The filters applied to the output have their own time. */
+  if (p->timed)
+    time = SzTime_Now() - time - SzFilter_GetTime(filter);
+  if (SZ_TRACE_ON)
+    SzTrace_CoderEnd(coder->MethodID, outSize, res, time);
+  if (res == SZ_OK)
+    SzDecoderPool_AddTime(p->pool, SzStats_GetCoder(coder->MethodID), outSize, time);
+
+  if (temp)
+  {
+    LookToRead_Free(&memStream);
+    SzFolderDec_FreeTemp(p, temp, (size_t)inSize);
+  }
+  return res;
+}
+
+#ifndef _7ZIP_ST
+
+/* The call, jump and range coder inputs of BCJ2 are independent of the main
+   input, so the ones produced by coders are decoded on their own threads
+   while the calling thread decodes the main input. Smaller inputs aren't
+   worth a thread. */
+#define SZ_BCJ2_THREAD_MIN (1 << 16)
+
+typedef struct
+{
+  CSzFolderDec dec;  /* dec.inStream is stream */
+  CLookToRead stream;
+  UInt32 src;
+  Byte *buf;
+  size_t size;
+  SRes res;
+  CThread thread;
+} CSzBcj2Worker;
+
+static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE Bcj2Worker_ThreadFunc(void *param)
+{
+  CSzBcj2Worker *w = (CSzBcj2Worker *)param;
+  w->res = SzFolderDec_DecodeToTemp(&w->dec, w->src, &w->buf, &w->size);
+  return 0;
+}
+
+/* Starts a worker for a BCJ2 input. Returns False if it's decoded by the
+   calling thread. */
+static Bool SzFolderDec_StartBcj2Worker(CSzFolderDec *p, UInt32 src, CSzBcj2Worker *w)
+{
+  const CSzFolder *f = p->folder;
+  if (SZ_SOURCE_IS_PACK(src) || f->UnpackSizes[src] < SZ_BCJ2_THREAD_MIN ||
+      LookToRead_Clone(&w->stream, p->inStream, p->startPos,
+          p->startPos + GetSum(p->packSizes, f->NumPackStreams)) != SZ_OK)
+    return False;
+  w->dec = *p;
+  w->dec.inStream = &w->stream;
+  w->dec.progress = NULL;  /* only the calling thread reports it */
+  w->src = src;
+  w->buf = 0;
+  w->size = 0;
+  w->res = SZ_OK;
+  if (Thread_Create(&w->thread, Bcj2Worker_ThreadFunc, w) != 0)
+  {
+    LookToRead_Free(&w->stream);
+    return False;
+  }
+  return True;
+}
+
+#endif
+
+/* Decodes the four inputs of BCJ2 and then BCJ2 itself. The main input is
+   decoded to the end of outBuffer, which Bcj2_Decode allows. */
+static SRes SzFolderDec_DecodeBcj2(CSzFolderDec *p, UInt32 ci,
+    Byte *outBuffer, size_t outSize, CSzFilter *filter)
+{
+  Byte *bufs[4] = { 0, 0, 0, 0 };
+  size_t sizes[4] = { 0, 0, 0, 0 };
+  SRes res = SZ_OK;
+  unsigned i;
+#ifndef _7ZIP_ST
+  CSzBcj2Worker workers[4];
+  Bool started[4] = { False, False, False, False };
+#endif
+#ifndef _7ZIP_ST
+  for (i = 1; i < 4; i++)
+    started[i] = SzFolderDec_StartBcj2Worker(p, SzFolderDec_GetSource(p, p->inStart[ci] + i), &workers[i]);
+#endif
+  for (i = 0; i < 4 && res == SZ_OK; i++)
+  {
+    UInt32 src = SzFolderDec_GetSource(p, p->inStart[ci] + i);
+#ifndef _7ZIP_ST
+    if (started[i])
+      continue;
+#endif
+    if (i == 0 && !SZ_SOURCE_IS_PACK(src))
+    {
+      UInt64 unpackSize = p->folder->UnpackSizes[src];
+      if (unpackSize > outSize) /* check it */
+        res = SZ_ERROR_PARAM;
+      else
+      {
+        sizes[0] = (size_t)unpackSize;
+        res = SzFolderDec_DecodeOut(p, src, outBuffer + (outSize - sizes[0]), sizes[0]);
+      }
+    }
+    else
+      res = SzFolderDec_DecodeToTemp(p, src, &bufs[i], &sizes[i]);
+  }
+#ifndef _7ZIP_ST
+  /* The workers are always joined, even if the calling thread failed. */
+  for (i = 1; i < 4; i++)
+    if (started[i])
+    {
+      Thread_Wait(&workers[i].thread);
+      LookToRead_Free(&workers[i].stream);
+      bufs[i] = workers[i].buf;
+      sizes[i] = workers[i].size;
+      if (res == SZ_OK)
+        res = workers[i].res;
+    }
+#endif
+  if (res == SZ_OK)
+  {
+    UInt64 time;
+    if (SZ_TRACE_ON)
+      SzTrace_CoderStart(k_BCJ2, outSize);
+    time = p->timed ? SzTime_Now() : 0;
+    res = Bcj2_Decode(
+        bufs[0] ? bufs[0] : outBuffer + (outSize - sizes[0]), sizes[0],
+        bufs[1], sizes[1],
+        bufs[2], sizes[2],
+        bufs[3], sizes[3],
+        outBuffer, outSize);
+    if (p->timed)
+      time = SzTime_Now() - time;
+    if (SZ_TRACE_ON)
+      SzTrace_CoderEnd(k_BCJ2, outSize, res, time);
+    if (res == SZ_OK)
+      SzDecoderPool_AddTime(p->pool, SZ_STATS_BCJ2, outSize, time);
+  }
+  if (res == SZ_OK && filter)
+    SzFilter_Convert(filter, outBuffer, outSize, True);
+  for (i = 0; i < 4; i++)
+    SzFolderDec_FreeTemp(p, bufs[i], sizes[i]);
+  return res;
+}
+
+static SRes SzFolderDec_DecodeOut(CSzFolderDec *p, UInt32 src, Byte *outBuffer, size_t outSize)
+{
+  const CSzFolder *f = p->folder;
+  CSzFilter *filters = NULL, *chain = NULL;
+  UInt32 numFilters = 0, i;
+  SRes res;
+
+  for (i = src; !SZ_SOURCE_IS_PACK(i) && IS_FILTER(&f->Coders[i]);
+      i = SzFolderDec_GetSource(p, p->inStart[i]))
+    numFilters++;
+
+  if (numFilters != 0)
+  {
+    filters = (CSzFilter *)SzAlloc(numFilters * sizeof(CSzFilter));
+    if (filters == 0)
+      return SZ_ERROR_MEM;
+    /* The filter nearest to the base runs first. */
+    for (numFilters = 0, i = src; !SZ_SOURCE_IS_PACK(i) && IS_FILTER(&f->Coders[i]);
+        i = SzFolderDec_GetSource(p, p->inStart[i]), numFilters++)
+    {
+      res = SzFilter_Init(&filters[numFilters], &f->Coders[i]);
+      if (res != SZ_OK)
+      {
+        SzFree(filters);
+        return res;
+      }
+      filters[numFilters].timed = p->timed;
+      filters[numFilters].next = chain;
+      chain = &filters[numFilters];
+    }
+    if (SZ_TRACE_ON)
+      for (i = src; !SZ_SOURCE_IS_PACK(i) && IS_FILTER(&f->Coders[i]);
+          i = SzFolderDec_GetSource(p, p->inStart[i]))
+        SzTrace_CoderStart(f->Coders[i].MethodID, outSize);
+  }
+
+  if (SZ_SOURCE_IS_PACK(i))
+  {
+    /* A pack stream that is the output: it's copied. */
+    UInt32 pi = i - NUM_FOLDER_CODERS_MAX;
+    UInt64 time = p->timed ? SzTime_Now() : 0;
+    res = LookInStream_SeekTo(p->inStream, p->startPos + GetSum(p->packSizes, pi));
+    if (res == SZ_OK)
+      res = SzDecodeCopy(p->packSizes[pi], p->inStream, outBuffer, outSize, chain, p->progress);
+    if (p->timed)
+      time = SzTime_Now() - time - SzFilter_GetTime(chain);
+    if (res == SZ_OK)
+      SzDecoderPool_AddTime(p->pool, SZ_STATS_COPY, outSize, time);
+  }
+  else if (f->Coders[i].MethodID == k_BCJ2)
+    res = SzFolderDec_DecodeBcj2(p, i, outBuffer, outSize, chain);
+  else
+    res = SzFolderDec_DecodeMain(p, i, outBuffer, outSize, chain);
+
+  for (chain = filters + numFilters; chain != filters; )
+  {
+    chain--;
+    if (SZ_TRACE_ON)
+      SzTrace_CoderEnd(chain->methodID, outSize, res, chain->time);
+    if (res == SZ_OK)
+      SzDecoderPool_AddTime(p->pool, SzStats_GetCoder(chain->methodID), outSize, chain->time);
+  }
+  SzFree(filters);
+  return res;
 }
 
 static SRes SzFolder_Decode2(const CSzFolder *folder, const UInt64 *packSizes,
+    CLookToRead *inStream, UInt64 startPos, CSzDecoderPool *pool, Bool timeStats,
+    ICompressProgress *progress, UInt64 progressStep,
+    Byte *outBuffer, size_t outSize)
+{
+  CSzFolderDec p;
+  CSzProgress pr;
+  UInt32 root;
+  RINOK(SzFolderDec_Init(&p, folder, &root));
+  SzProgress_Init(&pr, progress, progressStep);
+  p.packSizes = packSizes;
+  p.inStream = inStream;
+  p.startPos = startPos;
+  p.pool = pool;
+  p.progress = progress ? &pr : NULL;
+  p.timed = SZ_TRACE_ON || timeStats;
+  return SzFolderDec_DecodeOut(&p, root, outBuffer, outSize);
+}
+
+STATIC SRes SzFolder_Decode(const CSzFolder *folder, const UInt64 *packSizes,
+    CLookToRead *inStream, UInt64 startPos,
+    Byte *outBuffer, size_t outSize)
+{
+  return SzFolder_Decode2(folder, packSizes, inStream, startPos, NULL, False, NULL, 0, outBuffer, outSize);
+}
+
+STATIC SRes SzFolder_DecodeProgress(const CSzFolder *folder, const UInt64 *packSizes,
     CLookToRead *inStream, UInt64 startPos,
     Byte *outBuffer, size_t outSize,
-    Byte *tempBuf[])
+    ICompressProgress *progress, UInt64 progressStep)
+{
+  return SzFolder_Decode2(folder, packSizes, inStream, startPos, NULL, False,
+      progress, progressStep, outBuffer, outSize);
+}
+
+/* ---------- Streaming folder decoder ----------
+
+Each source that is read in the coder graph (a pack stream, or a main coder
+or BCJ2 with the chain of filters above it) is a node. A node hands out its
+output through Look/Skip, like CLookToRead: unfiltered output straight from
+the pack stream or from the LZMA or Deflate dictionary, and filtered,
+BCJ2 or PPMd output from a buffer of SZ_STREAM_BUF_SIZE bytes. The dictionaries are
+rings of at most dicSize bytes, so a folder needs about the sum of its
+dictionaries however large it is. */
+
+#define SZ_STREAM_BUF_SIZE (1 << 16)
+
+/* The input of a Deflate or PPMd node: the output of node. */
+typedef struct
+{
+  ILookIn vt;
+  struct CSzStreamNode *node;
+} CSzNodeIn;
+
+typedef struct CSzStreamNode
+{
+  Bool isPack;
+  UInt32 methodID;
+  UInt64 outRem;  /* output of the base not released yet */
+  struct CSzStreamNode *inputs[4];
+  CLookToRead stream;  /* pack */
+  CLzma2Dec lzma;  /* LZMA uses lzma.decoder */
+  size_t dicReadPos;  /* also for deflate */
+  CDeflateDec *deflate;
+  CSzNodeIn nodeIn;
+  CPpmd7 *ppmd;
+  CPpmd7z_RangeDec ppmdRc;  /* ppmdRc.in is set at the first span */
+  CBcj2Dec bcj2;
+  const Byte *bcj2Starts[4];
+#ifdef _7ZIP_ZSTD
+  ZSTD_DStream *zstd;
+  size_t zstdRet;  /* the last result of ZSTD_decompressStream, 0 at the end of a frame */
+#endif
+  CSzFilter *filter;
+  CSzFilter *lastFilter;
+  /* window[pos, lim) can be read. With buf, window is buf and buf[lim, size)
+     waits for the filters. BCJ2, PPMd and Zstd nodes always decode to buf. */
+  const Byte *window;
+  size_t pos;
+  size_t lim;
+  Byte *buf;
+  size_t size;
+} CSzStreamNode;
+
+struct CSzFolderStream
+{
+  CSzFolderDec dec;
+  CSzStreamNode *nodes;
+  UInt32 numNodes;
+  CSzFilter *filters;
+  UInt32 numFilters;
+  CSzStreamNode *root;
+  UInt32 crc;
+};
+
+static SRes SzStreamNode_Look(CSzStreamNode *p, const Byte **buf, size_t *size);
+
+static void SzStreamNode_Skip(CSzStreamNode *p, size_t size)
+{
+  p->pos += size;
+}
+
+/* Decodes the next span of an LZMA or LZMA2 stream to the dictionary. */
+static SRes SzStreamNode_DecodeLzma(CSzStreamNode *p)
+{
+  CLzmaDec *dec = &p->lzma.decoder;
+  CSzStreamNode *in = p->inputs[0];
+  size_t start, dicLimit;
+  ELzmaStatus status;
+
+  if (dec->dicPos == dec->dicBufSize)
+    dec->dicPos = p->dicReadPos = 0;
+  start = dec->dicPos;
+  dicLimit = dec->dicBufSize - start;
+  if (dicLimit > p->outRem)
+    dicLimit = (size_t)p->outRem;
+  if (dicLimit > SZ_STREAM_BUF_SIZE)
+    dicLimit = SZ_STREAM_BUF_SIZE;
+  dicLimit += start;
+
+  for (;;)
+  {
+    const Byte *inBuf;
+    size_t inSize, dicPos = dec->dicPos;
+    ELzmaFinishMode finishMode = (dicLimit - start == p->outRem) ? LZMA_FINISH_END : LZMA_FINISH_ANY;
+    SRes res;
+    RINOK(SzStreamNode_Look(in, &inBuf, &inSize));
+    if (p->methodID == k_LZMA)
+      res = LzmaDec_DecodeToDic(dec, dicLimit, inBuf, &inSize, finishMode, &status);
+    else
+      res = Lzma2Dec_DecodeToDic(&p->lzma, dicLimit, inBuf, &inSize, finishMode, &status);
+    SzStreamNode_Skip(in, inSize);
+    RINOK(res);
+    if (dec->dicPos == dicLimit && status != LZMA_STATUS_NEEDS_MORE_INPUT)
+      break;
+    if (inSize == 0 && dec->dicPos == dicPos)
+      return SZ_ERROR_DATA;
+  }
+
+  if (dicLimit - start == p->outRem)
+  {
+    /* The end: the stream must be finished and fully read. */
+    const Byte *inBuf;
+    size_t inSize;
+    if (status != LZMA_STATUS_FINISHED_WITH_MARK &&
+        (p->methodID != k_LZMA || status != LZMA_STATUS_MAYBE_FINISHED_WITHOUT_MARK))
+      return SZ_ERROR_DATA;
+    RINOK(SzStreamNode_Look(in, &inBuf, &inSize));
+    if (inSize != 0)
+      return SZ_ERROR_DATA;
+  }
+  return SZ_OK;
+}
+
+static SRes SzNodeIn_Look(void *pp, const Byte **buf, size_t *size)
+{
+  return SzStreamNode_Look(((CSzNodeIn *)pp)->node, buf, size);
+}
+
+static void SzNodeIn_Skip(void *pp, size_t size)
+{
+  SzStreamNode_Skip(((CSzNodeIn *)pp)->node, size);
+}
+
+/* Decodes the next span of a Deflate stream to the dictionary. */
+static SRes SzStreamNode_DecodeDeflate(CSzStreamNode *p)
+{
+  CDeflateDec *dec = p->deflate;
+  size_t start, dicLimit;
+
+  if (dec->dicPos == dec->dicBufSize)
+    dec->dicPos = p->dicReadPos = 0;
+  start = dec->dicPos;
+  dicLimit = dec->dicBufSize - start;
+  if (dicLimit > p->outRem)
+    dicLimit = (size_t)p->outRem;
+  if (dicLimit > SZ_STREAM_BUF_SIZE)
+    dicLimit = SZ_STREAM_BUF_SIZE;
+  RINOK(DeflateDec_DecodeToDic(dec, start + dicLimit, dicLimit == p->outRem));
+  return dec->dicPos == start ? SZ_ERROR_DATA : SZ_OK;
+}
+
+/* Returns the output of the base that isn't released yet, at least one
+   byte if the base isn't finished. */
+static SRes SzStreamNode_Produce(CSzStreamNode *p, const Byte **buf, size_t *size)
+{
+  *size = 0;
+  if (p->outRem == 0)
+    return SZ_OK;
+  if (p->isPack)
+  {
+    size_t n = p->outRem < LookToRead_BUF_SIZE ? (size_t)p->outRem : LookToRead_BUF_SIZE;
+    RINOK(LookToRead_Look(&p->stream, (const void **)buf, &n));
+    if (n == 0)
+      return SZ_ERROR_INPUT_EOF;
+    *size = n < p->outRem ? n : (size_t)p->outRem;
+  }
+  else if (p->methodID == k_Copy)
+  {
+    RINOK(SzStreamNode_Look(p->inputs[0], buf, size));
+    if (*size == 0)
+      return SZ_ERROR_DATA;
+    if (*size > p->outRem)
+      *size = (size_t)p->outRem;
+  }
+  else if (p->deflate)
+  {
+    CDeflateDec *dec = p->deflate;
+    if (p->dicReadPos == dec->dicPos)
+      RINOK(SzStreamNode_DecodeDeflate(p));
+    *buf = dec->dic + p->dicReadPos;
+    *size = dec->dicPos - p->dicReadPos;
+  }
+  else
+  {
+    CLzmaDec *dec = &p->lzma.decoder;
+    if (p->dicReadPos == dec->dicPos)
+      RINOK(SzStreamNode_DecodeLzma(p));
+    *buf = dec->dic + p->dicReadPos;
+    *size = dec->dicPos - p->dicReadPos;
+  }
+  return SZ_OK;
+}
+
+/* Releases size bytes returned by SzStreamNode_Produce. */
+static void SzStreamNode_Release(CSzStreamNode *p, size_t size)
+{
+  if (p->isPack)
+    LOOKTOREAD_SKIP(&p->stream, size);
+  else if (p->methodID == k_Copy)
+    SzStreamNode_Skip(p->inputs[0], size);
+  else
+    p->dicReadPos += size;
+  p->outRem -= size;
+}
+
+/* Decodes BCJ2 to dest[0, size), pulling its inputs as they run out. */
+static SRes SzStreamNode_DecodeBcj2(CSzStreamNode *p, Byte *dest, size_t size)
+{
+  CBcj2Dec *d = &p->bcj2;
+  d->dest = dest;
+  d->destLim = dest + size;
+  for (;;)
+  {
+    const Byte *buf;
+    unsigned s;
+    Bcj2Dec_Decode(d);
+    if (d->need == BCJ2_NEED_OUT)
+      return SZ_OK;
+    s = d->need;
+    SzStreamNode_Skip(p->inputs[s], d->bufs[s] - p->bcj2Starts[s]);
+    p->bcj2Starts[s] = d->bufs[s];
+    RINOK(SzStreamNode_Look(p->inputs[s], &buf, &size));
+    if (size == 0)
+      return SZ_ERROR_DATA;
+    d->bufs[s] = p->bcj2Starts[s] = buf;
+    d->lims[s] = buf + size;
+  }
+}
+
+/* Decodes PPMd to dest[0, size). The last call checks the end of the input. */
+static SRes SzStreamNode_DecodePpmd(CSzStreamNode *p, Byte *dest, size_t size)
+{
+  CPpmd7z_RangeDec *rc = &p->ppmdRc;
+  if (!rc->in && !Ppmd7z_RangeDec_Init(rc, &p->nodeIn.vt) && rc->res == SZ_OK)
+    rc->res = SZ_ERROR_DATA;
+  RINOK(SzPpmd_Decode(p->ppmd, rc, dest, size));
+  if (p->outRem == size)
+    return SzPpmd_Finish(rc);
+  return SZ_OK;
+}
+
+#ifdef _7ZIP_ZSTD
+
+/* Decodes Zstd to dest[0, size). The last call also reads the rest of the
+   input, which must end on a frame boundary. */
+static SRes SzStreamNode_DecodeZstd(CSzStreamNode *p, Byte *dest, size_t size)
+{
+  CSzStreamNode *in = p->inputs[0];
+  Bool last = (p->outRem == size);
+  ZSTD_outBuffer out;
+  out.dst = dest;
+  out.size = size;
+  out.pos = 0;
+  for (;;)
+  {
+    ZSTD_inBuffer zin;
+    const Byte *inBuf;
+    size_t inSize, outPos = out.pos;
+    if (out.pos == size && !last)
+      return SZ_OK;
+    RINOK(SzStreamNode_Look(in, &inBuf, &inSize));
+    if (inSize == 0 && out.pos == size && p->zstdRet == 0)
+      return SZ_OK;
+    zin.src = inBuf;
+    zin.size = inSize;
+    zin.pos = 0;
+    p->zstdRet = ZSTD_decompressStream(p->zstd, &out, &zin);
+    SzStreamNode_Skip(in, zin.pos);
+    if (ZSTD_isError(p->zstdRet))
+      return SZ_ERROR_DATA;
+    if (zin.pos == 0 && out.pos == outPos)
+      return SZ_ERROR_DATA;
+  }
+}
+
+#endif
+
+static SRes SzStreamNode_Fill(CSzStreamNode *p)
+{
+  if (!p->buf)
+  {
+    SzStreamNode_Release(p, p->lim);
+    p->pos = p->lim = 0;
+    return SzStreamNode_Produce(p, &p->window, &p->lim);
+  }
+
+  /* Keep the bytes the filters left for the next span. */
+  if (p->outRem == 0 && p->lim == p->size)
+  {
+    p->pos = p->lim = p->size = 0;
+    return SZ_OK;
+  }
+  memmove(p->buf, p->buf + p->lim, p->size - p->lim);
+  p->size -= p->lim;
+  {
+    CSzFilter *f;
+    for (f = p->filter; f != NULL; f = f->next)
+    {
+      f->pos -= p->lim;
+      f->ip += (UInt32)p->lim;
+    }
+  }
+  p->pos = p->lim = 0;
+
+  for (;;)
+  {
+    size_t n = SZ_STREAM_BUF_SIZE - p->size;
+    Bool finish;
+    if (n > p->outRem)
+      n = (size_t)p->outRem;
+    if (!p->isPack && p->methodID == k_BCJ2)
+    {
+      RINOK(SzStreamNode_DecodeBcj2(p, p->buf + p->size, n));
+      p->outRem -= n;
+    }
+    else if (!p->isPack && p->methodID == k_PPMD)
+    {
+      RINOK(SzStreamNode_DecodePpmd(p, p->buf + p->size, n));
+      p->outRem -= n;
+    }
+#ifdef _7ZIP_ZSTD
+    else if (!p->isPack && p->methodID == k_ZSTD)
+    {
+      RINOK(SzStreamNode_DecodeZstd(p, p->buf + p->size, n));
+      p->outRem -= n;
+    }
+#endif
+    else if (n != 0)
+    {
+      const Byte *data;
+      size_t avail;
+      RINOK(SzStreamNode_Produce(p, &data, &avail));
+      if (n > avail)
+        n = avail;
+      memcpy(p->buf + p->size, data, n);
+      SzStreamNode_Release(p, n);
+    }
+    p->size += n;
+    finish = (p->outRem == 0);
+    if (p->filter)
+    {
+      SzFilter_Convert(p->filter, p->buf, p->size, finish);
+      p->lim = finish ? p->size : p->lastFilter->pos;
+    }
+    else
+      p->lim = p->size;
+    if (p->lim != 0 || finish)
+      break;
+  }
+  p->window = p->buf;
+  return SZ_OK;
+}
+
+/* Sets *size to 0 at the end of the output. */
+static SRes SzStreamNode_Look(CSzStreamNode *p, const Byte **buf, size_t *size)
+{
+  if (p->pos == p->lim)
+    RINOK(SzStreamNode_Fill(p));
+  *buf = p->window + p->pos;
+  *size = p->lim - p->pos;
+  return SZ_OK;
+}
+
+static void SzStreamNode_Free(CSzStreamNode *p, CSzDecoderPool *pool)
+{
+  if (p->isPack)
+    LookToRead_Free(&p->stream);
+  else if (p->methodID == k_LZMA || p->methodID == k_LZMA2)
+  {
+    if (p->lzma.decoder.dic)
+      SzDecoderPool_SubMemory(pool, p->lzma.decoder.dicBufSize);
+    SzFree(p->lzma.decoder.dic);
+    Lzma2Dec_FreeProbs(&p->lzma);
+  }
+  else if (p->deflate)
+  {
+    if (p->deflate->dic)
+      SzDecoderPool_SubMemory(pool, p->deflate->dicBufSize);
+    SzFree(p->deflate->dic);
+    SzFree(p->deflate);
+  }
+  else if (p->ppmd)
+    SzDecoderPool_PutPpmd(pool, p->ppmd);
+#ifdef _7ZIP_ZSTD
+  ZSTD_freeDStream(p->zstd);
+#endif
+  if (p->buf)
+    SzDecoderPool_SubMemory(pool, SZ_STREAM_BUF_SIZE);
+  SzFree(p->buf);
+}
+
+/* Makes the node for a source, and the nodes of its inputs. */
+static SRes SzFolderStream_AddNode(CSzFolderStream *p, UInt32 src, CSzStreamNode **node)
+{
+  const CSzFolder *f = p->dec.folder;
+  CSzStreamNode *n = &p->nodes[p->numNodes++];
+  UInt32 i, j;
+
+  memset(n, 0, sizeof(*n));
+  Lzma2Dec_Construct(&n->lzma);
+  *node = n;
+
+  /* The filter nearest to the base runs first, as in SzFolderDec_DecodeOut. */
+  for (i = src; !SZ_SOURCE_IS_PACK(i) && IS_FILTER(&f->Coders[i]);
+      i = SzFolderDec_GetSource(&p->dec, p->dec.inStart[i]))
+  {
+    CSzFilter *filter = &p->filters[p->numFilters++];
+    RINOK(SzFilter_Init(filter, &f->Coders[i]));
+    if (!n->lastFilter)
+      n->lastFilter = filter;
+    filter->next = n->filter;
+    n->filter = filter;
+  }
+
+  if (SZ_SOURCE_IS_PACK(i))
+  {
+    UInt32 pi = i - NUM_FOLDER_CODERS_MAX;
+    n->isPack = True;
+    n->outRem = p->dec.packSizes[pi];
+    RINOK(LookToRead_Clone(&n->stream, p->dec.inStream, p->dec.startPos,
+        p->dec.startPos + GetSum(p->dec.packSizes, f->NumPackStreams)));
+    RINOK(LookInStream_SeekTo(&n->stream, p->dec.startPos + GetSum(p->dec.packSizes, pi)));
+  }
+  else
+  {
+    const CSzCoderInfo *coder = &f->Coders[i];
+    n->methodID = (UInt32)coder->MethodID;
+    n->outRem = f->UnpackSizes[i];
+    if (n->methodID == k_BCJ2)
+    {
+      for (j = 0; j < 4; j++)
+        RINOK(SzFolderStream_AddNode(p, SzFolderDec_GetSource(&p->dec, p->dec.inStart[i] + j), &n->inputs[j]));
+      Bcj2Dec_Init(&n->bcj2);
+    }
+    else
+    {
+      RINOK(SzFolderStream_AddNode(p, SzFolderDec_GetSource(&p->dec, p->dec.inStart[i]), &n->inputs[0]));
+      if (n->methodID == k_Copy)
+      {
+        if (n->inputs[0]->outRem != n->outRem)
+          return SZ_ERROR_DATA;
+      }
+      else if (n->methodID == k_Deflate || n->methodID == k_Deflate64)
+      {
+        CDeflateDec *dec;
+        Bool deflate64 = (n->methodID == k_Deflate64);
+        UInt32 dicSize = DEFLATE_WINDOW_SIZE(deflate64);
+        if ((dec = (CDeflateDec *)SzAlloc(sizeof(CDeflateDec))) == 0)
+          return SZ_ERROR_MEM;
+        n->deflate = dec;
+        n->nodeIn.vt.Look = SzNodeIn_Look;
+        n->nodeIn.vt.Skip = SzNodeIn_Skip;
+        n->nodeIn.node = n->inputs[0];
+        DeflateDec_Init(dec, &n->nodeIn.vt, deflate64);
+        dec->dic = NULL;
+        dec->dicBufSize = dicSize < n->outRem ? dicSize : (size_t)n->outRem;
+        if (dec->dicBufSize != 0 && (dec->dic = (Byte *)SzAlloc(dec->dicBufSize)) == 0)
+          return SZ_ERROR_MEM;
+        SzDecoderPool_AddMemory(p->dec.pool, dec->dicBufSize);
+      }
+      else if (n->methodID == k_PPMD)
+      {
+        RINOK(SzDecoderPool_TakePpmd(p->dec.pool, coder, &n->ppmd));
+        n->nodeIn.vt.Look = SzNodeIn_Look;
+        n->nodeIn.vt.Skip = SzNodeIn_Skip;
+        n->nodeIn.node = n->inputs[0];
+      }
+#ifdef _7ZIP_ZSTD
+      else if (n->methodID == k_ZSTD)
+      {
+        if (coder->PropsSize != 3 && coder->PropsSize != 5)
+          return SZ_ERROR_UNSUPPORTED;
+        if ((n->zstd = ZSTD_createDStream()) == 0)
+          return SZ_ERROR_MEM;
+        ZSTD_initDStream(n->zstd);
+      }
+#endif
+      else
+      {
+        CLzmaDec *dec = &n->lzma.decoder;
+        size_t dicBufSize;
+        if (n->methodID == k_LZMA)
+        {
+          RINOK(LzmaDec_AllocateProbs(dec, coder->Props, (unsigned)coder->PropsSize));
+        }
+        else
+        {
+          if (coder->PropsSize != 1)
+            return SZ_ERROR_DATA;
+          RINOK(Lzma2Dec_AllocateProbs(&n->lzma, coder->Props[0]));
+        }
+        dicBufSize = dec->prop.dicSize < n->outRem ? dec->prop.dicSize : (size_t)n->outRem;
+        if (dicBufSize != 0 && (dec->dic = (Byte *)SzAlloc(dicBufSize)) == 0)
+          return SZ_ERROR_MEM;
+        dec->dicBufSize = dicBufSize;
+        SzDecoderPool_AddMemory(p->dec.pool, dicBufSize);
+        if (n->methodID == k_LZMA)
+          LzmaDec_Init(dec);
+        else
+          Lzma2Dec_Init(&n->lzma);
+      }
+    }
+  }
+
+  /* Filters don't change the size. */
+  for (j = src; j != i; j = SzFolderDec_GetSource(&p->dec, p->dec.inStart[j]))
+    if (f->UnpackSizes[j] != n->outRem)
+      return SZ_ERROR_DATA;
+
+  if (n->filter || (!n->isPack &&
+      (n->methodID == k_BCJ2 || n->methodID == k_PPMD || n->methodID == k_ZSTD)))
+  {
+    if ((n->buf = (Byte *)SzAlloc(SZ_STREAM_BUF_SIZE)) == 0)
+      return SZ_ERROR_MEM;
+    SzDecoderPool_AddMemory(p->dec.pool, SZ_STREAM_BUF_SIZE);
+  }
+  return SZ_OK;
+}
+
+STATIC void SzFolderStream_Close(CSzFolderStream *p)
+{
+  UInt32 i;
+  if (!p)
+    return;
+  for (i = 0; i < p->numNodes; i++)
+    SzStreamNode_Free(&p->nodes[i], p->dec.pool);
+  SzFree(p->nodes);
+  SzFree(p->filters);
+  SzFree(p);
+}
+
+static SRes SzFolderStream_Open2(CSzFolderStream **stream, const CSzFolder *folder,
+    const UInt64 *packSizes, CLookToRead *inStream, UInt64 startPos, CSzDecoderPool *pool)
+{
+  CSzFolderStream *p;
+  UInt32 root;
+  SRes res;
+
+  *stream = NULL;
+  if ((p = (CSzFolderStream *)SzAlloc(sizeof(CSzFolderStream))) == 0)
+    return SZ_ERROR_MEM;
+  memset(p, 0, sizeof(*p));
+  res = SzFolderDec_Init(&p->dec, folder, &root);
+  if (res == SZ_OK)
+  {
+    p->dec.packSizes = packSizes;
+    p->dec.inStream = inStream;
+    p->dec.startPos = startPos;
+    p->dec.pool = pool;
+    p->crc = CRC_INIT_VAL;
+    p->nodes = (CSzStreamNode *)SzAlloc((folder->NumCoders + folder->NumPackStreams) * sizeof(CSzStreamNode));
+    p->filters = (CSzFilter *)SzAlloc(folder->NumCoders * sizeof(CSzFilter));
+    if (p->nodes == 0 || p->filters == 0)
+      res = SZ_ERROR_MEM;
+  }
+  if (res == SZ_OK)
+    res = SzFolderStream_AddNode(p, root, &p->root);
+  if (res != SZ_OK)
+  {
+    SzFolderStream_Close(p);
+    return res;
+  }
+  *stream = p;
+  return SZ_OK;
+}
+
+STATIC SRes SzFolderStream_Open(CSzFolderStream **stream, const CSzFolder *folder,
+    const UInt64 *packSizes, CLookToRead *inStream, UInt64 startPos)
+{
+  return SzFolderStream_Open2(stream, folder, packSizes, inStream, startPos, NULL);
+}
+
+STATIC SRes SzFolderStream_Read(CSzFolderStream *p, void *buf, size_t *size)
+{
+  size_t rem = *size;
+  *size = 0;
+  while (rem != 0)
+  {
+    const Byte *data;
+    size_t n;
+    RINOK(SzStreamNode_Look(p->root, &data, &n));
+    if (n == 0)
+    {
+      if (*size == 0 && p->dec.folder->UnpackCRCDefined &&
+          CRC_GET_DIGEST(p->crc) != p->dec.folder->UnpackCRC)
+        return SZ_ERROR_CRC;
+      break;
+    }
+    if (n > rem)
+      n = rem;
+    memcpy(buf, data, n);
+    SzStreamNode_Skip(p->root, n);
+    p->crc = CrcUpdate(p->crc, data, n);
+    buf = (Byte *)buf + n;
+    *size += n;
+    rem -= n;
+  }
+  return SZ_OK;
+}
+
+/* Like SzFolderStream_Read without copying: skips size bytes, which must be
+   there, updating *crc (a running CRC, from CRC_INIT_VAL) with them if crc
+   is not NULL. The CRC of the folder is only updated if it's defined. */
+static SRes SzFolderStream_SkipCrc(CSzFolderStream *p, UInt64 size, UInt32 *crc)
+{
+  while (size != 0)
+  {
+    const Byte *data;
+    size_t n;
+    RINOK(SzStreamNode_Look(p->root, &data, &n));
+    if (n == 0)
+      return SZ_ERROR_DATA;
+    if (n > size)
+      n = (size_t)size;
+    SzStreamNode_Skip(p->root, n);
+    if (p->dec.folder->UnpackCRCDefined)
+      p->crc = CrcUpdate(p->crc, data, n);
+    if (crc)
+      *crc = CrcUpdate(*crc, data, n);
+    size -= n;
+  }
+  return SZ_OK;
+}
+
+/* 7zCrc.c */
+
+#define kCrcPoly 0xEDB88320
+
+/* Based on crc32h in: http://www.hackersdelight.org/hdcodetxt/crc.c.txt */
+STATIC UInt32 MY_FAST_CALL CrcUpdate(UInt32 v, const void *data, size_t size) {
+  const UInt32 g0 = kCrcPoly, g1 = g0>>1,
+      g2 = g0>>2, g3 = g0>>3, g4 = g0>>4, g5 = g0>>5,
+      g6 = (g0>>6)^g0, g7 = ((g0>>6)^g0)>>1;
+  register const Byte *p = (const Byte*)data;
+  register const Byte *pend = p + size;
+  register Int32 crc = (Int32)v;
+  if (p != pend) {
+    do {
+      crc ^= *p++;
+      crc = ((UInt32)crc >> 8) ^
+         ((crc<<31>>31) & g7) ^ ((crc<<30>>31) & g6) ^
+         ((crc<<29>>31) & g5) ^ ((crc<<28>>31) & g4) ^
+         ((crc<<27>>31) & g3) ^ ((crc<<26>>31) & g2) ^
+         ((crc<<25>>31) & g1) ^ ((crc<<24>>31) & g0);
+    } while (p != pend);
+  }
+  return (UInt32)crc;
+}
+
+STATIC UInt32 MY_FAST_CALL CrcCalc(const void *data, size_t size) {
+  return CRC_GET_DIGEST(CrcUpdate(CRC_INIT_VAL, data, size));
+}
+
+/* 7zAlloc.c */
+
+STATIC void *SzAlloc(size_t size) {
+  void *r;
+  if (size == 0)
+    return 0;
+  r = malloc(size);
+  if (SZ_TRACE_ON)
+    SzTrace_Memory(SZ_TRACE_ALLOC, r, size);
+  return r;
+}
+
+STATIC void SzFree(void *address) {
+  if (SZ_TRACE_ON && address)
+    SzTrace_Memory(SZ_TRACE_FREE, address, 0);
+  free(address);
+}
+
+/* 7zStream.c */
+
+STATIC void LookToRead_SetVolumes(CLookToRead *p, CSzVolume *volumes, UInt32 numVolumes,
+    ISzVolumeOpen *volumeOpen) {
+  UInt32 i;
+  p->volumes = volumes;
+  p->volume_open = volumeOpen;
+  p->num_volumes = numVolumes;
+  p->volume_index = 0;
+  p->volume_start = 0;
+  p->data_len = 0;
+  for (i = 0; i < numVolumes; i++)
+    p->data_len += volumes[i].size;
+  p->data_pos = p->pos = p->size = 0;
+}
+
+typedef struct CSzReadAhead CSzReadAhead;
+
+#ifndef _7ZIP_ST
+
+typedef struct
+{
+  Byte *data;
+  size_t pos;  /* Logical offset of data[0]. */
+  size_t size;
+  SRes res;
+} CSzReadAheadBuf;
+
+struct CSzReadAhead
+{
+  CSzReadAheadBuf *bufs;
+  UInt32 numBufs;
+  size_t bufSize;
+  UInt32 head;  /* Oldest filled buffer. */
+  UInt32 count;  /* Number of filled buffers. */
+  size_t rangeStart;  /* Pack streams announced by LookToRead_SetReadAheadRange. */
+  size_t rangeEnd;
+  size_t fetchPos;  /* Next logical offset the thread reads. */
+  size_t limit;  /* The thread stops reading at this offset. */
+  UInt32 generation;  /* Changed by each seek, buffers fetched before it are dropped. */
+  Bool stop;
+  UInt32 volumeIndex;  /* Volume cursor of the thread, see CLookToRead. */
+  size_t volumeStart;
+  CThread thread;
+  CCriticalSection cs;
+  CCondVar canRead;
+  CCondVar canFetch;
+  CLookToRead *stream;
+};
+
+#endif
+
+/* Opens the volume if needed and returns its data in *data. With read-ahead
+ * the volume can be opened by the other thread, so v->data is only read
+ * under the lock.
+ */
+static SRes LookToRead_OpenVolume(CLookToRead *p, UInt32 index, const void **data) {
+  CSzVolume *v = p->volumes + index;
+  SRes res = SZ_OK;
+#ifndef _7ZIP_ST
+  if (p->read_ahead)
+    CriticalSection_Enter(&p->read_ahead->cs);
+#endif
+  if (!v->data) {
+    if (!p->volume_open)
+      res = SZ_ERROR_READ;
+    else if ((res = p->volume_open->Open(p->volume_open, index, v)) == SZ_OK && !v->data)
+      res = SZ_ERROR_READ;
+  }
+  *data = v->data;
+#ifndef _7ZIP_ST
+  if (p->read_ahead)
+    CriticalSection_Leave(&p->read_ahead->cs);
+#endif
+  return res;
+}
+
+/* Copies size bytes at logical offset pos to dest, crossing volume boundaries
+ * if needed. (*volumeIndex, *volumeStart) is a cursor which makes sequential
+ * reads fast. The caller must make sure that pos + size <= data_len.
+ */
+static SRes LookToRead_ReadAt(CLookToRead *p, size_t pos, UInt32 *volumeIndex, size_t *volumeStart,
+    Byte *dest, size_t size) {
+  if (!p->volumes) {
+    memcpy(dest, (const Byte*)p->data + pos, size);
+    return SZ_OK;
+  }
+  if (pos < *volumeStart) {  /* Seek backwards: rescan from the first volume. */
+    *volumeIndex = 0;
+    *volumeStart = 0;
+  }
+  while (size > 0) {
+    const CSzVolume *v = p->volumes + *volumeIndex;
+    const void *data;
+    size_t inVolume = pos - *volumeStart, cur;
+    if (inVolume >= v->size) {
+      if (*volumeIndex + 1 >= p->num_volumes)
+        return SZ_ERROR_INPUT_EOF;
+      *volumeStart += v->size;
+      ++*volumeIndex;
+      continue;
+    }
+    RINOK(LookToRead_OpenVolume(p, *volumeIndex, &data));
+    cur = v->size - inVolume;
+    if (cur > size)
+      cur = size;
+    memcpy(dest, (const Byte*)data + inVolume, cur);
+    dest += cur;
+    size -= cur;
+    pos += cur;
+  }
+  return SZ_OK;
+}
+
+/* Copies size bytes at data_pos to dest and advances data_pos. */
+static SRes LookToRead_Fetch(CLookToRead *p, Byte *dest, size_t size) {
+#ifndef _7ZIP_ST
+  CSzReadAhead *ra = p->read_ahead;
+  while (ra && size > 0 && p->data_pos < ra->limit) {
+    CSzReadAheadBuf *b;
+    size_t cur;
+    SRes res;
+    CriticalSection_Enter(&ra->cs);
+    while (ra->count == 0 && p->data_pos < ra->limit)
+      CondVar_Wait(&ra->canRead, &ra->cs);
+    if (ra->count == 0) {
+      CriticalSection_Leave(&ra->cs);
+      break;
+    }
+    b = ra->bufs + ra->head;
+    res = b->res;
+    cur = b->pos + b->size - p->data_pos;  /* b->pos <= data_pos < b->pos + b->size */
+    if (cur > size)
+      cur = size;
+    if (res == SZ_OK) {
+      memcpy(dest, b->data + (p->data_pos - b->pos), cur);
+      dest += cur;
+      size -= cur;
+      p->data_pos += cur;
+    }
+    if (res != SZ_OK || p->data_pos == b->pos + b->size) {
+      if (++ra->head == ra->numBufs)
+        ra->head = 0;
+      ra->count--;
+      CondVar_Signal(&ra->canFetch);
+    }
+    CriticalSection_Leave(&ra->cs);
+    RINOK(res);
+  }
+#endif
+  RINOK(LookToRead_ReadAt(p, p->data_pos, &p->volume_index, &p->volume_start, dest, size));
+  p->data_pos += size;
+  return SZ_OK;
+}
+
+#ifndef _7ZIP_ST
+
+static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE ReadAhead_ThreadFunc(void *param) {
+  CSzReadAhead *ra = (CSzReadAhead *)param;
+  CriticalSection_Enter(&ra->cs);
+  for (;;) {
+    UInt32 generation, slot;
+    size_t pos, size;
+    SRes res;
+    while (!ra->stop && (ra->count == ra->numBufs || ra->fetchPos >= ra->limit))
+      CondVar_Wait(&ra->canFetch, &ra->cs);
+    if (ra->stop)
+      break;
+    generation = ra->generation;
+    pos = ra->fetchPos;
+    size = ra->limit - pos;
+    if (size > ra->bufSize)
+      size = ra->bufSize;
+    slot = ra->head + ra->count;
+    if (slot >= ra->numBufs)
+      slot -= ra->numBufs;
+    CriticalSection_Leave(&ra->cs);
+    res = LookToRead_ReadAt(ra->stream, pos, &ra->volumeIndex, &ra->volumeStart, ra->bufs[slot].data, size);
+    CriticalSection_Enter(&ra->cs);
+    if (generation == ra->generation) {
+      CSzReadAheadBuf *b = ra->bufs + slot;
+      b->pos = pos;
+      b->size = size;
+      b->res = res;
+      ra->count++;
+      ra->fetchPos = (res == SZ_OK) ? pos + size : ra->limit;
+      CondVar_Signal(&ra->canRead);
+    }
+  }
+  CriticalSection_Leave(&ra->cs);
+  return 0;
+}
+
+/* Pack streams in [start, end) are going to be read, maybe with seeks. */
+static void LookToRead_SetReadAheadRange(CLookToRead *p, UInt64 start, UInt64 end) {
+  CSzReadAhead *ra = p->read_ahead;
+  if (!ra)
+    return;
+  CriticalSection_Enter(&ra->cs);
+  ra->rangeStart = (size_t)start;
+  ra->rangeEnd = (size_t)(end < p->data_len ? end : p->data_len);
+  CriticalSection_Leave(&ra->cs);
+}
+
+STATIC SRes LookToRead_StartReadAhead(CLookToRead *p, UInt32 numBufs, size_t bufSize) {
+  CSzReadAhead *ra;
+  UInt32 i;
+  SRes res = SZ_ERROR_THREAD;
+  if (p->read_ahead || numBufs == 0 || bufSize == 0)
+    return SZ_ERROR_PARAM;
+  if (!(ra = (CSzReadAhead *)SzAlloc(sizeof(CSzReadAhead))))
+    return SZ_ERROR_MEM;
+  memset(ra, 0, sizeof(*ra));
+  ra->stream = p;
+  ra->numBufs = numBufs;
+  ra->bufSize = bufSize;
+  if (!(ra->bufs = (CSzReadAheadBuf *)SzAlloc(numBufs * sizeof(CSzReadAheadBuf)))) {
+    SzFree(ra);
+    return SZ_ERROR_MEM;
+  }
+  for (i = 0; i < numBufs; i++)
+    if (!(ra->bufs[i].data = (Byte *)SzAlloc(bufSize))) {
+      while (i != 0)
+        SzFree(ra->bufs[--i].data);
+      SzFree(ra->bufs);
+      SzFree(ra);
+      return SZ_ERROR_MEM;
+    }
+  /* On failure, the primitives initialised so far are destroyed. */
+  if (CriticalSection_Init(&ra->cs) == 0) {
+    if (CondVar_Init(&ra->canRead) == 0) {
+      if (CondVar_Init(&ra->canFetch) == 0) {
+        if (Thread_Create(&ra->thread, ReadAhead_ThreadFunc, ra) == 0)
+          res = SZ_OK;
+        else
+          CondVar_Delete(&ra->canFetch);
+      }
+      if (res != SZ_OK)
+        CondVar_Delete(&ra->canRead);
+    }
+    if (res != SZ_OK)
+      CriticalSection_Delete(&ra->cs);
+  }
+  if (res != SZ_OK) {
+    for (i = 0; i < numBufs; i++)
+      SzFree(ra->bufs[i].data);
+    SzFree(ra->bufs);
+    SzFree(ra);
+    return res;
+  }
+  p->read_ahead = ra;
+  return SZ_OK;
+}
+
+STATIC void LookToRead_StopReadAhead(CLookToRead *p) {
+  CSzReadAhead *ra = p->read_ahead;
+  UInt32 i;
+  if (!ra)
+    return;
+  CriticalSection_Enter(&ra->cs);
+  ra->stop = True;
+  CondVar_Broadcast(&ra->canFetch);
+  CriticalSection_Leave(&ra->cs);
+  Thread_Wait(&ra->thread);
+  CondVar_Delete(&ra->canFetch);
+  CondVar_Delete(&ra->canRead);
+  CriticalSection_Delete(&ra->cs);
+  p->read_ahead = NULL;
+  for (i = 0; i < ra->numBufs; i++)
+    SzFree(ra->bufs[i].data);
+  SzFree(ra->bufs);
+  SzFree(ra);
+}
+
+#else
+
+#define LookToRead_SetReadAheadRange(p, start, end)
+
+STATIC SRes LookToRead_StartReadAhead(CLookToRead *p, UInt32 numBufs, size_t bufSize) {
+  (void)p; (void)numBufs; (void)bufSize;
+  return SZ_ERROR_UNSUPPORTED;
+}
+
+STATIC void LookToRead_StopReadAhead(CLookToRead *p) {
+  (void)p;
+}
+
+#endif
+
+STATIC SRes LookInStream_SeekTo(CLookToRead *p, UInt64 offset)
+{
+  if (SZ_TRACE_ON)
+    SzTrace_Seek(offset);
+  p->pos = p->size = 0;
+  if (offset >= p->data_len) {
+    errno = EINVAL;
+    return SZ_ERROR_READ;
+  }
+  p->data_pos = offset;
+#ifndef _7ZIP_ST
+  if (p->read_ahead) {
+    CSzReadAhead *ra = p->read_ahead;
+    CriticalSection_Enter(&ra->cs);
+    ra->generation++;
+    ra->head = ra->count = 0;
+    ra->fetchPos = offset;
+    /* Only the announced pack streams are read ahead. */
+    ra->limit = (offset >= ra->rangeStart && offset < ra->rangeEnd) ? ra->rangeEnd : offset;
+    CondVar_Signal(&ra->canFetch);
+    CriticalSection_Leave(&ra->cs);
+  }
+#endif
+  return SZ_OK;
+}
+
+/* Makes dest a stream over the data of src up to end, with its own
+   position and buffer and without read-ahead. The volumes holding
+   [start, end) are opened here, so dest never calls ISzVolumeOpen and can
+   be read from another thread. dest must be freed with LookToRead_Free. */
+STATIC SRes LookToRead_Clone(CLookToRead *dest, CLookToRead *src, UInt64 start, UInt64 end) {
+  if (src->volumes) {
+    UInt64 volumeStart = 0;
+    UInt32 i;
+    const void *data;
+    for (i = 0; i < src->num_volumes && volumeStart < end; volumeStart += src->volumes[i++].size)
+      if (volumeStart + src->volumes[i].size > start)
+        RINOK(LookToRead_OpenVolume(src, i, &data));
+  }
+  *dest = *src;
+  if (end < dest->data_len)
+    dest->data_len = (size_t)end;
+  dest->volume_open = NULL;
+  dest->read_ahead = NULL;
+  dest->window = NULL;
+  dest->buf = NULL;
+  dest->data_pos = dest->pos = dest->size = 0;
+  return SZ_OK;
+}
+
+STATIC void LookToRead_Free(CLookToRead *p) {
+  LookToRead_StopReadAhead(p);
+  SzFree(p->buf);
+  p->buf = NULL;
+  p->window = NULL;
+  p->pos = p->size = 0;
+}
+
+/* Makes room for at least size bytes in buf, keeping the unread bytes. */
+static SRes LookToRead_Reserve(CLookToRead *p, size_t size) {
+  size_t size_in_buf = p->size - p->pos;
+  size_t newSize;
+  Byte *newBuf;
+  if (p->buf_size == 0)
+    p->buf_size = LookToRead_BUF_SIZE;
+  if (p->buf_size_max == 0)
+    p->buf_size_max = LookToRead_BUF_SIZE_MAX;
+  newSize = p->buf_size;
+  /* Decoders ask for long spans: grow geometrically to cut the number of refills. */
+  while (newSize < size && newSize < p->buf_size_max)
+    newSize <<= 1;
+  if (newSize > p->buf_size_max)
+    newSize = p->buf_size_max;
+  if (p->buf && newSize <= p->buf_size)
+    return SZ_OK;
+  if (!(newBuf = (Byte*)SzAlloc(newSize)))
+    return p->buf ? SZ_OK : SZ_ERROR_MEM;  /* Failing to grow is not an error. */
+  if (size_in_buf > 0)
+    memcpy(newBuf, p->window + p->pos, size_in_buf);
+  SzFree(p->buf);
+  p->buf = newBuf;
+  p->buf_size = newSize;
+  p->window = newBuf;
+  p->pos = 0;
+  p->size = size_in_buf;
+  return SZ_OK;
+}
+
+STATIC SRes LookToRead_Look(CLookToRead *p, const void **buf, size_t *size) {
+  SRes res = SZ_OK;
+  size_t size_in_buf = p->size - p->pos;
+  size_t rsize;
+
+  if (*size > size_in_buf) {
+    if (!p->volumes && !p->read_ahead) {
+      /* All input is in memory: let the window cover the rest of it. */
+      size_t start = p->data_pos - size_in_buf;
+      p->window = (const Byte*)p->data + start;
+      p->pos = 0;
+      p->size = *size = p->data_len - start;
+      p->data_pos = p->data_len;
+      *buf = p->window;
+      return SZ_OK;
+    }
+    RINOK(LookToRead_Reserve(p, *size));
+    memmove(p->buf, p->window + p->pos, size_in_buf);
+    p->window = p->buf;
+    p->pos = 0;
+    /* We fill the buffer, we read more than: *size - size_in_buf; */
+    rsize = p->buf_size - size_in_buf;
+    if ((p->data_pos + rsize) > p->data_len) {
+      rsize = p->data_len - p->data_pos;
+    }
+    if (rsize > 0) {
+      res = LookToRead_Fetch(p, p->buf + size_in_buf, rsize);
+      if (res != SZ_OK)
+        rsize = 0;
+    }
+    p->size = *size = size_in_buf += rsize;
+  } else {
+    *size = size_in_buf;
+  }
+  *buf = p->window + p->pos;
+  return res;
+}
+
+STATIC SRes LookToRead_ReadAll(CLookToRead *p, void *buf, size_t size) {
+  Byte *lbuf;
+  SRes res = SZ_OK;
+  size_t got;
+  while (size > 0) {
+    got = size;
+    res = LookToRead_Look(p, (const void**)&lbuf, &got);
+    if (res != SZ_OK) break;
+    if (got == 0) { res = SZ_ERROR_INPUT_EOF; break; }
+    if (got > size) got = size;
+    LOOKTOREAD_SKIP(p, got);
+    memcpy(buf, lbuf, got);
+    size -= got;
+    buf = (Byte*)buf + got;
+  }
+  return res;
+}
+
+/* BraSimd.c -- Vector search for x86 branch opcodes */
+
+#define IsJcc(b0, b1) ((b0) == 0x0F && ((b1) & 0xF0) == 0x80)
+#define IsJ(b0, b1) ((b1 & 0xFE) == 0xE8 || IsJcc(b0, b1))
+
+/* Bra_FindE8 returns the offset of the first E8/E9 byte in data[0, size),
+   or size. Bra_FindJ returns the offset of the first byte data[i] in
+   [1, size) for which IsJ(data[i - 1], data[i]) holds, or size. */
+typedef size_t (*Bra_FindFunc)(const Byte *data, size_t size);
+
+static size_t Bra_FindE8(const Byte *data, size_t size)
+{
+  size_t i;
+  for (i = 0; i < size; i++)
+    if ((data[i] & 0xFE) == 0xE8)
+      break;
+  return i;
+}
+
+static size_t Bra_FindJ(const Byte *data, size_t size)
+{
+  size_t i;
+  for (i = 1; i < size; i++)
+    if (IsJ(data[i - 1], data[i]))
+      break;
+  return (i < size) ? i : size;
+}
+
+#if defined(BRA_USE_SSE2) || defined(BRA_USE_AVX2)
+
+#ifdef _MSC_VER
+static MY_FORCE_INLINE unsigned Bra_Ctz(UInt32 v) { unsigned long i; _BitScanForward(&i, v); return (unsigned)i; }
+#else
+#define Bra_Ctz(v) ((unsigned)__builtin_ctz(v))
+#endif
+
+static size_t Bra_FindE8_SSE2(const Byte *data, size_t size)
+{
+  const __m128i kFE = _mm_set1_epi8((char)0xFE), kE8 = _mm_set1_epi8((char)0xE8);
+  size_t i;
+  for (i = 0; i + 16 <= size; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(data + i));
+    UInt32 m = (UInt32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, kFE), kE8));
+    if (m != 0)
+      return i + Bra_Ctz(m);
+  }
+  return i + Bra_FindE8(data + i, size - i);
+}
+
+static size_t Bra_FindJ_SSE2(const Byte *data, size_t size)
+{
+  const __m128i kFE = _mm_set1_epi8((char)0xFE), kE8 = _mm_set1_epi8((char)0xE8);
+  const __m128i kF0 = _mm_set1_epi8((char)0xF0), k80 = _mm_set1_epi8((char)0x80);
+  const __m128i k0F = _mm_set1_epi8(0x0F);
+  size_t i;
+  for (i = 1; i + 16 <= size; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(data + i));
+    __m128i prev = _mm_loadu_si128((const __m128i *)(const void *)(data + i - 1));
+    __m128i j = _mm_cmpeq_epi8(_mm_and_si128(v, kFE), kE8);
+    __m128i jcc = _mm_and_si128(_mm_cmpeq_epi8(prev, k0F), _mm_cmpeq_epi8(_mm_and_si128(v, kF0), k80));
+    UInt32 m = (UInt32)_mm_movemask_epi8(_mm_or_si128(j, jcc));
+    if (m != 0)
+      return i + Bra_Ctz(m);
+  }
+  if (i >= size)
+    return size;
+  return i - 1 + Bra_FindJ(data + i - 1, size - i + 1);
+}
+
+#endif
+
+#ifdef BRA_USE_AVX2
+
+__attribute__((target("avx2")))
+static size_t Bra_FindE8_AVX2(const Byte *data, size_t size)
+{
+  const __m256i kFE = _mm256_set1_epi8((char)0xFE), kE8 = _mm256_set1_epi8((char)0xE8);
+  size_t i;
+  for (i = 0; i + 32 <= size; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(data + i));
+    UInt32 m = (UInt32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, kFE), kE8));
+    if (m != 0)
+      return i + Bra_Ctz(m);
+  }
+  return i + Bra_FindE8_SSE2(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t Bra_FindJ_AVX2(const Byte *data, size_t size)
+{
+  const __m256i kFE = _mm256_set1_epi8((char)0xFE), kE8 = _mm256_set1_epi8((char)0xE8);
+  const __m256i kF0 = _mm256_set1_epi8((char)0xF0), k80 = _mm256_set1_epi8((char)0x80);
+  const __m256i k0F = _mm256_set1_epi8(0x0F);
+  size_t i;
+  for (i = 1; i + 32 <= size; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(data + i));
+    __m256i prev = _mm256_loadu_si256((const __m256i *)(const void *)(data + i - 1));
+    __m256i j = _mm256_cmpeq_epi8(_mm256_and_si256(v, kFE), kE8);
+    __m256i jcc = _mm256_and_si256(_mm256_cmpeq_epi8(prev, k0F), _mm256_cmpeq_epi8(_mm256_and_si256(v, kF0), k80));
+    UInt32 m = (UInt32)_mm256_movemask_epi8(_mm256_or_si256(j, jcc));
+    if (m != 0)
+      return i + Bra_Ctz(m);
+  }
+  if (i >= size)
+    return size;
+  return i - 1 + Bra_FindJ_SSE2(data + i - 1, size - i + 1);
+}
+
+#endif
+
+#ifdef BRA_USE_NEON
+
+/* NEON has no movemask: a block with a hit is rescanned by the scalar code. */
+
+static size_t Bra_FindE8_NEON(const Byte *data, size_t size)
+{
+  const uint8x16_t kFE = vdupq_n_u8(0xFE), kE8 = vdupq_n_u8(0xE8);
+  size_t i;
+  for (i = 0; i + 16 <= size; i += 16)
+  {
+    uint8x16_t v = vld1q_u8(data + i);
+    if (vmaxvq_u8(vceqq_u8(vandq_u8(v, kFE), kE8)) != 0)
+      break;
+  }
+  return i + Bra_FindE8(data + i, size - i);
+}
+
+static size_t Bra_FindJ_NEON(const Byte *data, size_t size)
+{
+  const uint8x16_t kFE = vdupq_n_u8(0xFE), kE8 = vdupq_n_u8(0xE8);
+  const uint8x16_t kF0 = vdupq_n_u8(0xF0), k80 = vdupq_n_u8(0x80);
+  const uint8x16_t k0F = vdupq_n_u8(0x0F);
+  size_t i;
+  for (i = 1; i + 16 <= size; i += 16)
+  {
+    uint8x16_t v = vld1q_u8(data + i);
+    uint8x16_t prev = vld1q_u8(data + i - 1);
+    uint8x16_t j = vceqq_u8(vandq_u8(v, kFE), kE8);
+    uint8x16_t jcc = vandq_u8(vceqq_u8(prev, k0F), vceqq_u8(vandq_u8(v, kF0), k80));
+    if (vmaxvq_u8(vorrq_u8(j, jcc)) != 0)
+      break;
+  }
+  if (i >= size)
+    return size;
+  return i - 1 + Bra_FindJ(data + i - 1, size - i + 1);
+}
+
+#endif
+
+static Bra_FindFunc Bra_GetFindE8(void)
+{
+#ifdef BRA_USE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return Bra_FindE8_AVX2;
+#endif
+#if defined(BRA_USE_SSE2)
+  return Bra_FindE8_SSE2;
+#elif defined(BRA_USE_NEON)
+  return Bra_FindE8_NEON;
+#else
+  return Bra_FindE8;
+#endif
+}
+
+static Bra_FindFunc Bra_GetFindJ(void)
+{
+#ifdef BRA_USE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return Bra_FindJ_AVX2;
+#endif
+#if defined(BRA_USE_SSE2)
+  return Bra_FindJ_SSE2;
+#elif defined(BRA_USE_NEON)
+  return Bra_FindJ_NEON;
+#else
+  return Bra_FindJ;
+#endif
+}
+
+/* Bcj2.c -- Converter for x86 code (BCJ2) */
+
+#ifdef _LZMA_PROB32
+#define CProb UInt32
+#else
+#define CProb UInt16
+#endif
+
+#define kNumTopBits 24
+#define kTopValue ((UInt32)1 << kNumTopBits)
+
+#define kNumBitModelTotalBits 11
+#define kBitModelTotal (1 << kNumBitModelTotalBits)
+#define kNumMoveBits 5
+
+#define BCJ2_DEC_STATE_INIT 0  /* reading the first 5 bytes of the RC stream */
+#define BCJ2_DEC_STATE_MAIN 1  /* copying the main stream */
+#define BCJ2_DEC_STATE_BIT 2   /* the bit of opcode isn't decoded yet */
+#define BCJ2_DEC_STATE_ADDR 3  /* reading the address of opcode to temp */
+#define BCJ2_DEC_STATE_OUT 4   /* writing temp[tempPos, 4) */
+
+STATIC void Bcj2Dec_Init(CBcj2Dec *p)
+{
+  unsigned i;
+  p->state = BCJ2_DEC_STATE_INIT;
+  p->tempPos = 0;
+  p->ip = 0;
+  p->range = 0xFFFFFFFF;
+  p->code = 0;
+  p->prevByte = 0;
+  for (i = 0; i < sizeof(p->probs) / sizeof(p->probs[0]); i++)
+    p->probs[i] = kBitModelTotal >> 1;
+}
+
+/* The range coder is normalized before a bit is decoded rather than after,
+   so a bit never waits for input half way. */
+STATIC void Bcj2Dec_Decode(CBcj2Dec *p)
+{
+  Bra_FindFunc findJ = Bra_GetFindJ();
+  for (;;)
+  {
+    if (p->dest == p->destLim)
+    {
+      p->need = BCJ2_NEED_OUT;
+      return;
+    }
+    switch (p->state)
+    {
+      case BCJ2_DEC_STATE_INIT:
+        for (; p->tempPos < 5; p->tempPos++)
+        {
+          if (p->bufs[BCJ2_STREAM_RC] == p->lims[BCJ2_STREAM_RC])
+          {
+            p->need = BCJ2_STREAM_RC;
+            return;
+          }
+          p->code = (p->code << 8) | *p->bufs[BCJ2_STREAM_RC]++;
+        }
+        p->state = BCJ2_DEC_STATE_MAIN;
+        break;
+
+      case BCJ2_DEC_STATE_MAIN:
+      {
+        const Byte *src = p->bufs[BCJ2_STREAM_MAIN];
+        Byte *dest = p->dest;
+        Byte prevByte = p->prevByte;
+        size_t limit = p->lims[BCJ2_STREAM_MAIN] - src;
+        if (limit == 0)
+        {
+          p->need = BCJ2_STREAM_MAIN;
+          return;
+        }
+        if (limit > (size_t)(p->destLim - dest))
+          limit = p->destLim - dest;
+        if (limit > 1 && !IsJ(prevByte, src[0]))
+        {
+          /* The run before the next branch opcode is copied as is. The main
+             stream can overlap the output, but never behind it, so memmove
+             is enough. */
+          size_t n = findJ(src, limit);
+          memmove(dest, src, n);
+          src += n;
+          dest += n;
+          limit -= n;
+          prevByte = src[-1];
+        }
+        while (limit != 0)
+        {
+          Byte b = *src++;
+          *dest++ = b;
+          limit--;
+          if (IsJ(prevByte, b))
+          {
+            p->opcode = b;
+            p->state = BCJ2_DEC_STATE_BIT;
+            break;
+          }
+          prevByte = b;
+        }
+        p->prevByte = prevByte;
+        p->ip += (UInt32)(dest - p->dest);
+        p->bufs[BCJ2_STREAM_MAIN] = src;
+        p->dest = dest;
+        break;
+      }
+
+      case BCJ2_DEC_STATE_BIT:
+      {
+        CProb *prob;
+        UInt32 bound, ttt;
+        if (p->range < kTopValue)
+        {
+          if (p->bufs[BCJ2_STREAM_RC] == p->lims[BCJ2_STREAM_RC])
+          {
+            p->need = BCJ2_STREAM_RC;
+            return;
+          }
+          p->range <<= 8;
+          p->code = (p->code << 8) | *p->bufs[BCJ2_STREAM_RC]++;
+        }
+        if (p->opcode == 0xE8)
+          prob = p->probs + p->prevByte;
+        else if (p->opcode == 0xE9)
+          prob = p->probs + 256;
+        else
+          prob = p->probs + 257;
+        ttt = *prob;
+        bound = (p->range >> kNumBitModelTotalBits) * ttt;
+        if (p->code < bound)
+        {
+          p->range = bound;
+          *prob = (CProb)(ttt + ((kBitModelTotal - ttt) >> kNumMoveBits));
+          p->prevByte = p->opcode;
+          p->state = BCJ2_DEC_STATE_MAIN;
+          break;
+        }
+        p->range -= bound;
+        p->code -= bound;
+        *prob = (CProb)(ttt - (ttt >> kNumMoveBits));
+        p->tempPos = 0;
+        p->state = BCJ2_DEC_STATE_ADDR;
+      }
+      /* fall through */
+
+      case BCJ2_DEC_STATE_ADDR:
+      {
+        unsigned s = (p->opcode == 0xE8) ? BCJ2_STREAM_CALL : BCJ2_STREAM_JUMP;
+        UInt32 dest;
+        if (p->tempPos == 0 && p->lims[s] - p->bufs[s] >= 4)
+        {
+          dest = GetBe32(p->bufs[s]);
+          p->bufs[s] += 4;
+        }
+        else
+        {
+          for (; p->tempPos < 4; p->tempPos++)
+          {
+            if (p->bufs[s] == p->lims[s])
+            {
+              p->need = s;
+              return;
+            }
+            p->temp[p->tempPos] = *p->bufs[s]++;
+          }
+          dest = GetBe32(p->temp);
+        }
+        dest -= p->ip + 4;
+        p->temp[0] = (Byte)dest;
+        p->temp[1] = (Byte)(dest >> 8);
+        p->temp[2] = (Byte)(dest >> 16);
+        p->temp[3] = (Byte)(dest >> 24);
+        p->tempPos = 0;
+        p->state = BCJ2_DEC_STATE_OUT;
+      }
+      /* fall through */
+
+      default: /* BCJ2_DEC_STATE_OUT */
+        if (p->tempPos == 0 && p->destLim - p->dest >= 4)
+        {
+          memcpy(p->dest, p->temp, 4);
+          p->dest += 4;
+          p->ip += 4;
+          p->tempPos = 4;
+        }
+        else
+          while (p->tempPos < 4 && p->dest != p->destLim)
+          {
+            *p->dest++ = p->temp[p->tempPos++];
+            p->ip++;
+          }
+        if (p->tempPos == 4)
+        {
+          p->prevByte = p->temp[3];
+          p->state = BCJ2_DEC_STATE_MAIN;
+        }
+        break;
+    }
+  }
+}
+
+STATIC int Bcj2_Decode(
+    const Byte *buf0, size_t size0,
+    const Byte *buf1, size_t size1,
+    const Byte *buf2, size_t size2,
+    const Byte *buf3, size_t size3,
+    Byte *outBuf, size_t outSize)
+{
+  CBcj2Dec p;
+  Bcj2Dec_Init(&p);
+  p.bufs[0] = buf0; p.lims[0] = buf0 + size0;
+  p.bufs[1] = buf1; p.lims[1] = buf1 + size1;
+  p.bufs[2] = buf2; p.lims[2] = buf2 + size2;
+  p.bufs[3] = buf3; p.lims[3] = buf3 + size3;
+  p.dest = outBuf;
+  p.destLim = outBuf + outSize;
+  Bcj2Dec_Decode(&p);
+  return (p.dest == p.destLim) ? SZ_OK : SZ_ERROR_DATA;
+}
+
+/* Bra.c -- Converters for RISC code */
+
+STATIC size_t ARM_Convert(Byte *data, size_t size, UInt32 ip, int encoding)
+{
+  size_t i;
+  if (size < 4)
+    return 0;
+  size -= 4;
+  ip += 8;
+  for (i = 0; i <= size; i += 4)
+  {
+    if (data[i + 3] == 0xEB)
+    {
+      UInt32 dest;
+      UInt32 src = ((UInt32)data[i + 2] << 16) | ((UInt32)data[i + 1] << 8) | (data[i + 0]);
+      src <<= 2;
+      if (encoding)
+        dest = ip + (UInt32)i + src;
+      else
+        dest = src - (ip + (UInt32)i);
+      dest >>= 2;
+      data[i + 2] = (Byte)(dest >> 16);
+      data[i + 1] = (Byte)(dest >> 8);
+      data[i + 0] = (Byte)dest;
+    }
+  }
+  return i;
+}
+
+STATIC size_t ARMT_Convert(Byte *data, size_t size, UInt32 ip, int encoding)
+{
+  size_t i;
+  if (size < 4)
+    return 0;
+  size -= 4;
+  ip += 4;
+  for (i = 0; i <= size; i += 2)
+  {
+    if ((data[i + 1] & 0xF8) == 0xF0 &&
+        (data[i + 3] & 0xF8) == 0xF8)
+    {
+      UInt32 dest;
+      UInt32 src =
+        (((UInt32)data[i + 1] & 0x7) << 19) |
+        ((UInt32)data[i + 0] << 11) |
+        (((UInt32)data[i + 3] & 0x7) << 8) |
+        (data[i + 2]);
+      src <<= 1;
+      if (encoding)
+        dest = ip + (UInt32)i + src;
+      else
+        dest = src - (ip + (UInt32)i);
+      dest >>= 1;
+      data[i + 1] = (Byte)(0xF0 | ((dest >> 19) & 0x7));
+      data[i + 0] = (Byte)(dest >> 11);
+      data[i + 3] = (Byte)(0xF8 | ((dest >> 8) & 0x7));
+      data[i + 2] = (Byte)dest;
+      i += 2;
+    }
+  }
+  return i;
+}
+
+/* Converts BL and ADRP. ADRP is converted only if the page offset is within
+   +-512MB, as bigger ones are unlikely to be addresses in the same file. */
+STATIC size_t ARM64_Convert(Byte *data, size_t size, UInt32 ip, int encoding)
+{
+  size_t i;
+  for (i = 0; i + 4 <= size; i += 4)
+  {
+    UInt32 pc = ip + (UInt32)i;
+    UInt32 instr = GetUi32(data + i);
+    if ((instr >> 26) == 0x25)
+    {
+      /* BL */
+      UInt32 src = instr;
+      pc >>= 2;
+      if (!encoding)
+        pc = 0 - pc;
+      instr = 0x94000000 | ((src + pc) & 0x03FFFFFF);
+      SetUi32(data + i, instr);
+    }
+    else if ((instr & 0x9F000000) == 0x90000000)
+    {
+      /* ADRP */
+      UInt32 dest;
+      UInt32 src = ((instr >> 29) & 3) | ((instr >> 3) & 0x001FFFFC);
+      if ((src + 0x00020000) & 0x001C0000)
+        continue;
+      pc >>= 12;
+      if (!encoding)
+        pc = 0 - pc;
+      dest = src + pc;
+      instr &= 0x9000001F;
+      instr |= (dest & 3) << 29;
+      instr |= (dest & 0x0003FFFC) << 3;
+      instr |= (0 - (dest & 0x00020000)) & 0x00E00000;
+      SetUi32(data + i, instr);
+    }
+  }
+  return i;
+}
+
+/* Converts JAL, and AUIPC with the instruction which uses its rd (as xz's
+   RISC-V filter does). A converted pair is an AUIPC with rd x2 and the low
+   20 bits of the second instruction, followed by the address, big endian.
+   Other data which looks like either form is swapped with the other one
+   without converting the address, so that any data can be converted. */
+STATIC size_t RISCV_Convert(Byte *data, size_t size, UInt32 ip, int encoding)
+{
+  size_t i;
+  if (size < 8)
+    return 0;
+  size -= 8;
+  for (i = 0; i <= size; i += 2)
+  {
+    UInt32 instr = data[i];
+    if (instr == 0xEF)
+    {
+      /* JAL */
+      UInt32 b1 = data[i + 1], b2 = data[i + 2], b3 = data[i + 3], dest;
+      if ((b1 & 0x0D) != 0)
+        continue;
+      if (encoding)
+      {
+        dest = ((b1 & 0xF0) << 8) | ((b2 & 0x0F) << 16) | ((b2 & 0x10) << 7) |
+            ((b2 & 0xE0) >> 4) | ((b3 & 0x7F) << 4) | ((b3 & 0x80) << 13);
+        dest += ip + (UInt32)i;
+        data[i + 1] = (Byte)((b1 & 0x0F) | ((dest >> 13) & 0xF0));
+        data[i + 2] = (Byte)(dest >> 9);
+        data[i + 3] = (Byte)(dest >> 1);
+      }
+      else
+      {
+        dest = ((b1 & 0xF0) << 13) | (b2 << 9) | (b3 << 1);
+        dest -= ip + (UInt32)i;
+        data[i + 1] = (Byte)((b1 & 0x0F) | ((dest >> 8) & 0xF0));
+        data[i + 2] = (Byte)(((dest >> 16) & 0x0F) | ((dest >> 7) & 0x10) | ((dest << 4) & 0xE0));
+        data[i + 3] = (Byte)(((dest >> 4) & 0x7F) | ((dest >> 13) & 0x80));
+      }
+      i += 2;
+    }
+    else if ((instr & 0x7F) == 0x17)
+    {
+      /* AUIPC */
+      UInt32 instr2, addr;
+      instr = GetUi32(data + i);
+      if (instr & 0xE80)
+      {
+        /* rd isn't x0 or x2: a pair if the next instruction's rs1 is rd
+           (for the decoder, data which looks like a converted pair). */
+        instr2 = GetUi32(data + i + 4);
+        if (((instr << 8) ^ (instr2 - 3)) & 0xF8003)
+        {
+          i += 4;
+          continue;
+        }
+        addr = instr & 0xFFFFF000;
+        instr = 0x17 | (2 << 7) | (instr2 << 12);
+        if (encoding)
+        {
+          addr += (instr2 >> 20) - ((instr2 >> 19) & 0x1000) + ip + (UInt32)i;
+          instr2 = (addr >> 24) | ((addr >> 8) & 0xFF00) | ((addr << 8) & 0xFF0000) | (addr << 24);
+        }
+        else
+          instr2 = addr + (instr2 >> 20);
+      }
+      else
+      {
+        /* rd is x0 or x2: a converted pair (for the encoder, data which
+           looks like one) if bits 12-13 are set and the rs1 it keeps in
+           bits 27-31 isn't x0 or x2. */
+        UInt32 rs1 = instr >> 27;
+        if ((UInt32)((instr - 0x3117) << 18) >= (rs1 & 0x1D))
+        {
+          i += 2;
+          continue;
+        }
+        if (encoding)
+        {
+          addr = GetUi32(data + i + 4);
+          instr2 = (instr >> 12) | (addr << 20);
+          instr = 0x17 | (rs1 << 7) | (addr & 0xFFFFF000);
+        }
+        else
+        {
+          addr = GetBe32(data + i + 4) - (ip + (UInt32)i);
+          instr2 = (instr >> 12) | (addr << 20);
+          instr = 0x17 | (rs1 << 7) | ((addr + 0x800) & 0xFFFFF000);
+        }
+      }
+      SetUi32(data + i, instr);
+      SetUi32(data + i + 4, instr2);
+      i += 6;
+    }
+  }
+  return i;
+}
+
+STATIC size_t PPC_Convert(Byte *data, size_t size, UInt32 ip, int encoding)
+{
+  size_t i;
+  if (size < 4)
+    return 0;
+  size -= 4;
+  for (i = 0; i <= size; i += 4)
+  {
+    if ((data[i] >> 2) == 0x12 && (data[i + 3] & 3) == 1)
+    {
+      UInt32 dest;
+      UInt32 src = ((UInt32)(data[i + 0] & 3) << 24) |
+        ((UInt32)data[i + 1] << 16) |
+        ((UInt32)data[i + 2] << 8) |
+        ((UInt32)data[i + 3] & (~3));
+      if (encoding)
+        dest = ip + (UInt32)i + src;
+      else
+        dest = src - (ip + (UInt32)i);
+      data[i + 0] = (Byte)(0x48 | ((dest >> 24) & 0x3));
+      data[i + 1] = (Byte)(dest >> 16);
+      data[i + 2] = (Byte)(dest >> 8);
+      data[i + 3] &= 0x3;
+      data[i + 3] |= dest;
+    }
+  }
+  return i;
+}
+
+STATIC size_t SPARC_Convert(Byte *data, size_t size, UInt32 ip, int encoding)
+{
+  size_t i;
+  if (size < 4)
+    return 0;
+  size -= 4;
+  for (i = 0; i <= size; i += 4)
+  {
+    if ((data[i] == 0x40 && (data[i + 1] & 0xC0) == 0x00) ||
+        (data[i] == 0x7F && (data[i + 1] & 0xC0) == 0xC0))
+    {
+      UInt32 dest;
+      UInt32 src =
+        ((UInt32)data[i + 0] << 24) |
+        ((UInt32)data[i + 1] << 16) |
+        ((UInt32)data[i + 2] << 8) |
+        ((UInt32)data[i + 3]);
+      src <<= 2;
+      if (encoding)
+        dest = ip + (UInt32)i + src;
+      else
+        dest = src - (ip + (UInt32)i);
+      dest >>= 2;
+      dest = (((0 - ((dest >> 22) & 1)) << 22) & 0x3FFFFFFF) | (dest & 0x3FFFFF) | 0x40000000;
+      data[i + 0] = (Byte)(dest >> 24);
+      data[i + 1] = (Byte)(dest >> 16);
+      data[i + 2] = (Byte)(dest >> 8);
+      data[i + 3] = (Byte)dest;
+    }
+  }
+  return i;
+}
+
+/* BraIA64.c -- Converter for IA-64 code */
+
+static const Byte kBranchTable[32] =
+{
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  4, 4, 6, 6, 0, 0, 7, 7,
+  4, 4, 0, 0, 4, 4, 0, 0
+};
+
+STATIC size_t IA64_Convert(Byte *data, size_t size, UInt32 ip, int encoding)
+{
+  size_t i;
+  if (size < 16)
+    return 0;
+  size -= 16;
+  for (i = 0; i <= size; i += 16)
+  {
+    UInt32 mask = kBranchTable[data[i] & 0x1F];
+    UInt32 bitPos = 5;
+    int slot;
+    for (slot = 0; slot < 3; slot++, bitPos += 41)
+    {
+      UInt32 bytePos, bitRes;
+      UInt64 instruction, instNorm;
+      int j;
+      if (((mask >> slot) & 1) == 0)
+        continue;
+      bytePos = (bitPos >> 3);
+      bitRes = bitPos & 0x7;
+      instruction = 0;
+      for (j = 0; j < 6; j++)
+        instruction += (UInt64)data[i + j + bytePos] << (8 * j);
+
+      instNorm = instruction >> bitRes;
+      if (((instNorm >> 37) & 0xF) == 0x5 && ((instNorm >> 9) & 0x7) == 0)
+      {
+        UInt32 dest;
+        UInt32 src = (UInt32)((instNorm >> 13) & 0xFFFFF);
+        src |= ((UInt32)(instNorm >> 36) & 1) << 20;
+        src <<= 4;
+        if (encoding)
+          dest = ip + (UInt32)i + src;
+        else
+          dest = src - (ip + (UInt32)i);
+        dest >>= 4;
+        instNorm &= ~((UInt64)(0x8FFFFF) << 13);
+        instNorm |= ((UInt64)(dest & 0xFFFFF) << 13);
+        instNorm |= ((UInt64)(dest & 0x100000) << (36 - 20));
+        instruction &= (1 << bitRes) - 1;
+        instruction |= (instNorm << bitRes);
+        for (j = 0; j < 6; j++)
+          data[i + j + bytePos] = (Byte)(instruction >> (8 * j));
+      }
+    }
+  }
+  return i;
+}
+
+/* Bra86.c -- Converter for x86 code (BCJ) */
+
+#define Test86MSByte(b) ((b) == 0 || (b) == 0xFF)
+
+/*static const Byte kMaskToAllowedStatus[8] = {1, 1, 1, 0, 1, 0, 0, 0};*/
+static const Byte kMaskToAllowedStatus = 0x17;
+/*static const Byte kMaskToBitNumber[8] = {0, 1, 2, 2, 3, 3, 3, 3};*/
+static const UInt16 kMaskToBitNumber = 0xffa4;
+
+STATIC size_t x86_Convert(Byte *data, size_t size, UInt32 ip, UInt32 *state, int encoding)
+{
+  size_t bufferPos = 0, prevPosT;
+  UInt32 prevMask = *state & 0x7;
+  Bra_FindFunc findE8 = Bra_GetFindE8();
+  if (size < 5)
+    return 0;
+  ip += 5;
+  prevPosT = (size_t)0 - 1;
+
+  for (;;)
+  {
+    Byte *p = data + bufferPos;
+    Byte *limit = data + size - 4;
+    if (p < limit)
+      p += findE8(p, (size_t)(limit - p));
+    bufferPos = (size_t)(p - data);
+    if (p >= limit)
+      break;
+    prevPosT = bufferPos - prevPosT;
+    if (prevPosT > 3)
+      prevMask = 0;
+    else
+    {
+      prevMask = (prevMask << ((int)prevPosT - 1)) & 0x7;
+      if (prevMask != 0)
+      {
+        Byte b = p[4 - ((kMaskToBitNumber >> (prevMask * 2)) & 3)];
+        if (!((kMaskToAllowedStatus >> prevMask) & 1) || Test86MSByte(b))
+        {
+          prevPosT = bufferPos;
+          prevMask = ((prevMask << 1) & 0x7) | 1;
+          bufferPos++;
+          continue;
+        }
+      }
+    }
+    prevPosT = bufferPos;
+
+    if (Test86MSByte(p[4]))
+    {
+      UInt32 src = ((UInt32)p[4] << 24) | ((UInt32)p[3] << 16) | ((UInt32)p[2] << 8) | ((UInt32)p[1]);
+      UInt32 dest;
+      for (;;)
+      {
+        Byte b;
+        int index;
+        if (encoding)
+          dest = (ip + (UInt32)bufferPos) + src;
+        else
+          dest = src - (ip + (UInt32)bufferPos);
+        if (prevMask == 0)
+          break;
+        index = ((kMaskToBitNumber >> (prevMask * 2)) & 3) * 8;
+        b = (Byte)(dest >> (24 - index));
+        if (!Test86MSByte(b))
+          break;
+        src = dest ^ ((1 << (32 - index)) - 1);
+      }
+      p[4] = (Byte)(~(((dest >> 24) & 1) - 1));
+      p[3] = (Byte)(dest >> 16);
+      p[2] = (Byte)(dest >> 8);
+      p[1] = (Byte)dest;
+      bufferPos += 5;
+    }
+    else
+    {
+      prevMask = ((prevMask << 1) & 0x7) | 1;
+      bufferPos++;
+    }
+  }
+  prevPosT = bufferPos - prevPosT;
+  *state = ((prevPosT > 3) ? 0 : ((prevMask << ((int)prevPosT - 1)) & 0x7));
+  return bufferPos;
+}
+
+/* Delta.c -- Delta converter */
+
+STATIC void Delta_Init(Byte *state)
+{
+  memset(state, 0, DELTA_STATE_SIZE);
+}
+
+#if defined(BRA_USE_SSE2)
+
+/* Adds the stride-delta prefix sums inside a block of 16 bytes, then the
+   carry: the last delta output bytes, repeated. For delta >= 16 the carry
+   alone is the whole sum. */
+static size_t Delta_Decode_SSE2(unsigned delta, Byte *data, size_t i, size_t size)
+{
+  for (; i + 16 <= size; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(data + i));
+    __m128i carry;
+    const Byte *prev = data + i - delta;
+    switch (delta)
+    {
+      case 1:
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        carry = _mm_set1_epi8((char)prev[0]);
+        break;
+      case 2:
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        carry = _mm_set1_epi16((short)GetUi16(prev));
+        break;
+      case 4:
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        carry = _mm_set1_epi32((int)GetUi32(prev));
+        break;
+      case 8:
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        carry = _mm_loadl_epi64((const __m128i *)(const void *)prev);
+        carry = _mm_unpacklo_epi64(carry, carry);
+        break;
+      default:
+        carry = _mm_loadu_si128((const __m128i *)(const void *)prev);
+    }
+    _mm_storeu_si128((__m128i *)(void *)(data + i), _mm_add_epi8(v, carry));
+  }
+  return i;
+}
+
+#elif defined(BRA_USE_NEON)
+
+/* The same as Delta_Decode_SSE2; vextq_u8(zero, v, 16 - n) shifts v up by
+   n bytes. */
+static size_t Delta_Decode_NEON(unsigned delta, Byte *data, size_t i, size_t size)
+{
+  const uint8x16_t zero = vdupq_n_u8(0);
+  for (; i + 16 <= size; i += 16)
+  {
+    uint8x16_t v = vld1q_u8(data + i);
+    uint8x16_t carry;
+    const Byte *prev = data + i - delta;
+    switch (delta)
+    {
+      case 1:
+        v = vaddq_u8(v, vextq_u8(zero, v, 15));
+        v = vaddq_u8(v, vextq_u8(zero, v, 14));
+        v = vaddq_u8(v, vextq_u8(zero, v, 12));
+        v = vaddq_u8(v, vextq_u8(zero, v, 8));
+        carry = vld1q_dup_u8(prev);
+        break;
+      case 2:
+        v = vaddq_u8(v, vextq_u8(zero, v, 14));
+        v = vaddq_u8(v, vextq_u8(zero, v, 12));
+        v = vaddq_u8(v, vextq_u8(zero, v, 8));
+        carry = vreinterpretq_u8_u16(vdupq_n_u16(GetUi16(prev)));
+        break;
+      case 4:
+        v = vaddq_u8(v, vextq_u8(zero, v, 12));
+        v = vaddq_u8(v, vextq_u8(zero, v, 8));
+        carry = vreinterpretq_u8_u32(vdupq_n_u32(GetUi32(prev)));
+        break;
+      case 8:
+        v = vaddq_u8(v, vextq_u8(zero, v, 8));
+        carry = vcombine_u8(vld1_u8(prev), vld1_u8(prev));
+        break;
+      default:
+        carry = vld1q_u8(prev);
+    }
+    vst1q_u8(data + i, vaddq_u8(v, carry));
+  }
+  return i;
+}
+
+#endif
+
+STATIC void Delta_Decode(Byte *state, unsigned delta, Byte *data, size_t size)
+{
+  size_t i;
+  size_t head = (size < delta) ? size : delta;
+
+  /* The first delta bytes add the previous output, which is in the state. */
+  for (i = 0; i < head; i++)
+    data[i] = (Byte)(data[i] + state[i]);
+
+#if defined(BRA_USE_SSE2) || defined(BRA_USE_NEON)
+  if (delta >= 16 || (delta & (delta - 1)) == 0)
+#if defined(BRA_USE_SSE2)
+    i = Delta_Decode_SSE2(delta, data, i, size);
+#else
+    i = Delta_Decode_NEON(delta, data, i, size);
+#endif
+#endif
+  for (; i < size; i++)
+    data[i] = (Byte)(data[i] + data[i - delta]);
+
+  if (size >= delta)
+    memcpy(state, data + size - delta, delta);
+  else
+  {
+    memmove(state, state + size, delta - size);
+    memcpy(state + delta - size, data, size);
+  }
+}
+
+/* DeflateDec.c -- Deflate and Deflate64 Decoder */
+
+#define DEFLATE_STATE_HEADER 0
+#define DEFLATE_STATE_STORED 1
+#define DEFLATE_STATE_HUFFMAN 2
+#define DEFLATE_STATE_FINISHED 3
+
+#define DEFLATE_LIT_BITS 10
+#define DEFLATE_DIST_BITS 8
+#define DEFLATE_LEVEL_BITS 7
+#define DEFLATE_MAX_BITS 15
+
+/* A table entry holds the number of bits of the code in bits 0..4, the
+   kind in bits 5..7, a count in bits 8..12 and a value in bits 16..31. A
+   code longer than the table bits continues in a subtable: the entry at its
+   first bits is DF_SUB, with the subtable index and its bits. */
+#define DF_LIT  (0 << 5)  /* value is the byte */
+#define DF_LIT2 (1 << 5)  /* two bytes, count is the bits of the first */
+#define DF_BASE (2 << 5)  /* a length or distance, count is the extra bits */
+#define DF_END  (3 << 5)
+#define DF_SUB  (4 << 5)
+#define DF_BAD  (5 << 5)
+
+#define DF_KIND(e) ((e) & 0xE0)
+#define DF_BITS(e) ((unsigned)(e) & 0x1F)
+#define DF_COUNT(e) (((unsigned)(e) >> 8) & 0x1F)
+#define DF_VALUE(e) ((e) >> 16)
+#define DF_ENTRY(kind, bits, count, value) \
+    ((UInt32)(kind) | (UInt32)(bits) | ((UInt32)(count) << 8) | ((UInt32)(value) << 16))
+
+static const UInt16 kLenBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const Byte kLenExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const UInt16 kDistBase[32] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+  32769, 49153 };
+static const Byte kCodeLenOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+STATIC void DeflateDec_Init(CDeflateDec *p, ILookIn *in, Bool deflate64)
+{
+  unsigned i;
+  p->in = in;
+  p->start = p->cur = p->lim = NULL;
+  p->bitBuf = 0;
+  p->bitCount = 0;
+  p->overread = 0;
+  p->dicPos = 0;
+  p->histSize = 0;
+  p->remLen = 0;
+  p->rep = 0;
+  p->storedRem = 0;
+  p->state = DEFLATE_STATE_HEADER;
+  p->isFinal = False;
+  p->deflate64 = deflate64;
+  p->fixedTables = False;
+
+  for (i = 0; i < 256; i++)
+    p->litEntries[i] = DF_ENTRY(DF_LIT, 0, 0, i);
+  p->litEntries[256] = DF_ENTRY(DF_END, 0, 0, 0);
+  for (i = 0; i < 29; i++)
+    p->litEntries[257 + i] = DF_ENTRY(DF_BASE, 0, kLenExtra[i], kLenBase[i]);
+  if (deflate64)
+    p->litEntries[285] = DF_ENTRY(DF_BASE, 0, 16, 3);
+  p->litEntries[286] = p->litEntries[287] = DF_ENTRY(DF_BAD, 0, 0, 0);
+  for (i = 0; i < 32; i++)
+    p->distEntries[i] = (i < 30 || deflate64) ?
+        DF_ENTRY(DF_BASE, 0, i < 4 ? 0 : (i >> 1) - 1, kDistBase[i]) :
+        DF_ENTRY(DF_BAD, 0, 0, 0);
+}
+
+/* Builds the table of the canonical code given by the lengths of num
+   symbols. entries[sym] is the entry of sym without its bits. Returns False
+   if the code is over-subscribed, or incomplete with more than one code. */
+static Bool Deflate_BuildTable(UInt32 *table, unsigned tableBits, unsigned tableSize,
+    const Byte *lens, unsigned num, const UInt32 *entries)
+{
+  unsigned count[DEFLATE_MAX_BITS + 1];
+  unsigned offs[DEFLATE_MAX_BITS + 1];
+  UInt16 sorted[288];
+  unsigned len, sym, i, used, numCodes, subBits = 0;
+  UInt32 code, subPrefix = (UInt32)0 - 1, subStart = 0;
+  int left = 1;
+
+  memset(count, 0, sizeof(count));
+  for (sym = 0; sym < num; sym++)
+    count[lens[sym]]++;
+  numCodes = num - count[0];
+  for (len = 1; len <= DEFLATE_MAX_BITS; len++)
+  {
+    left = (left << 1) - (int)count[len];
+    if (left < 0)
+      return False;
+  }
+  if (left > 0 && numCodes > 1)
+    return False;
+
+  offs[1] = 0;
+  for (len = 1; len < DEFLATE_MAX_BITS; len++)
+    offs[len + 1] = offs[len] + count[len];
+  for (sym = 0; sym < num; sym++)
+    if (lens[sym] != 0)
+      sorted[offs[lens[sym]]++] = (UInt16)sym;
+
+  for (i = 0; i < ((unsigned)1 << tableBits); i++)
+    table[i] = DF_ENTRY(DF_BAD, 0, 0, 0);
+  used = (unsigned)1 << tableBits;
+
+  code = 0;
+  i = 0;
+  for (len = 1; len <= DEFLATE_MAX_BITS; len++, code <<= 1)
+  {
+    for (; count[len] != 0; count[len]--, code++, i++)
+    {
+      /* The stream holds the code from its highest bit, the table is
+         indexed from the first bit read. */
+      UInt32 rev = 0, e = entries[sorted[i]];
+      unsigned k, step;
+      for (k = 0; k < len; k++)
+        rev |= ((code >> k) & 1) << (len - 1 - k);
+      if (len <= tableBits)
+      {
+        for (step = (unsigned)1 << len; rev < ((UInt32)1 << tableBits); rev += step)
+          table[rev] = e | len;
+        continue;
+      }
+      if ((rev & (((UInt32)1 << tableBits) - 1)) != subPrefix)
+      {
+        /* The subtable is big enough for the codes left with this prefix. */
+        int subLeft;
+        subPrefix = rev & (((UInt32)1 << tableBits) - 1);
+        subBits = len - tableBits;
+        subLeft = 1 << subBits;
+        while (subBits + tableBits < DEFLATE_MAX_BITS)
+        {
+          subLeft -= (int)count[subBits + tableBits];
+          if (subLeft <= 0)
+            break;
+          subBits++;
+          subLeft <<= 1;
+        }
+        if (used + ((unsigned)1 << subBits) > tableSize)
+          return False;
+        subStart = used;
+        used += (unsigned)1 << subBits;
+        for (k = subStart; k < used; k++)
+          table[k] = DF_ENTRY(DF_BAD, 0, 0, 0);
+        table[subPrefix] = DF_ENTRY(DF_SUB, tableBits, subBits, subStart);
+      }
+      for (step = (unsigned)1 << (len - tableBits), rev >>= tableBits;
+          rev < ((UInt32)1 << subBits); rev += step)
+        table[subStart + rev] = e | (len - tableBits);
+    }
+  }
+  return True;
+}
+
+/* Puts two literals in the entries whose bits hold both codes, so that
+   runs of literals take one lookup per two bytes. */
+static void Deflate_PairLiterals(UInt32 *table)
+{
+  unsigned i = (unsigned)1 << DEFLATE_LIT_BITS;
+  while (i != 0)
+  {
+    UInt32 e = table[--i], e2;
+    unsigned bits = DF_BITS(e);
+    if (DF_KIND(e) != DF_LIT)
+      continue;
+    /* Lower entries are not paired yet. */
+    e2 = table[i >> bits];
+    if (DF_KIND(e2) == DF_LIT && bits + DF_BITS(e2) <= DEFLATE_LIT_BITS)
+      table[i] = DF_ENTRY(DF_LIT2, bits + DF_BITS(e2), bits, DF_VALUE(e) | (DF_VALUE(e2) << 8));
+  }
+}
+
+/* Refills bitBuf to more than 56 bits. After the end of the input it adds
+   zero bytes, which are an error only if they are used. */
+static SRes DeflateDec_Refill(CDeflateDec *p)
+{
+  while (p->bitCount <= 56)
+  {
+    if (p->cur == p->lim)
+    {
+      size_t size;
+      if (p->overread * 8 > p->bitCount)
+        return SZ_ERROR_DATA;
+      p->in->Skip(p->in, (size_t)(p->cur - p->start));
+      RINOK(p->in->Look(p->in, &p->start, &size));
+      p->cur = p->start;
+      p->lim = p->start + size;
+      if (size == 0)
+      {
+        p->overread++;
+        p->bitCount += 8;
+        continue;
+      }
+    }
+    p->bitBuf |= (UInt64)*p->cur++ << p->bitCount;
+    p->bitCount += 8;
+  }
+  return SZ_OK;
+}
+
+static SRes DeflateDec_ReadBits(CDeflateDec *p, unsigned num, UInt32 *value)
+{
+  if (p->bitCount < num)
+    RINOK(DeflateDec_Refill(p));
+  *value = (UInt32)p->bitBuf & (((UInt32)1 << num) - 1);
+  p->bitBuf >>= num;
+  p->bitCount -= num;
+  return SZ_OK;
+}
+
+static void DeflateDec_AddHistory(CDeflateDec *p, size_t size)
+{
+  UInt32 window = DEFLATE_WINDOW_SIZE(p->deflate64);
+  if (size > window - p->histSize)
+    p->histSize = window;
+  else
+    p->histSize += (UInt32)size;
+}
+
+static SRes DeflateDec_ReadTables(CDeflateDec *p)
 {
-  UInt32 ci;
-  size_t tempSizes[3] = { 0, 0, 0};
-  size_t tempSize3 = 0;
-  Byte *tempBuf3 = 0;
+  Byte lens[288 + 32];
+  Byte levelLens[19];
+  UInt32 levelEntries[19];
+  UInt32 levelTable[1 << DEFLATE_LEVEL_BITS];
+  UInt32 numLit, numDist, numLevels, i, v;
+
+  RINOK(DeflateDec_ReadBits(p, 5, &numLit));
+  RINOK(DeflateDec_ReadBits(p, 5, &numDist));
+  RINOK(DeflateDec_ReadBits(p, 4, &numLevels));
+  numLit += 257;
+  numDist += 1;
+  numLevels += 4;
+  if (!p->deflate64 && (numLit > 286 || numDist > 30))
+    return SZ_ERROR_DATA;
 
-  RINOK(CheckSupportedFolder(folder));
+  memset(levelLens, 0, sizeof(levelLens));
+  for (i = 0; i < numLevels; i++)
+  {
+    RINOK(DeflateDec_ReadBits(p, 3, &v));
+    levelLens[kCodeLenOrder[i]] = (Byte)v;
+  }
+  for (i = 0; i < 19; i++)
+    levelEntries[i] = DF_ENTRY(DF_LIT, 0, 0, i);
+  if (!Deflate_BuildTable(levelTable, DEFLATE_LEVEL_BITS, 1 << DEFLATE_LEVEL_BITS,
+      levelLens, 19, levelEntries))
+    return SZ_ERROR_DATA;
 
-  for (ci = 0; ci < folder->NumCoders; ci++)
+  for (i = 0; i < numLit + numDist;)
   {
-    CSzCoderInfo *coder = &folder->Coders[ci];
+    UInt32 e, sym, rep;
+    Byte len = 0;
+    if (p->bitCount < DEFLATE_LEVEL_BITS)
+      RINOK(DeflateDec_Refill(p));
+    e = levelTable[(size_t)p->bitBuf & ((1 << DEFLATE_LEVEL_BITS) - 1)];
+    if (DF_KIND(e) != DF_LIT)
+      return SZ_ERROR_DATA;
+    p->bitBuf >>= DF_BITS(e);
+    p->bitCount -= DF_BITS(e);
+    sym = DF_VALUE(e);
+    if (sym < 16)
+    {
+      lens[i++] = (Byte)sym;
+      continue;
+    }
+    if (sym == 16)
+    {
+      if (i == 0)
+        return SZ_ERROR_DATA;
+      len = lens[i - 1];
+      RINOK(DeflateDec_ReadBits(p, 2, &rep));
+      rep += 3;
+    }
+    else if (sym == 17)
+    {
+      RINOK(DeflateDec_ReadBits(p, 3, &rep));
+      rep += 3;
+    }
+    else
+    {
+      RINOK(DeflateDec_ReadBits(p, 7, &rep));
+      rep += 11;
+    }
+    if (rep > numLit + numDist - i)
+      return SZ_ERROR_DATA;
+    memset(lens + i, len, rep);
+    i += rep;
+  }
+
+  if (lens[256] == 0)
+    return SZ_ERROR_DATA;
+  if (!Deflate_BuildTable(p->litTable, DEFLATE_LIT_BITS, DEFLATE_LIT_TABLE_SIZE,
+        lens, numLit, p->litEntries) ||
+      !Deflate_BuildTable(p->distTable, DEFLATE_DIST_BITS, DEFLATE_DIST_TABLE_SIZE,
+        lens + numLit, numDist, p->distEntries))
+    return SZ_ERROR_DATA;
+  Deflate_PairLiterals(p->litTable);
+  return SZ_OK;
+}
 
-    if (IS_MAIN_METHOD((UInt32)coder->MethodID))
+static SRes DeflateDec_ReadBlockHeader(CDeflateDec *p)
+{
+  UInt32 v;
+  RINOK(DeflateDec_ReadBits(p, 3, &v));
+  p->isFinal = (Bool)(v & 1);
+  switch (v >> 1)
+  {
+    case 0:
     {
-      UInt32 si = 0;
-      UInt64 offset;
-      UInt64 inSize;
-      Byte *outBufCur = outBuffer;
-      size_t outSizeCur = outSize;
-      if (folder->NumCoders == 4)
+      UInt32 nlen;
+      RINOK(DeflateDec_ReadBits(p, p->bitCount & 7, &v));
+      RINOK(DeflateDec_ReadBits(p, 16, &v));
+      RINOK(DeflateDec_ReadBits(p, 16, &nlen));
+      if (v != (~nlen & 0xFFFF))
+        return SZ_ERROR_DATA;
+      p->storedRem = v;
+      p->state = DEFLATE_STATE_STORED;
+      return SZ_OK;
+    }
+    case 1:
+      if (!p->fixedTables)
       {
-        UInt32 indices[] = { 3, 2, 0 };
-        UInt64 unpackSize = folder->UnpackSizes[ci];
-        si = indices[ci];
-        if (ci < 2)
-        {
-          Byte *temp;
-          outSizeCur = (size_t)unpackSize;
-          if (outSizeCur != unpackSize)
-            return SZ_ERROR_MEM;
-          temp = (Byte *)SzAlloc(outSizeCur);
-          if (temp == 0 && outSizeCur != 0)
-            return SZ_ERROR_MEM;
-          outBufCur = tempBuf[1 - ci] = temp;
-          tempSizes[1 - ci] = outSizeCur;
-        }
-        else if (ci == 2)
-        {
-          if (unpackSize > outSize) /* check it */
-            return SZ_ERROR_PARAM;
-          tempBuf3 = outBufCur = outBuffer + (outSize - (size_t)unpackSize);
-          tempSize3 = outSizeCur = (size_t)unpackSize;
-        }
-        else
-          return SZ_ERROR_UNSUPPORTED;
+        Byte lens[288 + 32];
+        memset(lens, 8, 144);
+        memset(lens + 144, 9, 256 - 144);
+        memset(lens + 256, 7, 280 - 256);
+        memset(lens + 280, 8, 288 - 280);
+        memset(lens + 288, 5, 32);
+        Deflate_BuildTable(p->litTable, DEFLATE_LIT_BITS, DEFLATE_LIT_TABLE_SIZE,
+            lens, 288, p->litEntries);
+        Deflate_BuildTable(p->distTable, DEFLATE_DIST_BITS, DEFLATE_DIST_TABLE_SIZE,
+            lens + 288, 32, p->distEntries);
+        Deflate_PairLiterals(p->litTable);
+        p->fixedTables = True;
       }
-      offset = GetSum(packSizes, si);
-      inSize = packSizes[si];
-#ifdef _SZ_SEEK_DEBUG
-      fprintf(stderr, "SEEKN 2\n");
-#endif
-      RINOK(LookInStream_SeekTo(inStream, startPos + offset));
+      break;
+    case 2:
+      p->fixedTables = False;
+      RINOK(DeflateDec_ReadTables(p));
+      break;
+    default:
+      return SZ_ERROR_DATA;
+  }
+  p->state = DEFLATE_STATE_HUFFMAN;
+  return SZ_OK;
+}
+
+static SRes DeflateDec_CopyStored(CDeflateDec *p, size_t dicLimit)
+{
+  size_t start = p->dicPos;
+
+  /* The bytes left in bitBuf come first. bitCount is a multiple of 8. */
+  while (p->storedRem != 0 && p->bitCount != 0 && p->dicPos != dicLimit)
+  {
+    if (p->overread * 8 >= p->bitCount)
+      return SZ_ERROR_DATA;
+    p->dic[p->dicPos++] = (Byte)p->bitBuf;
+    p->bitBuf >>= 8;
+    p->bitCount -= 8;
+    p->storedRem--;
+  }
+  if (p->bitCount == 0)
+    p->bitBuf = 0;
 
-      if (coder->MethodID == k_Copy)
+  while (p->storedRem != 0 && p->dicPos != dicLimit)
+  {
+    size_t size;
+    if (p->cur == p->lim)
+    {
+      p->in->Skip(p->in, (size_t)(p->cur - p->start));
+      RINOK(p->in->Look(p->in, &p->start, &size));
+      p->cur = p->start;
+      p->lim = p->start + size;
+      if (size == 0)
+        return SZ_ERROR_DATA;
+    }
+    size = (size_t)(p->lim - p->cur);
+    if (size > p->storedRem)
+      size = p->storedRem;
+    if (size > dicLimit - p->dicPos)
+      size = dicLimit - p->dicPos;
+    memcpy(p->dic + p->dicPos, p->cur, size);
+    p->cur += size;
+    p->dicPos += size;
+    p->storedRem -= (UInt32)size;
+  }
+
+  DeflateDec_AddHistory(p, p->dicPos - start);
+  if (p->storedRem == 0)
+    p->state = p->isFinal ? DEFLATE_STATE_FINISHED : DEFLATE_STATE_HEADER;
+  return SZ_OK;
+}
+
+#define DF_SAVE { p->bitBuf = bitBuf; p->bitCount = bitCount; p->cur = cur; }
+#define DF_LOAD { bitBuf = p->bitBuf; bitCount = p->bitCount; cur = p->cur; lim = p->lim; }
+
+/* Makes bitBuf hold at least n bits. With 8 bytes of input left, it loads
+   them at once and keeps the whole bytes that fit. */
+#define DF_NEED(n) \
+  if (bitCount < (n)) { \
+    if (lim - cur >= 8) { \
+      bitBuf |= GetUi64(cur) << bitCount; \
+      cur += (63 - bitCount) >> 3; \
+      bitCount |= 56; } \
+    else { SRes res_; DF_SAVE; res_ = DeflateDec_Refill(p); DF_LOAD; \
+      if (res_ != SZ_OK) return res_; } }
+
+#define DF_DROP(n) { unsigned n_ = (n); bitBuf >>= n_; bitCount -= n_; }
+
+/* Decodes the symbols of a block until its end or dicLimit. With finish, the
+   end of the block must come at dicLimit. */
+static SRes DeflateDec_DecodeHuffman(CDeflateDec *p, size_t dicLimit, Bool finish)
+{
+  UInt64 bitBuf = p->bitBuf;
+  unsigned bitCount = p->bitCount;
+  const Byte *cur = p->cur;
+  const Byte *lim = p->lim;
+  Byte *dic = p->dic;
+  size_t dicPos = p->dicPos;
+  size_t startPos = dicPos;
+  size_t dicBufSize = p->dicBufSize;
+  const UInt32 *litTable = p->litTable;
+  const UInt32 *distTable = p->distTable;
+  UInt32 remLen = p->remLen;
+  UInt32 dist = p->rep;
+
+  for (;;)
+  {
+    UInt32 e;
+    if (remLen != 0)
+    {
+      size_t n = dicLimit - dicPos;
+      size_t src = dicPos - dist;
+      if (n == 0)
+        break;
+      if (n > remLen)
+        n = remLen;
+      remLen -= (UInt32)n;
+      if (dicPos < dist)
       {
-        size_t size = inSize;
-#ifdef _SZ_CODER_DEBUG
-      fprintf(stderr, "CODER Copy\n");
-#endif
-        if (inSize != outSizeCur) /* check it */
-          return SZ_ERROR_DATA;
-        if (inSize != size)
-          return SZ_ERROR_MEM;
-        RINOK(LookToRead_ReadAll(inStream, outBufCur, size));
+        src += dicBufSize;
+        do
+        {
+          dic[dicPos++] = dic[src];
+          if (++src == dicBufSize)
+            src = 0;
+        }
+        while (--n != 0);
       }
-      else if (coder->MethodID == k_LZMA)
+      else
       {
-#ifdef _SZ_CODER_DEBUG
-      fprintf(stderr, "CODER LZMA\n");
-#endif
-        RINOK(SzDecodeLzma(coder, inSize, inStream, outBufCur, outSizeCur));
+        Byte *d = dic + dicPos;
+        const Byte *s = dic + src;
+        dicPos += n;
+        if (dist >= 8)
+          for (; n >= 8; n -= 8, d += 8, s += 8)
+            memcpy(d, s, 8);
+        for (; n != 0; n--)
+          *d++ = *s++;
       }
-      else if (coder->MethodID == k_LZMA2)
+      if (remLen != 0)
+        break;
+    }
+    if (dicPos == dicLimit && !finish)
+      break;
+
+    DF_NEED(48)
+    e = litTable[(size_t)bitBuf & ((1 << DEFLATE_LIT_BITS) - 1)];
+    if (DF_KIND(e) == DF_SUB)
+    {
+      DF_DROP(DEFLATE_LIT_BITS)
+      e = litTable[DF_VALUE(e) + ((size_t)bitBuf & (((size_t)1 << DF_COUNT(e)) - 1))];
+    }
+    if (DF_KIND(e) <= DF_LIT2)
+    {
+      if (dicPos == dicLimit)
+        return SZ_ERROR_DATA;
+      if (DF_KIND(e) == DF_LIT2 && dicLimit - dicPos >= 2)
       {
-#ifdef _SZ_CODER_DEBUG
-      fprintf(stderr, "CODER LZMA2\n");
-#endif
-        RINOK(SzDecodeLzma2(coder, inSize, inStream, outBufCur, outSizeCur));
+        DF_DROP(DF_BITS(e))
+        dic[dicPos] = (Byte)DF_VALUE(e);
+        dic[dicPos + 1] = (Byte)(DF_VALUE(e) >> 8);
+        dicPos += 2;
       }
       else
       {
-        return SZ_ERROR_UNSUPPORTED;
+        DF_DROP(DF_KIND(e) == DF_LIT ? DF_BITS(e) : DF_COUNT(e))
+        dic[dicPos++] = (Byte)DF_VALUE(e);
+      }
+      continue;
+    }
+    DF_DROP(DF_BITS(e))
+    if (DF_KIND(e) == DF_BASE)
+    {
+      if (dicPos == dicLimit)
+        return SZ_ERROR_DATA;
+      remLen = DF_VALUE(e) + ((UInt32)bitBuf & (((UInt32)1 << DF_COUNT(e)) - 1));
+      DF_DROP(DF_COUNT(e))
+      DF_NEED(32)
+      e = distTable[(size_t)bitBuf & ((1 << DEFLATE_DIST_BITS) - 1)];
+      if (DF_KIND(e) == DF_SUB)
+      {
+        DF_DROP(DEFLATE_DIST_BITS)
+        e = distTable[DF_VALUE(e) + ((size_t)bitBuf & (((size_t)1 << DF_COUNT(e)) - 1))];
       }
+      if (DF_KIND(e) != DF_BASE)
+        return SZ_ERROR_DATA;
+      DF_DROP(DF_BITS(e))
+      dist = DF_VALUE(e) + ((UInt32)bitBuf & (((UInt32)1 << DF_COUNT(e)) - 1));
+      DF_DROP(DF_COUNT(e))
+      if (dist > p->histSize + (dicPos - startPos))
+        return SZ_ERROR_DATA;
+      continue;
     }
-    else if (coder->MethodID == k_BCJ2)
+    if (DF_KIND(e) != DF_END)
+      return SZ_ERROR_DATA;
+    p->state = p->isFinal ? DEFLATE_STATE_FINISHED : DEFLATE_STATE_HEADER;
+    break;
+  }
+
+  DF_SAVE
+  p->dicPos = dicPos;
+  p->remLen = remLen;
+  p->rep = dist;
+  DeflateDec_AddHistory(p, dicPos - startPos);
+  return SZ_OK;
+}
+
+STATIC SRes DeflateDec_DecodeToDic(CDeflateDec *p, size_t dicLimit, Bool finish)
+{
+  SRes res = SZ_OK;
+  while (res == SZ_OK)
+  {
+    if (p->state == DEFLATE_STATE_FINISHED)
     {
-      UInt64 offset = GetSum(packSizes, 1);
-      UInt64 s3Size = packSizes[1];
       size_t size;
-#ifdef _SZ_CODER_DEBUG
-      fprintf(stderr, "CODER BCJ2\n");
-#endif
-      if (ci != 3)
-        return SZ_ERROR_UNSUPPORTED;
-#ifdef _SZ_SEEK_DEBUG
-      fprintf(stderr, "SEEKN 3\n");
-#endif
-      RINOK(LookInStream_SeekTo(inStream, startPos + offset));
-      tempSizes[2] = size = (size_t)s3Size;
-      if (size != s3Size)
-        return SZ_ERROR_MEM;
-      tempBuf[2] = (Byte *)SzAlloc(tempSizes[2]);
-      if (tempBuf[2] == 0 && tempSizes[2] != 0)
-        return SZ_ERROR_MEM;
-      RINOK(LookToRead_ReadAll(inStream, tempBuf[2], size));
-      RINOK(Bcj2_Decode(
-          tempBuf3, tempSize3,
-          tempBuf[0], tempSizes[0],
-          tempBuf[1], tempSizes[1],
-          tempBuf[2], tempSizes[2],
-          outBuffer, outSize));
+      if (!finish)
+        break;
+      /* Only the zero bytes after the input can be left in bitBuf. */
+      if (p->dicPos != dicLimit || p->overread != (p->bitCount >> 3) || p->cur != p->lim)
+        return SZ_ERROR_DATA;
+      p->in->Skip(p->in, (size_t)(p->cur - p->start));
+      p->start = p->cur;
+      RINOK(p->in->Look(p->in, &p->start, &size));
+      p->cur = p->lim = p->start;
+      return size == 0 ? SZ_OK : SZ_ERROR_DATA;
+    }
+    if (p->dicPos == dicLimit && !finish)
+      break;
+    if (p->state == DEFLATE_STATE_HEADER)
+      res = DeflateDec_ReadBlockHeader(p);
+    else if (p->state == DEFLATE_STATE_STORED)
+    {
+      if (p->dicPos == dicLimit && p->storedRem != 0)
+        return SZ_ERROR_DATA;
+      res = DeflateDec_CopyStored(p, dicLimit);
     }
     else
     {
-      if (ci != 1)
-        return SZ_ERROR_UNSUPPORTED;
-      switch(coder->MethodID)
+      res = DeflateDec_DecodeHuffman(p, dicLimit, finish);
+      if (res == SZ_OK && p->state == DEFLATE_STATE_HUFFMAN)
       {
-        case k_BCJ:
-        {
-          UInt32 state;
-#ifdef _SZ_CODER_DEBUG
-          fprintf(stderr, "CODER BCJ\n");
-#endif
-          x86_Convert_Init(state);
-          x86_Convert(outBuffer, outSize, 0, &state, 0);
-          break;
-        }
-        case k_ARM:
-#ifdef _SZ_CODER_DEBUG
-          fprintf(stderr, "CODER ARM\n");
-#endif
-          ARM_Convert(outBuffer, outSize, 0, 0);
-          break;
-        default:
-          return SZ_ERROR_UNSUPPORTED;
+        /* Stopped at dicLimit. */
+        if (finish)
+          return SZ_ERROR_DATA;
+        break;
       }
     }
   }
-  return SZ_OK;
+  if (res == SZ_OK)
+  {
+    p->in->Skip(p->in, (size_t)(p->cur - p->start));
+    p->start = p->cur;
+  }
+  return res;
 }
 
-STATIC SRes SzFolder_Decode(const CSzFolder *folder, const UInt64 *packSizes,
-    CLookToRead *inStream, UInt64 startPos,
-    Byte *outBuffer, size_t outSize)
+/* Ppmd7.c -- PPMdH codec
+2010-03-12 : Igor Pavlov : Public domain
+This code is based on PPMd var.H (2001): Dmitry Shkarin : Public domain */
+
+static const UInt16 kInitBinEsc[] = { 0x3CDD, 0x1F3F, 0x59BF, 0x48F3, 0x64A1, 0x5ABC, 0x6632, 0x6051};
+static const Byte PPMD7_kExpEscape[16] = { 25, 14, 9, 7, 5, 5, 4, 4, 4, 3, 3, 3, 2, 2, 2, 2 };
+
+#define MAX_FREQ 124
+#define UNIT_SIZE 12
+
+#define U2B(nu) ((UInt32)(nu) * UNIT_SIZE)
+#define U2I(nu) (p->Units2Indx[(nu) - 1])
+#define I2U(indx) (p->Indx2Units[indx])
+
+#define REF(ptr) ((UInt32)((Byte *)(ptr) - (p)->Base))
+#define STATS_REF(ptr) REF(ptr)
+#define CTX(ref) ((CPpmd7_Context *)Ppmd7_GetContext(p, ref))
+#define STATS(ctx) Ppmd7_GetStats(p, ctx)
+#define ONE_STATE(ctx) Ppmd7Context_OneState(ctx)
+#define SUFFIX(ctx) CTX((ctx)->Suffix)
+
+#define Ppmd7_GetPtr(p, offs) ((void *)((p)->Base + (offs)))
+#define Ppmd7_GetContext(p, offs) ((CPpmd7_Context *)Ppmd7_GetPtr((p), (offs)))
+#define Ppmd7_GetStats(p, ctx) ((CPpmd_State *)Ppmd7_GetPtr((p), ((ctx)->Stats)))
+
+#define Ppmd_See_Update(p)  if ((p)->Shift < PPMD_PERIOD_BITS && --(p)->Count == 0) \
+    { (p)->Summ <<= 1; (p)->Count = (Byte)(3 << (p)->Shift++); }
+
+#define Ppmd7_GetBinSumm(p) \
+    &p->BinSumm[Ppmd7Context_OneState(p->MinContext)->Freq - 1][p->PrevSuccess + \
+    p->NS2BSIndx[Ppmd7_GetContext(p, p->MinContext->Suffix)->NumStats - 1] + \
+    (p->HiBitsFlag = p->HB2Flag[p->FoundState->Symbol]) + \
+    2 * p->HB2Flag[Ppmd7Context_OneState(p->MinContext)->Symbol] + \
+    ((p->RunLength >> 26) & 0x20)]
+
+#define PPMD_SetAllBitsIn256Bytes(charMask) \
+  { unsigned z; for (z = 0; z < sizeof(charMask) / sizeof(charMask[0]); z += 8) { \
+  charMask[z + 7] = charMask[z + 6] = charMask[z + 5] = charMask[z + 4] = \
+  charMask[z + 3] = charMask[z + 2] = charMask[z + 1] = charMask[z + 0] = (size_t)0 - 1; }}
+
+typedef CPpmd7_Context *CTX_PTR;
+
+typedef struct
 {
-  Byte *tempBuf[3] = { 0, 0, 0};
-  int i;
-  SRes res = SzFolder_Decode2(folder, packSizes, inStream, startPos,
-      outBuffer, (size_t)outSize, tempBuf);
+  UInt16 Stamp; /* must be at offset 0 as CPpmd7_Context::NumStats. Stamp=0 means free */
+  UInt16 NU;
+  UInt32 Next; /* must be at offset >= 4 */
+  UInt32 Prev;
+} CPpmd7_Node;
+
+#define NODE(offs) ((CPpmd7_Node *)(p->Base + (offs)))
+
+static void SetSuccessor(CPpmd_State *p, UInt32 v)
+{
+  (p)->SuccessorLow = (UInt16)((UInt32)(v) & 0xFFFF);
+  (p)->SuccessorHigh = (UInt16)(((UInt32)(v) >> 16) & 0xFFFF);
+}
+
+#define SUCCESSOR(s) ((UInt32)(s)->SuccessorLow | ((UInt32)(s)->SuccessorHigh << 16))
+
+STATIC void Ppmd7_Construct(CPpmd7 *p)
+{
+  unsigned i, k, m;
+
+  p->Base = 0;
+  p->BaseSize = 0;
+
+  for (i = 0, k = 0; i < PPMD_NUM_INDEXES; i++)
+  {
+    unsigned step = (i >= 12 ? 4 : (i >> 2) + 1);
+    do { p->Units2Indx[k++] = (Byte)i; } while (--step);
+    p->Indx2Units[i] = (Byte)k;
+  }
+
+  p->NS2BSIndx[0] = (0 << 1);
+  p->NS2BSIndx[1] = (1 << 1);
+  memset(p->NS2BSIndx + 2, (2 << 1), 9);
+  memset(p->NS2BSIndx + 11, (3 << 1), 256 - 11);
+
   for (i = 0; i < 3; i++)
-    SzFree(tempBuf[i]);
-  return res;
+    p->NS2Indx[i] = (Byte)i;
+  for (m = i, k = 1; i < 256; i++)
+  {
+    p->NS2Indx[i] = (Byte)m;
+    if (--k == 0)
+      k = (++m) - 2;
+  }
+
+  memset(p->HB2Flag, 0, 0x40);
+  memset(p->HB2Flag + 0x40, 8, 0x100 - 0x40);
 }
 
-/* 7zCrc.c */
+STATIC void Ppmd7_Free(CPpmd7 *p)
+{
+  SzFree(p->Base);
+  p->Size = 0;
+  p->BaseSize = 0;
+  p->Base = 0;
+}
 
-#define kCrcPoly 0xEDB88320
+STATIC Bool Ppmd7_Alloc(CPpmd7 *p, UInt32 size)
+{
+  /* AlignOffset puts the end of the block, where the units start, on a
+     4-byte boundary; one more unit there is the list head of GlueFreeBlocks */
+  size_t need = PPMD7_ALLOC_SIZE(size);
+  if (p->Base == 0 || p->BaseSize < need)
+  {
+    Ppmd7_Free(p);
+    if ((p->Base = (Byte *)SzAlloc(need)) == 0)
+      return False;
+    p->BaseSize = need;
+  }
+  p->AlignOffset = 4 - (size & 3);
+  p->Size = size;
+  return True;
+}
 
-/* Based on crc32h in: http://www.hackersdelight.org/hdcodetxt/crc.c.txt */
-STATIC UInt32 MY_FAST_CALL CrcCalc(const void *data, size_t size) {
-  const UInt32 g0 = kCrcPoly, g1 = g0>>1,
-      g2 = g0>>2, g3 = g0>>3, g4 = g0>>4, g5 = g0>>5,
-      g6 = (g0>>6)^g0, g7 = ((g0>>6)^g0)>>1;
-  register const Byte *p = (const Byte*)data;
-  register const Byte *pend = p + size;
-  register Int32 crc = -1;
-  if (p != pend) {
-    do {
-      crc ^= *p++;
-      crc = ((UInt32)crc >> 8) ^
-         ((crc<<31>>31) & g7) ^ ((crc<<30>>31) & g6) ^
-         ((crc<<29>>31) & g5) ^ ((crc<<28>>31) & g4) ^
-         ((crc<<27>>31) & g3) ^ ((crc<<26>>31) & g2) ^
-         ((crc<<25>>31) & g1) ^ ((crc<<24>>31) & g0);
-    } while (p != pend);
+static void InsertNode(CPpmd7 *p, void *node, unsigned indx)
+{
+  *((UInt32 *)node) = p->FreeList[indx];
+  p->FreeList[indx] = REF(node);
+}
+
+static void *RemoveNode(CPpmd7 *p, unsigned indx)
+{
+  UInt32 *node = (UInt32 *)Ppmd7_GetPtr(p, p->FreeList[indx]);
+  p->FreeList[indx] = *node;
+  return node;
+}
+
+static void SplitBlock(CPpmd7 *p, void *ptr, unsigned oldIndx, unsigned newIndx)
+{
+  unsigned i, nu = I2U(oldIndx) - I2U(newIndx);
+  ptr = (Byte *)ptr + U2B(I2U(newIndx));
+  if (I2U(i = U2I(nu)) != nu)
+  {
+    unsigned k = I2U(--i);
+    InsertNode(p, ((Byte *)ptr) + U2B(k), nu - k - 1);
   }
-  return ~crc;
+  InsertNode(p, ptr, i);
 }
 
-/* 7zAlloc.c */
+static void GlueFreeBlocks(CPpmd7 *p)
+{
+  UInt32 head = p->AlignOffset + p->Size;
+  UInt32 n = head;
+  unsigned i;
 
-STATIC void *SzAlloc(size_t size) {
-  if (size == 0)
-    return 0;
-#ifdef _SZ_ALLOC_DEBUG
-  void *r = malloc(size);
-  fprintf(stderr, "DYNAMIC ALLOC %lld = %p\n", (long long)size, r);
-  return r;
-#else
-  return malloc(size);
-#endif
+  p->GlueCount = 255;
+
+  /* create doubly-linked list of free blocks */
+  for (i = 0; i < PPMD_NUM_INDEXES; i++)
+  {
+    UInt16 nu = I2U(i);
+    UInt32 next = p->FreeList[i];
+    p->FreeList[i] = 0;
+    while (next != 0)
+    {
+      CPpmd7_Node *node = NODE(next);
+      node->Next = n;
+      n = NODE(n)->Prev = next;
+      next = *(const UInt32 *)node;
+      node->Stamp = 0;
+      node->NU = (UInt16)nu;
+    }
+  }
+  NODE(head)->Stamp = 1;
+  NODE(head)->Next = n;
+  NODE(n)->Prev = head;
+  if (p->LoUnit != p->HiUnit)
+    ((CPpmd7_Node *)p->LoUnit)->Stamp = 1;
+
+  /* Glue free blocks */
+  while (n != head)
+  {
+    CPpmd7_Node *node = NODE(n);
+    UInt32 nu = (UInt32)node->NU;
+    for (;;)
+    {
+      CPpmd7_Node *node2 = NODE(n) + nu;
+      nu += node2->NU;
+      if (node2->Stamp != 0 || nu >= 0x10000)
+        break;
+      NODE(node2->Prev)->Next = node2->Next;
+      NODE(node2->Next)->Prev = node2->Prev;
+      node->NU = (UInt16)nu;
+    }
+    n = node->Next;
+  }
+
+  /* Fill lists of free blocks */
+  for (n = NODE(head)->Next; n != head;)
+  {
+    CPpmd7_Node *node = NODE(n);
+    unsigned nu;
+    UInt32 next = node->Next;
+    for (nu = node->NU; nu > 128; nu -= 128, node += 128)
+      InsertNode(p, node, PPMD_NUM_INDEXES - 1);
+    if (I2U(i = U2I(nu)) != nu)
+    {
+      unsigned k = I2U(--i);
+      InsertNode(p, node + k, nu - k - 1);
+    }
+    InsertNode(p, node, i);
+    n = next;
+  }
 }
 
-STATIC void SzFree(void *address) {
-  #ifdef _SZ_ALLOC_DEBUG
-  fprintf(stderr, "DYNAMIC FREE %p\n", address);
-  #endif
-  free(address);
+static void *AllocUnitsRare(CPpmd7 *p, unsigned indx)
+{
+  unsigned i;
+  void *retVal;
+  if (p->GlueCount == 0)
+  {
+    GlueFreeBlocks(p);
+    if (p->FreeList[indx] != 0)
+      return RemoveNode(p, indx);
+  }
+  i = indx;
+  do
+  {
+    if (++i == PPMD_NUM_INDEXES)
+    {
+      UInt32 numBytes = U2B(I2U(indx));
+      p->GlueCount--;
+      return ((UInt32)(p->UnitsStart - p->Text) > numBytes) ? (p->UnitsStart -= numBytes) : (NULL);
+    }
+  }
+  while (p->FreeList[i] == 0);
+  retVal = RemoveNode(p, i);
+  SplitBlock(p, retVal, i, indx);
+  return retVal;
 }
 
-/* 7zStream.c */
-
-STATIC SRes LookInStream_SeekTo(CLookToRead *p, UInt64 offset)
+static void *AllocUnits(CPpmd7 *p, unsigned indx)
 {
-  p->pos = p->size = 0;
-  if (offset >= p->data_len) {
-    errno = EINVAL;
-    return SZ_ERROR_READ;
+  UInt32 numBytes;
+  if (p->FreeList[indx] != 0)
+    return RemoveNode(p, indx);
+  numBytes = U2B(I2U(indx));
+  if (numBytes <= (UInt32)(p->HiUnit - p->LoUnit))
+  {
+    void *retVal = p->LoUnit;
+    p->LoUnit += numBytes;
+    return retVal;
   }
-  p->data_pos = offset;
-  return SZ_OK;
+  return AllocUnitsRare(p, indx);
 }
 
-STATIC SRes LookToRead_Look(CLookToRead *p, const void **buf, size_t *size) {
-  SRes res = SZ_OK;
-  size_t size_in_buf = p->size - p->pos;
-  size_t rsize;
+#define MyMem12Cpy(dest, src, num) \
+  { UInt32 *d = (UInt32 *)dest; const UInt32 *s = (const UInt32 *)src; UInt32 n = num; \
+    do { d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; s += 3; d += 3; } while (--n); }
 
-  /* Checking size_in_buf <= p->pos is needed to avoid overlap in memcpy. */
-  if (*size > size_in_buf && size_in_buf <= p->pos) {  /* TODO(pts): Do we need memmove instead? */
-    memcpy(p->buf, p->buf + p->pos, size_in_buf);
-    p->pos = 0;
-    /* True but we can do it later: p->size = size_in_buf; */
-    /* : res = FileInStream_Read(p->realStream, p->buf + size_in_buf, size); */
-    /* We fill the buffer, we read more than: *size - size_in_buf; */
-    rsize = LookToRead_BUF_SIZE - size_in_buf;
-    if ((p->data_pos + rsize) > p->data_len) {
-      rsize = p->data_len - p->data_pos;
-    }
-    if (rsize > 0) {
-      memcpy(p->buf + size_in_buf, (char*)p->data + p->data_pos, rsize);
-      p->data_pos += rsize;
-    } 
-    p->size = *size = size_in_buf += rsize;
-  } else {
-    *size = size_in_buf;
+static void *ShrinkUnits(CPpmd7 *p, void *oldPtr, unsigned oldNU, unsigned newNU)
+{
+  unsigned i0 = U2I(oldNU);
+  unsigned i1 = U2I(newNU);
+  if (i0 == i1)
+    return oldPtr;
+  if (p->FreeList[i1] != 0)
+  {
+    void *ptr = RemoveNode(p, i1);
+    MyMem12Cpy(ptr, oldPtr, newNU);
+    InsertNode(p, oldPtr, i0);
+    return ptr;
   }
-  *buf = p->buf + p->pos;
-  return res;
+  SplitBlock(p, oldPtr, i0, i1);
+  return oldPtr;
 }
 
-STATIC SRes LookToRead_ReadAll(CLookToRead *p, void *buf, size_t size) {
-  Byte *lbuf;
-  SRes res = SZ_OK;
-  size_t got;
-  while (size > 0) {
-    got = size;
-    res = LookToRead_Look(p, (const void**)&lbuf, &got);
-    if (res != SZ_OK) break;
-    if (got == 0) { res = SZ_ERROR_INPUT_EOF; break; }
-    LOOKTOREAD_SKIP(p, got);
-    memcpy(buf, lbuf, got);
-    size -= got;
-    buf = (Byte*)buf + got;
+static void RestartModel(CPpmd7 *p)
+{
+  unsigned i, k, m;
+
+  memset(p->FreeList, 0, sizeof(p->FreeList));
+  p->Text = p->Base + p->AlignOffset;
+  p->HiUnit = p->Text + p->Size;
+  p->LoUnit = p->UnitsStart = p->HiUnit - p->Size / 8 / UNIT_SIZE * 7 * UNIT_SIZE;
+  p->GlueCount = 0;
+
+  p->OrderFall = p->MaxOrder;
+  p->RunLength = p->InitRL = -(Int32)((p->MaxOrder < 12) ? p->MaxOrder : 12) - 1;
+  p->PrevSuccess = 0;
+
+  p->MinContext = p->MaxContext = (CTX_PTR)(p->HiUnit -= UNIT_SIZE); /* AllocContext(p); */
+  p->MinContext->Suffix = 0;
+  p->MinContext->NumStats = 256;
+  p->MinContext->SummFreq = 256 + 1;
+  p->FoundState = (CPpmd_State *)p->LoUnit; /* AllocUnits(p, PPMD_NUM_INDEXES - 1); */
+  p->LoUnit += U2B(256 / 2);
+  p->MinContext->Stats = REF(p->FoundState);
+  for (i = 0; i < 256; i++)
+  {
+    CPpmd_State *s = &p->FoundState[i];
+    s->Symbol = (Byte)i;
+    s->Freq = 1;
+    SetSuccessor(s, 0);
   }
-  return res;
+
+  for (i = 0; i < 128; i++)
+    for (k = 0; k < 8; k++)
+    {
+      UInt16 *dest = p->BinSumm[i] + k;
+      UInt16 val = (UInt16)(PPMD_BIN_SCALE - kInitBinEsc[k] / (i + 2));
+      for (m = 0; m < 64; m += 8)
+        dest[m] = val;
+    }
+
+  for (i = 0; i < 25; i++)
+    for (k = 0; k < 16; k++)
+    {
+      CPpmd_See *s = &p->See[i][k];
+      s->Summ = (UInt16)((5 * i + 10) << (s->Shift = PPMD_PERIOD_BITS - 4));
+      s->Count = 4;
+    }
 }
 
-/* Bcj2.c -- Converter for x86 code (BCJ2) */
+STATIC void Ppmd7_Init(CPpmd7 *p, unsigned maxOrder)
+{
+  p->MaxOrder = maxOrder;
+  RestartModel(p);
+  p->DummySee.Shift = PPMD_PERIOD_BITS;
+  p->DummySee.Summ = 0; /* unused */
+  p->DummySee.Count = 64; /* unused */
+}
 
-#ifdef _LZMA_PROB32
-#define CProb UInt32
-#else
-#define CProb UInt16
-#endif
+static CTX_PTR CreateSuccessors(CPpmd7 *p, Bool skip)
+{
+  CPpmd_State upState;
+  CTX_PTR c = p->MinContext;
+  UInt32 upBranch = SUCCESSOR(p->FoundState);
+  CPpmd_State *ps[PPMD7_MAX_ORDER];
+  unsigned numPs = 0;
 
-#define IsJcc(b0, b1) ((b0) == 0x0F && ((b1) & 0xF0) == 0x80)
-#define IsJ(b0, b1) ((b1 & 0xFE) == 0xE8 || IsJcc(b0, b1))
+  if (!skip)
+    ps[numPs++] = p->FoundState;
 
-#define kNumTopBits 24
-#define kTopValue ((UInt32)1 << kNumTopBits)
+  while (c->Suffix)
+  {
+    UInt32 successor;
+    CPpmd_State *s;
+    c = SUFFIX(c);
+    if (c->NumStats != 1)
+    {
+      for (s = STATS(c); s->Symbol != p->FoundState->Symbol; s++);
+    }
+    else
+      s = ONE_STATE(c);
+    successor = SUCCESSOR(s);
+    if (successor != upBranch)
+    {
+      c = CTX(successor);
+      if (numPs == 0)
+        return c;
+      break;
+    }
+    ps[numPs++] = s;
+  }
 
-#define kNumBitModelTotalBits 11
-#define kBitModelTotal (1 << kNumBitModelTotalBits)
-#define kNumMoveBits 5
+  upState.Symbol = *(const Byte *)Ppmd7_GetPtr(p, upBranch);
+  SetSuccessor(&upState, upBranch + 1);
 
-#define RC_READ_BYTE (*buffer++)
-#define RC_TEST { if (buffer == bufferLim) return SZ_ERROR_DATA; }
-#define RC_INIT2 code = 0; range = 0xFFFFFFFF; \
-  { int i; for (i = 0; i < 5; i++) { RC_TEST; code = (code << 8) | RC_READ_BYTE; }}
+  if (c->NumStats == 1)
+    upState.Freq = ONE_STATE(c)->Freq;
+  else
+  {
+    UInt32 cf, s0;
+    CPpmd_State *s;
+    for (s = STATS(c); s->Symbol != upState.Symbol; s++);
+    cf = s->Freq - 1;
+    s0 = c->SummFreq - c->NumStats - cf;
+    upState.Freq = (Byte)(1 + ((2 * cf <= s0) ? (5 * cf > s0) : ((2 * cf + 3 * s0 - 1) / (2 * s0))));
+  }
 
-#define NORMALIZE_BCJ2 if (range < kTopValue) { RC_TEST; range <<= 8; code = (code << 8) | RC_READ_BYTE; }
+  do
+  {
+    /* Create Child */
+    CTX_PTR c1; /* = AllocContext(p); */
+    if (p->HiUnit != p->LoUnit)
+      c1 = (CTX_PTR)(p->HiUnit -= UNIT_SIZE);
+    else if (p->FreeList[0] != 0)
+      c1 = (CTX_PTR)RemoveNode(p, 0);
+    else
+    {
+      c1 = (CTX_PTR)AllocUnitsRare(p, 0);
+      if (!c1)
+        return NULL;
+    }
+    c1->NumStats = 1;
+    *ONE_STATE(c1) = upState;
+    c1->Suffix = REF(c);
+    SetSuccessor(ps[--numPs], REF(c1));
+    c = c1;
+  }
+  while (numPs != 0);
 
-#define IF_BIT_0_BCJ2(p) ttt = *(p); bound = (range >> kNumBitModelTotalBits) * ttt; if (code < bound)
-#define UPDATE_0_BCJ2(p) range = bound; *(p) = (CProb)(ttt + ((kBitModelTotal - ttt) >> kNumMoveBits)); NORMALIZE_BCJ2;
-#define UPDATE_1_BCJ2(p) range -= bound; code -= bound; *(p) = (CProb)(ttt - (ttt >> kNumMoveBits)); NORMALIZE_BCJ2;
+  return c;
+}
 
-STATIC int Bcj2_Decode(
-    const Byte *buf0, size_t size0,
-    const Byte *buf1, size_t size1,
-    const Byte *buf2, size_t size2,
-    const Byte *buf3, size_t size3,
-    Byte *outBuf, size_t outSize)
+static void SwapStates(CPpmd_State *t1, CPpmd_State *t2)
 {
-  CProb p[256 + 2];
-  size_t inPos = 0, outPos = 0;
-
-  const Byte *buffer, *bufferLim;
-  UInt32 range, code;
-  Byte prevByte = 0;
+  CPpmd_State tmp = *t1;
+  *t1 = *t2;
+  *t2 = tmp;
+}
 
-  unsigned int i;
-  for (i = 0; i < sizeof(p) / sizeof(p[0]); i++)
-    p[i] = kBitModelTotal >> 1;
+static void UpdateModel(CPpmd7 *p)
+{
+  UInt32 successor, fSuccessor = SUCCESSOR(p->FoundState);
+  CTX_PTR c;
+  unsigned s0, ns;
 
-  buffer = buf3;
-  bufferLim = buffer + size3;
-  RC_INIT2
+  if (p->FoundState->Freq < MAX_FREQ / 4 && p->MinContext->Suffix != 0)
+  {
+    c = SUFFIX(p->MinContext);
 
-  if (outSize == 0)
-    return SZ_OK;
+    if (c->NumStats == 1)
+    {
+      CPpmd_State *s = ONE_STATE(c);
+      if (s->Freq < 32)
+        s->Freq++;
+    }
+    else
+    {
+      CPpmd_State *s = STATS(c);
+      if (s->Symbol != p->FoundState->Symbol)
+      {
+        do { s++; } while (s->Symbol != p->FoundState->Symbol);
+        if (s[0].Freq >= s[-1].Freq)
+        {
+          SwapStates(&s[0], &s[-1]);
+          s--;
+        }
+      }
+      if (s->Freq < MAX_FREQ - 9)
+      {
+        s->Freq += 2;
+        c->SummFreq += 2;
+      }
+    }
+  }
 
-  for (;;)
+  if (p->OrderFall == 0)
   {
-    Byte b;
-    CProb *prob;
-    UInt32 bound;
-    UInt32 ttt;
-
-    size_t limit = size0 - inPos;
-    if (outSize - outPos < limit)
-      limit = outSize - outPos;
-    while (limit != 0)
+    p->MinContext = p->MaxContext = CreateSuccessors(p, True);
+    if (p->MinContext == 0)
     {
-      Byte b = buf0[inPos];
-      outBuf[outPos++] = b;
-      if (IsJ(prevByte, b))
-        break;
-      inPos++;
-      prevByte = b;
-      limit--;
+      RestartModel(p);
+      return;
     }
+    SetSuccessor(p->FoundState, REF(p->MinContext));
+    return;
+  }
 
-    if (limit == 0 || outPos == outSize)
-      break;
+  *p->Text++ = p->FoundState->Symbol;
+  successor = REF(p->Text);
+  if (p->Text >= p->UnitsStart)
+  {
+    RestartModel(p);
+    return;
+  }
 
-    b = buf0[inPos++];
+  if (fSuccessor)
+  {
+    if (fSuccessor <= successor)
+    {
+      CTX_PTR cs = CreateSuccessors(p, False);
+      if (cs == NULL)
+      {
+        RestartModel(p);
+        return;
+      }
+      fSuccessor = REF(cs);
+    }
+    if (--p->OrderFall == 0)
+    {
+      successor = fSuccessor;
+      p->Text -= (p->MaxContext != p->MinContext);
+    }
+  }
+  else
+  {
+    SetSuccessor(p->FoundState, successor);
+    fSuccessor = REF(p->MinContext);
+  }
 
-    if (b == 0xE8)
-      prob = p + prevByte;
-    else if (b == 0xE9)
-      prob = p + 256;
-    else
-      prob = p + 257;
+  s0 = p->MinContext->SummFreq - (ns = p->MinContext->NumStats) - (p->FoundState->Freq - 1);
 
-    IF_BIT_0_BCJ2(prob)
+  for (c = p->MaxContext; c != p->MinContext; c = SUFFIX(c))
+  {
+    unsigned ns1;
+    UInt32 cf, sf;
+    if ((ns1 = c->NumStats) != 1)
     {
-      UPDATE_0_BCJ2(prob)
-      prevByte = b;
+      if ((ns1 & 1) == 0)
+      {
+        /* Expand for one UNIT */
+        unsigned oldNU = ns1 >> 1;
+        unsigned i = U2I(oldNU);
+        if (i != U2I(oldNU + 1))
+        {
+          void *ptr = AllocUnits(p, i + 1);
+          void *oldPtr;
+          if (!ptr)
+          {
+            RestartModel(p);
+            return;
+          }
+          oldPtr = STATS(c);
+          MyMem12Cpy(ptr, oldPtr, oldNU);
+          InsertNode(p, oldPtr, i);
+          c->Stats = STATS_REF(ptr);
+        }
+      }
+      c->SummFreq = (UInt16)(c->SummFreq + (2 * ns1 < ns) + 2 * ((4 * ns1 <= ns) & (c->SummFreq <= 8 * ns1)));
     }
     else
     {
-      UInt32 dest;
-      const Byte *v;
-      UPDATE_1_BCJ2(prob)
-      if (b == 0xE8)
+      CPpmd_State *s = (CPpmd_State*)AllocUnits(p, 0);
+      if (!s)
       {
-        v = buf1;
-        if (size1 < 4)
-          return SZ_ERROR_DATA;
-        buf1 += 4;
-        size1 -= 4;
+        RestartModel(p);
+        return;
       }
+      *s = *ONE_STATE(c);
+      c->Stats = REF(s);
+      if (s->Freq < MAX_FREQ / 4 - 1)
+        s->Freq <<= 1;
       else
+        s->Freq = MAX_FREQ - 4;
+      c->SummFreq = (UInt16)(s->Freq + p->InitEsc + (ns > 3));
+    }
+    cf = 2 * (UInt32)p->FoundState->Freq * (c->SummFreq + 6);
+    sf = (UInt32)s0 + c->SummFreq;
+    if (cf < 6 * sf)
+    {
+      cf = 1 + (cf > sf) + (cf >= 4 * sf);
+      c->SummFreq += 3;
+    }
+    else
+    {
+      cf = 4 + (cf >= 9 * sf) + (cf >= 12 * sf) + (cf >= 15 * sf);
+      c->SummFreq = (UInt16)(c->SummFreq + cf);
+    }
+    {
+      CPpmd_State *s = STATS(c) + ns1;
+      SetSuccessor(s, successor);
+      s->Symbol = p->FoundState->Symbol;
+      s->Freq = (Byte)cf;
+      c->NumStats = (UInt16)(ns1 + 1);
+    }
+  }
+  p->MaxContext = p->MinContext = CTX(fSuccessor);
+}
+
+static void Rescale(CPpmd7 *p)
+{
+  unsigned i, adder, sumFreq, escFreq;
+  CPpmd_State *stats = STATS(p->MinContext);
+  CPpmd_State *s = p->FoundState;
+  {
+    CPpmd_State tmp = *s;
+    for (; s != stats; s--)
+      s[0] = s[-1];
+    *s = tmp;
+  }
+  escFreq = p->MinContext->SummFreq - s->Freq;
+  s->Freq += 4;
+  adder = (p->OrderFall != 0);
+  s->Freq = (Byte)((s->Freq + adder) >> 1);
+  sumFreq = s->Freq;
+
+  i = p->MinContext->NumStats - 1;
+  do
+  {
+    escFreq -= (++s)->Freq;
+    s->Freq = (Byte)((s->Freq + adder) >> 1);
+    sumFreq += s->Freq;
+    if (s[0].Freq > s[-1].Freq)
+    {
+      CPpmd_State *s1 = s;
+      CPpmd_State tmp = *s1;
+      do
+        s1[0] = s1[-1];
+      while (--s1 != stats && tmp.Freq > s1[-1].Freq);
+      *s1 = tmp;
+    }
+  }
+  while (--i);
+
+  if (s->Freq == 0)
+  {
+    unsigned numStats = p->MinContext->NumStats;
+    unsigned n0, n1;
+    do { i++; } while ((--s)->Freq == 0);
+    escFreq += i;
+    p->MinContext->NumStats = (UInt16)(p->MinContext->NumStats - i);
+    if (p->MinContext->NumStats == 1)
+    {
+      CPpmd_State tmp = *stats;
+      do
       {
-        v = buf2;
-        if (size2 < 4)
-          return SZ_ERROR_DATA;
-        buf2 += 4;
-        size2 -= 4;
+        tmp.Freq = (Byte)(tmp.Freq - (tmp.Freq >> 1));
+        escFreq >>= 1;
       }
-      dest = (((UInt32)v[0] << 24) | ((UInt32)v[1] << 16) |
-          ((UInt32)v[2] << 8) | ((UInt32)v[3])) - ((UInt32)outPos + 4);
-      outBuf[outPos++] = (Byte)dest;
-      if (outPos == outSize)
-        break;
-      outBuf[outPos++] = (Byte)(dest >> 8);
-      if (outPos == outSize)
-        break;
-      outBuf[outPos++] = (Byte)(dest >> 16);
-      if (outPos == outSize)
-        break;
-      outBuf[outPos++] = prevByte = (Byte)(dest >> 24);
+      while (escFreq > 1);
+      InsertNode(p, stats, U2I(((numStats + 1) >> 1)));
+      *(p->FoundState = ONE_STATE(p->MinContext)) = tmp;
+      return;
     }
+    n0 = (numStats + 1) >> 1;
+    n1 = (p->MinContext->NumStats + 1) >> 1;
+    if (n0 != n1)
+      p->MinContext->Stats = STATS_REF(ShrinkUnits(p, stats, n0, n1));
   }
-  return (outPos == outSize) ? SZ_OK : SZ_ERROR_DATA;
+  p->MinContext->SummFreq = (UInt16)(sumFreq + escFreq - (escFreq >> 1));
+  p->FoundState = STATS(p->MinContext);
 }
 
-/* Bra.c -- Converters for RISC code */
-
-STATIC size_t ARM_Convert(Byte *data, size_t size, UInt32 ip, int encoding)
+static CPpmd_See *Ppmd7_MakeEscFreq(CPpmd7 *p, unsigned numMasked, UInt32 *escFreq)
 {
-  size_t i;
-  if (size < 4)
-    return 0;
-  size -= 4;
-  ip += 8;
-  for (i = 0; i <= size; i += 4)
+  CPpmd_See *see;
+  unsigned nonMasked = p->MinContext->NumStats - numMasked;
+  if (p->MinContext->NumStats != 256)
   {
-    if (data[i + 3] == 0xEB)
+    see = p->See[p->NS2Indx[nonMasked - 1]] +
+        (nonMasked < (unsigned)SUFFIX(p->MinContext)->NumStats - p->MinContext->NumStats) +
+        2 * (p->MinContext->SummFreq < 11 * p->MinContext->NumStats) +
+        4 * (numMasked > nonMasked) +
+        p->HiBitsFlag;
     {
-      UInt32 dest;
-      UInt32 src = ((UInt32)data[i + 2] << 16) | ((UInt32)data[i + 1] << 8) | (data[i + 0]);
-      src <<= 2;
-      if (encoding)
-        dest = ip + (UInt32)i + src;
-      else
-        dest = src - (ip + (UInt32)i);
-      dest >>= 2;
-      data[i + 2] = (Byte)(dest >> 16);
-      data[i + 1] = (Byte)(dest >> 8);
-      data[i + 0] = (Byte)dest;
+      unsigned r = (see->Summ >> see->Shift);
+      see->Summ = (UInt16)(see->Summ - r);
+      *escFreq = r + (r == 0);
     }
   }
-  return i;
+  else
+  {
+    see = &p->DummySee;
+    *escFreq = 1;
+  }
+  return see;
 }
 
-/* Bra86.c -- Converter for x86 code (BCJ) */
+static void NextContext(CPpmd7 *p)
+{
+  CTX_PTR c = CTX(SUCCESSOR(p->FoundState));
+  if (p->OrderFall == 0 && (Byte *)c > p->Text)
+    p->MinContext = p->MaxContext = c;
+  else
+    UpdateModel(p);
+}
 
-#define Test86MSByte(b) ((b) == 0 || (b) == 0xFF)
+static void Ppmd7_Update1(CPpmd7 *p)
+{
+  CPpmd_State *s = p->FoundState;
+  s->Freq += 4;
+  p->MinContext->SummFreq += 4;
+  if (s[0].Freq > s[-1].Freq)
+  {
+    SwapStates(&s[0], &s[-1]);
+    p->FoundState = --s;
+    if (s->Freq > MAX_FREQ)
+      Rescale(p);
+  }
+  NextContext(p);
+}
 
-/*static const Byte kMaskToAllowedStatus[8] = {1, 1, 1, 0, 1, 0, 0, 0};*/
-static const Byte kMaskToAllowedStatus = 0x17;
-/*static const Byte kMaskToBitNumber[8] = {0, 1, 2, 2, 3, 3, 3, 3};*/
-static const UInt16 kMaskToBitNumber = 0xffa4;
+static void Ppmd7_Update1_0(CPpmd7 *p)
+{
+  p->PrevSuccess = (2 * p->FoundState->Freq > p->MinContext->SummFreq);
+  p->RunLength += p->PrevSuccess;
+  p->MinContext->SummFreq += 4;
+  if ((p->FoundState->Freq += 4) > MAX_FREQ)
+    Rescale(p);
+  NextContext(p);
+}
 
-STATIC size_t x86_Convert(Byte *data, size_t size, UInt32 ip, UInt32 *state, int encoding)
+static void Ppmd7_UpdateBin(CPpmd7 *p)
 {
-  size_t bufferPos = 0, prevPosT;
-  UInt32 prevMask = *state & 0x7;
-  if (size < 5)
-    return 0;
-  ip += 5;
-  prevPosT = (size_t)0 - 1;
+  p->FoundState->Freq = (Byte)(p->FoundState->Freq + (p->FoundState->Freq < 128 ? 1: 0));
+  p->PrevSuccess = 1;
+  p->RunLength++;
+  NextContext(p);
+}
 
-  for (;;)
+static void Ppmd7_Update2(CPpmd7 *p)
+{
+  CPpmd_State *s = p->FoundState;
+  s->Freq += 4;
+  p->MinContext->SummFreq += 4;
+  if (s->Freq > MAX_FREQ)
+    Rescale(p);
+  p->RunLength = p->InitRL;
+  UpdateModel(p);
+}
+
+/* Ppmd7Dec.c -- PPMdH Decoder
+2010-03-12 : Igor Pavlov : Public domain
+This code is based on PPMd var.H (2001): Dmitry Shkarin : Public domain */
+
+static Byte Ppmd7z_RangeDec_ReadSlow(CPpmd7z_RangeDec *p)
+{
+  size_t size = 0;
+  if (p->res == SZ_OK && !p->extra)
   {
-    Byte *p = data + bufferPos;
-    Byte *limit = data + size - 4;
-    for (; p < limit; p++)
-      if ((*p & 0xFE) == 0xE8)
-        break;
-    bufferPos = (size_t)(p - data);
-    if (p >= limit)
-      break;
-    prevPosT = bufferPos - prevPosT;
-    if (prevPosT > 3)
-      prevMask = 0;
-    else
-    {
-      prevMask = (prevMask << ((int)prevPosT - 1)) & 0x7;
-      if (prevMask != 0)
-      {
-        Byte b = p[4 - ((kMaskToBitNumber >> (prevMask * 2)) & 3)];
-        if (!((kMaskToAllowedStatus >> prevMask) & 1) || Test86MSByte(b))
-        {
-          prevPosT = bufferPos;
-          prevMask = ((prevMask << 1) & 0x7) | 1;
-          bufferPos++;
-          continue;
-        }
-      }
+    p->in->Skip(p->in, (size_t)(p->cur - p->start));
+    p->res = p->in->Look(p->in, &p->start, &size);
+    if (p->res != SZ_OK)
+      size = 0;
+  }
+  p->cur = p->start;
+  p->lim = p->start + size;
+  if (size == 0)
+  {
+    p->extra = True;
+    return 0;
+  }
+  return *p->cur++;
+}
+
+#define RC_READ_BYTE(p) ((p)->cur != (p)->lim ? *(p)->cur++ : Ppmd7z_RangeDec_ReadSlow(p))
+
+STATIC Bool Ppmd7z_RangeDec_Init(CPpmd7z_RangeDec *p, ILookIn *in)
+{
+  unsigned i;
+  p->in = in;
+  p->start = p->cur = p->lim = NULL;
+  p->res = SZ_OK;
+  p->extra = False;
+  p->Code = 0;
+  p->Range = 0xFFFFFFFF;
+  if (RC_READ_BYTE(p) != 0)
+    return False;
+  for (i = 0; i < 4; i++)
+    p->Code = (p->Code << 8) | RC_READ_BYTE(p);
+  return (p->Code < 0xFFFFFFFF);
+}
+
+static UInt32 Range_GetThreshold(CPpmd7z_RangeDec *p, UInt32 total)
+{
+  return (p->Code) / (p->Range /= total);
+}
+
+static void Range_Normalize(CPpmd7z_RangeDec *p)
+{
+  if (p->Range < kTopValue)
+  {
+    p->Code = (p->Code << 8) | RC_READ_BYTE(p);
+    p->Range <<= 8;
+    if (p->Range < kTopValue)
+    {
+      p->Code = (p->Code << 8) | RC_READ_BYTE(p);
+      p->Range <<= 8;
     }
-    prevPosT = bufferPos;
+  }
+}
 
-    if (Test86MSByte(p[4]))
+static void Range_Decode(CPpmd7z_RangeDec *p, UInt32 start, UInt32 size)
+{
+  p->Code -= start * p->Range;
+  p->Range *= size;
+  Range_Normalize(p);
+}
+
+static UInt32 Range_DecodeBit(CPpmd7z_RangeDec *p, UInt32 size0, UInt32 total)
+{
+  UInt32 newBound = (p->Range / total) * size0;
+  UInt32 symbol;
+  if (p->Code < newBound)
+  {
+    symbol = 0;
+    p->Range = newBound;
+  }
+  else
+  {
+    symbol = 1;
+    p->Code -= newBound;
+    p->Range -= newBound;
+  }
+  Range_Normalize(p);
+  return symbol;
+}
+
+#define MASK(sym) ((signed char *)charMask)[sym]
+
+STATIC int Ppmd7_DecodeSymbol(CPpmd7 *p, CPpmd7z_RangeDec *rc)
+{
+  size_t charMask[256 / sizeof(size_t)];
+  if (p->MinContext->NumStats != 1)
+  {
+    CPpmd_State *s = Ppmd7_GetStats(p, p->MinContext);
+    unsigned i;
+    UInt32 count, hiCnt;
+    if ((count = Range_GetThreshold(rc, p->MinContext->SummFreq)) < (hiCnt = s->Freq))
     {
-      UInt32 src = ((UInt32)p[4] << 24) | ((UInt32)p[3] << 16) | ((UInt32)p[2] << 8) | ((UInt32)p[1]);
-      UInt32 dest;
-      for (;;)
+      Byte symbol;
+      Range_Decode(rc, 0, s->Freq);
+      p->FoundState = s;
+      symbol = s->Symbol;
+      Ppmd7_Update1_0(p);
+      return symbol;
+    }
+    p->PrevSuccess = 0;
+    i = p->MinContext->NumStats - 1;
+    do
+    {
+      if ((hiCnt += (++s)->Freq) > count)
       {
-        Byte b;
-        int index;
-        if (encoding)
-          dest = (ip + (UInt32)bufferPos) + src;
-        else
-          dest = src - (ip + (UInt32)bufferPos);
-        if (prevMask == 0)
-          break;
-        index = ((kMaskToBitNumber >> (prevMask * 2)) & 3) * 8;
-        b = (Byte)(dest >> (24 - index));
-        if (!Test86MSByte(b))
-          break;
-        src = dest ^ ((1 << (32 - index)) - 1);
+        Byte symbol;
+        Range_Decode(rc, hiCnt - s->Freq, s->Freq);
+        p->FoundState = s;
+        symbol = s->Symbol;
+        Ppmd7_Update1(p);
+        return symbol;
       }
-      p[4] = (Byte)(~(((dest >> 24) & 1) - 1));
-      p[3] = (Byte)(dest >> 16);
-      p[2] = (Byte)(dest >> 8);
-      p[1] = (Byte)dest;
-      bufferPos += 5;
     }
-    else
+    while (--i);
+    if (count >= p->MinContext->SummFreq)
+      return -2;
+    p->HiBitsFlag = p->HB2Flag[p->FoundState->Symbol];
+    Range_Decode(rc, hiCnt, p->MinContext->SummFreq - hiCnt);
+    PPMD_SetAllBitsIn256Bytes(charMask);
+    MASK(s->Symbol) = 0;
+    i = p->MinContext->NumStats - 1;
+    do { MASK((--s)->Symbol) = 0; } while (--i);
+  }
+  else
+  {
+    UInt16 *prob = Ppmd7_GetBinSumm(p);
+    if (Range_DecodeBit(rc, *prob, PPMD_BIN_SCALE) == 0)
     {
-      prevMask = ((prevMask << 1) & 0x7) | 1;
-      bufferPos++;
+      Byte symbol;
+      *prob = (UInt16)PPMD_UPDATE_PROB_0(*prob);
+      symbol = (p->FoundState = Ppmd7Context_OneState(p->MinContext))->Symbol;
+      Ppmd7_UpdateBin(p);
+      return symbol;
     }
+    *prob = (UInt16)PPMD_UPDATE_PROB_1(*prob);
+    p->InitEsc = PPMD7_kExpEscape[*prob >> 10];
+    PPMD_SetAllBitsIn256Bytes(charMask);
+    MASK(Ppmd7Context_OneState(p->MinContext)->Symbol) = 0;
+    p->PrevSuccess = 0;
+  }
+  for (;;)
+  {
+    CPpmd_State *ps[256], *s;
+    UInt32 freqSum, count, hiCnt;
+    CPpmd_See *see;
+    unsigned i, num, numMasked = p->MinContext->NumStats;
+    do
+    {
+      p->OrderFall++;
+      if (!p->MinContext->Suffix)
+        return -1;
+      p->MinContext = Ppmd7_GetContext(p, p->MinContext->Suffix);
+    }
+    while (p->MinContext->NumStats == numMasked);
+    hiCnt = 0;
+    s = Ppmd7_GetStats(p, p->MinContext);
+    i = 0;
+    num = p->MinContext->NumStats - numMasked;
+    do
+    {
+      int k = (int)(MASK(s->Symbol));
+      hiCnt += (s->Freq & k);
+      ps[i] = s++;
+      i -= k;
+    }
+    while (i != num);
+
+    see = Ppmd7_MakeEscFreq(p, numMasked, &freqSum);
+    freqSum += hiCnt;
+    count = Range_GetThreshold(rc, freqSum);
+
+    if (count < hiCnt)
+    {
+      Byte symbol;
+      CPpmd_State **pps = ps;
+      for (hiCnt = 0; (hiCnt += (*pps)->Freq) <= count; pps++);
+      s = *pps;
+      Range_Decode(rc, hiCnt - s->Freq, s->Freq);
+      Ppmd_See_Update(see);
+      p->FoundState = s;
+      symbol = s->Symbol;
+      Ppmd7_Update2(p);
+      return symbol;
+    }
+    if (count >= freqSum)
+      return -2;
+    Range_Decode(rc, hiCnt, freqSum - hiCnt);
+    see->Summ = (UInt16)(see->Summ + freqSum);
+    do { MASK(ps[--i]->Symbol) = 0; } while (i != 0);
   }
-  prevPosT = bufferPos - prevPosT;
-  *state = ((prevPosT > 3) ? 0 : ((prevMask << ((int)prevPosT - 1)) & 0x7));
-  return bufferPos;
 }
 
 /* Lzma2Dec.c -- LZMA2 Decoder
@@ -1206,6 +5775,7 @@ static ELzma2State Lzma2Dec_UpdateState(CLzma2Dec *p, Byte b)
         return LZMA2_STATE_ERROR;
       p->decoder.prop.lc = lc;
       p->decoder.prop.lp = lp;
+      LzmaDec_SetDecodeFunc(&p->decoder);
       p->needInitProp = False;
       return LZMA2_STATE_DATA;
     }
@@ -1366,6 +5936,19 @@ STATIC SRes Lzma2Dec_DecodeToDic(CLzma2Dec *p, size_t dicLimit,
   { UPDATE_1(p); i = (i + i) + 1; A1; }
 #define GET_BIT(p, i) GET_BIT2(p, i, ; , ;)
 
+#ifdef _LZMA_DEC_FAST
+
+/* Branchless variants: literal bits are hard to predict, so (code >= bound)
+   is turned into a mask instead of a jump. */
+#define GET_BIT_MASK(p, mask) ttt = *(p); NORMALIZE; bound = (range >> kNumBitModelTotalBits) * ttt; \
+  mask = (unsigned)0 - (unsigned)(code >= bound); \
+  range = (bound & ~(UInt32)mask) | ((range - bound) & (UInt32)mask); \
+  code -= bound & (UInt32)mask; \
+  *(p) = (CLzmaProb)(ttt + (((kBitModelTotal - ttt) >> kNumMoveBits) & ~mask) - ((ttt >> kNumMoveBits) & mask));
+#define GET_BIT_FAST(p, i) { unsigned mask; GET_BIT_MASK(p, mask); i = (i + i) - mask; }
+
+#endif
+
 #define TREE_GET_BIT(probs, i) { GET_BIT((probs + i), i); }
 #define TREE_DECODE(probs, limit, i) \
   { i = 1; do { TREE_GET_BIT(probs, i); } while (i < limit); i -= limit; }
@@ -1457,6 +6040,48 @@ StopCompilingDueBUG
 
 #define LZMA_DIC_MIN (1 << 12)
 
+#ifdef _LZMA_DEC_FAST
+
+/* Copies a match of len bytes from (dest - dist) to dest in 8/16-byte
+   steps. The regions can overlap, and nothing beyond (dest + len) is
+   written, so it's also safe for a dictionary that wraps. */
+static MY_FORCE_INLINE void LzmaDec_CopyMatch(Byte *dest, size_t dist, unsigned len)
+{
+  const Byte *src = dest - dist;
+  Byte *lim = dest + len;
+  if (dist >= 8 && len >= 8)
+  {
+    UInt64 v0, v1;
+    if (dist >= 16)
+      for (; lim - dest >= 16; src += 16, dest += 16)
+      {
+        memcpy(&v0, src, 8);
+        memcpy(&v1, src + 8, 8);
+        memcpy(dest, &v0, 8);
+        memcpy(dest + 8, &v1, 8);
+      }
+    for (; lim - dest >= 8; src += 8, dest += 8)
+    {
+      memcpy(&v0, src, 8);
+      memcpy(dest, &v0, 8);
+    }
+    /* The last 8 bytes overlap with bytes which are already copied. */
+    if (dest != lim)
+    {
+      memcpy(&v0, lim - 8 - dist, 8);
+      memcpy(lim - 8, &v0, 8);
+    }
+  }
+  else if (dist == 1)
+    memset(dest, *src, len);
+  else
+    do
+      *dest++ = *src++;
+    while (dest != lim);
+}
+
+#endif
+
 /* First LZMA-symbol is always decoded.
 And it decodes new LZMA-symbols while (buf < bufLimit), but "buf" is without last normalization
 Out:
@@ -1470,15 +6095,15 @@ Out:
     = kMatchSpecLenStart + 2 : State Init Marker
 */
 
-static int MY_FAST_CALL LzmaDec_DecodeReal(CLzmaDec *p, size_t limit, const Byte *bufLimit)
+/* The decoder body is instantiated for the common lc/lp/pb sets with
+   constant masks, see LzmaDec_SetDecodeFunc. */
+static MY_FORCE_INLINE int LzmaDec_DecodeRealBody(CLzmaDec *p, size_t limit, const Byte *bufLimit,
+    unsigned lc, unsigned lpMask, unsigned pbMask)
 {
   CLzmaProb *probs = p->probs;
 
   unsigned state = p->state;
   UInt32 rep0 = p->reps[0], rep1 = p->reps[1], rep2 = p->reps[2], rep3 = p->reps[3];
-  unsigned pbMask = ((unsigned)1 << (p->prop.pb)) - 1;
-  unsigned lpMask = ((unsigned)1 << (p->prop.lp)) - 1;
-  unsigned lc = p->prop.lc;
 
   Byte *dic = p->dic;
   size_t dicBufSize = p->dicBufSize;
@@ -1513,7 +6138,18 @@ static int MY_FAST_CALL LzmaDec_DecodeReal(CLzmaDec *p, size_t limit, const Byte
       {
         state -= (state < 4) ? state : 3;
         symbol = 1;
+#ifdef _LZMA_DEC_FAST
+        GET_BIT_FAST(prob + symbol, symbol)
+        GET_BIT_FAST(prob + symbol, symbol)
+        GET_BIT_FAST(prob + symbol, symbol)
+        GET_BIT_FAST(prob + symbol, symbol)
+        GET_BIT_FAST(prob + symbol, symbol)
+        GET_BIT_FAST(prob + symbol, symbol)
+        GET_BIT_FAST(prob + symbol, symbol)
+        GET_BIT_FAST(prob + symbol, symbol)
+#else
         do { GET_BIT(prob + symbol, symbol) } while (symbol < 0x100);
+#endif
       }
       else
       {
@@ -1528,7 +6164,16 @@ static int MY_FAST_CALL LzmaDec_DecodeReal(CLzmaDec *p, size_t limit, const Byte
           matchByte <<= 1;
           bit = (matchByte & offs);
           probLit = prob + offs + bit + symbol;
+#ifdef _LZMA_DEC_FAST
+          {
+            unsigned mask;
+            GET_BIT_MASK(probLit, mask)
+            symbol = (symbol + symbol) - mask;
+            offs &= bit ^ ~mask;
+          }
+#else
           GET_BIT2(probLit, symbol, offs &= ~bit, offs &= bit)
+#endif
         }
         while (symbol < 0x100);
       }
@@ -1727,6 +6372,16 @@ static int MY_FAST_CALL LzmaDec_DecodeReal(CLzmaDec *p, size_t limit, const Byte
         processedPos += curLen;
 
         len -= curLen;
+#ifdef _LZMA_DEC_FAST
+        if (rep0 <= dicPos)
+        {
+          /* The source doesn't wrap: always the case if the dictionary is the
+             whole output buffer, as in SzDecodeLzma. */
+          LzmaDec_CopyMatch(dic + dicPos, rep0, curLen);
+          dicPos += curLen;
+        }
+        else
+#endif
         if (pos + curLen <= dicBufSize)
         {
           Byte *dest = dic + dicPos;
@@ -1794,6 +6449,31 @@ static void MY_FAST_CALL LzmaDec_WriteRem(CLzmaDec *p, size_t limit)
   }
 }
 
+static int MY_FAST_CALL LzmaDec_DecodeReal(CLzmaDec *p, size_t limit, const Byte *bufLimit)
+{
+  return LzmaDec_DecodeRealBody(p, limit, bufLimit, p->prop.lc,
+      ((unsigned)1 << p->prop.lp) - 1, ((unsigned)1 << p->prop.pb) - 1);
+}
+
+#define LZMA_DEC_REAL_SPEC(lc, lp, pb) \
+  static int MY_FAST_CALL LzmaDec_DecodeReal_ ## lc ## lp ## pb(CLzmaDec *p, size_t limit, const Byte *bufLimit) \
+    { return LzmaDec_DecodeRealBody(p, limit, bufLimit, lc, (1 << lp) - 1, (1 << pb) - 1); }
+
+/* lc3:lp0:pb2 is the default of every encoder; lc0:lp2:pb2 is used by 7-Zip
+   for the call and jump streams of BCJ2. */
+LZMA_DEC_REAL_SPEC(3, 0, 2)
+LZMA_DEC_REAL_SPEC(0, 2, 2)
+
+STATIC void LzmaDec_SetDecodeFunc(CLzmaDec *p)
+{
+  const CLzmaProps *prop = &p->prop;
+  p->decodeReal = LzmaDec_DecodeReal;
+  if (prop->lc == 3 && prop->lp == 0 && prop->pb == 2)
+    p->decodeReal = LzmaDec_DecodeReal_302;
+  else if (prop->lc == 0 && prop->lp == 2 && prop->pb == 2)
+    p->decodeReal = LzmaDec_DecodeReal_022;
+}
+
 static int MY_FAST_CALL LzmaDec_DecodeReal2(CLzmaDec *p, size_t limit, const Byte *bufLimit)
 {
   do
@@ -1805,7 +6485,7 @@ static int MY_FAST_CALL LzmaDec_DecodeReal2(CLzmaDec *p, size_t limit, const Byt
       if (limit - p->dicPos > rem)
         limit2 = p->dicPos + rem;
     }
-    RINOK(LzmaDec_DecodeReal(p, limit2, bufLimit));
+    RINOK(p->decodeReal(p, limit2, bufLimit));
     if (p->processedPos >= p->prop.dicSize)
       p->checkDicSize = p->prop.dicSize;
     LzmaDec_WriteRem(p, limit);
@@ -2232,6 +6912,7 @@ STATIC SRes LzmaDec_AllocateProbs(CLzmaDec *p, const Byte *props, unsigned props
   RINOK(LzmaProps_Decode(&propNew, props, propsSize));
   RINOK(LzmaDec_AllocateProbs2(p, &propNew));
   p->prop = propNew;
+  LzmaDec_SetDecodeFunc(p);
   return SZ_OK;
 }
 
@@ -2265,8 +6946,6 @@ STATIC const Byte k57zSignature[k7zSignatureSize - 1] = {'z', 0xBC, 0xAF, 0x27,
 #endif
 
 #define RINOM(x) { if ((x) == 0) return SZ_ERROR_MEM; }
-
-#define NUM_FOLDER_CODERS_MAX 32
 #define NUM_CODER_STREAMS_MAX 32
 
 static void SzCoderInfo_Init(CSzCoderInfo *p) {
@@ -2385,6 +7064,10 @@ static void SzArEx_Init(CSzArEx *p)
   p->FileNameOffsets = 0;
   p->FileNamesInHeaderBufPtr = 0;
   p->HeaderBufStart = 0;
+  p->DecoderPool = 0;
+  p->Progress = 0;
+  p->ProgressStep = 0;
+  p->TimeStats = False;
 }
 
 STATIC void SzArEx_Free(CSzArEx *p)
@@ -2396,6 +7079,7 @@ STATIC void SzArEx_Free(CSzArEx *p)
 
   SzFree(p->FileNameOffsets);
   SzFree(p->HeaderBufStart);
+  SzDecoderPool_Free(p->DecoderPool);
 
   SzAr_Free(&p->db);
   SzArEx_Init(p);
@@ -2494,6 +7178,52 @@ STATIC UInt64 SzArEx_GetFolderStreamPos(const CSzArEx *p, UInt32 folderIndex, UI
     p->PackStreamStartPositions[p->FolderStartPackStreamIndex[folderIndex] + indexInFolder];
 }
 
+static const Byte kUtf8Lead[4] = { 0, 0xC0, 0xE0, 0xF0 };
+
+STATIC size_t SzArEx_GetFileNameUtf8(const CSzArEx *p, UInt32 fileIndex, char *dest)
+{
+  const Byte *src = p->FileNamesInHeaderBufPtr + p->FileNameOffsets[fileIndex] * 2;
+  size_t len = p->FileNameOffsets[fileIndex + 1] - p->FileNameOffsets[fileIndex];
+  size_t i, pos = 0;
+  for (i = 0; i < len; i++)
+  {
+    UInt32 c = GetUi16(src + i * 2);
+    unsigned numAdds;
+    if (c >= 0xD800 && c < 0xDC00 && i + 1 < len)
+    {
+      UInt32 c2 = GetUi16(src + i * 2 + 2);
+      if (c2 >= 0xDC00 && c2 < 0xE000)
+      {
+        c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+        i++;
+      }
+    }
+    if (c == 0)
+      break;
+    if (c < 0x80)
+    {
+      if (dest)
+        dest[pos] = (char)c;
+      pos++;
+      continue;
+    }
+    numAdds = (c < 0x800) ? 1 : (c < 0x10000) ? 2 : 3;
+    if (dest)
+      dest[pos] = (char)(kUtf8Lead[numAdds] | (c >> (6 * numAdds)));
+    pos++;
+    while (numAdds != 0)
+    {
+      numAdds--;
+      if (dest)
+        dest[pos] = (char)(0x80 | ((c >> (6 * numAdds)) & 0x3F));
+      pos++;
+    }
+  }
+  if (dest)
+    dest[pos] = 0;
+  return pos;
+}
+
 typedef struct _CSzState
 {
   Byte *Data;
@@ -3329,9 +8059,8 @@ static SRes SzReadAndDecodePackedStreams2(
   folder = p->Folders;
   unpackSize = SzFolder_GetUnpackSize(folder);
 
-#ifdef _SZ_SEEK_DEBUG
-  fprintf(stderr, "SEEKN 4\n");
-#endif
+  LookToRead_SetReadAheadRange(inStream, dataStartPos,
+      dataStartPos + GetSum(p->PackSizes, folder->NumPackStreams));
   RINOK(LookInStream_SeekTo(inStream, dataStartPos));
 
   *outBufferSize = unpackSize;
@@ -3382,6 +8111,8 @@ static Int64 FindStartArcPos(CLookToRead *inStream, Byte **buf_out) {
         size < k7zStartHeaderSize) {
       break;
     }
+    if (size > LookToRead_BUF_SIZE)
+      size = LookToRead_BUF_SIZE;
     size -= k7zStartHeaderSize - 1;  /* size is usually much more. */
     for (p = buf, pend = buf + size;
          p != pend && !IS_7Z_SIGNATURE(p);
@@ -3406,9 +8137,11 @@ STATIC SRes SzArEx_Open(
   Byte *buf = 0;
   Byte *bufStart;
   CSzData sd;
-  UInt64 type;
+  UInt64 type, traceStart = 0;
 
   SzArEx_Init(p);
+  if (SZ_TRACE_ON)
+    traceStart = SzTime_Now();
   startArcPos = FindStartArcPos(inStream, &buf);
   if (startArcPos == 0) return SZ_ERROR_NO_ARCHIVE;
   if (buf[0] != k7zMajorVersion) return SZ_ERROR_UNSUPPORTED;
@@ -3421,6 +8154,8 @@ STATIC SRes SzArEx_Open(
 
   if (CrcCalc(buf + 6, 20) != GetUi32(buf + 2))
     return SZ_ERROR_CRC;
+  if (SZ_TRACE_ON)
+    SzTrace_Header(SZ_TRACE_HEADER_SIGNATURE, (UInt64)startArcPos, &traceStart);
 
   sd.Size = (size_t)nextHeaderSize;
   if (sd.Size != nextHeaderSize)
@@ -3432,16 +8167,8 @@ STATIC SRes SzArEx_Open(
 
   /* If the file is not long enough, we want to return SZ_ERROR_INPUT_EOF, which LookInStream_Read will do for us, so there is no need to check the file size here. */
   /* This is a real seek, actually changing the file offset. */
-#ifdef _SZ_SEEK_DEBUG
-  fprintf(stderr, "SEEKN 1\n");
-#endif
   RINOK(LookInStream_SeekTo(inStream, startArcPos + nextHeaderOffset));
 
-
-#ifdef _SZ_HEADER_DEBUG
-  /* Typically only 36..39 bytes */
-  fprintf(stderr, "HEADER read_next size=%ld\n", (long)sd.Size);
-#endif
   if (!(bufStart = (Byte*)SzAlloc(sd.Size))) return SZ_ERROR_MEM;
   sd.Data = bufStart;
   /* We need a loop here (implemented by LookToRead_ReadAll) to read
@@ -3457,42 +8184,366 @@ STATIC SRes SzArEx_Open(
     res = SZ_ERROR_ARCHIVE;
     goto erra;
   }
+  if (SZ_TRACE_ON)
+    SzTrace_Header(SZ_TRACE_HEADER_READ, sd.Size, &traceStart);
   if ((res = SzReadID(&sd, &type)) != SZ_OK) goto erra;
   if (type == k7zIdEncodedHeader) {
     CSzData sdu = sd;
-#ifdef _SZ_HEADER_DEBUG
-    /* Typically happens. */
-    fprintf(stderr, "HEADER found_encoded_header\n");
-#endif
     res = SzReadAndDecodePackedStreams(inStream, &sdu, &sd.Data, &sd.Size, p->startPosAfterHeader);
     SzFree(bufStart);
     bufStart = sd.Data;
     if (res != SZ_OK) goto erra;
-#ifdef _SZ_HEADER_DEBUG
-    /* Typical value: 521688 bytes */
-    fprintf(stderr, "HEADER encoded_header unpacked size=%lld\n", (long long)sd.Size);
-#endif
+    if (SZ_TRACE_ON)
+      SzTrace_Header(SZ_TRACE_HEADER_DECODE, sd.Size, &traceStart);
     if ((res = SzReadID(&sd, &type)) != SZ_OK) goto erra;
   }
   if (type != k7zIdHeader) {
     res = SZ_ERROR_UNSUPPORTED;
     goto erra;
   }
-#ifdef _SZ_HEADER_DEBUG
-  fprintf(stderr, "HEADER found_header\n");
-#endif
   if ((res = SzReadHeader(p, &sd)) != SZ_OK) goto erra;
-#ifdef _SZ_HEADER_DEBUG
+  if (SZ_TRACE_ON)
+    SzTrace_Header(SZ_TRACE_HEADER_PARSE, (size_t)(sd.Data - bufStart), &traceStart);
+  p->HeaderBufStart = bufStart;  /* p takes ownership of the buffer starting at bufStart. */
+  if (res == SZ_OK)
+    p->DecoderPool = SzDecoderPool_Create(p->db.NumFolders);  /* without it, nothing is reused */
+  return res;
+}
+
+STATIC SRes SzArEx_OpenFolderStream(const CSzArEx *p, CLookToRead *inStream,
+    UInt32 folderIndex, CSzFolderStream **stream)
+{
+  const UInt64 *packSizes = p->db.PackSizes + p->FolderStartPackStreamIndex[folderIndex];
+  RINOK(SzFolderStream_Open2(stream, p->db.Folders + folderIndex, packSizes,
+      inStream, SzArEx_GetFolderStreamPos(p, folderIndex, 0), p->DecoderPool));
+  SzDecoderPool_AddFolder(p->DecoderPool, folderIndex,
+      GetSum(packSizes, p->db.Folders[folderIndex].NumPackStreams));
+  return SZ_OK;
+}
+
+/* Streams a folder, checking the CRCs of its files and its UnpackCRC.
+   *fileIndex is the file being checked when it fails. */
+static SRes SzArEx_TestFolder(const CSzArEx *p, CLookToRead *inStream,
+    UInt32 folderIndex, UInt32 *fileIndex)
+{
+  const CSzFolder *folder = p->db.Folders + folderIndex;
+  CSzFolderStream *stream;
+  UInt32 i = p->FolderStartFileIndex[folderIndex], left = folder->NumUnpackStreams;
+  SRes res;
+  Byte b;
+  size_t size = 1;
+
+  *fileIndex = i;
+  RINOK(SzArEx_OpenFolderStream(p, inStream, folderIndex, &stream));
+  for (res = SZ_OK; left != 0 && res == SZ_OK; i++)
   {
-    const Bool FileNamesInHeaderBufPtr_inside = p->FileNamesInHeaderBufPtr >= bufStart && p->FileNamesInHeaderBufPtr < sd.Data + sd.Size;
-    fprintf(stderr, "HEADER FileNamesInHeaderBufPtr_inside=%d\n", FileNamesInHeaderBufPtr_inside);
-    if (!FileNamesInHeaderBufPtr_inside) abort();
+    const CSzFileItem *f = p->db.Files + i;
+    UInt32 crc = CRC_INIT_VAL;
+    /* With one file, its CRC is usually the UnpackCRC, checked below. */
+    Bool checkCrc = f->CrcDefined && !(folder->NumUnpackStreams == 1 && folder->UnpackCRCDefined);
+    if (p->FileIndexToFolderIndexMap[i] != folderIndex)
+      continue;
+    *fileIndex = i;
+    left--;
+    res = SzFolderStream_SkipCrc(stream, f->Size, checkCrc ? &crc : NULL);
+    if (res == SZ_OK && checkCrc && CRC_GET_DIGEST(crc) != f->Crc)
+      res = SZ_ERROR_CRC;
   }
+  /* The end of the folder, where its UnpackCRC is checked. */
+  if (res == SZ_OK && (res = SzFolderStream_Read(stream, &b, &size)) == SZ_OK && size != 0)
+    res = SZ_ERROR_DATA;
+  SzFolderStream_Close(stream);
+  return res;
+}
+
+typedef struct
+{
+  const CSzArEx *db;
+  UInt32 nextFolder;
+  SRes res;
+  UInt32 errorFolder;  /* the lowest folder which failed */
+  UInt32 errorFile;
+#ifndef _7ZIP_ST
+  CCriticalSection cs;
 #endif
-  p->HeaderBufStart = bufStart;  /* p takes ownership of the buffer starting at bufStart. */
+} CSzArExTest;
+
+typedef struct
+{
+  CSzArExTest *test;
+  CLookToRead stream;
+#ifndef _7ZIP_ST
+  CThread thread;
+#endif
+} CSzArExTestWorker;
+
+static void SzArExTestWorker_Run(CSzArExTestWorker *w)
+{
+  CSzArExTest *t = w->test;
+  for (;;)
+  {
+    UInt32 folderIndex, fileIndex;
+    SRes res;
+#ifndef _7ZIP_ST
+    CriticalSection_Enter(&t->cs);
+#endif
+    folderIndex = t->nextFolder;
+    if (t->res == SZ_OK && folderIndex < t->db->db.NumFolders)
+      t->nextFolder++;
+    else
+      folderIndex = (UInt32)-1;
+#ifndef _7ZIP_ST
+    CriticalSection_Leave(&t->cs);
+#endif
+    if (folderIndex == (UInt32)-1)
+      break;
+    res = SzArEx_TestFolder(t->db, &w->stream, folderIndex, &fileIndex);
+    if (res != SZ_OK)
+    {
+#ifndef _7ZIP_ST
+      CriticalSection_Enter(&t->cs);
+#endif
+      if (t->res == SZ_OK || folderIndex < t->errorFolder)
+      {
+        t->res = res;
+        t->errorFolder = folderIndex;
+        t->errorFile = fileIndex;
+      }
+#ifndef _7ZIP_ST
+      CriticalSection_Leave(&t->cs);
+#endif
+    }
+  }
+}
+
+#ifndef _7ZIP_ST
+static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE SzArExTestWorker_ThreadFunc(void *param)
+{
+  SzArExTestWorker_Run((CSzArExTestWorker *)param);
+  return 0;
+}
+#endif
+
+STATIC SRes SzArEx_Test(const CSzArEx *p, CLookToRead *inStream, UInt32 numThreads,
+    UInt32 *errorFileIndex)
+{
+  CSzArExTest t;
+  CSzArExTestWorker *workers;
+  UInt32 numWorkers = 0, i;
+  SRes res = SZ_OK;
+#ifndef _7ZIP_ST
+  UInt32 numStarted = 1;
+#endif
+
+  if (errorFileIndex)
+    *errorFileIndex = (UInt32)-1;
+#ifdef _7ZIP_ST
+  numThreads = 1;
+#endif
+  if (numThreads == 0)
+    numThreads = 1;
+  if (numThreads > p->db.NumFolders)
+    numThreads = p->db.NumFolders;
+  if (numThreads == 0)  /* no folders */
+    return SZ_OK;
+  if ((workers = (CSzArExTestWorker *)SzAlloc(numThreads * sizeof(CSzArExTestWorker))) == 0)
+    return SZ_ERROR_MEM;
+  t.db = p;
+  t.nextFolder = 0;
+  t.res = SZ_OK;
+  t.errorFolder = 0;
+  t.errorFile = (UInt32)-1;
+#ifndef _7ZIP_ST
+  if (CriticalSection_Init(&t.cs) != 0)
+  {
+    SzFree(workers);
+    return SZ_ERROR_THREAD;
+  }
+#endif
+  /* The clones open all the volumes here, on the calling thread. */
+  for (; numWorkers < numThreads; numWorkers++)
+  {
+    CSzArExTestWorker *w = &workers[numWorkers];
+    w->test = &t;
+    if ((res = LookToRead_Clone(&w->stream, inStream, 0, (UInt64)(Int64)-1)) != SZ_OK)
+      break;
+  }
+  if (res == SZ_OK)
+  {
+#ifndef _7ZIP_ST
+    /* The calling thread is workers[0]. Workers which can't be started
+       are left out. */
+    for (; numStarted < numWorkers; numStarted++)
+      if (Thread_Create(&workers[numStarted].thread, SzArExTestWorker_ThreadFunc, &workers[numStarted]) != 0)
+        break;
+#endif
+    SzArExTestWorker_Run(&workers[0]);
+  }
+#ifndef _7ZIP_ST
+  for (i = 1; i < numStarted; i++)
+    Thread_Wait(&workers[i].thread);
+  CriticalSection_Delete(&t.cs);
+#endif
+  for (i = 0; i < numWorkers; i++)
+    LookToRead_Free(&workers[i].stream);
+  SzFree(workers);
+  if (res == SZ_OK)
+    res = t.res;
+  if (errorFileIndex)
+    *errorFileIndex = t.errorFile;
+  return res;
+}
+
+struct CSzFileReader
+{
+  const CSzArEx *db;
+  CLookToRead *inStream;
+  UInt32 fileIndex;
+  UInt32 folderIndex;
+  UInt64 fileStart;  /* offset of the file in the folder */
+  UInt64 size;
+  const Byte *buffer;  /* the decoded folder from the cache of the caller, or NULL */
+  CSzFolderStream *stream;  /* NULL until the first read, and after a seek back or an error */
+  UInt64 folderPos;  /* position of stream in the folder */
+  UInt32 crc;  /* running CRC of the file bytes [0, crcPos) */
+  UInt64 crcPos;
+};
+
+STATIC SRes SzArEx_OpenFile(const CSzArEx *p, CLookToRead *inStream, UInt32 fileIndex,
+    UInt32 blockIndex, const Byte *outBuffer, CSzFileReader **reader)
+{
+  CSzFileReader *r;
+  UInt32 i;
+
+  *reader = NULL;
+  if ((r = (CSzFileReader *)SzAlloc(sizeof(CSzFileReader))) == 0)
+    return SZ_ERROR_MEM;
+  memset(r, 0, sizeof(*r));
+  r->db = p;
+  r->inStream = inStream;
+  r->fileIndex = fileIndex;
+  r->folderIndex = p->FileIndexToFolderIndexMap[fileIndex];
+  r->size = p->db.Files[fileIndex].Size;
+  r->crc = CRC_INIT_VAL;
+  if (r->folderIndex != (UInt32)-1)
+  {
+    for (i = p->FolderStartFileIndex[r->folderIndex]; i < fileIndex; i++)
+      if (p->FileIndexToFolderIndexMap[i] == r->folderIndex)
+        r->fileStart += p->db.Files[i].Size;
+    if (outBuffer && blockIndex == r->folderIndex)
+      r->buffer = outBuffer;
+  }
+  *reader = r;
+  return SZ_OK;
+}
+
+STATIC UInt64 SzFileReader_GetSize(const CSzFileReader *p)
+{
+  return p->size;
+}
+
+/* Moves the folder stream to target, restarting the folder if it's
+   behind. The skipped bytes of the file from crcPos on extend its CRC. */
+static SRes SzFileReader_SeekTo(CSzFileReader *p, UInt64 target)
+{
+  if (p->stream && p->folderPos > target)
+  {
+    SzFolderStream_Close(p->stream);
+    p->stream = NULL;
+  }
+  if (!p->stream)
+  {
+    RINOK(SzArEx_OpenFolderStream(p->db, p->inStream, p->folderIndex, &p->stream));
+    p->folderPos = 0;
+  }
+  if (p->folderPos < p->fileStart)
+  {
+    RINOK(SzFolderStream_SkipCrc(p->stream, p->fileStart - p->folderPos, NULL));
+    p->folderPos = p->fileStart;
+  }
+  if (p->folderPos < target)
+  {
+    UInt64 crcStart = p->fileStart + p->crcPos, n;
+    Bool extendCrc;
+    if (p->folderPos < crcStart && crcStart < target)
+    {
+      RINOK(SzFolderStream_SkipCrc(p->stream, crcStart - p->folderPos, NULL));
+      p->folderPos = crcStart;
+    }
+    n = target - p->folderPos;
+    extendCrc = (p->folderPos == crcStart);
+    RINOK(SzFolderStream_SkipCrc(p->stream, n, extendCrc ? &p->crc : NULL));
+    if (extendCrc)
+      p->crcPos += n;
+    p->folderPos = target;
+  }
+  return SZ_OK;
+}
+
+STATIC SRes SzFileReader_Read(CSzFileReader *p, UInt64 offset, void *buf, size_t *size)
+{
+  SRes res = SZ_OK;
+  if (offset >= p->size)
+  {
+    *size = 0;
+    return SZ_OK;
+  }
+  if (*size > p->size - offset)
+    *size = (size_t)(p->size - offset);
+  if (p->buffer)
+    memcpy(buf, p->buffer + (size_t)(p->fileStart + offset), *size);
+  else
+  {
+    size_t n = *size;
+    res = SzFileReader_SeekTo(p, p->fileStart + offset);
+    if (res == SZ_OK && (res = SzFolderStream_Read(p->stream, buf, &n)) == SZ_OK && n != *size)
+      res = SZ_ERROR_DATA;
+    if (res != SZ_OK)
+    {
+      /* The next read starts the folder again. */
+      SzFolderStream_Close(p->stream);
+      p->stream = NULL;
+      *size = 0;
+      return res;
+    }
+    p->folderPos += n;
+  }
+  /* The part of the read from crcPos on extends the CRC. */
+  if (offset <= p->crcPos && p->crcPos < offset + *size)
+  {
+    const CSzFileItem *f = p->db->db.Files + p->fileIndex;
+    size_t skip = (size_t)(p->crcPos - offset);
+    p->crc = CrcUpdate(p->crc, (const Byte *)buf + skip, *size - skip);
+    p->crcPos = offset + *size;
+    if (p->crcPos == p->size && f->CrcDefined && CRC_GET_DIGEST(p->crc) != f->Crc)
+      res = SZ_ERROR_CRC;
+  }
   return res;
 }
 
+STATIC void SzFileReader_Close(CSzFileReader *p)
+{
+  if (!p)
+    return;
+  SzFolderStream_Close(p->stream);
+  SzFree(p);
+}
+
+STATIC void SzArEx_GetStats(const CSzArEx *p, CSzArExStats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  if (p->DecoderPool)
+  {
+#ifndef _7ZIP_ST
+    CriticalSection_Enter(&p->DecoderPool->cs);
+#endif
+    *stats = p->DecoderPool->stats;
+#ifndef _7ZIP_ST
+    CriticalSection_Leave(&p->DecoderPool->cs);
+#endif
+  }
+}
+
 STATIC SRes SzArEx_Extract(
     const CSzArEx *p,
     CLookToRead *inStream,
@@ -3515,6 +8566,7 @@ STATIC SRes SzArEx_Extract(
   if (*outBuffer == 0 || *blockIndex != folderIndex)
   {
     CSzFolder *folder = p->db.Folders + folderIndex;
+    const UInt64 *packSizes = p->db.PackSizes + p->FolderStartPackStreamIndex[folderIndex];
     UInt64 unpackSizeSpec = SzFolder_GetUnpackSize(folder);
     size_t unpackSize = (size_t)unpackSizeSpec;
     UInt64 startOffset = SzArEx_GetFolderStreamPos(p, folderIndex, 0);
@@ -3525,10 +8577,10 @@ STATIC SRes SzArEx_Extract(
     SzFree(*outBuffer);
     *outBuffer = 0;
 
-#ifdef _SZ_SEEK_DEBUG
-    fprintf(stderr, "SEEKN 5\n");
-#endif
+    LookToRead_SetReadAheadRange(inStream, startOffset, startOffset +
+        GetSum(packSizes, folder->NumPackStreams));
     RINOK(LookInStream_SeekTo(inStream, startOffset));
+    SzDecoderPool_AddFolder(p->DecoderPool, folderIndex, GetSum(packSizes, folder->NumPackStreams));
 
     if (res == SZ_OK)
     {
@@ -3544,16 +8596,23 @@ STATIC SRes SzArEx_Extract(
       }
       if (res == SZ_OK)
       {
-        res = SzFolder_Decode(folder,
-          p->db.PackSizes + p->FolderStartPackStreamIndex[folderIndex],
-          inStream, startOffset,
+        /* The output is the caller's once it's decoded. */
+        SzDecoderPool_AddMemory(p->DecoderPool, unpackSize);
+        res = SzFolder_Decode2(folder, packSizes,
+          inStream, startOffset, p->DecoderPool, p->TimeStats,
+          p->Progress, p->ProgressStep,
           *outBuffer, unpackSize);
+        SzDecoderPool_SubMemory(p->DecoderPool, unpackSize);
         if (res == SZ_OK)
         {
           if (folder->UnpackCRCDefined)
           {
+            UInt64 time = p->TimeStats ? SzTime_Now() : 0;
             if (CrcCalc(*outBuffer, unpackSize) != folder->UnpackCRC)
               res = SZ_ERROR_CRC;
+            if (p->TimeStats)
+              time = SzTime_Now() - time;
+            SzDecoderPool_AddTime(p->DecoderPool, SZ_STATS_CRC, unpackSize, time);
           }
         }
       }
@@ -3569,8 +8628,15 @@ STATIC SRes SzArEx_Extract(
     *outSizeProcessed = (size_t)fileItem->Size;
     if (*offset + *outSizeProcessed > *outBufferSize)
       return SZ_ERROR_FAIL;
-    if (fileItem->CrcDefined && CrcCalc(*outBuffer + *offset, *outSizeProcessed) != fileItem->Crc)
-      res = SZ_ERROR_CRC;
+    if (fileItem->CrcDefined)
+    {
+      UInt64 time = p->TimeStats ? SzTime_Now() : 0;
+      if (CrcCalc(*outBuffer + *offset, *outSizeProcessed) != fileItem->Crc)
+        res = SZ_ERROR_CRC;
+      if (p->TimeStats)
+        time = SzTime_Now() - time;
+      SzDecoderPool_AddTime(p->DecoderPool, SZ_STATS_CRC, *outSizeProcessed, time);
+    }
   }
   return res;
 }
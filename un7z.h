@@ -113,9 +113,15 @@ typedef int Bool;
 	#endif
 	#define MY_CDECL __cdecl
 	#define MY_FAST_CALL __fastcall
+	#define MY_FORCE_INLINE __forceinline
 #else
 	#define MY_CDECL
 	#define MY_FAST_CALL
+	#if defined(__GNUC__)
+		#define MY_FORCE_INLINE __inline__ __attribute__((always_inline))
+	#else
+		#define MY_FORCE_INLINE
+	#endif
 #endif
 
 /* The following interfaces use first parameter as pointer to structure */
@@ -147,6 +153,23 @@ typedef struct
 struct CFileInStream;
 
 #define LookToRead_BUF_SIZE (1 << 14)
+#define LookToRead_BUF_SIZE_MAX (1 << 22)
+
+/* One part of a multi-volume archive (.7z.001, .7z.002, ...). */
+typedef struct
+{
+  const void *data;  /* NULL until the volume is opened, see ISzVolumeOpen. */
+  size_t size;  /* Must be known before the first read. */
+} CSzVolume;
+
+typedef struct
+{
+  SRes (*Open)(void *p, UInt32 index, CSzVolume *volume);
+    /* Sets volume->data for a volume which is touched for the first time.
+       Returns: result. (result != SZ_OK) means error, it's passed to the caller. */
+} ISzVolumeOpen;
+
+struct CSzReadAhead;
 
 typedef struct
 {
@@ -155,15 +178,49 @@ typedef struct
   size_t data_len;
   size_t pos;
   size_t size;
-  Byte buf[LookToRead_BUF_SIZE];
+  CSzVolume *volumes;  /* If not NULL, data is ignored and read from the volume set. */
+  ISzVolumeOpen *volume_open;  /* Can be NULL if all volumes are already opened. */
+  UInt32 num_volumes;
+  UInt32 volume_index;  /* Volume containing data_pos (a hint, it can be stale). */
+  size_t volume_start;  /* Logical offset of volumes[volume_index]. */
+  struct CSzReadAhead *read_ahead;  /* NULL if read-ahead is not started. */
+  const Byte *window;  /* Bytes returned by Look: buf, or data itself if copying is not needed. */
+  Byte *buf;  /* Allocated on first use, freed by LookToRead_Free. */
+  size_t buf_size;  /* 0 means LookToRead_BUF_SIZE. It can be set before the first read. */
+  size_t buf_size_max;  /* buf grows up to it for long Look requests. 0 means LookToRead_BUF_SIZE_MAX. */
 } CLookToRead;
 
+/* Presents the volumes as one logical stream, reads span volume boundaries.
+   volumes must stay valid while p is used. */
+STATIC void LookToRead_SetVolumes(CLookToRead *p, CSzVolume *volumes, UInt32 numVolumes,
+    ISzVolumeOpen *volumeOpen);
 STATIC SRes LookInStream_SeekTo(CLookToRead *p, UInt64 offset);
 
+/* Read-ahead copies the pack streams being decoded into a ring of numBufs
+   buffers of bufSize bytes on a background thread, so that page faults of
+   mapped (or lazily opened) volumes overlap with decoding. If it's started,
+   ISzVolumeOpen::Open can be called from the background thread.
+   LookToRead_StartReadAhead returns SZ_ERROR_UNSUPPORTED if un7z is built
+   with _7ZIP_ST. LookToRead_StopReadAhead must be called before p is freed. */
+STATIC SRes LookToRead_StartReadAhead(CLookToRead *p, UInt32 numBufs, size_t bufSize);
+STATIC void LookToRead_StopReadAhead(CLookToRead *p);
+
 /* STATIC void LookToRead_Init(CLookToRead *p) */
 #define LOOKTOREAD_INIT(p) do { memset(p, 0, sizeof(*p)); } while (0)
+/* Stops read-ahead and frees the input buffer. It must be called once p is
+   no longer used if p reads volumes or read-ahead was started, which
+   allocate buf. A stream over one buffer (data) allocates nothing, but
+   calling it is always safe. */
+STATIC void LookToRead_Free(CLookToRead *p);
+/* A clone reads the range [start, end) of the same archive data as src,
+   with its own position and buffer, from any thread: the volumes of the
+   range are opened by LookToRead_Clone, on the calling thread. Clones of
+   the pack streams of a folder let several threads decode folders of one
+   CSzArEx at once. dest is freed with LookToRead_Free. */
+STATIC SRes LookToRead_Clone(CLookToRead *dest, CLookToRead *src, UInt64 start, UInt64 end);
 /* 1. If less than *size bytes are already in the input buffer, then fills the
- *    rest of the input buffer from disk.
+ *    rest of the input buffer from disk. If the input is a single buffer in
+ *    memory (data), it's returned directly without copying.
  * 2. Sets *size to the number of bytes now in the input buffer. Can be more or
  *    less or equal to the original *size. Detect EOF by calling
  *    LOOKTOREAD_SKIP(*size), calling LookToRead_Look again, and then checking
@@ -275,6 +332,35 @@ STATIC SRes SzFolder_Decode(const CSzFolder *folder, const UInt64 *packSizes,
     CLookToRead *stream, UInt64 startPos,
     Byte *outBuffer, size_t outSize);
 
+/* SzFolder_Decode, which calls progress->Progress every progressStep bytes
+   of output (0 means SZ_PROGRESS_STEP_DEFAULT). inSize and outSize are the
+   bytes read and written by the coders of the folder so far: with several
+   coders (like BCJ2), outSize goes beyond the unpack size of the folder.
+   If Progress returns an error, decoding stops with SZ_ERROR_PROGRESS. */
+#define SZ_PROGRESS_STEP_DEFAULT (1 << 20)
+
+STATIC SRes SzFolder_DecodeProgress(const CSzFolder *folder, const UInt64 *packSizes,
+    CLookToRead *stream, UInt64 startPos,
+    Byte *outBuffer, size_t outSize,
+    ICompressProgress *progress, UInt64 progressStep);
+
+/* Streaming folder decoder. It decodes a folder from the start, in chunks,
+   with memory for the LZMA dictionaries (dicSize each, or less for smaller
+   streams) and a few small buffers, instead of the whole unpacked folder.
+   The pack streams are read through private copies of the position in stream:
+   its data or volumes must stay valid until SzFolderStream_Close, and the
+   volumes of the folder are opened by SzFolderStream_Open.
+   SzFolderStream_Read reads up to *size bytes and sets *size to the number
+   of bytes read, which is less only at the end of the folder. When it
+   reaches the end (*size == 0), it returns SZ_ERROR_CRC if the UnpackCRC
+   of the folder doesn't match. */
+typedef struct CSzFolderStream CSzFolderStream;
+
+STATIC SRes SzFolderStream_Open(CSzFolderStream **p, const CSzFolder *folder,
+    const UInt64 *packSizes, CLookToRead *stream, UInt64 startPos);
+STATIC SRes SzFolderStream_Read(CSzFolderStream *p, void *buf, size_t *size);
+STATIC void SzFolderStream_Close(CSzFolderStream *p);
+
 typedef struct
 {
   UInt32 Low;
@@ -347,12 +433,34 @@ typedef struct
   size_t *FileNameOffsets; /* in 2-byte steps */
   Byte *FileNamesInHeaderBufPtr;  /* UTF-16-LE */
   Byte *HeaderBufStart;  /* Buffer containing FileNamesInHeaderBufPtr. */
+
+  /* Decoders kept between folders by SzArEx_Extract and
+     SzArEx_OpenFolderStream, like the model memory of PPMd, and the
+     counters of SzArEx_GetStats. */
+  struct CSzDecoderPool *DecoderPool;
+
+  /* Set after SzArEx_Open to get the progress of the folder decodes of
+     SzArEx_Extract, like SzFolder_DecodeProgress. */
+  ICompressProgress *Progress;
+  UInt64 ProgressStep;
+
+  /* Set after SzArEx_Open to have SzArEx_Extract time its coders and CRC
+     checks for SzArEx_GetStats. That reads the clock for each coder and
+     each span a filter converts. */
+  Bool TimeStats;
 } CSzArEx;
 
 /*static void SzArEx_Init(CSzArEx *p);*/
 STATIC void SzArEx_Free(CSzArEx *p);
 STATIC UInt64 SzArEx_GetFolderStreamPos(const CSzArEx *p, UInt32 folderIndex, UInt32 indexInFolder);
 
+/* Writes the name of a file in UTF-8, followed by a '\0', to dest if it
+   isn't NULL, and returns its length without the '\0'. It takes at most 3
+   bytes for each UTF-16 unit of FileNameOffsets[fileIndex + 1] -
+   FileNameOffsets[fileIndex], which counts the '\0' of the name. An
+   unpaired surrogate is written like other units. */
+STATIC size_t SzArEx_GetFileNameUtf8(const CSzArEx *p, UInt32 fileIndex, char *dest);
+
 STATIC SRes SzArEx_Extract(
     const CSzArEx *db,
     CLookToRead *inStream,
@@ -364,6 +472,86 @@ STATIC SRes SzArEx_Extract(
     size_t *outSizeProcessed); /* size of file in *outBuffer */
 
 
+/* Opens a streaming decoder of a folder (solid block), see CSzFolderStream.
+   The files of the folder are stored one after another, from
+   FolderStartFileIndex[folderIndex], in the order of their indexes. */
+STATIC SRes SzArEx_OpenFolderStream(const CSzArEx *p, CLookToRead *inStream,
+    UInt32 folderIndex, CSzFolderStream **stream);
+
+/* Tests the whole archive: decodes every folder once, streaming and
+   without keeping the output, on up to numThreads threads (one folder per
+   thread at a time; 0 is taken as 1), and checks the CRCs of the files
+   and the UnpackCRC of the folders. It stops at the first error. If it
+   fails, *errorFileIndex (if not NULL) is the file being checked in the
+   lowest failed folder, or (UInt32)-1. inStream is only cloned, its
+   volumes are opened on the calling thread. */
+STATIC SRes SzArEx_Test(const CSzArEx *p, CLookToRead *inStream, UInt32 numThreads,
+    UInt32 *errorFileIndex);
+
+/* A reader of one file, decoding only as far as the bytes asked for.
+   SzFileReader_Read reads up to *size bytes at offset in the file and sets
+   *size to the number of bytes read, which is less only at the end of the
+   file. The decoder of the folder is kept between reads, so sequential
+   reads continue where the last one stopped; a read before it decodes the
+   folder again from its start. Memory is bounded like CSzFolderStream.
+   If blockIndex and outBuffer are the cache of SzArEx_Extract and hold the
+   folder of the file, reads are copied from outBuffer, which must then
+   stay valid until SzFileReader_Close.
+   Reads check the CRC of the file as far as they cover it from its start
+   without a gap, overlapping reads included: the read which reaches its
+   end returns SZ_ERROR_CRC if it doesn't match. inStream is
+   only cloned, it must stay valid until SzFileReader_Close. */
+typedef struct CSzFileReader CSzFileReader;
+
+STATIC SRes SzArEx_OpenFile(const CSzArEx *p, CLookToRead *inStream, UInt32 fileIndex,
+    UInt32 blockIndex, const Byte *outBuffer, CSzFileReader **reader);
+STATIC UInt64 SzFileReader_GetSize(const CSzFileReader *p);
+STATIC SRes SzFileReader_Read(CSzFileReader *p, UInt64 offset, void *buf, size_t *size);
+STATIC void SzFileReader_Close(CSzFileReader *p);
+
+/* Coder kinds of CSzArExStats. SZ_STATS_FILTER is the other branch
+   converters and Delta. */
+typedef enum
+{
+  SZ_STATS_COPY,
+  SZ_STATS_LZMA,
+  SZ_STATS_LZMA2,
+  SZ_STATS_DEFLATE,
+  SZ_STATS_PPMD,
+  SZ_STATS_ZSTD,
+  SZ_STATS_BCJ,
+  SZ_STATS_BCJ2,
+  SZ_STATS_FILTER,
+  SZ_STATS_NUM_CODERS
+} ESzStatsCoder;
+
+typedef struct
+{
+  UInt64 Bytes;  /* output */
+  UInt64 Time;   /* nanoseconds */
+} CSzStatsCounter;
+
+/* Counters of an archive since SzArEx_Open. Coders and Crc are counted by
+   SzArEx_Extract; their Time only with CSzArEx.TimeStats set. A filter's
+   time doesn't include the coder it's applied to. A folder decoded again
+   (because the caller's cache of the last folder was replaced) is counted
+   in FolderRedecodes too: many of them mean the files are extracted out of
+   folder order. MemoryPeak counts the big buffers of the decodes of the
+   archive, at once on all threads: the folder output of SzArEx_Extract
+   while it's decoded, the outputs of coders decoded to memory, the
+   dictionaries and the PPMd models. */
+typedef struct
+{
+  UInt64 InputBytes;     /* pack streams read by SzArEx_Extract and SzArEx_OpenFolderStream */
+  CSzStatsCounter Coders[SZ_STATS_NUM_CODERS];
+  CSzStatsCounter Crc;
+  UInt32 FolderDecodes;
+  UInt32 FolderRedecodes;
+  UInt64 MemoryPeak;     /* high-water mark, in bytes */
+} CSzArExStats;
+
+STATIC void SzArEx_GetStats(const CSzArEx *p, CSzArExStats *stats);
+
 /*
 SzArEx_Open Errors:
 SZ_ERROR_NO_ARCHIVE
@@ -379,8 +567,54 @@ STATIC SRes SzArEx_Open(CSzArEx *p, CLookToRead *inStream);
 
 STATIC void *SzAlloc(size_t size);
 STATIC void SzFree(void *address);
+#define CRC_INIT_VAL 0xFFFFFFFF
+#define CRC_GET_DIGEST(crc) ((crc) ^ CRC_INIT_VAL)
+STATIC UInt32 MY_FAST_CALL CrcUpdate(UInt32 crc, const void *data, size_t size);
 STATIC UInt32 MY_FAST_CALL CrcCalc(const void *data, size_t size);
 
+/* Tracing. A callback set with SzTrace_Set receives the seeks in the
+   archive, the coders of whole folder decodes (SzFolder_Decode and
+   SzArEx_Extract, not CSzFolderStream), the allocations and the phases of
+   SzArEx_Open, from all threads. Set it before opening archives: it isn't
+   synchronized with decoding. Without one, each event costs one branch. */
+
+typedef enum
+{
+  SZ_TRACE_SEEK,         /* offset: new position in the archive */
+  SZ_TRACE_CODER_START,  /* method, size: bytes to decode */
+  SZ_TRACE_CODER_END,    /* method, size, res, time */
+  SZ_TRACE_ALLOC,        /* ptr (NULL if it failed), size */
+  SZ_TRACE_FREE,         /* ptr */
+  SZ_TRACE_HEADER        /* phase, size: bytes of the phase, time */
+} ESzTraceType;
+
+/* Phases of SzArEx_Open, in order, each traced when it completes. DECODE
+   is only there for encoded (compressed) headers. */
+typedef enum
+{
+  SZ_TRACE_HEADER_SIGNATURE,  /* finding the signature header */
+  SZ_TRACE_HEADER_READ,       /* reading the header and checking its CRC */
+  SZ_TRACE_HEADER_DECODE,     /* decoding an encoded header */
+  SZ_TRACE_HEADER_PARSE       /* parsing the header */
+} ESzTraceHeaderPhase;
+
+typedef struct
+{
+  ESzTraceType type;
+  ESzTraceHeaderPhase phase;
+  UInt64 method;
+  UInt64 offset;
+  UInt64 size;
+  UInt64 time;  /* duration, in nanoseconds */
+  const void *ptr;
+  SRes res;
+} CSzTraceEvent;
+
+typedef void (*SzTraceFunc)(void *ctx, const CSzTraceEvent *event);
+
+/* Sets the callback, or removes it if func is NULL. */
+STATIC void SzTrace_Set(SzTraceFunc func, void *ctx);
+
 /*
 MY_CPU_LE means that CPU is LITTLE ENDIAN.
 If MY_CPU_LE is not defined, we don't know about that property of platform (it can be LITTLE ENDIAN).
@@ -0,0 +1,605 @@
+/* un7z.hpp -- header-only C++17 interface of un7z */
+
+#ifndef __7Z_HPP
+#define __7Z_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(_MSVC_LANG) ? _MSVC_LANG >= 202002L : __cplusplus >= 202002L
+#if defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define UN7Z_HAVE_SPAN 1
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define UN7Z_HAVE_COROUTINES 1
+#endif
+#endif
+#endif
+
+#include "un7z.h"
+
+namespace un7z {
+
+/* A view of decoded bytes: std::span<const Byte> with C++20. */
+#ifdef UN7Z_HAVE_SPAN
+using Bytes = std::span<const Byte>;
+#else
+class Bytes
+{
+public:
+  constexpr Bytes() noexcept = default;
+  constexpr Bytes(const Byte *data, std::size_t size) noexcept : data_(data), size_(size) {}
+  constexpr const Byte *data() const noexcept { return data_; }
+  constexpr std::size_t size() const noexcept { return size_; }
+  constexpr bool empty() const noexcept { return size_ == 0; }
+  constexpr const Byte *begin() const noexcept { return data_; }
+  constexpr const Byte *end() const noexcept { return data_ + size_; }
+  constexpr const Byte &operator[](std::size_t i) const noexcept { return data_[i]; }
+
+private:
+  const Byte *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+#endif
+
+/* Thrown for every error with its SRes. fileIndex() is the file being
+   extracted or tested, or (UInt32)-1. */
+class Error : public std::runtime_error
+{
+public:
+  explicit Error(SRes res, UInt32 fileIndex = (UInt32)-1)
+    : std::runtime_error(message(res)), res_(res), fileIndex_(fileIndex) {}
+  SRes code() const noexcept { return res_; }
+  UInt32 fileIndex() const noexcept { return fileIndex_; }
+
+  static const char *message(SRes res) noexcept
+  {
+    switch (res)
+    {
+      case SZ_ERROR_DATA: return "un7z: data error";
+      case SZ_ERROR_MEM: return "un7z: can not allocate memory";
+      case SZ_ERROR_CRC: return "un7z: CRC error";
+      case SZ_ERROR_UNSUPPORTED: return "un7z: unsupported archive";
+      case SZ_ERROR_INPUT_EOF: return "un7z: unexpected end of archive";
+      case SZ_ERROR_READ: return "un7z: read error";
+      case SZ_ERROR_PROGRESS: return "un7z: cancelled";
+      case SZ_ERROR_ARCHIVE: return "un7z: archive header error";
+      case SZ_ERROR_NO_ARCHIVE: return "un7z: not a .7z archive";
+      default: return "un7z: error";
+    }
+  }
+
+private:
+  SRes res_;
+  UInt32 fileIndex_;
+};
+
+namespace detail {
+
+/* A decoded folder, freed when the archive and the last Data pointing to
+   it are done with it. */
+struct Block
+{
+  UInt32 folderIndex = (UInt32)-1;
+  Byte *buffer = nullptr;
+  std::size_t size = 0;
+
+  Block() = default;
+  Block(const Block &) = delete;
+  Block &operator=(const Block &) = delete;
+  ~Block() { SzFree(buffer); }
+};
+
+/* Everything an Archive owns, at a fixed address: the C structures point
+   into each other. */
+struct ArchiveState
+{
+  CSzArEx db;
+  CLookToRead stream;
+  std::string names;  /* UTF-8, each one followed by '\0' */
+  std::vector<std::size_t> nameOffsets;  /* NumFiles + 1 */
+  std::vector<UInt32> sortedNames;  /* file indexes by name, made by the first find */
+  std::shared_ptr<Block> block;  /* the last decoded folder */
+  std::mutex asyncMutex;  /* held by the async extracts for block and stream */
+
+  ArchiveState()
+  {
+    std::memset(&db, 0, sizeof(db));
+    LOOKTOREAD_INIT(&stream);
+  }
+  ArchiveState(const ArchiveState &) = delete;
+  ArchiveState &operator=(const ArchiveState &) = delete;
+  ~ArchiveState()
+  {
+    SzArEx_Free(&db);
+    LookToRead_Free(&stream);
+  }
+
+  std::string_view name(UInt32 i) const
+  {
+    return std::string_view(names.data() + nameOffsets[i], nameOffsets[i + 1] - nameOffsets[i] - 1);
+  }
+
+  /* Converts the UTF-16 names of the header once. */
+  void convertNames()
+  {
+    UInt32 numFiles = db.db.NumFiles;
+    names.reserve(db.FileNameOffsets ? db.FileNameOffsets[numFiles] * 3 / 2 : 0);
+    nameOffsets.resize(numFiles + 1);
+    for (UInt32 i = 0; i < numFiles; i++)
+    {
+      std::size_t pos = names.size();
+      nameOffsets[i] = pos;
+      names.resize(pos + (db.FileNameOffsets[i + 1] - db.FileNameOffsets[i]) * 3 + 1);
+      names.resize(pos + SzArEx_GetFileNameUtf8(&db, i, &names[pos]) + 1);
+    }
+    nameOffsets[numFiles] = names.size();
+  }
+};
+
+/* A clone of the archive stream over the pack streams of one folder. */
+struct StreamClone
+{
+  CLookToRead stream;
+
+  StreamClone() { LOOKTOREAD_INIT(&stream); }
+  StreamClone(const StreamClone &) = delete;
+  StreamClone &operator=(const StreamClone &) = delete;
+  ~StreamClone() { LookToRead_Free(&stream); }
+};
+
+} // namespace detail
+
+/* A file or directory of an Archive, valid while the archive is. */
+class Entry
+{
+public:
+  UInt32 index() const noexcept { return index_; }
+  std::string_view name() const noexcept { return state_->name(index_); }
+  const CSzFileItem &item() const noexcept { return state_->db.db.Files[index_]; }
+  UInt64 size() const noexcept { return item().Size; }
+  bool isDir() const noexcept { return item().IsDir != 0; }
+  bool hasStream() const noexcept { return item().HasStream != 0; }
+  std::optional<UInt32> crc() const
+  {
+    return item().CrcDefined ? std::optional<UInt32>(item().Crc) : std::nullopt;
+  }
+  /* The NTFS time: 100 ns ticks since 1601. */
+  std::optional<UInt64> mtime() const
+  {
+    const CSzFileItem &f = item();
+    return f.MTimeDefined ? std::optional<UInt64>(((UInt64)f.MTime.High << 32) | f.MTime.Low) : std::nullopt;
+  }
+  UInt32 attrib() const noexcept { return item().Attrib; }
+  /* The folder (solid block) holding the data, or (UInt32)-1. */
+  UInt32 folder() const noexcept { return state_->db.FileIndexToFolderIndexMap[index_]; }
+
+private:
+  friend class Archive;
+  friend class EntryIterator;
+  friend class Entries;
+  Entry(const detail::ArchiveState *state, UInt32 index) noexcept : state_(state), index_(index) {}
+
+  const detail::ArchiveState *state_;
+  UInt32 index_;
+};
+
+class EntryIterator
+{
+public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = Entry;
+  using difference_type = std::ptrdiff_t;
+  using pointer = void;
+  using reference = Entry;
+
+  Entry operator*() const noexcept { return Entry(state_, index_); }
+  EntryIterator &operator++() noexcept { index_++; return *this; }
+  EntryIterator operator++(int) noexcept { EntryIterator it = *this; index_++; return it; }
+  bool operator==(const EntryIterator &it) const noexcept { return index_ == it.index_; }
+  bool operator!=(const EntryIterator &it) const noexcept { return index_ != it.index_; }
+
+private:
+  friend class Entries;
+  EntryIterator(const detail::ArchiveState *state, UInt32 index) noexcept : state_(state), index_(index) {}
+
+  const detail::ArchiveState *state_;
+  UInt32 index_;
+};
+
+/* The entries of an Archive in header order, see Archive::entries. */
+class Entries
+{
+public:
+  EntryIterator begin() const noexcept { return EntryIterator(state_, 0); }
+  EntryIterator end() const noexcept { return EntryIterator(state_, size()); }
+  UInt32 size() const noexcept { return state_->db.db.NumFiles; }
+  Entry operator[](UInt32 i) const noexcept { return Entry(state_, i); }
+
+private:
+  friend class Archive;
+  explicit Entries(const detail::ArchiveState *state) noexcept : state_(state) {}
+
+  const detail::ArchiveState *state_;
+};
+
+/* The bytes of an extracted file. It keeps its decoded folder alive, also
+   after the Archive is gone, and is move-only so that the reference count
+   is never touched behind the caller's back. */
+class Data
+{
+public:
+  Data() noexcept = default;
+  Data(Data &&) noexcept = default;
+  Data &operator=(Data &&) noexcept = default;
+  Data(const Data &) = delete;
+  Data &operator=(const Data &) = delete;
+
+  const Byte *data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+  const Byte *begin() const noexcept { return data_; }
+  const Byte *end() const noexcept { return data_ + size_; }
+  Bytes bytes() const noexcept { return Bytes(data_, size_); }
+  std::string_view str() const noexcept { return std::string_view((const char *)data_, size_); }
+
+private:
+  friend class Archive;
+  Data(std::shared_ptr<const detail::Block> block, const Byte *data, std::size_t size) noexcept
+    : block_(std::move(block)), data_(data), size_(size) {}
+
+  std::shared_ptr<const detail::Block> block_;
+  const Byte *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+/* Reads parts of one file, see CSzFileReader. Move-only, and like the
+   Archive it comes from, not thread-safe. */
+class FileReader
+{
+public:
+  FileReader() noexcept = default;
+  FileReader(FileReader &&r) noexcept : block_(std::move(r.block_)), reader_(r.reader_) { r.reader_ = nullptr; }
+  FileReader &operator=(FileReader &&r) noexcept
+  {
+    std::swap(block_, r.block_);
+    std::swap(reader_, r.reader_);
+    return *this;
+  }
+  FileReader(const FileReader &) = delete;
+  FileReader &operator=(const FileReader &) = delete;
+  ~FileReader() { SzFileReader_Close(reader_); }
+
+  UInt64 size() const noexcept { return reader_ ? SzFileReader_GetSize(reader_) : 0; }
+
+  /* Reads up to size bytes at offset, returns the number read. */
+  std::size_t read(UInt64 offset, void *buf, std::size_t size)
+  {
+    SRes res = SzFileReader_Read(reader_, offset, buf, &size);
+    if (res != SZ_OK)
+      throw Error(res);
+    return size;
+  }
+
+private:
+  friend class Archive;
+  FileReader(std::shared_ptr<const detail::Block> block, CSzFileReader *reader) noexcept
+    : block_(std::move(block)), reader_(reader) {}
+
+  std::shared_ptr<const detail::Block> block_;  /* when it reads from the cached folder */
+  CSzFileReader *reader_ = nullptr;
+};
+
+/* An opened archive. It's move-only and not thread-safe: use one per
+   thread, or SzArEx_Test for parallel checks. The archive data (or
+   volumes) must stay valid while it's used. */
+class Archive
+{
+public:
+  /* Opens an archive in memory. */
+  Archive(const void *data, std::size_t size) : state_(new detail::ArchiveState)
+  {
+    state_->stream.data = data;
+    state_->stream.data_len = size;
+    open();
+  }
+
+  /* Opens a multi-volume archive, see LookToRead_SetVolumes. */
+  Archive(CSzVolume *volumes, UInt32 numVolumes, ISzVolumeOpen *volumeOpen = nullptr)
+    : state_(new detail::ArchiveState)
+  {
+    LookToRead_SetVolumes(&state_->stream, volumes, numVolumes, volumeOpen);
+    open();
+  }
+
+  Archive(Archive &&) noexcept = default;
+  Archive &operator=(Archive &&) noexcept = default;
+  Archive(const Archive &) = delete;
+  Archive &operator=(const Archive &) = delete;
+
+  Entries entries() const noexcept { return Entries(state_.get()); }
+  EntryIterator begin() const noexcept { return entries().begin(); }
+  EntryIterator end() const noexcept { return entries().end(); }
+  UInt32 size() const noexcept { return state_->db.db.NumFiles; }
+  Entry operator[](UInt32 i) const noexcept { return Entry(state_.get(), i); }
+
+  /* Finds an entry by its UTF-8 name, with '/' as it's stored. The first
+     call sorts the names. */
+  std::optional<Entry> find(std::string_view name) const
+  {
+    detail::ArchiveState &s = *state_;
+    if (s.sortedNames.size() != s.db.db.NumFiles)
+    {
+      s.sortedNames.resize(s.db.db.NumFiles);
+      for (UInt32 i = 0; i < s.db.db.NumFiles; i++)
+        s.sortedNames[i] = i;
+      std::sort(s.sortedNames.begin(), s.sortedNames.end(),
+          [&s](UInt32 a, UInt32 b) { return s.name(a) < s.name(b); });
+    }
+    auto it = std::lower_bound(s.sortedNames.begin(), s.sortedNames.end(), name,
+        [&s](UInt32 a, std::string_view n) { return s.name(a) < n; });
+    if (it == s.sortedNames.end() || s.name(*it) != name)
+      return std::nullopt;
+    return Entry(state_.get(), *it);
+  }
+
+  /* Extracts a file with SzArEx_Extract. The decoded folder is shared by
+     the Data of all its files and kept for the next call, so extracting in
+     folder order decodes every folder once. */
+  Data extract(const Entry &entry) { return extract(entry.index()); }
+
+  Data extract(UInt32 fileIndex)
+  {
+    detail::ArchiveState &s = *state_;
+    UInt32 folderIndex = s.db.FileIndexToFolderIndexMap[fileIndex];
+    std::shared_ptr<detail::Block> block = s.block;
+    UInt32 blockIndex = (UInt32)-1;
+    Byte *buffer = nullptr;
+    std::size_t bufferSize = 0, offset = 0, size = 0;
+    SRes res;
+
+    if (folderIndex == (UInt32)-1)
+      return Data();
+    if (block && block->folderIndex == folderIndex)
+    {
+      /* Only finds the file and checks its CRC, the buffer is kept. */
+      blockIndex = folderIndex;
+      buffer = block->buffer;
+      bufferSize = block->size;
+      res = SzArEx_Extract(&s.db, &s.stream, fileIndex, &blockIndex, &buffer, &bufferSize, &offset, &size);
+    }
+    else
+    {
+      block = std::make_shared<detail::Block>();
+      res = SzArEx_Extract(&s.db, &s.stream, fileIndex, &blockIndex, &buffer, &bufferSize, &offset, &size);
+      block->buffer = buffer;
+      block->size = bufferSize;
+      block->folderIndex = folderIndex;
+      if (res == SZ_OK)
+        s.block = block;
+    }
+    if (res != SZ_OK)
+      throw Error(res, fileIndex);
+    return Data(std::move(block), buffer + offset, size);
+  }
+
+  /* Opens a file for reads of its parts. If the last extract decoded its
+     folder, reads are copied from it, otherwise they decode only as far
+     as needed. */
+  FileReader openFile(const Entry &entry) { return openFile(entry.index()); }
+
+  FileReader openFile(UInt32 fileIndex)
+  {
+    detail::ArchiveState &s = *state_;
+    std::shared_ptr<const detail::Block> block;
+    CSzFileReader *reader;
+    SRes res;
+    if (s.block && s.block->folderIndex == s.db.FileIndexToFolderIndexMap[fileIndex])
+      block = s.block;
+    res = SzArEx_OpenFile(&s.db, &s.stream, fileIndex, block ? block->folderIndex : (UInt32)-1,
+        block ? block->buffer : nullptr, &reader);
+    if (res != SZ_OK)
+      throw Error(res, fileIndex);
+    return FileReader(std::move(block), reader);
+  }
+
+  /* Tests the whole archive with SzArEx_Test. */
+  void test(UInt32 numThreads = 1)
+  {
+    UInt32 fileIndex;
+    SRes res = SzArEx_Test(&state_->db, &state_->stream, numThreads, &fileIndex);
+    if (res != SZ_OK)
+      throw Error(res, fileIndex);
+  }
+
+  /* Extracts a file on an executor, and calls callback(error, data) there,
+     with a null std::exception_ptr on success. executor is any callable
+     which runs the task it's given, such as
+     [&pool](auto task) { pool.post(std::move(task)); }.
+     The only I/O, opening the volumes of the folder, is done here: the
+     task decodes from a clone of the stream (LookToRead_Clone), so it never
+     blocks on ISzVolumeOpen. Async extracts can be made from several
+     threads at once and share the folder cache of extract(), but the
+     other methods must not run at the same time, and the archive must
+     outlive the tasks. With un7z built with _7ZIP_ST the executor must run
+     one task at a time. */
+  template <class Executor, class Callback>
+  void extractAsync(const Entry &entry, Executor &&executor, Callback callback)
+  {
+    extractAsync(entry.index(), std::forward<Executor>(executor), std::move(callback));
+  }
+
+  template <class Executor, class Callback>
+  void extractAsync(UInt32 fileIndex, Executor &&executor, Callback callback)
+  {
+    detail::ArchiveState *s = state_.get();
+    UInt32 folderIndex = s->db.FileIndexToFolderIndexMap[fileIndex];
+    std::shared_ptr<detail::Block> block;
+    std::shared_ptr<detail::StreamClone> clone;
+    SRes res = SZ_OK;
+
+    if (folderIndex != (UInt32)-1)
+    {
+      std::lock_guard<std::mutex> lock(s->asyncMutex);
+      if (s->block && s->block->folderIndex == folderIndex)
+        block = s->block;
+      else
+      {
+        UInt64 start = SzArEx_GetFolderStreamPos(&s->db, folderIndex, 0), end = start;
+        const UInt64 *packSizes = s->db.db.PackSizes + s->db.FolderStartPackStreamIndex[folderIndex];
+        for (UInt32 i = 0; i < s->db.db.Folders[folderIndex].NumPackStreams; i++)
+          end += packSizes[i];
+        clone = std::make_shared<detail::StreamClone>();
+        res = LookToRead_Clone(&clone->stream, &s->stream, start, end);
+      }
+    }
+    if (res != SZ_OK)
+    {
+      callback(std::make_exception_ptr(Error(res, fileIndex)), Data());
+      return;
+    }
+    executor([s, fileIndex, folderIndex, block = std::move(block), clone = std::move(clone),
+        callback = std::move(callback)]() mutable
+    {
+      if (folderIndex == (UInt32)-1)
+      {
+        callback(std::exception_ptr(), Data());
+        return;
+      }
+      UInt32 blockIndex = (UInt32)-1;
+      Byte *buffer = nullptr;
+      std::size_t bufferSize = 0, offset = 0, size = 0;
+      SRes res;
+      if (block)
+      {
+        /* Only finds the file and checks its CRC. */
+        blockIndex = folderIndex;
+        buffer = block->buffer;
+        bufferSize = block->size;
+        res = SzArEx_Extract(&s->db, &s->stream, fileIndex, &blockIndex, &buffer, &bufferSize, &offset, &size);
+      }
+      else
+      {
+        block = std::make_shared<detail::Block>();
+        res = SzArEx_Extract(&s->db, &clone->stream, fileIndex, &blockIndex, &buffer, &bufferSize, &offset, &size);
+        block->buffer = buffer;
+        block->size = bufferSize;
+        block->folderIndex = folderIndex;
+        clone.reset();
+        if (res == SZ_OK)
+        {
+          std::lock_guard<std::mutex> lock(s->asyncMutex);
+          s->block = block;
+        }
+      }
+      if (res != SZ_OK)
+        callback(std::make_exception_ptr(Error(res, fileIndex)), Data());
+      else
+        callback(std::exception_ptr(), Data(std::move(block), buffer + offset, size));
+    });
+  }
+
+#ifdef UN7Z_HAVE_COROUTINES
+  /* co_await archive.extractAsync(entry, executor) extracts like the
+     callback form and resumes the coroutine on the executor, with the
+     Data or by throwing un7z::Error. If the callback runs before the
+     coroutine is suspended (when the stream can't be cloned, or the
+     executor runs the task inline), the coroutine goes on without
+     suspending, on the calling thread. */
+  template <class Executor>
+  class ExtractAwaiter
+  {
+  public:
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+      handle_ = handle;
+      archive_->extractAsync(fileIndex_, executor_, [this](std::exception_ptr error, Data data)
+      {
+        error_ = std::move(error);
+        data_ = std::move(data);
+        /* Whichever of the callback and await_suspend comes second goes
+           on with the coroutine. */
+        if (done_.exchange(true, std::memory_order_acq_rel))
+          handle_.resume();
+      });
+      return !done_.exchange(true, std::memory_order_acq_rel);
+    }
+    Data await_resume()
+    {
+      if (error_)
+        std::rethrow_exception(error_);
+      return std::move(data_);
+    }
+
+  private:
+    friend class Archive;
+    ExtractAwaiter(Archive *archive, UInt32 fileIndex, Executor executor)
+      : archive_(archive), fileIndex_(fileIndex), executor_(std::move(executor)) {}
+
+    Archive *archive_;
+    UInt32 fileIndex_;
+    Executor executor_;
+    std::coroutine_handle<> handle_;
+    std::atomic<bool> done_{false};
+    std::exception_ptr error_;
+    Data data_;
+  };
+
+  template <class Executor>
+  ExtractAwaiter<std::decay_t<Executor>> extractAsync(const Entry &entry, Executor &&executor)
+  {
+    return ExtractAwaiter<std::decay_t<Executor>>(this, entry.index(), std::forward<Executor>(executor));
+  }
+
+  template <class Executor>
+  ExtractAwaiter<std::decay_t<Executor>> extractAsync(UInt32 fileIndex, Executor &&executor)
+  {
+    return ExtractAwaiter<std::decay_t<Executor>>(this, fileIndex, std::forward<Executor>(executor));
+  }
+#endif
+
+  /* Has extract time its coders and CRC checks for stats(). */
+  void timeStats(bool on) noexcept { state_->db.TimeStats = on ? True : False; }
+
+  CSzArExStats stats() const
+  {
+    CSzArExStats stats;
+    SzArEx_GetStats(&state_->db, &stats);
+    return stats;
+  }
+
+  /* The C structures, for the rest of the un7z API. */
+  const CSzArEx &db() const noexcept { return state_->db; }
+  CLookToRead &stream() noexcept { return state_->stream; }
+
+private:
+  void open()
+  {
+    SRes res = SzArEx_Open(&state_->db, &state_->stream);
+    if (res != SZ_OK)
+      throw Error(res);
+    state_->convertNames();
+  }
+
+  std::unique_ptr<detail::ArchiveState> state_;
+};
+
+} // namespace un7z
+
+#endif